@@ -0,0 +1,619 @@
+#include "analyzer.h"
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <tuple>
+#include <utility>
+
+namespace {
+
+constexpr int REG_I = 16;
+constexpr int REG_COUNT = 17;
+constexpr uint16_t LAST_INSTRUCTION = Chip8::MEMORY_SIZE - 2;
+
+// How an instruction passes on control, decoded exactly like Chip8::execute_switch().
+enum class Flow {
+	NEXT,
+	JUMP,
+	CALL,
+	RETURN,
+	SKIP,
+	INDIRECT,
+	INVALID
+};
+
+Flow get_flow(uint16_t code)
+{
+	switch (code & 0xF000) {
+	case 0x0000:
+		return (code & 0xFF) == 0xE0 ? Flow::NEXT : (code & 0xFF) == 0xEE ? Flow::RETURN : Flow::INVALID;
+	case 0x1000:
+		return Flow::JUMP;
+	case 0x2000:
+		return Flow::CALL;
+	case 0x3000:
+	case 0x4000:
+	case 0x5000:
+	case 0x9000:
+		return Flow::SKIP;
+	case 0x8000:
+		return (code & 0xF) <= 0x7 || (code & 0xF) == 0xE ? Flow::NEXT : Flow::INVALID;
+	case 0xB000:
+		return Flow::INDIRECT;
+	case 0xE000:
+		return (code & 0xF) == 0xE || (code & 0xF) == 0x1 ? Flow::SKIP : Flow::INVALID;
+	case 0xF000:
+		switch (code & 0xFF) {
+		case 0x07:
+		case 0x0A:
+		case 0x15:
+		case 0x18:
+		case 0x1E:
+		case 0x29:
+		case 0x30:
+		case 0x33:
+		case 0x55:
+		case 0x65:
+			return Flow::NEXT;
+		default:
+			return Flow::INVALID;
+		}
+	default:
+		return Flow::NEXT;
+	}
+}
+
+// Registers, bit 16 for I, whose value the instruction uses, under any quirk setting.
+uint32_t get_reads(uint16_t code)
+{
+	uint32_t x = 1u << ((code >> 8) & 0xF);
+	uint32_t y = 1u << ((code >> 4) & 0xF);
+	uint32_t i = 1u << REG_I;
+	switch (code & 0xF000) {
+	case 0x3000:
+	case 0x4000:
+	case 0x7000:
+	case 0xE000:
+		return x;
+	case 0x5000:
+	case 0x9000:
+	case 0x8000:
+		return (code & 0xF) == 0x0 ? y : x | y;
+	case 0xB000:
+		return 1;
+	case 0xD000:
+		return x | y | i;
+	case 0xF000:
+		switch (code & 0xFF) {
+		case 0x15:
+		case 0x18:
+		case 0x29:
+			return x;
+		case 0x1E:
+		case 0x33:
+			return x | i;
+		case 0x55:
+			return ((x << 1) - 1) | i;
+		case 0x65:
+			return i;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+// Per register: a constant or unknown, and the quirk-dependent instruction its value came from, if any.
+// Address 0 never holds a reachable instruction, so it stands for no such write.
+struct AbstractState {
+	uint32_t known;
+	uint16_t values[REG_COUNT];
+	uint16_t taintWriters[REG_COUNT];
+	Chip8Quirk taintQuirks[REG_COUNT];
+
+	bool is_known(int reg) const { return (known >> reg & 1) != 0; }
+	void set(int reg, uint16_t value)
+	{
+		known |= 1u << reg;
+		values[reg] = value;
+		taintWriters[reg] = 0;
+	}
+	void forget(int reg)
+	{
+		known &= ~(1u << reg);
+		taintWriters[reg] = 0;
+	}
+	// unknown because it depends on quirk, which the reads after it will be reported against
+	void taint(int reg, Chip8Quirk quirk, uint16_t writer)
+	{
+		known &= ~(1u << reg);
+		taintWriters[reg] = writer;
+		taintQuirks[reg] = quirk;
+	}
+	// keeps the taint: the value still carries the quirk-dependent input
+	void update(int reg, bool isKnown, uint16_t value)
+	{
+		if (isKnown) {
+			known |= 1u << reg;
+			values[reg] = value;
+		}
+		else {
+			known &= ~(1u << reg);
+		}
+	}
+	// the state a path merging into this one allows; returns whether anything changed
+	bool join(const AbstractState& other)
+	{
+		bool changed = false;
+		for (int reg = 0; reg < REG_COUNT; ++reg) {
+			if (is_known(reg) && (!other.is_known(reg) || other.values[reg] != values[reg])) {
+				known &= ~(1u << reg);
+				changed = true;
+			}
+			if (taintWriters[reg] == 0 && other.taintWriters[reg] != 0) {
+				taintWriters[reg] = other.taintWriters[reg];
+				taintQuirks[reg] = other.taintQuirks[reg];
+				changed = true;
+			}
+		}
+		return changed;
+	}
+};
+
+class Analyzer {
+public:
+	Analyzer(const uint8_t* memory, Chip8Analysis& analysis);
+	void run();
+private:
+	typedef vector<pair<uint16_t, AbstractState>> Successors;
+
+	uint16_t fetch(uint16_t address) const { return static_cast<uint16_t>(_memory[address] << 8 | _memory[address + 1]); }
+	void step(uint16_t address, const AbstractState& in, Successors& successors) const;
+	void solve();
+	void record_effects();
+	void build_blocks();
+
+	const uint8_t* _memory;
+	Chip8Analysis& _analysis;
+	vector<AbstractState> _states;
+	vector<bool> _reached;
+};
+
+Analyzer::Analyzer(const uint8_t* memory, Chip8Analysis& analysis) : _memory(memory), _analysis(analysis),
+	_states(Chip8::MEMORY_SIZE), _reached(Chip8::MEMORY_SIZE, false)
+{}
+
+void Analyzer::step(uint16_t address, const AbstractState& in, Successors& successors) const
+{
+	uint16_t code = fetch(address);
+	int x = (code >> 8) & 0xF;
+	int y = (code >> 4) & 0xF;
+	uint8_t kk = code & 0xFF;
+	uint16_t nnn = code & 0xFFF;
+	uint16_t next = address + 2;
+	AbstractState out = in;
+	bool xyKnown = in.is_known(x) && in.is_known(y);
+	uint8_t vx = static_cast<uint8_t>(in.values[x]);
+	uint8_t vy = static_cast<uint8_t>(in.values[y]);
+
+	switch (get_flow(code)) {
+	case Flow::INVALID:
+	case Flow::RETURN:
+		return;
+	case Flow::JUMP:
+		successors.push_back(std::make_pair(nnn, out));
+		return;
+	case Flow::CALL: {
+		successors.push_back(std::make_pair(nnn, out));
+		// whatever the subroutine leaves behind is unknown
+		AbstractState after = out;
+		after.known = 0;
+		successors.push_back(std::make_pair(next, after));
+		return;
+	}
+	case Flow::SKIP:
+		successors.push_back(std::make_pair(next, out));
+		successors.push_back(std::make_pair(static_cast<uint16_t>(address + 4), out));
+		return;
+	case Flow::INDIRECT:
+		if (in.is_known(0)) {
+			successors.push_back(std::make_pair(static_cast<uint16_t>(nnn + in.values[0]), out));
+		}
+		return;
+	case Flow::NEXT:
+		break;
+	}
+
+	switch (code & 0xF000) {
+	case 0x6000:
+		out.set(x, kk);
+		break;
+	case 0x7000:
+		out.update(x, in.is_known(x), static_cast<uint8_t>(vx + kk));
+		break;
+	case 0x8000:
+		switch (code & 0xF) {
+		case 0x0:
+			out.update(x, in.is_known(y), vy);
+			out.taintWriters[x] = in.taintWriters[y];
+			out.taintQuirks[x] = in.taintQuirks[y];
+			break;
+		case 0x1:
+		case 0x2:
+		case 0x3: {
+			uint8_t result = (code & 0xF) == 0x1 ? vx | vy : (code & 0xF) == 0x2 ? vx & vy : vx ^ vy;
+			out.update(x, xyKnown, result);
+			out.taint(0xF, Chip8Quirk::RESET_VF, address);
+			break;
+		}
+		case 0x4:
+			out.update(x, xyKnown, static_cast<uint8_t>(vx + vy));
+			out.update(0xF, xyKnown, vx > 0xFF - vy);
+			break;
+		case 0x5:
+			out.update(x, xyKnown, static_cast<uint8_t>(vx - vy));
+			out.update(0xF, xyKnown, vx >= vy);
+			break;
+		case 0x7:
+			out.update(x, xyKnown, static_cast<uint8_t>(vy - vx));
+			out.update(0xF, xyKnown, vy >= vx);
+			break;
+		case 0x6:
+		case 0xE:
+			if (x == y) {
+				bool right = (code & 0xF) == 0x6;
+				out.update(x, in.is_known(x), static_cast<uint8_t>(right ? vx >> 1 : vx << 1));
+				out.update(0xF, in.is_known(x), right ? vx & 1 : vx >> 7);
+			}
+			else {
+				out.taint(x, Chip8Quirk::SET_VX_TO_VY, address);
+				out.taint(0xF, Chip8Quirk::SET_VX_TO_VY, address);
+			}
+			break;
+		}
+		break;
+	case 0xA000:
+		out.set(REG_I, nnn);
+		break;
+	case 0xC000:
+		out.forget(x);
+		break;
+	case 0xD000:
+		out.forget(0xF);
+		break;
+	case 0xF000:
+		switch (kk) {
+		case 0x07:
+		case 0x0A:
+			out.forget(x);
+			break;
+		case 0x1E:
+			out.update(REG_I, in.is_known(REG_I) && in.is_known(x), static_cast<uint16_t>(in.values[REG_I] + vx));
+			break;
+		case 0x29:
+			if (in.is_known(x)) {
+				out.set(REG_I, static_cast<uint16_t>(5 * vx));
+			}
+			else {
+				out.forget(REG_I);
+			}
+			break;
+		case 0x55:
+			out.taint(REG_I, Chip8Quirk::INCREMENT_I, address);
+			break;
+		case 0x65:
+			for (int reg = 0; reg <= x; ++reg) {
+				out.forget(reg);
+			}
+			out.taint(REG_I, Chip8Quirk::INCREMENT_I, address);
+			break;
+		}
+		break;
+	}
+	successors.push_back(std::make_pair(next, out));
+}
+
+// Propagates register states along every path until they stop changing. Each register can only go
+// from a constant to unknown and from untainted to tainted, so this ends after a few passes.
+void Analyzer::solve()
+{
+	AbstractState reset;
+	std::memset(&reset, 0, sizeof(reset));
+	reset.known = (1u << REG_COUNT) - 1;
+	_states[Chip8::PROGRAM_START] = reset;
+	_reached[Chip8::PROGRAM_START] = true;
+
+	vector<uint16_t> work(1, Chip8::PROGRAM_START);
+	vector<bool> queued(Chip8::MEMORY_SIZE, false);
+	queued[Chip8::PROGRAM_START] = true;
+	Successors successors;
+	while (!work.empty()) {
+		uint16_t address = work.back();
+		work.pop_back();
+		queued[address] = false;
+		successors.clear();
+		step(address, _states[address], successors);
+		for (const pair<uint16_t, AbstractState>& successor : successors) {
+			uint16_t target = successor.first;
+			if (target > LAST_INSTRUCTION) {
+				continue;
+			}
+			bool changed = !_reached[target];
+			if (changed) {
+				_states[target] = successor.second;
+				_reached[target] = true;
+			}
+			else {
+				changed = _states[target].join(successor.second);
+			}
+			if (changed && !queued[target]) {
+				queued[target] = true;
+				work.push_back(target);
+			}
+		}
+	}
+}
+
+void Analyzer::record_effects()
+{
+	for (int address = 0; address <= LAST_INSTRUCTION; ++address) {
+		if (_reached[address]) {
+			_analysis.bytes[address] |= BYTE_CODE;
+			_analysis.bytes[address + 1] |= BYTE_CODE_TAIL;
+			++_analysis.instructionCount;
+		}
+	}
+
+	std::set<std::tuple<uint16_t, uint16_t, int>> hints;
+	vector<pair<uint16_t, uint16_t>> writes;
+	for (int address = 0; address <= LAST_INSTRUCTION; ++address) {
+		if (!_reached[address]) {
+			continue;
+		}
+		const AbstractState& state = _states[address];
+		uint16_t code = fetch(address);
+		int x = (code >> 8) & 0xF;
+		if ((address & 1) != 0 || (_analysis.bytes[address] & BYTE_CODE_TAIL) != 0) {
+			_analysis.misalignedInstructions.push_back(address);
+		}
+		Flow flow = get_flow(code);
+		if (flow == Flow::INVALID) {
+			_analysis.invalidInstructions.push_back(address);
+			continue;
+		}
+		if (flow == Flow::INDIRECT) {
+			Chip8IndirectJump jump;
+			jump.address = address;
+			jump.isResolved = state.is_known(0);
+			jump.target = jump.isResolved ? static_cast<uint16_t>((code & 0xFFF) + state.values[0]) : 0;
+			_analysis.indirectJumps.push_back(jump);
+		}
+
+		uint32_t reads = get_reads(code);
+		for (int reg = 0; reg < REG_COUNT; ++reg) {
+			if ((reads >> reg & 1) && state.taintWriters[reg] != 0
+				&& hints.insert(std::make_tuple(state.taintWriters[reg], static_cast<uint16_t>(address), reg)).second) {
+				Chip8QuirkHint hint;
+				hint.quirk = state.taintQuirks[reg];
+				hint.writer = state.taintWriters[reg];
+				hint.reader = static_cast<uint16_t>(address);
+				hint.reg = reg;
+				_analysis.quirkHints.push_back(hint);
+			}
+		}
+
+		int length = 0;
+		uint8_t flag = 0;
+		if ((code & 0xF000) == 0xD000) {
+			length = code & 0xF;
+			flag = BYTE_SPRITE;
+		}
+		else if ((code & 0xF0FF) == 0xF065) {
+			length = x + 1;
+			flag = BYTE_LOADED;
+		}
+		else if ((code & 0xF0FF) == 0xF055 || (code & 0xF0FF) == 0xF033) {
+			length = (code & 0xFF) == 0x55 ? x + 1 : 3;
+			flag = BYTE_WRITTEN;
+			if (!state.is_known(REG_I)) {
+				Chip8CodeWrite write;
+				write.writer = address;
+				write.isTargetKnown = false;
+				write.first = write.last = 0;
+				_analysis.codeWrites.push_back(write);
+				continue;
+			}
+			writes.push_back(std::make_pair(static_cast<uint16_t>(address), state.values[REG_I]));
+		}
+		if (flag != 0 && state.is_known(REG_I)) {
+			for (int i = state.values[REG_I]; i < state.values[REG_I] + length && i < Chip8::MEMORY_SIZE; ++i) {
+				_analysis.bytes[i] |= flag;
+			}
+		}
+	}
+
+	// only now that all code is marked
+	for (const pair<uint16_t, uint16_t>& write : writes) {
+		uint16_t code = fetch(write.first);
+		int length = (code & 0xFF) == 0x55 ? ((code >> 8) & 0xF) + 1 : 3;
+		int last = std::min(write.second + length, static_cast<int>(Chip8::MEMORY_SIZE)) - 1;
+		for (int i = write.second; i <= last; ++i) {
+			if (_analysis.bytes[i] & (BYTE_CODE | BYTE_CODE_TAIL)) {
+				Chip8CodeWrite codeWrite;
+				codeWrite.writer = write.first;
+				codeWrite.isTargetKnown = true;
+				codeWrite.first = write.second;
+				codeWrite.last = static_cast<uint16_t>(last);
+				_analysis.codeWrites.push_back(codeWrite);
+				break;
+			}
+		}
+	}
+}
+
+void Analyzer::build_blocks()
+{
+	vector<bool> leaders(Chip8::MEMORY_SIZE, false);
+	leaders[Chip8::PROGRAM_START] = true;
+	Successors successors;
+	for (int address = 0; address <= LAST_INSTRUCTION; ++address) {
+		if (!_reached[address]) {
+			continue;
+		}
+		Flow flow = get_flow(fetch(address));
+		if (flow == Flow::NEXT) {
+			continue;
+		}
+		successors.clear();
+		step(static_cast<uint16_t>(address), _states[address], successors);
+		for (const pair<uint16_t, AbstractState>& successor : successors) {
+			if (successor.first <= LAST_INSTRUCTION) {
+				leaders[successor.first] = true;
+			}
+		}
+	}
+
+	for (int address = 0; address <= LAST_INSTRUCTION; ++address) {
+		if (!_reached[address] || !leaders[address]) {
+			continue;
+		}
+		_analysis.bytes[address] |= BYTE_BLOCK_START;
+		Chip8Block block;
+		block.start = static_cast<uint16_t>(address);
+		uint16_t last = block.start;
+		Flow flow = get_flow(fetch(last));
+		while (flow == Flow::NEXT && last + 2 <= LAST_INSTRUCTION && _reached[last + 2] && !leaders[last + 2]) {
+			last += 2;
+			flow = get_flow(fetch(last));
+		}
+		block.end = last + 2;
+		uint16_t code = fetch(last);
+		switch (flow) {
+		case Flow::NEXT:
+			block.kind = block.end <= LAST_INSTRUCTION ? Chip8BlockEnd::FALLTHROUGH : Chip8BlockEnd::INVALID;
+			break;
+		case Flow::JUMP:
+			block.kind = (code & 0xFFF) == last ? Chip8BlockEnd::HALT : Chip8BlockEnd::JUMP;
+			break;
+		case Flow::CALL:
+			block.kind = Chip8BlockEnd::CALL;
+			break;
+		case Flow::RETURN:
+			block.kind = Chip8BlockEnd::RETURN;
+			break;
+		case Flow::SKIP:
+			block.kind = Chip8BlockEnd::SKIP;
+			break;
+		case Flow::INDIRECT:
+			block.kind = Chip8BlockEnd::INDIRECT_JUMP;
+			break;
+		case Flow::INVALID:
+			block.kind = Chip8BlockEnd::INVALID;
+			break;
+		}
+		successors.clear();
+		step(last, _states[last], successors);
+		for (const pair<uint16_t, AbstractState>& successor : successors) {
+			if (successor.first <= LAST_INSTRUCTION) {
+				block.successors.push_back(successor.first);
+			}
+			else if (block.kind != Chip8BlockEnd::INVALID) {
+				// a path off the end of memory faults there
+				_analysis.invalidInstructions.push_back(last);
+			}
+		}
+		_analysis.blocks.push_back(block);
+	}
+	std::sort(_analysis.invalidInstructions.begin(), _analysis.invalidInstructions.end());
+	_analysis.invalidInstructions.erase(std::unique(_analysis.invalidInstructions.begin(), _analysis.invalidInstructions.end()),
+		_analysis.invalidInstructions.end());
+}
+
+void Analyzer::run()
+{
+	solve();
+	record_effects();
+	build_blocks();
+}
+
+}
+
+void analyze_rom(const uint8_t* memory, size_t romSize, Chip8Analysis& analysis)
+{
+	std::memset(analysis.bytes, 0, sizeof(analysis.bytes));
+	analysis.blocks.clear();
+	analysis.indirectJumps.clear();
+	analysis.codeWrites.clear();
+	analysis.quirkHints.clear();
+	analysis.invalidInstructions.clear();
+	analysis.misalignedInstructions.clear();
+	analysis.romSize = static_cast<uint16_t>(std::min(romSize, static_cast<size_t>(Chip8::MAX_ROM_SIZE)));
+	analysis.instructionCount = 0;
+	Analyzer(memory, analysis).run();
+}
+
+const Chip8Block* Chip8Analysis::find_block(uint16_t address) const
+{
+	auto block = std::upper_bound(blocks.begin(), blocks.end(), address,
+		[](uint16_t address, const Chip8Block& block) { return address < block.start; });
+	if (block == blocks.begin() || !is_code(address)) {
+		return nullptr;
+	}
+	--block;
+	return address < block->end ? &*block : nullptr;
+}
+
+bool Chip8Analysis::is_fully_resolved() const
+{
+	for (const Chip8IndirectJump& jump : indirectJumps) {
+		if (!jump.isResolved) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint8_t Chip8Analysis::get_quirk_dependencies() const
+{
+	uint8_t quirks = 0;
+	for (const Chip8QuirkHint& hint : quirkHints) {
+		quirks |= 1 << static_cast<int>(hint.quirk);
+	}
+	return quirks;
+}
+
+const char* get_quirk_name(Chip8Quirk quirk)
+{
+	switch (quirk) {
+	case Chip8Quirk::RESET_VF:
+		return "resetVF";
+	case Chip8Quirk::SET_VX_TO_VY:
+		return "setVXtoVY";
+	case Chip8Quirk::INCREMENT_I:
+		return "incrementI";
+	}
+	return "?";
+}
+
+const char* get_block_end_name(Chip8BlockEnd kind)
+{
+	switch (kind) {
+	case Chip8BlockEnd::FALLTHROUGH:
+		return "fallthrough";
+	case Chip8BlockEnd::JUMP:
+		return "jump";
+	case Chip8BlockEnd::CALL:
+		return "call";
+	case Chip8BlockEnd::RETURN:
+		return "return";
+	case Chip8BlockEnd::SKIP:
+		return "skip";
+	case Chip8BlockEnd::INDIRECT_JUMP:
+		return "indirect jump";
+	case Chip8BlockEnd::HALT:
+		return "halt";
+	case Chip8BlockEnd::INVALID:
+		return "invalid";
+	}
+	return "?";
+}
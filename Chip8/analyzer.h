@@ -0,0 +1,119 @@
+#ifndef CHIP8_ANALYZER_H
+#define CHIP8_ANALYZER_H
+
+#include "chip8.h"
+#include <cstdint>
+#include <vector>
+
+// What the analyzer learned about each byte of memory; several can apply at once.
+enum Chip8ByteFlags : uint8_t {
+	// first byte of an instruction some path reaches
+	BYTE_CODE = 1 << 0,
+	// second byte of such an instruction
+	BYTE_CODE_TAIL = 1 << 1,
+	// drawn by DXYN through an I the analyzer could follow
+	BYTE_SPRITE = 1 << 2,
+	// loaded into registers by FX65
+	BYTE_LOADED = 1 << 3,
+	// stored to by FX33 or FX55
+	BYTE_WRITTEN = 1 << 4,
+	// first instruction of a basic block
+	BYTE_BLOCK_START = 1 << 5
+};
+
+// How a basic block hands over control.
+enum class Chip8BlockEnd {
+	// runs into the next block, which starts at a jump or skip target
+	FALLTHROUGH,
+	// 1MMM
+	JUMP,
+	// 2MMM; the successors are the subroutine and the instruction after the call
+	CALL,
+	// 00EE
+	RETURN,
+	// 3XKK, 4XKK, 5XY0, 9XY0, EX9E, EXA1
+	SKIP,
+	// BMMM; a successor only when V0 is known there
+	INDIRECT_JUMP,
+	// 1MMM to itself
+	HALT,
+	// an opcode the interpreter faults on, or a path that runs off the end of memory
+	INVALID
+};
+
+struct Chip8Block {
+	uint16_t start;
+	// address after the last instruction
+	uint16_t end;
+	Chip8BlockEnd kind;
+	vector<uint16_t> successors;
+};
+
+enum class Chip8Quirk {
+	RESET_VF,
+	SET_VX_TO_VY,
+	INCREMENT_I
+};
+
+// A register written differently depending on a quirk, read later on some path.
+struct Chip8QuirkHint {
+	Chip8Quirk quirk;
+	// the quirk-dependent instruction
+	uint16_t writer;
+	// the instruction that reads its result
+	uint16_t reader;
+	// 0 to F for V0 to VF, 16 for I
+	int reg;
+};
+
+// FX33 or FX55 storing over reachable code, or through an I the analyzer could not follow.
+struct Chip8CodeWrite {
+	uint16_t writer;
+	bool isTargetKnown;
+	uint16_t first;
+	uint16_t last;
+};
+
+// BMMM, with its target when V0 is the same constant on every path there.
+struct Chip8IndirectJump {
+	uint16_t address;
+	bool isResolved;
+	uint16_t target;
+};
+
+// Static view of a ROM: control-flow graph, code and data bytes and what the program may rely on.
+// Registers and I are tracked as constants along every path, starting from their reset values, which
+// resolves most BMMM jump tables and sprite addresses. Anything data dependent, from CXKK, FX65, keys
+// or timers, is treated as unknown, so the result holds whatever the input.
+// It describes the ROM as loaded: a program that stores over its own code may run differently,
+// which codeWrites reports.
+struct Chip8Analysis {
+	uint8_t bytes[Chip8::MEMORY_SIZE];
+	// sorted by start address
+	vector<Chip8Block> blocks;
+	vector<Chip8IndirectJump> indirectJumps;
+	vector<Chip8CodeWrite> codeWrites;
+	vector<Chip8QuirkHint> quirkHints;
+	// reachable addresses holding an opcode the interpreter does not know
+	vector<uint16_t> invalidInstructions;
+	// instructions at odd addresses or overlapping another instruction
+	vector<uint16_t> misalignedInstructions;
+	uint16_t romSize;
+	int instructionCount;
+
+	bool is_code(uint16_t address) const { return address < Chip8::MEMORY_SIZE && (bytes[address] & BYTE_CODE) != 0; }
+	// the block containing the instruction at address, nullptr when it is not reachable code
+	const Chip8Block* find_block(uint16_t address) const;
+	// whether every path leaving the program counter can be followed statically
+	bool is_fully_resolved() const;
+	// quirks whose setting changes a value the program reads, bits as in Chip8Quirks order:
+	// 0 resetVF, 1 setVXtoVY, 2 increamentI
+	uint8_t get_quirk_dependencies() const;
+};
+
+// Analyzes a ROM of romSize bytes loaded at 0x200 of memory, as Chip8::get_memory() returns it.
+void analyze_rom(const uint8_t* memory, size_t romSize, Chip8Analysis& analysis);
+const char* get_quirk_name(Chip8Quirk quirk);
+const char* get_block_end_name(Chip8BlockEnd kind);
+
+#endif // CHIP8_ANALYZER_H
@@ -1,14 +1,14 @@
 #include "chip8.h"
+#include "hash.h"
+#include "trace.h"
 #include <iostream>
-#include <fstream>
 #include <random>
 #include <algorithm>
+#include <cstring>
 
-using std::ifstream;
 using std::cout;
 using std::cerr;
 using std::wcout;
-using std::wcerr;
 using std::endl;
 
 Chip8Quirks::Chip8Quirks(bool resetVF, bool setVXtoVY, bool increamentI)
@@ -18,15 +18,25 @@ Chip8Quirks::Chip8Quirks(bool resetVF, bool setVXtoVY, bool increamentI)
 	this->increamentI = increamentI;
 }
 
-Chip8Quirks::Chip8Quirks(Chip8Quirks& other) : Chip8Quirks(other.resetVF, other.setVXtoVY, other.increamentI)
-{}
+uint8_t Chip8Quirks::to_bits() const
+{
+	return (resetVF ? 1 : 0) | (setVXtoVY ? 2 : 0) | (increamentI ? 4 : 0);
+}
+
+Chip8Quirks Chip8Quirks::from_bits(uint8_t bits)
+{
+	return Chip8Quirks((bits & 1) != 0, (bits & 2) != 0, (bits & 4) != 0);
+}
 
-Chip8::Chip8() : _memory(), _variables(),
-	_I(0), _timer(0), _soundTimer(0), _programCounter(0x200),
-	_hexKeyboard(), _wasKeyHeldDown(-1),
-	_mt19937(_randomDevice()), _numDistribution(0x0, 0xFF),
-	_displayBuffer(), _quirks(), _skipOnSpriteCollision(false),
-	_isROMOpened(false),
+Chip8::Chip8() : _memory(),
+	_seed(_randomDevice()), _isSeedPending(false), _mt19937(_seed), _numDistribution(0x0, 0xFF),
+	_isROMOpened(false), _romHash(0), _loadError(Chip8LoadError::NONE),
+	_engine(Chip8Engine::SWITCH), _nativeProgram(nullptr),
+	_fault(Chip8Fault::NONE), _faultAddress(0), _isFaultLogged(true), _instructionsPerFrame(DEFAULT_INSTRUCTIONS_PER_FRAME),
+	_ticks(0), _variables(), _I(0), _programCounter(0x200), _callStack(), _stackPointer(0),
+	_hexKeyboard(), _wasKeyHeldDown(-1), _keyEvents(), _keyEventHead(0), _keyEventCount(0), _keyEdgeCycles(),
+	_keyEventLog(nullptr),
+	_timer(0), _soundTimer(0), _soundTimerState(nullptr),
 	_fonts {
 		0xF0, 0x90, 0x90, 0x90, 0xF0,
 		0x20, 0x60, 0x20, 0x20, 0x70,
@@ -44,7 +54,8 @@ Chip8::Chip8() : _memory(), _variables(),
 		0xE0, 0x90, 0x90, 0x90, 0xE0,
 		0xF0, 0x80, 0xF0, 0x80, 0xF0,
 		0xF0, 0x80, 0xF0, 0x80, 0x80
-	}
+	},
+	_displayBuffer(), _displayBits(), _quirks()
 {
 	reset();
 }
@@ -52,50 +63,324 @@ Chip8::Chip8() : _memory(), _variables(),
 void Chip8::reset()
 {
 	_ticks = 0;
-	_I = _timer = _soundTimer = 0;
+	_I = _timer = 0;
+	set_sound_timer(0);
 	_programCounter = 0x200;
-	if (!_callStack.empty()) {
-		_callStack.pop();
-	}
+	_stackPointer = 0;
 	std::fill(_variables, _variables + VARIABLE_SIZE, 0);
 	std::fill(_memory, _memory + MEMORY_SIZE, 0);
 	_wasKeyHeldDown = -1;
+	std::fill(_hexKeyboard, _hexKeyboard + KEYPAD_COUNT, false);
+	_keyEventHead = _keyEventCount = 0;
+	std::fill(_keyEdgeCycles, _keyEdgeCycles + KEYPAD_COUNT, 0);
 	for (int i = 0; i < DISPLAY_ROWS; ++i) {
 		std::fill(_displayBuffer[i], _displayBuffer[i] + DISPLAY_COLS, 255);
+		std::fill(_displayBits[i], _displayBits[i] + DISPLAY_ROW_BYTES, 0);
 	}
 	_isROMOpened = false;
+	_romHash = 0;
+	_fault = Chip8Fault::NONE;
+	std::fill(_predecoded.begin(), _predecoded.end(), Chip8Predecoded());
 }
 
 bool Chip8::load_rom(const wstring& path)
 {
+	return load_rom_from_file(native_path(path), utf8_path(path));
+}
+
+bool Chip8::load_rom(const string& path)
+{
+	return load_rom_from_file(native_path(path), path);
+}
+
+bool Chip8::load_rom_from_file(const NativePath& path, const string& name)
+{
+	MappedFile file;
+	if (!file.open(path)) {
+		return fail_load(Chip8LoadError::OPEN_FAILED, name);
+	}
+	// checked before mapping so an oversized file is never read
+	if (file.get_size() > static_cast<size_t>(MAX_ROM_SIZE)) {
+		return fail_load(Chip8LoadError::TOO_LARGE, name);
+	}
+	if (!file.map()) {
+		return fail_load(Chip8LoadError::READ_FAILED, name);
+	}
+	return load_rom_from_memory(file.get_data(), file.get_size());
+}
+
+bool Chip8::load_rom_from_memory(const uint8_t* data, size_t size)
+{
+	if (size > static_cast<size_t>(MAX_ROM_SIZE)) {
+		return fail_load(Chip8LoadError::TOO_LARGE, "ROM image");
+	}
 	reset();
+	std::copy(_fonts, _fonts + 16 * 5, _memory);
+	std::copy(data, data + size, _memory + PROGRAM_START);
+	_romHash = fnv1a64(_memory + PROGRAM_START, size);
+	_isROMOpened = true;
+	_loadError = Chip8LoadError::NONE;
+	return _isROMOpened;
+}
 
-	ifstream ifs;
-	ifs.open(path, ifstream::binary);
-	if (!ifs.is_open() || !ifs.good()) {
-		wcerr << "Open: " << path << " error" << endl;
-		return false;
+bool Chip8::fail_load(Chip8LoadError error, const string& name)
+{
+	reset();
+	_loadError = error;
+	if (_isFaultLogged) {
+		cerr << "Load: " << name << ": " << get_load_error_name(error) << endl;
 	}
-	std::copy(_fonts, _fonts+16*5, _memory);
+	return false;
+}
 
-	ifs.seekg(0, ifs.end);
-	size_t length = static_cast<size_t>(ifs.tellg());
-	ifs.seekg(0, ifs.beg);
+void Chip8::set_seed(uint32_t seed)
+{
+	_seed = seed;
+	_isSeedPending = true;
+}
 
-	ifs.read(reinterpret_cast<char*>(_memory + 0x200), length);
-	ifs.close();
+void Chip8::save_snapshot(Chip8Snapshot& snapshot) const
+{
+	static_assert(sizeof(snapshot.memory) == sizeof(_memory), "snapshot memory size");
+	static_assert(sizeof(snapshot.variables) == sizeof(_variables), "snapshot variables size");
+	static_assert(sizeof(snapshot.callStack) == sizeof(_callStack), "snapshot stack size");
+	static_assert(sizeof(snapshot.keyboard) == sizeof(_hexKeyboard), "snapshot keyboard size");
+	static_assert(sizeof(snapshot.displayBuffer) == sizeof(_displayBuffer), "snapshot display size");
+	static_assert(sizeof(snapshot.displayBits) == sizeof(_displayBits), "snapshot display bits size");
+	std::memcpy(snapshot.memory, _memory, sizeof(_memory));
+	std::memcpy(snapshot.variables, _variables, sizeof(_variables));
+	snapshot.I = _I;
+	snapshot.programCounter = _programCounter;
+	std::memcpy(snapshot.callStack, _callStack, sizeof(_callStack));
+	snapshot.stackPointer = _stackPointer;
+	snapshot.timer = _timer;
+	snapshot.soundTimer = _soundTimer;
+	std::memcpy(snapshot.keyboard, _hexKeyboard, sizeof(_hexKeyboard));
+	snapshot.wasKeyHeldDown = _wasKeyHeldDown;
+	std::memcpy(snapshot.displayBuffer, _displayBuffer, sizeof(_displayBuffer));
+	std::memcpy(snapshot.displayBits, _displayBits, sizeof(_displayBits));
+	snapshot.ticks = _ticks;
+	snapshot.romHash = _romHash;
+	snapshot.isROMOpened = _isROMOpened;
+}
 
-	_isROMOpened = true;
+void Chip8::load_snapshot(const Chip8Snapshot& snapshot)
+{
+	std::memcpy(_memory, snapshot.memory, sizeof(_memory));
+	std::memcpy(_variables, snapshot.variables, sizeof(_variables));
+	_I = snapshot.I;
+	_programCounter = snapshot.programCounter;
+	std::memcpy(_callStack, snapshot.callStack, sizeof(_callStack));
+	_stackPointer = snapshot.stackPointer;
+	_timer = snapshot.timer;
+	set_sound_timer(snapshot.soundTimer);
+	std::memcpy(_hexKeyboard, snapshot.keyboard, sizeof(_hexKeyboard));
+	_wasKeyHeldDown = snapshot.wasKeyHeldDown;
+	std::memcpy(_displayBuffer, snapshot.displayBuffer, sizeof(_displayBuffer));
+	std::memcpy(_displayBits, snapshot.displayBits, sizeof(_displayBits));
+	_ticks = snapshot.ticks;
+	_romHash = snapshot.romHash;
+	_isROMOpened = snapshot.isROMOpened;
+	_keyEventHead = _keyEventCount = 0;
+	std::fill(_keyEdgeCycles, _keyEdgeCycles + KEYPAD_COUNT, 0);
+	_fault = Chip8Fault::NONE;
+	std::fill(_predecoded.begin(), _predecoded.end(), Chip8Predecoded());
+}
 
-	return _isROMOpened;
+uint64_t Chip8::state_hash() const
+{
+	uint64_t hash = fnv1a64(_memory, sizeof(_memory));
+	hash = fnv1a64(_variables, sizeof(_variables), hash);
+	hash = fnv1a64(&_I, sizeof(_I), hash);
+	hash = fnv1a64(&_programCounter, sizeof(_programCounter), hash);
+	hash = fnv1a64(_callStack, sizeof(_callStack[0]) * _stackPointer, hash);
+	hash = fnv1a64(&_stackPointer, sizeof(_stackPointer), hash);
+	hash = fnv1a64(&_timer, sizeof(_timer), hash);
+	hash = fnv1a64(&_soundTimer, sizeof(_soundTimer), hash);
+	hash = fnv1a64(_hexKeyboard, sizeof(_hexKeyboard), hash);
+	hash = fnv1a64(&_wasKeyHeldDown, sizeof(_wasKeyHeldDown), hash);
+	return fnv1a64(_displayBits, sizeof(_displayBits), hash);
+}
+
+Chip8Registers Chip8::get_registers() const
+{
+	Chip8Registers registers;
+	registers.programCounter = _programCounter;
+	registers.I = _I;
+	std::copy(_variables, _variables + VARIABLE_SIZE, registers.variables);
+	registers.stackPointer = _stackPointer;
+	std::copy(_callStack, _callStack + STACK_SIZE, registers.callStack);
+	registers.timer = _timer;
+	registers.soundTimer = _soundTimer;
+	return registers;
 }
 
+// Wraps around instead of reading past memory; step() faults before executing from there.
 uint16_t Chip8::fetch_code() const
 {
-	return ((_memory[_programCounter] << 8) | _memory[_programCounter + 1]);
+	return ((_memory[_programCounter & (MEMORY_SIZE - 1)] << 8) | _memory[(_programCounter + 1) & (MEMORY_SIZE - 1)]);
 }
 
 void Chip8::execute_code(uint16_t code)
+{
+	if (_engine == Chip8Engine::TABLE) {
+		(this->*DISPATCH_TABLES.main[code >> 12])(code);
+	}
+	else {
+		execute_switch(code);
+	}
+	_ticks++;
+}
+
+void Chip8::step()
+{
+	if (_keyEventCount > 0) {
+		apply_key_events();
+	}
+	if (_programCounter > MEMORY_SIZE - 2) {
+		raise_fault(Chip8Fault::PC_OUT_OF_BOUNDS, 0);
+		_ticks++;
+		return;
+	}
+	execute_code(fetch_code());
+}
+
+const Chip8::DispatchTables Chip8::DISPATCH_TABLES = Chip8::build_dispatch_tables();
+
+// Mirrors the decoding of execute_switch() exactly, including which bits select a handler in each group.
+Chip8::DispatchTables Chip8::build_dispatch_tables()
+{
+	DispatchTables tables;
+	std::fill(tables.group8, tables.group8 + 16, &Chip8::code_unknown);
+	std::fill(tables.groupE, tables.groupE + 16, &Chip8::code_unknown);
+	std::fill(tables.groupF, tables.groupF + 256, &Chip8::code_unknown);
+
+	tables.main[0x0] = &Chip8::dispatch_0NNN;
+	tables.main[0x1] = &Chip8::code_1MMM;
+	tables.main[0x2] = &Chip8::code_2MMM;
+	tables.main[0x3] = &Chip8::code_3XKK;
+	tables.main[0x4] = &Chip8::code_4XKK;
+	tables.main[0x5] = &Chip8::code_5XY0;
+	tables.main[0x6] = &Chip8::code_6XKK;
+	tables.main[0x7] = &Chip8::code_7XKK;
+	tables.main[0x8] = &Chip8::dispatch_8XYN;
+	tables.main[0x9] = &Chip8::code_9XY0;
+	tables.main[0xA] = &Chip8::code_AMMM;
+	tables.main[0xB] = &Chip8::code_BMMM;
+	tables.main[0xC] = &Chip8::code_CXKK;
+	tables.main[0xD] = &Chip8::code_DXYN;
+	tables.main[0xE] = &Chip8::dispatch_EXNN;
+	tables.main[0xF] = &Chip8::dispatch_FXNN;
+
+	tables.group8[0x0] = &Chip8::code_8XY0;
+	tables.group8[0x1] = &Chip8::code_8XY1;
+	tables.group8[0x2] = &Chip8::code_8XY2;
+	tables.group8[0x3] = &Chip8::code_8XY3;
+	tables.group8[0x4] = &Chip8::code_8XY4;
+	tables.group8[0x5] = &Chip8::code_8XY5;
+	tables.group8[0x6] = &Chip8::code_8XY6;
+	tables.group8[0x7] = &Chip8::code_8XY7;
+	tables.group8[0xE] = &Chip8::code_8XYE;
+
+	tables.groupE[0xE] = &Chip8::code_EX9E;
+	tables.groupE[0x1] = &Chip8::code_EXA1;
+
+	tables.groupF[0x07] = &Chip8::code_FX07;
+	tables.groupF[0x0A] = &Chip8::code_FX0A;
+	tables.groupF[0x15] = &Chip8::code_FX15;
+	tables.groupF[0x18] = &Chip8::code_FX18;
+	tables.groupF[0x1E] = &Chip8::code_FX1E;
+	tables.groupF[0x29] = &Chip8::code_FX29;
+	tables.groupF[0x30] = &Chip8::code_FX30;
+	tables.groupF[0x33] = &Chip8::code_FX33;
+	tables.groupF[0x55] = &Chip8::code_FX55;
+	tables.groupF[0x65] = &Chip8::code_FX65;
+	return tables;
+}
+
+void Chip8::dispatch_0NNN(uint16_t code)
+{
+	if ((code & 0x00FF) == 0x00E0) {
+		code_00E0();
+	}
+	else if ((code & 0x00FF) == 0x00EE) {
+		code_00EE();
+	}
+	else {
+		code_unknown(code);
+	}
+}
+
+void Chip8::dispatch_8XYN(uint16_t code)
+{
+	(this->*DISPATCH_TABLES.group8[code & 0xF])(code);
+}
+
+void Chip8::dispatch_EXNN(uint16_t code)
+{
+	(this->*DISPATCH_TABLES.groupE[code & 0xF])(code);
+}
+
+void Chip8::dispatch_FXNN(uint16_t code)
+{
+	(this->*DISPATCH_TABLES.groupF[code & 0xFF])(code);
+}
+
+const char* get_fault_name(Chip8Fault fault)
+{
+	switch (fault) {
+	case Chip8Fault::NONE:
+		return "none";
+	case Chip8Fault::UNKNOWN_OPCODE:
+		return "unknown opcode";
+	case Chip8Fault::STACK_OVERFLOW:
+		return "stack overflow";
+	case Chip8Fault::STACK_UNDERFLOW:
+		return "stack underflow";
+	case Chip8Fault::MEMORY_OUT_OF_BOUNDS:
+		return "memory out of bounds";
+	case Chip8Fault::PC_OUT_OF_BOUNDS:
+		return "program counter out of bounds";
+	case Chip8Fault::KEY_OUT_OF_RANGE:
+		return "key out of range";
+	}
+	return "?";
+}
+
+const char* get_load_error_name(Chip8LoadError error)
+{
+	switch (error) {
+	case Chip8LoadError::NONE:
+		return "none";
+	case Chip8LoadError::OPEN_FAILED:
+		return "cannot open";
+	case Chip8LoadError::READ_FAILED:
+		return "cannot read";
+	case Chip8LoadError::TOO_LARGE:
+		return "too large for memory";
+	}
+	return "?";
+}
+
+void Chip8::raise_fault(Chip8Fault fault, uint16_t code)
+{
+	if (_fault != Chip8Fault::NONE) {
+		return;
+	}
+	_fault = fault;
+	_faultAddress = _programCounter;
+	// once per fault: a faulted program runs into it again every instruction
+	if (_isFaultLogged) {
+		cerr << get_fault_name(fault) << " " << std::hex << code << " at " << _programCounter << std::dec << endl;
+	}
+}
+
+void Chip8::code_unknown(uint16_t code)
+{
+	raise_fault(Chip8Fault::UNKNOWN_OPCODE, code);
+}
+
+void Chip8::execute_switch(uint16_t code)
 {
 	switch (code & 0xF000) {
 	case 0x0000:
@@ -107,7 +392,7 @@ void Chip8::execute_code(uint16_t code)
 			code_00EE();
 			break;
 		default:
-			cerr << "Unknown " << code << endl;
+			code_unknown(code);
 			break;
 		}
 		break;
@@ -162,7 +447,7 @@ void Chip8::execute_code(uint16_t code)
 			code_8XYE(code);
 			break;
 		default:
-			cerr << "Unknown " << code << endl;
+			code_unknown(code);
 			break;
 		}
 		break;
@@ -190,7 +475,7 @@ void Chip8::execute_code(uint16_t code)
 			code_EXA1(code);
 			break;
 		default:
-			cerr << "Unknown " << code << endl;
+			code_unknown(code);
 			break;
 		}
 		break;
@@ -226,29 +511,461 @@ void Chip8::execute_code(uint16_t code)
 			code_FX65(code);
 			break;
 		default:
-			cerr << "Unknown " << code << endl;
+			code_unknown(code);
 			break;
 		}
 		break;
 	default:
-		cerr << "Unknown " << code << endl;
+		code_unknown(code);
 		break;
 	}
-	_ticks++;
+}
+
+void Chip8::run_frame()
+{
+	{
+		TRACE_SCOPE("execute", "core");
+		if (_engine == Chip8Engine::NATIVE && _nativeProgram && _isROMOpened && _nativeProgram->romHash == _romHash) {
+			run_native(_instructionsPerFrame);
+		}
+		else if (_engine == Chip8Engine::PREDECODED) {
+			run_predecoded(_instructionsPerFrame);
+		}
+		else {
+			for (int i = 0; i < _instructionsPerFrame; ++i) {
+				step();
+			}
+		}
+	}
+	TRACE_SCOPE("countdown", "core");
+	countdown();
+}
+
+// Alternates between translated code and single interpreter steps. Translated code is stopped right
+// before the next key edge is due, so step() applies it at the same instruction as the interpreter would.
+// Once it cannot run even one instruction the program is likely in code the translation never saw,
+// e.g. written at runtime, and the rest of the frame is interpreted.
+void Chip8::run_native(int count)
+{
+	Chip8NativeContext context(*this);
+	while (count > 0) {
+		int budget = count;
+		if (_keyEventCount > 0) {
+			uint64_t due = _keyEvents[_keyEventHead].cycle;
+			budget = due <= _ticks ? 0 : static_cast<int>(std::min<uint64_t>(due - _ticks, budget));
+		}
+		if (budget > 0) {
+			int done = _nativeProgram->run(context, budget);
+			_ticks += done;
+			count -= done;
+			if (done == 0) {
+				break;
+			}
+			if (count == 0) {
+				return;
+			}
+		}
+		step();
+		--count;
+	}
+	for (; count > 0; --count) {
+		step();
+	}
+}
+
+void Chip8::set_engine(Chip8Engine engine)
+{
+	_engine = engine;
+	// memory may have changed without invalidation while another engine ran
+	if (engine == Chip8Engine::PREDECODED) {
+		_predecoded.assign(MEMORY_SIZE, Chip8Predecoded());
+	}
+	else {
+		vector<Chip8Predecoded>().swap(_predecoded);
+	}
+}
+
+static bool is_skip_code(uint16_t code)
+{
+	switch (code & 0xF000) {
+	case 0x3000:
+	case 0x4000:
+	case 0x5000:
+	case 0x9000:
+		return true;
+	case 0xE000:
+		return (code & 0xF) == 0xE || (code & 0xF) == 0x1;
+	default:
+		return false;
+	}
+}
+
+Chip8Predecoded Chip8::predecode(const uint8_t* memory, uint16_t address)
+{
+	Chip8Predecoded entry = {};
+	int available = std::min((MEMORY_SIZE - address) / 2, 3);
+	for (int i = 0; i < available; ++i) {
+		entry.codes[i] = static_cast<uint16_t>(memory[address + 2 * i] << 8 | memory[address + 2 * i + 1]);
+	}
+	const uint16_t* codes = entry.codes;
+	uint16_t back = 0x1000 | address;
+	auto fuse = [&entry](Chip8FusedOp op, int count) {
+		entry.op = op;
+		entry.count = static_cast<uint8_t>(count);
+		return entry;
+	};
+
+	if (available >= 3) {
+		if ((codes[0] & 0xF0FF) == 0xF007 && is_skip_code(codes[1]) && codes[2] == back) {
+			return fuse(Chip8FusedOp::DELAY_POLL, 3);
+		}
+		if ((codes[0] & 0xF000) == 0xA000 && (codes[1] & 0xF0FF) == 0xF01E && (codes[2] & 0xF0FF) == 0xF065) {
+			return fuse(Chip8FusedOp::TABLE_LOAD, 3);
+		}
+		if ((codes[0] & 0xF000) == 0x6000 && (codes[1] & 0xF000) == 0x6000 && (codes[2] & 0xF000) == 0x6000) {
+			return fuse(Chip8FusedOp::LOAD_TRIPLE, 3);
+		}
+	}
+	if (available >= 2) {
+		if (is_skip_code(codes[0]) && codes[1] == back) {
+			return fuse(Chip8FusedOp::POLL_LOOP, 2);
+		}
+		if ((codes[0] & 0xF000) == 0xA000 && (codes[1] & 0xF000) == 0xD000) {
+			return fuse(Chip8FusedOp::SET_I_DRAW, 2);
+		}
+		if ((codes[0] & 0xF0FF) == 0xF029 && (codes[1] & 0xF000) == 0xD000) {
+			return fuse(Chip8FusedOp::DIGIT_DRAW, 2);
+		}
+		if ((codes[0] & 0xF000) == 0x7000 && ((codes[1] & 0xF000) == 0x3000 || (codes[1] & 0xF000) == 0x4000)
+			&& (codes[0] & 0x0F00) == (codes[1] & 0x0F00)) {
+			return fuse(Chip8FusedOp::COUNT_SKIP, 2);
+		}
+		if ((codes[0] & 0xF000) == 0x6000 && (codes[1] & 0xF000) == 0x6000) {
+			return fuse(Chip8FusedOp::LOAD_PAIR, 2);
+		}
+	}
+	if (codes[0] == back) {
+		return fuse(Chip8FusedOp::SPIN, 1);
+	}
+	if ((codes[0] & 0xF0FF) == 0xF00A) {
+		return fuse(Chip8FusedOp::KEY_WAIT, 1);
+	}
+	return fuse(Chip8FusedOp::SINGLE, 1);
+}
+
+void Chip8::invalidate_predecoded(int first, int last)
+{
+	// an entry covers at most three instructions, so it starts at most five bytes before a byte it covers
+	for (int address = std::max(first - 5, 0); address <= last && address < MEMORY_SIZE; ++address) {
+		_predecoded[address].count = 0;
+	}
+}
+
+// Fused entries run when the frame has room for all their instructions before the next key edge,
+// single instructions otherwise, so every frame ends in the state the interpreter would reach.
+void Chip8::run_predecoded(int count)
+{
+	while (count > 0) {
+		int limit = count;
+		if (_keyEventCount > 0) {
+			uint64_t due = _keyEvents[_keyEventHead].cycle;
+			limit = due <= _ticks ? 0 : static_cast<int>(std::min<uint64_t>(due - _ticks, limit));
+		}
+		if (limit == 0 || _programCounter > MEMORY_SIZE - 2) {
+			step();
+			--count;
+			continue;
+		}
+		Chip8Predecoded& entry = _predecoded[_programCounter];
+		if (entry.count == 0) {
+			entry = predecode(_memory, _programCounter);
+		}
+		// most entries are single instructions, which skip the handler call
+		if (entry.op == Chip8FusedOp::SINGLE || entry.count > limit) {
+			execute_switch(entry.codes[0]);
+			++_ticks;
+			--count;
+			continue;
+		}
+		int done = (this->*FUSED_HANDLERS[static_cast<int>(entry.op)])(entry, limit);
+		_ticks += done;
+		count -= done;
+	}
+}
+
+// indexed by Chip8FusedOp
+const Chip8::FusedHandler Chip8::FUSED_HANDLERS[] = {
+	&Chip8::fused_single,
+	&Chip8::fused_spin,
+	&Chip8::fused_key_wait,
+	&Chip8::fused_poll_loop,
+	&Chip8::fused_delay_poll,
+	&Chip8::fused_table_load,
+	&Chip8::fused_set_i_draw,
+	&Chip8::fused_digit_draw,
+	&Chip8::fused_count_skip,
+	&Chip8::fused_load_triple,
+	&Chip8::fused_load_pair
+};
+
+int Chip8::fused_single(const Chip8Predecoded& entry, int)
+{
+	return run_single(entry.codes[0]);
+}
+
+int Chip8::fused_spin(const Chip8Predecoded&, int limit)
+{
+	return limit;
+}
+
+int Chip8::fused_key_wait(const Chip8Predecoded& entry, int limit)
+{
+	uint16_t start = _programCounter;
+	code_FX0A(entry.codes[0]);
+	return _programCounter == start ? limit : 1;
+}
+
+int Chip8::fused_poll_loop(const Chip8Predecoded& entry, int limit)
+{
+	uint16_t start = _programCounter;
+	run_single(entry.codes[0]);
+	// skipped out of the loop, or faulted
+	if (_programCounter != start + 2) {
+		return 1;
+	}
+	// nothing a skip reads changes inside the loop, so every further round ends the same way
+	_programCounter = start;
+	return limit / 2 * 2;
+}
+
+int Chip8::fused_delay_poll(const Chip8Predecoded& entry, int limit)
+{
+	uint16_t start = _programCounter;
+	code_FX07(entry.codes[0]);
+	run_single(entry.codes[1]);
+	if (_programCounter != start + 4) {
+		return 2;
+	}
+	_programCounter = start;
+	return limit / 3 * 3;
+}
+
+int Chip8::fused_table_load(const Chip8Predecoded& entry, int)
+{
+	code_AMMM(entry.codes[0]);
+	code_FX1E(entry.codes[1]);
+	code_FX65(entry.codes[2]);
+	return 3;
+}
+
+int Chip8::fused_set_i_draw(const Chip8Predecoded& entry, int)
+{
+	code_AMMM(entry.codes[0]);
+	code_DXYN(entry.codes[1]);
+	return 2;
+}
+
+int Chip8::fused_digit_draw(const Chip8Predecoded& entry, int)
+{
+	code_FX29(entry.codes[0]);
+	code_DXYN(entry.codes[1]);
+	return 2;
+}
+
+int Chip8::fused_count_skip(const Chip8Predecoded& entry, int)
+{
+	code_7XKK(entry.codes[0]);
+	run_single(entry.codes[1]);
+	return 2;
+}
+
+int Chip8::fused_load_triple(const Chip8Predecoded& entry, int)
+{
+	_variables[(entry.codes[0] & 0x0F00) >> 8] = entry.codes[0] & 0xFF;
+	_variables[(entry.codes[1] & 0x0F00) >> 8] = entry.codes[1] & 0xFF;
+	_variables[(entry.codes[2] & 0x0F00) >> 8] = entry.codes[2] & 0xFF;
+	_programCounter += 6;
+	return 3;
+}
+
+int Chip8::fused_load_pair(const Chip8Predecoded& entry, int)
+{
+	_variables[(entry.codes[0] & 0x0F00) >> 8] = entry.codes[0] & 0xFF;
+	_variables[(entry.codes[1] & 0x0F00) >> 8] = entry.codes[1] & 0xFF;
+	_programCounter += 4;
+	return 2;
+}
+
+void Chip8::set_instructions_per_frame(int count)
+{
+	_instructionsPerFrame = std::max(count, 1);
+}
+
+// Decodes like execute_switch(): 5XY0 and 9XY0 ignore the low nibble, EXNN only looks at it.
+int Chip8::skip_outcome(uint16_t code, const uint8_t* variables) const
+{
+	uint8_t vx = variables[(code & 0x0F00) >> 8];
+	switch (code & 0xF000) {
+	case 0x3000:
+		return vx == (code & 0xFF) ? 1 : 0;
+	case 0x4000:
+		return vx != (code & 0xFF) ? 1 : 0;
+	case 0x5000:
+		return vx == variables[(code & 0x00F0) >> 4] ? 1 : 0;
+	case 0x9000:
+		return vx != variables[(code & 0x00F0) >> 4] ? 1 : 0;
+	default:
+		if (vx >= KEYPAD_COUNT) {
+			return -1;
+		}
+		return _hexKeyboard[vx] == ((code & 0xF) == 0xE) ? 1 : 0;
+	}
+}
+
+// Three shapes are recognised, with the program counter anywhere in them: a jump to itself, FX0A,
+// a skip followed by a jump back to it and FX07 followed by a skip and a jump back to the FX07.
+bool Chip8::find_idle_loop(IdleLoop& loop) const
+{
+	int pc = _programCounter;
+	if (_keyEventCount > 0 || pc > MEMORY_SIZE - 2) {
+		return false;
+	}
+	auto code_at = [this](int address) {
+		return address >= 0 && address <= MEMORY_SIZE - 2 ? _memory[address] << 8 | _memory[address + 1] : -1;
+	};
+	loop.timerRegister = -1;
+	loop.frames = -1;
+	loop.offset = 0;
+	int code = code_at(pc);
+	if (code == (0x1000 | pc)) {
+		loop.wait = Chip8Wait::HALT;
+		loop.start = static_cast<uint16_t>(pc);
+		loop.length = 1;
+		return true;
+	}
+	if ((code & 0xF0FF) == 0xF00A) {
+		// it changes nothing while the first held key is the one it already saw, or no key is held
+		int held = -1;
+		for (int i = 0; i < KEYPAD_COUNT && held < 0; ++i) {
+			held = _hexKeyboard[i] ? i : -1;
+		}
+		if (held != _wasKeyHeldDown) {
+			return false;
+		}
+		loop.wait = Chip8Wait::KEY;
+		loop.start = static_cast<uint16_t>(pc);
+		loop.length = 1;
+		return true;
+	}
+	for (int offset = 0; offset < 2; ++offset) {
+		int start = pc - 2 * offset;
+		int skip = code_at(start);
+		if (skip < 0 || !is_skip_code(static_cast<uint16_t>(skip)) || code_at(start + 2) != (0x1000 | start)) {
+			continue;
+		}
+		if (skip_outcome(static_cast<uint16_t>(skip), _variables) != 0) {
+			return false;
+		}
+		loop.wait = (skip & 0xF000) == 0xE000 ? Chip8Wait::KEY : Chip8Wait::HALT;
+		loop.start = static_cast<uint16_t>(start);
+		loop.length = 2;
+		loop.offset = offset;
+		return true;
+	}
+	// every frame has to run the FX07, so it sees each value the delay timer takes
+	if (_instructionsPerFrame < 3) {
+		return false;
+	}
+	for (int offset = 0; offset < 3; ++offset) {
+		int start = pc - 2 * offset;
+		int read = code_at(start), skip = code_at(start + 2);
+		if (read < 0 || (read & 0xF0FF) != 0xF007 || skip < 0 || !is_skip_code(static_cast<uint16_t>(skip))
+			|| code_at(start + 4) != (0x1000 | start)) {
+			continue;
+		}
+		uint8_t variables[VARIABLE_SIZE];
+		std::copy(_variables, _variables + VARIABLE_SIZE, variables);
+		// on the skip, the next frame starts by comparing what the last FX07 read
+		if (offset == 1 && skip_outcome(static_cast<uint16_t>(skip), variables) != 0) {
+			return false;
+		}
+		int x = (read & 0x0F00) >> 8;
+		int frames = 0;
+		for (;; ++frames) {
+			variables[x] = static_cast<uint8_t>(std::max(_timer - frames, 0));
+			int outcome = skip_outcome(static_cast<uint16_t>(skip), variables);
+			if (outcome != 0) {
+				break;
+			}
+			// the timer stays at 0, so every further frame is the same
+			if (variables[x] == 0) {
+				frames = -1;
+				break;
+			}
+		}
+		if (frames == 0) {
+			return false;
+		}
+		loop.wait = frames > 0 ? Chip8Wait::TIMER : (skip & 0xF000) == 0xE000 ? Chip8Wait::KEY : Chip8Wait::HALT;
+		loop.start = static_cast<uint16_t>(start);
+		loop.length = 3;
+		loop.offset = offset;
+		loop.frames = frames;
+		loop.timerRegister = x;
+		return true;
+	}
+	return false;
+}
+
+Chip8Wait Chip8::find_wait(int* frames) const
+{
+	IdleLoop loop;
+	if (!find_idle_loop(loop)) {
+		return Chip8Wait::NONE;
+	}
+	if (frames) {
+		*frames = loop.frames;
+	}
+	return loop.wait;
+}
+
+int Chip8::skip_idle_frames(int count)
+{
+	IdleLoop loop;
+	if (count <= 0 || !find_idle_loop(loop)) {
+		return 0;
+	}
+	int frames = loop.frames < 0 ? count : std::min(loop.frames, count);
+	uint64_t instructions = static_cast<uint64_t>(frames) * _instructionsPerFrame;
+	_ticks += instructions;
+	_programCounter = static_cast<uint16_t>(loop.start + 2 * ((loop.offset + instructions) % loop.length));
+	if (loop.timerRegister >= 0) {
+		// what the FX07 of the last skipped frame read
+		_variables[loop.timerRegister] = static_cast<uint8_t>(std::max(_timer - (frames - 1), 0));
+	}
+	_timer = static_cast<uint8_t>(std::max(_timer - frames, 0));
+	if (_soundTimer > 0) {
+		set_sound_timer(static_cast<uint8_t>(std::max(_soundTimer - frames, 0)));
+	}
+	return frames;
 }
 
 void Chip8::code_00E0()
 {
 	for (int row = 0; row < DISPLAY_ROWS; ++row) {
 		std::fill(_displayBuffer[row], _displayBuffer[row] + DISPLAY_COLS, 255);
+		std::fill(_displayBits[row], _displayBits[row] + DISPLAY_ROW_BYTES, 0);
 	}
 	_programCounter += 2;
 }
 
 void Chip8::code_00EE()
 {
-	_programCounter = _callStack.top();
-	_callStack.pop();
+	if (_stackPointer == 0) {
+		raise_fault(Chip8Fault::STACK_UNDERFLOW, 0x00EE);
+		return;
+	}
+	_programCounter = _callStack[--_stackPointer];
 }
 
 void Chip8::code_1MMM(uint16_t code)
@@ -258,7 +975,11 @@ void Chip8::code_1MMM(uint16_t code)
 
 void Chip8::code_2MMM(uint16_t code)
 {
-	_callStack.push(_programCounter + 2);
+	if (_stackPointer == STACK_SIZE) {
+		raise_fault(Chip8Fault::STACK_OVERFLOW, code);
+		return;
+	}
+	_callStack[_stackPointer++] = _programCounter + 2;
 	_programCounter = code & 0x0FFF;
 }
 
@@ -417,6 +1138,11 @@ void Chip8::code_BMMM(uint16_t code)
 
 void Chip8::code_CXKK(uint16_t code)
 {
+	if (_isSeedPending) {
+		_mt19937.seed(_seed);
+		_numDistribution.reset();
+		_isSeedPending = false;
+	}
 	int num = _numDistribution(_mt19937);
 	_variables[(code & 0x0F00) >> 8] = num & (code & 0x00FF);
 	_programCounter += 2;
@@ -427,6 +1153,10 @@ void Chip8::code_DXYN(uint16_t code)
 	int X = _variables[(code & 0x0F00) >> 8];
 	int Y = _variables[(code & 0x00F0) >> 4];
 	uint8_t N = code & 0x000F;
+	if (_I + std::min<int>(N, DISPLAY_ROWS - Y % DISPLAY_ROWS) > MEMORY_SIZE) {
+		raise_fault(Chip8Fault::MEMORY_OUT_OF_BOUNDS, code);
+		return;
+	}
 	_variables[0xF] = 0;
 	Y %= DISPLAY_ROWS;
 	X %= DISPLAY_COLS;
@@ -441,6 +1171,9 @@ void Chip8::code_DXYN(uint16_t code)
 			//uint8_t* p = &_displayBuffer[(Y + row) % DISPLAY_ROWS][(X + (7 - col)) % DISPLAY_COLS];
 			if (bit && *p == 0) _variables[0xF] = 1;
 			*p = ((bit && *p == 0) || (!bit && *p == 255)) ? 255 : 0;
+			if (bit) {
+				_displayBits[r][c >> 3] ^= 0x80 >> (c & 7);
+			}
 			/*if (bit) {
 				if (*p == 0) {
 					_variables[0xF] = 1;
@@ -457,16 +1190,26 @@ void Chip8::code_DXYN(uint16_t code)
 
 void Chip8::code_EX9E(uint16_t code)
 {
+	uint8_t key = _variables[(code & 0x0F00) >> 8];
+	if (key >= KEYPAD_COUNT) {
+		raise_fault(Chip8Fault::KEY_OUT_OF_RANGE, code);
+		return;
+	}
 	_programCounter += 2;
-	if (_hexKeyboard[_variables[(code & 0x0F00) >> 8]] == 1) {
+	if (_hexKeyboard[key] == 1) {
 		_programCounter += 2;
 	}
 }
 
 void Chip8::code_EXA1(uint16_t code)
 {
+	uint8_t key = _variables[(code & 0x0F00) >> 8];
+	if (key >= KEYPAD_COUNT) {
+		raise_fault(Chip8Fault::KEY_OUT_OF_RANGE, code);
+		return;
+	}
 	_programCounter += 2;
-	if (_hexKeyboard[_variables[(code & 0x0F00) >> 8]] == 0) {
+	if (_hexKeyboard[key] == 0) {
 		_programCounter += 2;
 	}
 }
@@ -503,10 +1246,11 @@ void Chip8::code_FX15(uint16_t code)
 
 void Chip8::code_FX18(uint16_t code)
 {
-	_soundTimer = _variables[(code & 0x0F00) >> 8];
-	if (_soundTimer > 0 && _soundTimer < 4) {
-		_soundTimer = 4;
+	uint8_t value = _variables[(code & 0x0F00) >> 8];
+	if (value > 0 && value < 4) {
+		value = 4;
 	}
+	set_sound_timer(value);
 	_programCounter += 2;
 }
 
@@ -524,10 +1268,17 @@ void Chip8::code_FX29(uint16_t code)
 
 void Chip8::code_FX33(uint16_t code)
 {
+	if (_I + 3 > MEMORY_SIZE) {
+		raise_fault(Chip8Fault::MEMORY_OUT_OF_BOUNDS, code);
+		return;
+	}
 	int value = _variables[(code & 0x0F00) >> 8];
 	_memory[_I] = value / 100;
 	_memory[_I + 1] = (value / 10) % 10;
 	_memory[_I + 2] = value % 10;
+	if (!_predecoded.empty()) {
+		invalidate_predecoded(_I, _I + 2);
+	}
 	_programCounter += 2;
 }
 
@@ -535,9 +1286,16 @@ void Chip8::code_FX33(uint16_t code)
 void Chip8::code_FX55(uint16_t code)
 {
 	int X = (code & 0x0F00) >> 8;
+	if (_I + X + 1 > MEMORY_SIZE) {
+		raise_fault(Chip8Fault::MEMORY_OUT_OF_BOUNDS, code);
+		return;
+	}
 	for (int i = 0; i <= X; i++) {
 		_memory[_I + i] = _variables[i];
 	}
+	if (!_predecoded.empty()) {
+		invalidate_predecoded(_I, _I + X);
+	}
 
 	if (_quirks.increamentI) {
 		_I += X + 1;
@@ -550,6 +1308,10 @@ void Chip8::code_FX55(uint16_t code)
 void Chip8::code_FX65(uint16_t code)
 {
 	int X = (code & 0x0F00) >> 8;
+	if (_I + X + 1 > MEMORY_SIZE) {
+		raise_fault(Chip8Fault::MEMORY_OUT_OF_BOUNDS, code);
+		return;
+	}
 	for (int i = 0; i <= X; i++) {
 		_variables[i] = _memory[_I + i];
 	}
@@ -564,11 +1326,51 @@ void Chip8::code_FX65(uint16_t code)
 void Chip8::on_key_down(int key)
 {
 	_hexKeyboard[key] = 1;
+	if (_keyEventLog) {
+		_keyEventLog->push_back({ _ticks, static_cast<uint8_t>(key), true });
+	}
 }
 
 void Chip8::on_key_up(int key)
 {
 	_hexKeyboard[key] = 0;
+	if (_keyEventLog) {
+		_keyEventLog->push_back({ _ticks, static_cast<uint8_t>(key), false });
+	}
+}
+
+bool Chip8::queue_key_event(int key, bool down, uint64_t cycle)
+{
+	if (key < 0 || key >= KEYPAD_COUNT || _keyEventCount == KEY_EVENT_CAPACITY) {
+		return false;
+	}
+	cycle = std::max(cycle, _ticks);
+	if (_keyEventCount > 0) {
+		const Chip8KeyEvent& last = _keyEvents[(_keyEventHead + _keyEventCount - 1) % KEY_EVENT_CAPACITY];
+		cycle = std::max(cycle, last.cycle);
+	}
+	cycle = std::max(cycle, _keyEdgeCycles[key]);
+	_keyEdgeCycles[key] = cycle + 1;
+
+	Chip8KeyEvent& event = _keyEvents[(_keyEventHead + _keyEventCount) % KEY_EVENT_CAPACITY];
+	event.cycle = cycle;
+	event.key = static_cast<uint8_t>(key);
+	event.down = down;
+	++_keyEventCount;
+	return true;
+}
+
+void Chip8::apply_key_events()
+{
+	while (_keyEventCount > 0 && _keyEvents[_keyEventHead].cycle <= _ticks) {
+		const Chip8KeyEvent& event = _keyEvents[_keyEventHead];
+		_hexKeyboard[event.key] = event.down;
+		if (_keyEventLog) {
+			_keyEventLog->push_back(event);
+		}
+		_keyEventHead = (_keyEventHead + 1) % KEY_EVENT_CAPACITY;
+		--_keyEventCount;
+	}
 }
 
 void Chip8::countdown()
@@ -577,11 +1379,30 @@ void Chip8::countdown()
 		--_timer;
 	}
 	if (_soundTimer > 0) {
-		--_soundTimer;
+		set_sound_timer(_soundTimer - 1);
+	}
+}
+
+void Chip8::publish_sound_timer(std::atomic<uint8_t>* target)
+{
+	_soundTimerState = target;
+	if (_soundTimerState) {
+		_soundTimerState->store(_soundTimer, std::memory_order_relaxed);
+	}
+}
+
+void Chip8::set_sound_timer(uint8_t value)
+{
+	if ((value > 0) != (_soundTimer > 0)) {
+		TRACE_INSTANT(value > 0 ? "sound on" : "sound off", "audio");
+	}
+	_soundTimer = value;
+	if (_soundTimerState) {
+		_soundTimerState->store(value, std::memory_order_relaxed);
 	}
 }
 
-void Chip8::set_quirks(Chip8Quirks& quirks)
+void Chip8::set_quirks(const Chip8Quirks& quirks)
 {
 	_quirks.resetVF = quirks.resetVF;
 	_quirks.setVXtoVY = quirks.setVXtoVY;
@@ -603,7 +1424,3 @@ void Chip8::set_increment_I(bool value)
 	_quirks.increamentI = value;
 }
 
-void Chip8::set_skip_on_sprite_collision(bool skip)
-{
-	_skipOnSpriteCollision = skip;
-}
@@ -1,22 +1,175 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include "mappedfile.h"
 #include <string>
-#include <stack>
 #include <random>
 #include <vector>
 #include <utility>
+#include <atomic>
 
 using std::string;
 using std::wstring;
-using std::stack;
 using std::random_device;
 using std::mt19937;
 using std::uniform_int_distribution;
 using std::pair;
+using std::vector;
+
+// A keypad edge stamped with the instruction count (see Chip8::get_ticks()) at which it takes effect.
+struct Chip8KeyEvent {
+	uint64_t cycle;
+	uint8_t key;
+	bool down;
+};
+
+// How execute_code() decodes an opcode. Every engine calls the same handlers and has to stay
+// in lockstep with SWITCH, see Tools/lockstep.
+enum class Chip8Engine {
+	// nested switch on the opcode nibbles
+	SWITCH,
+	// member function tables indexed by the opcode nibbles
+	TABLE,
+	// run_frame() runs the Chip8NativeProgram given to set_native_program() while its ROM is loaded,
+	// and SWITCH for whatever that leaves to the interpreter; step() always interprets
+	NATIVE,
+	// run_frame() decodes each address once and runs common sequences through one fused handler,
+	// see Chip8FusedOp; step() decodes like SWITCH
+	PREDECODED
+};
+
+// How the PREDECODED engine runs the instructions at an address. Fused ops cover a fixed sequence and
+// only run when the frame has room for all of it before the next key edge, so they never change
+// what the program sees. The order follows how often the sequences ran in ROM/Test, see chip8opstats.
+enum class Chip8FusedOp : uint8_t {
+	// one instruction through the SWITCH decoder
+	SINGLE,
+	// 1MMM to itself: the rest of the frame is this jump
+	SPIN,
+	// FX0A: once it did not complete, repeating it changes nothing until a key edge
+	KEY_WAIT,
+	// a skip, then 1MMM back to the skip: loops until the frame ends when the skip is not taken
+	POLL_LOOP,
+	// FX07, a skip, then 1MMM back to the FX07: the delay timer only moves between frames
+	DELAY_POLL,
+	// AMMM FX1E FX65
+	TABLE_LOAD,
+	// AMMM DXYN
+	SET_I_DRAW,
+	// FX29 DXYN
+	DIGIT_DRAW,
+	// 7XKK, then 3XKK or 4XKK on the same register
+	COUNT_SKIP,
+	// 6XKK 6XKK 6XKK
+	LOAD_TRIPLE,
+	// 6XKK 6XKK
+	LOAD_PAIR
+};
+
+// The decoded form of one address for the PREDECODED engine.
+struct Chip8Predecoded {
+	Chip8FusedOp op;
+	// instructions covered, 0 while the address has not been decoded
+	uint8_t count;
+	uint16_t codes[3];
+};
+
+// What an idle loop at the program counter waits for, see Chip8::find_wait().
+enum class Chip8Wait {
+	// no loop the core can see through
+	NONE,
+	// FX0A, or a loop polling EX9E/EXA1: it lasts until a key edge
+	KEY,
+	// a loop polling FX07 that ends after a known number of frames
+	TIMER,
+	// a loop nothing ends, like a jump to itself
+	HALT
+};
+
+class Chip8NativeContext;
+
+// A ROM translated to C++ ahead of time by chip8aot, see Tools/aot.
+struct Chip8NativeProgram {
+	// Chip8::get_rom_hash() of the ROM it was translated from
+	uint64_t romHash;
+	const char* name;
+	// Runs translated code from the program counter until budget instructions have run or the next one is
+	// left to the interpreter: untranslated or overwritten code, an unresolved jump or an instruction that faults.
+	// Returns the number of instructions run.
+	int (*run)(Chip8NativeContext& context, int budget);
+};
+
+// Snapshot of the CPU for debugging tools.
+struct Chip8Registers {
+	uint16_t programCounter;
+	uint16_t I;
+	uint8_t variables[16];
+	int stackPointer;
+	uint16_t callStack[16];
+	uint8_t timer;
+	uint8_t soundTimer;
+};
+
+// Why the core stopped advancing. The instruction that faults is not executed and the program
+// counter stays on it, so a faulted program keeps faulting until it is reset or reloaded.
+enum class Chip8Fault {
+	NONE,
+	UNKNOWN_OPCODE,
+	// 2MMM with all 16 stack entries in use
+	STACK_OVERFLOW,
+	// 00EE with an empty stack
+	STACK_UNDERFLOW,
+	// DXYN, FX33, FX55 or FX65 would touch memory past 0xFFF through I
+	MEMORY_OUT_OF_BOUNDS,
+	// the program counter left memory, e.g. through BMMM
+	PC_OUT_OF_BOUNDS,
+	// EX9E or EXA1 with VX past F
+	KEY_OUT_OF_RANGE
+};
+
+const char* get_fault_name(Chip8Fault fault);
+
+// Why the last load_rom() or load_rom_from_memory() failed.
+enum class Chip8LoadError {
+	NONE,
+	// missing, not a regular file or not readable
+	OPEN_FAILED,
+	// opened but its contents could not be mapped
+	READ_FAILED,
+	// larger than the 3584 bytes from 0x200 to the end of memory
+	TOO_LARGE
+};
+
+const char* get_load_error_name(Chip8LoadError error);
+
+// Everything reset() and load_rom() set up, as plain data, so a prepared machine can be restored
+// with a few memcpys instead of resetting and loading it again.
+struct Chip8Snapshot {
+	uint8_t memory[4096];
+	uint8_t variables[16];
+	uint16_t I;
+	uint16_t programCounter;
+	uint16_t callStack[16];
+	int stackPointer;
+	uint8_t timer;
+	uint8_t soundTimer;
+	bool keyboard[16];
+	int wasKeyHeldDown;
+	uint8_t displayBuffer[32][64];
+	uint8_t displayBits[32][8];
+	uint64_t ticks;
+	uint64_t romHash;
+	bool isROMOpened;
+};
 
 struct Chip8Quirks {
 	Chip8Quirks() : resetVF(false), setVXtoVY(false), increamentI(false)
 	{}
 	Chip8Quirks(bool resetVF, bool setVXtoVY, bool increamentI);
-	Chip8Quirks(Chip8Quirks& other);
+	// The packed form every file format and the server use: bit 0 resetVF, bit 1 setVXtoVY, bit 2 increamentI.
+	// from_bits() ignores the higher bits.
+	uint8_t to_bits() const;
+	static Chip8Quirks from_bits(uint8_t bits);
 	bool resetVF;
 	bool setVXtoVY;
 	bool increamentI;
@@ -31,6 +184,10 @@ struct Chip8Quirks {
 // * To use the CHIP-8 language, you must first store the 512-byte CHIP-8 language program at memory locations 0000 to 01FF.
 // * When using CHIP-8 instructions your program must always begin at location 0200.
 class Chip8 {
+	// Tools/bench calls the handlers directly to time them apart from the dispatch in execute_code().
+	friend class Chip8Bench;
+	friend class Chip8NativeContext;
+
 // IO & Storage
 public:
 	Chip8();
@@ -38,15 +195,45 @@ public:
 	Chip8(const Chip8&&) = delete;
 	Chip8& operator= (const Chip8&) = delete;
 	void reset();
+	// The file is mapped, not read, and turned down before that when it is too large to fit.
 	bool load_rom(const wstring& path);
+	// UTF-8 path
+	bool load_rom(const string& path);
+	// Same as load_rom() from an image already in memory, so batch runners need no file per job.
+	bool load_rom_from_memory(const uint8_t* data, size_t size);
+	// NONE after a successful load; written to cerr as well unless set_fault_logging(false)
+	Chip8LoadError get_load_error() const { return _loadError; }
+	static constexpr int PROGRAM_START = 0x200;
 	bool is_ROM_opened() const { return _isROMOpened; }
-private:
+	// FNV-1a of the loaded ROM image, 0 when no ROM is loaded
+	uint64_t get_rom_hash() const { return _romHash; }
+	// CXKK draws from a generator seeded with this; the seed survives reset() and load_rom()
+	// but the sequence restarts only on set_seed().
+	uint32_t get_seed() const { return _seed; }
+	// Cheap to call often: the generator is only reseeded when CXKK next draws from it.
+	void set_seed(uint32_t seed);
+	// Hash over everything that decides future execution: memory, registers, stack, timers, keypad and display.
+	// Two cores with equal hashes run identically given the same input.
+	uint64_t state_hash() const;
 	static constexpr int MEMORY_SIZE = 4096;
+	static constexpr int MAX_ROM_SIZE = MEMORY_SIZE - PROGRAM_START;
+	const uint8_t* get_memory() const { return _memory; }
+	// Pending key edges, the seed, quirks and engine are not part of the snapshot;
+	// load_snapshot() drops the pending edges and clears the fault.
+	void save_snapshot(Chip8Snapshot& snapshot) const;
+	void load_snapshot(const Chip8Snapshot& snapshot);
+private:
 	uint8_t _memory[MEMORY_SIZE];
 	random_device _randomDevice;
+	uint32_t _seed;
+	bool _isSeedPending;
 	mt19937 _mt19937;
 	uniform_int_distribution<> _numDistribution;
 	bool _isROMOpened;
+	uint64_t _romHash;
+	Chip8LoadError _loadError;
+	bool load_rom_from_file(const NativePath& path, const string& name);
+	bool fail_load(Chip8LoadError error, const string& name);
 	
 // Instructions
 public:
@@ -54,7 +241,94 @@ public:
 	bool is_draw_code(uint16_t code) const { return (code & 0xF000) == 0xD000; }
 	bool is_sprites_overlapped() const { return _variables[0xF] == 1; }
 	void execute_code(uint16_t code);
+	// Applies the key edges due at this cycle, then executes the next instruction.
+	void step();
+	// Executes one frame worth of instructions, then ticks the timers.
+	void run_frame();
+	Chip8Engine get_engine() const { return _engine; }
+	// The engine survives reset() and load_rom().
+	void set_engine(Chip8Engine engine);
+	// Used by the NATIVE engine for the ROM it was translated from, ignored for any other; survives reset() and load_rom().
+	void set_native_program(const Chip8NativeProgram* program) { _nativeProgram = program; }
+	const Chip8NativeProgram* get_native_program() const { return _nativeProgram; }
+	Chip8Registers get_registers() const;
+	// What the PREDECODED engine runs at address, from the memory as it is.
+	static Chip8Predecoded predecode(const uint8_t* memory, uint16_t address);
+	// The first fault since the last reset, load or clear_fault(), and the address of the instruction that raised it.
+	Chip8Fault get_fault() const { return _fault; }
+	uint16_t get_fault_address() const { return _faultAddress; }
+	void clear_fault() { _fault = Chip8Fault::NONE; }
+	// The first fault and any load error are written to cerr by default; fuzzers and batch runners turn that off
+	// and poll get_fault() and get_load_error().
+	void set_fault_logging(bool value) { _isFaultLogged = value; }
+	static constexpr int DEFAULT_INSTRUCTIONS_PER_FRAME = 15;
+	int get_instructions_per_frame() const { return _instructionsPerFrame; }
+	void set_instructions_per_frame(int count);
+	// instructions executed since the last reset
+	uint64_t get_ticks() const { return _ticks; }
+	// The idle loop the program is in at a frame boundary, if any. A loop counts when running it leaves
+	// everything but the ticks, the timers and a register FX07 writes as it was, and no key edge is pending.
+	// frames gets how many frames a TIMER loop keeps idling, -1 for the others.
+	Chip8Wait find_wait(int* frames = nullptr) const;
+	// Accounts for up to count frames of that loop without running it: ticks, timers, the program counter's
+	// place in the loop and the FX07 register end up as run_frame() would leave them. Returns the frames
+	// skipped, fewer when the loop ends first; hosts of many instances run the rest with run_frame().
+	int skip_idle_frames(int count);
 private:
+	struct IdleLoop {
+		Chip8Wait wait;
+		uint16_t start;
+		// instructions per round, and how many of them the program counter is past
+		int length;
+		int offset;
+		// frames it keeps idling, -1 until a key edge
+		int frames;
+		// written by the FX07 of a delay poll, -1 otherwise
+		int timerRegister;
+	};
+	bool find_idle_loop(IdleLoop& loop) const;
+	// 1 when the skip at code would skip with these registers, 0 when not, -1 when it would fault
+	int skip_outcome(uint16_t code, const uint8_t* variables) const;
+	typedef void (Chip8::*Handler)(uint16_t code);
+	struct DispatchTables {
+		Handler main[16];
+		Handler group8[16];
+		Handler groupE[16];
+		Handler groupF[256];
+	};
+	static DispatchTables build_dispatch_tables();
+	static const DispatchTables DISPATCH_TABLES;
+	void execute_switch(uint16_t code);
+	void run_native(int count);
+	void run_predecoded(int count);
+	// drops decoded entries that cover any byte from first to last
+	void invalidate_predecoded(int first, int last);
+	int run_single(uint16_t code) { execute_switch(code); return 1; }
+	// Fused handlers run the entry at the program counter and return how many instructions that was,
+	// at most limit.
+	typedef int (Chip8::*FusedHandler)(const Chip8Predecoded& entry, int limit);
+	static const FusedHandler FUSED_HANDLERS[];
+	int fused_single(const Chip8Predecoded& entry, int limit);
+	int fused_spin(const Chip8Predecoded& entry, int limit);
+	int fused_key_wait(const Chip8Predecoded& entry, int limit);
+	int fused_poll_loop(const Chip8Predecoded& entry, int limit);
+	int fused_delay_poll(const Chip8Predecoded& entry, int limit);
+	int fused_table_load(const Chip8Predecoded& entry, int limit);
+	int fused_set_i_draw(const Chip8Predecoded& entry, int limit);
+	int fused_digit_draw(const Chip8Predecoded& entry, int limit);
+	int fused_count_skip(const Chip8Predecoded& entry, int limit);
+	int fused_load_triple(const Chip8Predecoded& entry, int limit);
+	int fused_load_pair(const Chip8Predecoded& entry, int limit);
+	// second level of the TABLE engine for the opcode groups that share a first nibble
+	void dispatch_0NNN(uint16_t code);
+	void dispatch_8XYN(uint16_t code);
+	void dispatch_EXNN(uint16_t code);
+	void dispatch_FXNN(uint16_t code);
+	void raise_fault(Chip8Fault fault, uint16_t code);
+	void code_unknown(uint16_t code);
+	// SUPER-CHIP big font, not supported and ignored
+	void code_FX30(uint16_t) {}
+
 	void code_00E0();
 	void code_00EE();
 	void code_1MMM(uint16_t code);
@@ -95,47 +369,81 @@ private:
 	void code_FX65(uint16_t code);
 private:
 	uint16_t _opcode;
+	Chip8Engine _engine;
+	const Chip8NativeProgram* _nativeProgram;
+	// one entry per address while the engine is PREDECODED, empty otherwise
+	vector<Chip8Predecoded> _predecoded;
+	Chip8Fault _fault;
+	uint16_t _faultAddress;
+	bool _isFaultLogged;
+	int _instructionsPerFrame;
 	static constexpr int VARIABLE_SIZE = 16;
-	uint32_t _ticks;
+	uint64_t _ticks;
 	uint8_t _variables[VARIABLE_SIZE];
 	uint16_t _I;
 	uint16_t _programCounter;
-	stack<uint16_t> _callStack;
+	static constexpr int STACK_SIZE = 16;
+	uint16_t _callStack[STACK_SIZE];
+	int _stackPointer;
 
 
 // Keyboard
 public:
 	void on_key_down(int key);
 	void on_key_up(int key);
+	// Schedules a key edge for run_frame(), which applies it right before the instruction at `cycle`.
+	// Edges are kept in order and every edge of a key lands at least one instruction after its previous one,
+	// so a tap shorter than a frame is still seen by FX0A and EX9E.
+	// Returns false when the queue is full.
+	bool queue_key_event(int key, bool down, uint64_t cycle);
+	int get_pending_key_events() const { return _keyEventCount; }
+	// Every edge that reaches the keypad, queued or direct, is appended to target with the cycle it took effect at.
+	void log_key_events(vector<Chip8KeyEvent>* target) { _keyEventLog = target; }
 
 	static constexpr int KEYPAD_COUNT = 16;
+	static constexpr int KEY_EVENT_CAPACITY = 64;
 private:
+	void apply_key_events();
+
 	bool _hexKeyboard[KEYPAD_COUNT];
 	int _wasKeyHeldDown;
+	Chip8KeyEvent _keyEvents[KEY_EVENT_CAPACITY];
+	int _keyEventHead, _keyEventCount;
+	uint64_t _keyEdgeCycles[KEYPAD_COUNT];
+	vector<Chip8KeyEvent>* _keyEventLog;
 
 
 // Timer
 public:
 	void countdown();
 	uint8_t get_sound_timer() const { return _soundTimer; }
+	// The sound timer is mirrored into target whenever it changes, so an audio thread can follow it without locking.
+	void publish_sound_timer(std::atomic<uint8_t>* target);
 private:
+	void set_sound_timer(uint8_t value);
 	// 1 unit = 1/60 second
 	uint8_t _timer, _soundTimer;
+	std::atomic<uint8_t>* _soundTimerState;
 
 
 // Display Buffer
 public:
 	static constexpr int DISPLAY_ROWS = 32;
 	static constexpr int DISPLAY_COLS = 64;
+	static constexpr int DISPLAY_ROW_BYTES = DISPLAY_COLS / 8;
 	const uint8_t* get_display_buffer() const { return &_displayBuffer[0][0]; }
+	// Same image packed 1 bit per pixel, MSB first, set bits are the drawn (dark) pixels.
+	const uint8_t* get_display_bits() const { return &_displayBits[0][0]; }
 private:
 	uint8_t _fonts[80];
 	uint8_t _displayBuffer[DISPLAY_ROWS][DISPLAY_COLS];
+	uint8_t _displayBits[DISPLAY_ROWS][DISPLAY_ROW_BYTES];
 	
 
 // Emulation Quirks
 public:
-	void set_quirks(Chip8Quirks& quirks);
+	void set_quirks(const Chip8Quirks& quirks);
+	const Chip8Quirks& get_quirks() const { return _quirks; }
 	bool get_reset_VF() const { return _quirks.resetVF; }
 	void set_reset_VF(bool value);
 	bool is_VX_set_to_VY() const { return _quirks.setVXtoVY; }
@@ -144,12 +452,31 @@ public:
 	void set_increment_I(bool value);
 private:
 	Chip8Quirks _quirks;
+};
 
-
-// Video Configs
+// What translated code sees of the core: the state it updates in place, and the interpreter's handlers
+// for the instructions it does not inline. Made by run_frame() for the duration of one frame.
+class Chip8NativeContext {
 public:
-	bool skip_on_sprites_overlap() const { return _skipOnSpriteCollision; }
-	void set_skip_on_sprite_collision(bool skip);
+	explicit Chip8NativeContext(Chip8& chip8) : memory(chip8._memory), variables(chip8._variables), I(chip8._I),
+		programCounter(chip8._programCounter), callStack(chip8._callStack), stackPointer(chip8._stackPointer),
+		keyboard(chip8._hexKeyboard), timer(chip8._timer), quirks(chip8._quirks), _chip8(chip8)
+	{}
+	// Runs the handler for code as the interpreter would with the program counter on it,
+	// without counting an instruction; it may fault or leave the program counter anywhere.
+	void execute(uint16_t code) { _chip8.execute_switch(code); }
+
+	uint8_t* const memory;
+	uint8_t* const variables;
+	uint16_t& I;
+	uint16_t& programCounter;
+	uint16_t* const callStack;
+	int& stackPointer;
+	const bool* const keyboard;
+	uint8_t& timer;
+	const Chip8Quirks& quirks;
 private:
-	bool _skipOnSpriteCollision;
-};
\ No newline at end of file
+	Chip8& _chip8;
+};
+
+#endif // CHIP8_H
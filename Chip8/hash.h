@@ -0,0 +1,22 @@
+#ifndef CHIP8_HASH_H
+#define CHIP8_HASH_H
+
+#include <cstdint>
+#include <cstddef>
+
+// 64-bit FNV-1a, used for ROM identity and state checkpoints.
+// Chain calls by passing the previous result as `hash`.
+constexpr uint64_t FNV1A64_OFFSET = 0xCBF29CE484222325ULL;
+constexpr uint64_t FNV1A64_PRIME = 0x100000001B3ULL;
+
+inline uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = FNV1A64_OFFSET)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= FNV1A64_PRIME;
+	}
+	return hash;
+}
+
+#endif // CHIP8_HASH_H
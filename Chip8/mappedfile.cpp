@@ -0,0 +1,177 @@
+#include "mappedfile.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+
+#ifdef _WIN32
+
+NativePath native_path(const string& utf8Path)
+{
+	int length = MultiByteToWideChar(CP_UTF8, 0, utf8Path.data(), static_cast<int>(utf8Path.size()), nullptr, 0);
+	wstring widePath(length, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, utf8Path.data(), static_cast<int>(utf8Path.size()), &widePath[0], length);
+	return widePath;
+}
+
+NativePath native_path(const wstring& widePath)
+{
+	return widePath;
+}
+
+string utf8_path(const wstring& widePath)
+{
+	int length = WideCharToMultiByte(CP_UTF8, 0, widePath.data(), static_cast<int>(widePath.size()), nullptr, 0, nullptr, nullptr);
+	string utf8Path(length, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, widePath.data(), static_cast<int>(widePath.size()), &utf8Path[0], length, nullptr, nullptr);
+	return utf8Path;
+}
+
+MappedFile::MappedFile() : _file(INVALID_HANDLE_VALUE), _mapping(nullptr), _size(0), _data(nullptr)
+{}
+
+bool MappedFile::open(const NativePath& path)
+{
+	close();
+	_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size)) {
+		close();
+		return false;
+	}
+	_size = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+bool MappedFile::map()
+{
+	if (_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	if (_data || _size == 0) {
+		return true;
+	}
+	_mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!_mapping) {
+		return false;
+	}
+	_data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, _size));
+	return _data != nullptr;
+}
+
+void MappedFile::close()
+{
+	if (_data) {
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping) {
+		CloseHandle(_mapping);
+	}
+	if (_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(_file);
+	}
+	_file = INVALID_HANDLE_VALUE;
+	_mapping = nullptr;
+	_size = 0;
+	_data = nullptr;
+}
+
+#else
+
+NativePath native_path(const string& utf8Path)
+{
+	return utf8Path;
+}
+
+NativePath native_path(const wstring& widePath)
+{
+	return utf8_path(widePath);
+}
+
+// wchar_t holds UTF-32 here
+string utf8_path(const wstring& widePath)
+{
+	string utf8Path;
+	for (wchar_t c : widePath) {
+		uint32_t codePoint = static_cast<uint32_t>(c);
+		if (codePoint < 0x80) {
+			utf8Path += static_cast<char>(codePoint);
+		}
+		else if (codePoint < 0x800) {
+			utf8Path += static_cast<char>(0xC0 | codePoint >> 6);
+			utf8Path += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+		else if (codePoint < 0x10000) {
+			utf8Path += static_cast<char>(0xE0 | codePoint >> 12);
+			utf8Path += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+			utf8Path += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+		else {
+			utf8Path += static_cast<char>(0xF0 | codePoint >> 18);
+			utf8Path += static_cast<char>(0x80 | (codePoint >> 12 & 0x3F));
+			utf8Path += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+			utf8Path += static_cast<char>(0x80 | (codePoint & 0x3F));
+		}
+	}
+	return utf8Path;
+}
+
+MappedFile::MappedFile() : _descriptor(-1), _size(0), _data(nullptr)
+{}
+
+bool MappedFile::open(const NativePath& path)
+{
+	close();
+	_descriptor = ::open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if (_descriptor < 0 || fstat(_descriptor, &status) != 0 || !S_ISREG(status.st_mode)) {
+		close();
+		return false;
+	}
+	_size = static_cast<size_t>(status.st_size);
+	return true;
+}
+
+bool MappedFile::map()
+{
+	if (_descriptor < 0) {
+		return false;
+	}
+	if (_data || _size == 0) {
+		return true;
+	}
+	void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _descriptor, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	_data = static_cast<const uint8_t*>(data);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data) {
+		munmap(const_cast<uint8_t*>(_data), _size);
+	}
+	if (_descriptor >= 0) {
+		::close(_descriptor);
+	}
+	_descriptor = -1;
+	_size = 0;
+	_data = nullptr;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
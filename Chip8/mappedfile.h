@@ -0,0 +1,45 @@
+#ifndef CHIP8_MAPPED_FILE_H
+#define CHIP8_MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// File names the way the OS takes them: UTF-16 on Windows, UTF-8 bytes everywhere else.
+#ifdef _WIN32
+typedef std::wstring NativePath;
+#else
+typedef std::string NativePath;
+#endif
+
+NativePath native_path(const std::string& utf8Path);
+NativePath native_path(const std::wstring& widePath);
+// For messages; the reverse of native_path(const std::string&).
+std::string utf8_path(const std::wstring& widePath);
+
+// Read-only view of a whole file. open() only learns the size, so a caller can turn a file down
+// before anything is mapped or read.
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator= (const MappedFile&) = delete;
+	bool open(const NativePath& path);
+	// Maps the whole file after open(). An empty file maps to an empty view without data.
+	bool map();
+	void close();
+	size_t get_size() const { return _size; }
+	const uint8_t* get_data() const { return _data; }
+private:
+#ifdef _WIN32
+	void* _file;
+	void* _mapping;
+#else
+	int _descriptor;
+#endif
+	size_t _size;
+	const uint8_t* _data;
+};
+
+#endif // CHIP8_MAPPED_FILE_H
@@ -0,0 +1,301 @@
+#include "movie.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+using std::ifstream;
+using std::ofstream;
+using std::cerr;
+using std::endl;
+
+namespace {
+
+const char MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+const uint32_t MOVIE_VERSION = 1;
+
+void put_u16(vector<uint8_t>& out, uint16_t value)
+{
+	out.push_back(static_cast<uint8_t>(value));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void put_u32(vector<uint8_t>& out, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i) {
+		out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+}
+
+void put_u64(vector<uint8_t>& out, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i) {
+		out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+}
+
+void put_varint(vector<uint8_t>& out, uint32_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+class Reader {
+public:
+	Reader(const vector<uint8_t>& data) : _data(data), _pos(0), _ok(true)
+	{}
+	bool ok() const { return _ok; }
+	uint64_t get(int bytes)
+	{
+		if (_pos + bytes > _data.size()) {
+			_ok = false;
+			return 0;
+		}
+		uint64_t value = 0;
+		for (int i = 0; i < bytes; ++i) {
+			value |= static_cast<uint64_t>(_data[_pos++]) << (i * 8);
+		}
+		return value;
+	}
+	uint32_t get_varint()
+	{
+		uint32_t value = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			uint8_t byte = static_cast<uint8_t>(get(1));
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) {
+				return value;
+			}
+		}
+		_ok = false;
+		return 0;
+	}
+private:
+	const vector<uint8_t>& _data;
+	size_t _pos;
+	bool _ok;
+};
+
+}
+
+bool Movie::save(const wstring& path) const
+{
+	return save_file(native_path(path), utf8_path(path));
+}
+
+bool Movie::save(const string& path) const
+{
+	return save_file(native_path(path), path);
+}
+
+bool Movie::load(const wstring& path)
+{
+	return load_file(native_path(path), utf8_path(path));
+}
+
+bool Movie::load(const string& path)
+{
+	return load_file(native_path(path), path);
+}
+
+bool Movie::save_file(const NativePath& path, const string& name) const
+{
+	vector<uint8_t> out(MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+	put_u32(out, MOVIE_VERSION);
+	put_u64(out, romHash);
+	put_u32(out, seed);
+	put_u32(out, quirks.to_bits());
+	put_u32(out, static_cast<uint32_t>(instructionsPerFrame));
+	put_u32(out, frameCount);
+	put_u32(out, CHECKPOINT_INTERVAL);
+	put_u32(out, static_cast<uint32_t>(inputs.size()));
+	put_u32(out, static_cast<uint32_t>(checkpoints.size()));
+	put_u64(out, finalHash);
+
+	uint32_t frame = 0;
+	for (const MovieInput& input : inputs) {
+		put_varint(out, input.frame - frame);
+		put_varint(out, input.offset);
+		put_u16(out, input.toggled);
+		frame = input.frame;
+	}
+	for (uint64_t checkpoint : checkpoints) {
+		put_u64(out, checkpoint);
+	}
+
+	ofstream ofs;
+	ofs.open(path, ofstream::binary);
+	if (!ofs.is_open()) {
+		cerr << "Open: " << name << " error" << endl;
+		return false;
+	}
+	ofs.write(reinterpret_cast<const char*>(out.data()), out.size());
+	return ofs.good();
+}
+
+bool Movie::load_file(const NativePath& path, const string& name)
+{
+	ifstream ifs;
+	ifs.open(path, ifstream::binary);
+	if (!ifs.is_open()) {
+		cerr << "Open: " << name << " error" << endl;
+		return false;
+	}
+	vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+	Reader reader(data);
+	bool isMovie = data.size() >= sizeof(MOVIE_MAGIC) && std::equal(MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC), data.begin());
+	reader.get(sizeof(MOVIE_MAGIC));
+	if (!isMovie || reader.get(4) != MOVIE_VERSION) {
+		cerr << name << " is not a movie file" << endl;
+		return false;
+	}
+	romHash = reader.get(8);
+	seed = static_cast<uint32_t>(reader.get(4));
+	uint32_t quirkFlags = static_cast<uint32_t>(reader.get(4));
+	quirks = Chip8Quirks::from_bits(static_cast<uint8_t>(quirkFlags));
+	instructionsPerFrame = static_cast<int>(reader.get(4));
+	frameCount = static_cast<uint32_t>(reader.get(4));
+	uint32_t checkpointInterval = static_cast<uint32_t>(reader.get(4));
+	uint32_t inputCount = static_cast<uint32_t>(reader.get(4));
+	uint32_t checkpointCount = static_cast<uint32_t>(reader.get(4));
+	finalHash = reader.get(8);
+	if (!reader.ok() || checkpointInterval != CHECKPOINT_INTERVAL || inputCount > data.size()
+		|| instructionsPerFrame < 1 || instructionsPerFrame > MAX_INSTRUCTIONS_PER_FRAME
+		|| checkpointCount > frameCount / CHECKPOINT_INTERVAL) {
+		cerr << name << " has a broken header" << endl;
+		return false;
+	}
+
+	inputs.clear();
+	inputs.reserve(inputCount);
+	uint32_t frame = 0;
+	for (uint32_t i = 0; i < inputCount && reader.ok(); ++i) {
+		MovieInput input;
+		frame += reader.get_varint();
+		input.frame = frame;
+		input.offset = static_cast<uint16_t>(reader.get_varint());
+		input.toggled = static_cast<uint16_t>(reader.get(2));
+		inputs.push_back(input);
+	}
+	checkpoints.clear();
+	for (uint32_t i = 0; i < checkpointCount && reader.ok(); ++i) {
+		checkpoints.push_back(reader.get(8));
+	}
+	if (!reader.ok()) {
+		cerr << name << " is truncated" << endl;
+		return false;
+	}
+	return true;
+}
+
+MovieRecorder::MovieRecorder() : _chip8(nullptr), _startCycle(0), _keys(0)
+{}
+
+bool MovieRecorder::start(Chip8& chip8, uint32_t seed)
+{
+	if (chip8.get_instructions_per_frame() > Movie::MAX_INSTRUCTIONS_PER_FRAME) {
+		return false;
+	}
+	_chip8 = &chip8;
+	_movie = Movie();
+	_movie.romHash = chip8.get_rom_hash();
+	_movie.seed = seed;
+	_movie.quirks = chip8.get_quirks();
+	_movie.instructionsPerFrame = chip8.get_instructions_per_frame();
+	_edges.clear();
+	_startCycle = chip8.get_ticks();
+	_keys = 0;
+	chip8.set_seed(seed);
+	chip8.log_key_events(&_edges);
+	return true;
+}
+
+void MovieRecorder::end_frame()
+{
+	if (!_chip8) {
+		return;
+	}
+	for (const Chip8KeyEvent& edge : _edges) {
+		uint16_t bit = static_cast<uint16_t>(1 << edge.key);
+		if (((_keys & bit) != 0) == edge.down) {
+			continue;
+		}
+		_keys ^= bit;
+		uint64_t cycle = edge.cycle - _startCycle;
+		uint32_t frame = static_cast<uint32_t>(cycle / _movie.instructionsPerFrame);
+		uint16_t offset = static_cast<uint16_t>(cycle % _movie.instructionsPerFrame);
+		if (!_movie.inputs.empty() && _movie.inputs.back().frame == frame && _movie.inputs.back().offset == offset) {
+			_movie.inputs.back().toggled ^= bit;
+		}
+		else {
+			_movie.inputs.push_back({ frame, offset, bit });
+		}
+	}
+	_edges.clear();
+
+	++_movie.frameCount;
+	if (_movie.frameCount % Movie::CHECKPOINT_INTERVAL == 0) {
+		_movie.checkpoints.push_back(_chip8->state_hash());
+	}
+}
+
+const Movie& MovieRecorder::stop()
+{
+	if (_chip8) {
+		_movie.finalHash = _chip8->state_hash();
+		_chip8->log_key_events(nullptr);
+		_chip8 = nullptr;
+	}
+	return _movie;
+}
+
+bool replay_movie(const Movie& movie, Chip8& chip8, MovieReplayResult& result)
+{
+	result = MovieReplayResult();
+	if (chip8.get_rom_hash() != movie.romHash) {
+		return false;
+	}
+	chip8.set_seed(movie.seed);
+	chip8.set_quirks(movie.quirks);
+	chip8.set_instructions_per_frame(movie.instructionsPerFrame);
+
+	uint16_t keys = 0;
+	size_t next = 0;
+	size_t checkpoint = 0;
+	for (uint32_t frame = 0; frame < movie.frameCount; ++frame) {
+		uint64_t frameStart = chip8.get_ticks();
+		for (; next < movie.inputs.size() && movie.inputs[next].frame == frame; ++next) {
+			const MovieInput& input = movie.inputs[next];
+			for (int key = 0; key < Chip8::KEYPAD_COUNT; ++key) {
+				if (input.toggled & (1 << key)) {
+					keys ^= 1 << key;
+					// an edge dropped here would make the rest of the replay differ from the recording
+					if (!chip8.queue_key_event(key, (keys & (1 << key)) != 0, frameStart + input.offset)) {
+						result.overflowFrame = frame;
+						return false;
+					}
+				}
+			}
+		}
+		chip8.run_frame();
+		++result.framesRun;
+
+		if ((frame + 1) % Movie::CHECKPOINT_INTERVAL == 0 && checkpoint < movie.checkpoints.size()) {
+			if (chip8.state_hash() != movie.checkpoints[checkpoint++]) {
+				result.desyncFrame = frame;
+				return false;
+			}
+			++result.checkpointsVerified;
+		}
+	}
+	result.finalHash = chip8.state_hash();
+	if (result.finalHash != movie.finalHash) {
+		result.desyncFrame = movie.frameCount;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,86 @@
+#ifndef CHIP8_MOVIE_H
+#define CHIP8_MOVIE_H
+
+#include "chip8.h"
+#include <cstdint>
+#include <vector>
+#include <string>
+
+// The keys set in `toggled` flip state right before instruction `offset` of `frame`.
+struct MovieInput {
+	uint32_t frame;
+	uint16_t offset;
+	uint16_t toggled;
+};
+
+// Everything needed to replay a session bit for bit: the starting conditions, every keypad edge
+// and a state hash every CHECKPOINT_INTERVAL frames to verify the replay against.
+// Stored as a small header followed by varint frame deltas and 16-bit key mask deltas.
+struct Movie {
+	Movie() : romHash(0), seed(0), quirks(), instructionsPerFrame(Chip8::DEFAULT_INSTRUCTIONS_PER_FRAME),
+		frameCount(0), finalHash(0)
+	{}
+	static constexpr uint32_t CHECKPOINT_INTERVAL = 60;
+	// inputs store their instruction offset within the frame in 16 bits
+	static constexpr int MAX_INSTRUCTIONS_PER_FRAME = 65535;
+
+	bool save(const wstring& path) const;
+	bool load(const wstring& path);
+	// UTF-8 paths
+	bool save(const string& path) const;
+	bool load(const string& path);
+
+	uint64_t romHash;
+	uint32_t seed;
+	Chip8Quirks quirks;
+	int instructionsPerFrame;
+	uint32_t frameCount;
+	vector<MovieInput> inputs;
+	// checkpoints[i] is the state hash after frame (i + 1) * CHECKPOINT_INTERVAL
+	vector<uint64_t> checkpoints;
+	uint64_t finalHash;
+private:
+	bool save_file(const NativePath& path, const string& name) const;
+	bool load_file(const NativePath& path, const string& name);
+};
+
+class MovieRecorder {
+public:
+	MovieRecorder();
+	MovieRecorder(const MovieRecorder&) = delete;
+	MovieRecorder& operator= (const MovieRecorder&) = delete;
+	// chip8 must hold a freshly loaded ROM. Seeds its generator and starts logging its key edges.
+	// Returns false, without recording, when chip8 runs more than Movie::MAX_INSTRUCTIONS_PER_FRAME per frame.
+	bool start(Chip8& chip8, uint32_t seed);
+	// Call after every Chip8::run_frame() while recording.
+	void end_frame();
+	// Detaches from the core; the movie stays valid until the next start().
+	const Movie& stop();
+	bool is_recording() const { return _chip8 != nullptr; }
+private:
+	Chip8* _chip8;
+	Movie _movie;
+	vector<Chip8KeyEvent> _edges;
+	uint64_t _startCycle;
+	uint16_t _keys;
+};
+
+struct MovieReplayResult {
+	MovieReplayResult() : framesRun(0), checkpointsVerified(0), desyncFrame(-1), overflowFrame(-1), finalHash(0)
+	{}
+	uint32_t framesRun;
+	uint32_t checkpointsVerified;
+	// first frame whose state hash did not match, -1 when none
+	int64_t desyncFrame;
+	// frame with more key edges than Chip8::KEY_EVENT_CAPACITY, where the replay stopped; -1 when none
+	int64_t overflowFrame;
+	uint64_t finalHash;
+};
+
+// Runs chip8, which must hold the movie's ROM freshly loaded, through the whole movie as fast as it can,
+// without pacing or rendering. Stops at the first checkpoint mismatch.
+// Returns false when the ROM differs from the recorded one, a frame holds more edges than the key queue
+// takes, or the replay desynced.
+bool replay_movie(const Movie& movie, Chip8& chip8, MovieReplayResult& result);
+
+#endif // CHIP8_MOVIE_H
@@ -0,0 +1,230 @@
+#include "romarchive.h"
+#include "hash.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+using std::cerr;
+using std::endl;
+using std::ofstream;
+
+namespace {
+
+const char ROM_ARCHIVE_MAGIC[4] = { 'C', '8', 'P', 'K' };
+
+static_assert(sizeof(RomArchiveHeader) == 32, "RomArchiveHeader is read in place and must not change size");
+static_assert(sizeof(RomArchiveEntry) == 32, "RomArchiveEntry is read in place and must not change size");
+
+// Orders like std::string::compare, so the writer's sort and the reader's search agree.
+int compare_name(const char* name, size_t length, const string& other)
+{
+	int result = std::memcmp(name, other.data(), std::min(length, other.size()));
+	if (result != 0) {
+		return result;
+	}
+	return length < other.size() ? -1 : length > other.size() ? 1 : 0;
+}
+
+}
+
+constexpr uint32_t RomArchive::VERSION;
+constexpr uint32_t RomArchive::BYTE_ORDER_MARK;
+
+RomArchive::RomArchive() : _header(nullptr), _entries(nullptr), _nameIndex(nullptr), _names(nullptr)
+{}
+
+bool RomArchive::fail(const string& path, const char* reason)
+{
+	close();
+	cerr << "Archive: " << path << ": " << reason << endl;
+	return false;
+}
+
+bool RomArchive::open(const string& path)
+{
+	close();
+	if (!_file.open(native_path(path)) || !_file.map()) {
+		return fail(path, "cannot open");
+	}
+	uint64_t fileSize = _file.get_size();
+	const uint8_t* base = _file.get_data();
+	if (fileSize < sizeof(RomArchiveHeader)) {
+		return fail(path, "not an archive");
+	}
+	const RomArchiveHeader* header = reinterpret_cast<const RomArchiveHeader*>(base);
+	if (!std::equal(header->magic, header->magic + sizeof(header->magic), ROM_ARCHIVE_MAGIC)) {
+		return fail(path, "not an archive");
+	}
+	if (header->byteOrder == 0x04030201) {
+		return fail(path, "packed on a machine of the other byte order");
+	}
+	if (header->version != VERSION || header->byteOrder != BYTE_ORDER_MARK) {
+		return fail(path, "unsupported version");
+	}
+	uint64_t count = header->entryCount;
+	if (sizeof(RomArchiveHeader) + count * sizeof(RomArchiveEntry) > fileSize
+		|| header->nameIndexOffset % sizeof(uint32_t) != 0
+		|| header->nameIndexOffset + count * sizeof(uint32_t) > fileSize
+		|| static_cast<uint64_t>(header->namesOffset) + header->namesSize > fileSize) {
+		return fail(path, "tables out of bounds");
+	}
+	const RomArchiveEntry* entries = reinterpret_cast<const RomArchiveEntry*>(base + sizeof(RomArchiveHeader));
+	const uint32_t* nameIndex = reinterpret_cast<const uint32_t*>(base + header->nameIndexOffset);
+	for (uint64_t i = 0; i < count; ++i) {
+		const RomArchiveEntry& entry = entries[i];
+		if (static_cast<uint64_t>(entry.offset) + entry.size > fileSize
+			|| static_cast<uint64_t>(entry.nameOffset) + entry.nameLength > header->namesSize
+			|| nameIndex[i] >= count) {
+			return fail(path, "entry out of bounds");
+		}
+		if (i > 0 && entries[i - 1].hash >= entry.hash) {
+			return fail(path, "hash index not sorted");
+		}
+	}
+	_header = header;
+	_entries = entries;
+	_nameIndex = nameIndex;
+	_names = reinterpret_cast<const char*>(base + header->namesOffset);
+	return true;
+}
+
+void RomArchive::close()
+{
+	_file.close();
+	_header = nullptr;
+	_entries = nullptr;
+	_nameIndex = nullptr;
+	_names = nullptr;
+}
+
+const RomArchiveEntry* RomArchive::find(uint64_t hash) const
+{
+	const RomArchiveEntry* end = _entries + get_entry_count();
+	const RomArchiveEntry* entry = std::lower_bound(_entries, end, hash,
+		[](const RomArchiveEntry& entry, uint64_t hash) { return entry.hash < hash; });
+	return entry != end && entry->hash == hash ? entry : nullptr;
+}
+
+const RomArchiveEntry* RomArchive::find(const string& name) const
+{
+	const uint32_t* end = _nameIndex + get_entry_count();
+	const uint32_t* index = std::lower_bound(_nameIndex, end, name, [this](uint32_t index, const string& name) {
+		return compare_name(_names + _entries[index].nameOffset, _entries[index].nameLength, name) < 0;
+	});
+	if (index == end) {
+		return nullptr;
+	}
+	const RomArchiveEntry& entry = _entries[*index];
+	return compare_name(_names + entry.nameOffset, entry.nameLength, name) == 0 ? &entry : nullptr;
+}
+
+string RomArchive::get_name(const RomArchiveEntry& entry) const
+{
+	return string(_names + entry.nameOffset, entry.nameLength);
+}
+
+RomArchiveMetadata RomArchive::get_metadata(const RomArchiveEntry& entry) const
+{
+	RomArchiveMetadata metadata;
+	metadata.flags = entry.flags;
+	metadata.quirks = Chip8Quirks::from_bits(entry.quirks);
+	metadata.instructionsPerFrame = entry.instructionsPerFrame;
+	return metadata;
+}
+
+bool RomArchive::load(const RomArchiveEntry& entry, Chip8& chip8) const
+{
+	if (!chip8.load_rom_from_memory(get_rom(entry), entry.size)) {
+		return false;
+	}
+	RomArchiveMetadata metadata = get_metadata(entry);
+	if (metadata.flags & ROM_ARCHIVE_HAS_QUIRKS) {
+		chip8.set_quirks(metadata.quirks);
+	}
+	if (metadata.flags & ROM_ARCHIVE_HAS_INSTRUCTIONS_PER_FRAME) {
+		chip8.set_instructions_per_frame(metadata.instructionsPerFrame);
+	}
+	return true;
+}
+
+bool RomArchiveWriter::add(const string& name, const uint8_t* data, size_t size, const RomArchiveMetadata& metadata)
+{
+	if (size > static_cast<size_t>(Chip8::MAX_ROM_SIZE) || name.size() > UINT16_MAX) {
+		return false;
+	}
+	uint64_t hash = fnv1a64(data, size);
+	if (!_hashes.insert(hash).second) {
+		return false;
+	}
+	Rom rom;
+	rom.name = name;
+	rom.hash = hash;
+	rom.data.assign(data, data + size);
+	rom.metadata = metadata;
+	_roms.push_back(rom);
+	return true;
+}
+
+bool RomArchiveWriter::write(const string& path) const
+{
+	vector<const Rom*> byHash;
+	for (const Rom& rom : _roms) {
+		byHash.push_back(&rom);
+	}
+	std::sort(byHash.begin(), byHash.end(), [](const Rom* a, const Rom* b) { return a->hash < b->hash; });
+	vector<uint32_t> nameIndex(byHash.size());
+	for (uint32_t i = 0; i < nameIndex.size(); ++i) {
+		nameIndex[i] = i;
+	}
+	std::sort(nameIndex.begin(), nameIndex.end(),
+		[&byHash](uint32_t a, uint32_t b) { return byHash[a]->name < byHash[b]->name; });
+
+	uint32_t count = static_cast<uint32_t>(byHash.size());
+	RomArchiveHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::copy(ROM_ARCHIVE_MAGIC, ROM_ARCHIVE_MAGIC + 4, header.magic);
+	header.version = RomArchive::VERSION;
+	header.byteOrder = RomArchive::BYTE_ORDER_MARK;
+	header.entryCount = count;
+	header.nameIndexOffset = static_cast<uint32_t>(sizeof(RomArchiveHeader) + count * sizeof(RomArchiveEntry));
+	header.namesOffset = header.nameIndexOffset + count * sizeof(uint32_t);
+	for (const Rom* rom : byHash) {
+		header.namesSize += static_cast<uint32_t>(rom->name.size());
+	}
+	header.dataOffset = (header.namesOffset + header.namesSize + 15) & ~15u;
+
+	vector<RomArchiveEntry> entries(count);
+	string names;
+	uint32_t offset = header.dataOffset;
+	for (uint32_t i = 0; i < count; ++i) {
+		const Rom& rom = *byHash[i];
+		RomArchiveEntry& entry = entries[i];
+		std::memset(&entry, 0, sizeof(entry));
+		entry.hash = rom.hash;
+		entry.offset = offset;
+		entry.size = static_cast<uint32_t>(rom.data.size());
+		entry.nameOffset = static_cast<uint32_t>(names.size());
+		entry.nameLength = static_cast<uint16_t>(rom.name.size());
+		entry.flags = rom.metadata.flags;
+		entry.quirks = rom.metadata.quirks.to_bits();
+		entry.instructionsPerFrame = static_cast<uint16_t>(rom.metadata.instructionsPerFrame);
+		names += rom.name;
+		offset += entry.size;
+	}
+
+	ofstream ofs(native_path(path), ofstream::binary);
+	if (!ofs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofs.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(RomArchiveEntry));
+	ofs.write(reinterpret_cast<const char*>(nameIndex.data()), nameIndex.size() * sizeof(uint32_t));
+	ofs.write(names.data(), names.size());
+	ofs.write("\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", header.dataOffset - header.namesOffset - header.namesSize);
+	for (const Rom* rom : byHash) {
+		ofs.write(reinterpret_cast<const char*>(rom->data.data()), rom->data.size());
+	}
+	return ofs.good();
+}
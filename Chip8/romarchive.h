@@ -0,0 +1,112 @@
+#ifndef CHIP8_ROM_ARCHIVE_H
+#define CHIP8_ROM_ARCHIVE_H
+
+#include "chip8.h"
+#include "mappedfile.h"
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+// A corpus of ROMs in one file for the batch tools, read in place from a mapping:
+//   RomArchiveHeader
+//   RomArchiveEntry[entryCount]   sorted by hash, for binary search
+//   uint32_t[entryCount]          entry indices sorted by name
+//   names                         not terminated, see RomArchiveEntry::nameOffset
+//   ROM images
+// Fields are in the byte order of the machine that packed the archive, offsets count from the start of the file.
+struct RomArchiveHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t nameIndexOffset;
+	uint32_t namesOffset;
+	uint32_t namesSize;
+	uint32_t dataOffset;
+	// RomArchive::BYTE_ORDER_MARK as the packer stored it; an archive from a machine of the other order is refused
+	uint32_t byteOrder;
+};
+
+enum RomArchiveFlags : uint8_t {
+	ROM_ARCHIVE_HAS_QUIRKS = 1 << 0,
+	ROM_ARCHIVE_HAS_INSTRUCTIONS_PER_FRAME = 1 << 1
+};
+
+// Quirk bits as in the movie format: 0 resetVF, 1 setVXtoVY, 2 increamentI.
+struct RomArchiveEntry {
+	// fnv1a64 of the image, the same as Chip8::get_rom_hash() after loading it
+	uint64_t hash;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t nameOffset;
+	uint16_t nameLength;
+	uint16_t instructionsPerFrame;
+	uint8_t quirks;
+	uint8_t flags;
+	uint8_t reserved[6];
+};
+
+// What the packer stores along with a ROM; fields only count when their flag is set.
+struct RomArchiveMetadata {
+	RomArchiveMetadata() : flags(0), quirks(), instructionsPerFrame(0)
+	{}
+	uint8_t flags;
+	Chip8Quirks quirks;
+	int instructionsPerFrame;
+};
+
+class RomArchive {
+public:
+	static constexpr uint32_t VERSION = 3;
+	static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+	RomArchive();
+	RomArchive(const RomArchive&) = delete;
+	RomArchive& operator= (const RomArchive&) = delete;
+	// Maps the archive and checks every table lies inside the file, so lookups need no checks later.
+	bool open(const string& path);
+	void close();
+	bool is_open() const { return _header != nullptr; }
+
+	size_t get_entry_count() const { return _header ? _header->entryCount : 0; }
+	// in hash order
+	const RomArchiveEntry& get_entry(size_t index) const { return _entries[index]; }
+	// Both binary searches; nullptr when the archive has no such ROM.
+	const RomArchiveEntry* find(uint64_t hash) const;
+	const RomArchiveEntry* find(const string& name) const;
+	string get_name(const RomArchiveEntry& entry) const;
+	// points into the mapping, valid until close()
+	const uint8_t* get_rom(const RomArchiveEntry& entry) const { return _file.get_data() + entry.offset; }
+	RomArchiveMetadata get_metadata(const RomArchiveEntry& entry) const;
+	// Loads the image straight from the mapping and applies the stored quirks and instructions per frame.
+	bool load(const RomArchiveEntry& entry, Chip8& chip8) const;
+private:
+	bool fail(const string& path, const char* reason);
+
+	MappedFile _file;
+	const RomArchiveHeader* _header;
+	const RomArchiveEntry* _entries;
+	const uint32_t* _nameIndex;
+	const char* _names;
+};
+
+// Collects ROMs in memory and writes them as one archive. Images with the same hash are stored once,
+// under the name added first.
+class RomArchiveWriter {
+public:
+	// false when the image is a duplicate or too large to ever load
+	bool add(const string& name, const uint8_t* data, size_t size, const RomArchiveMetadata& metadata);
+	size_t get_rom_count() const { return _roms.size(); }
+	bool write(const string& path) const;
+private:
+	struct Rom {
+		string name;
+		uint64_t hash;
+		vector<uint8_t> data;
+		RomArchiveMetadata metadata;
+	};
+	vector<Rom> _roms;
+	std::set<uint64_t> _hashes;
+};
+
+#endif // CHIP8_ROM_ARCHIVE_H
@@ -0,0 +1,153 @@
+#include "romdb.h"
+#include "hash.h"
+#include "romdb_table.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+using std::cerr;
+using std::endl;
+
+namespace {
+
+constexpr uint32_t ROM_PROFILE_SLOTS = 1u << ROM_PROFILE_SLOT_BITS;
+
+static_assert(sizeof(ROM_PROFILES) / sizeof(ROM_PROFILES[0]) == ROM_PROFILE_SLOTS,
+	"romdb_table.h must have one entry per slot");
+
+// Every known ROM has to sit in the slot its hash maps to, or find() would miss it.
+constexpr bool is_perfect(uint32_t slot)
+{
+	return slot == ROM_PROFILE_SLOTS
+		|| ((ROM_PROFILES[slot].hash == 0
+			|| rom_profile_slot(ROM_PROFILES[slot].hash, ROM_PROFILE_SEED, ROM_PROFILE_SLOT_BITS) == slot)
+			&& is_perfect(slot + 1));
+}
+
+static_assert(is_perfect(0), "romdb_table.h is stale, regenerate it with chip8romdb --generate");
+
+bool parse_quirks(const string& value, uint8_t& quirks)
+{
+	quirks = 0;
+	if (value == "none") {
+		return true;
+	}
+	std::istringstream names(value);
+	string name;
+	while (std::getline(names, name, '+')) {
+		if (name == "resetVF") {
+			quirks |= 1;
+		}
+		else if (name == "setVXtoVY") {
+			quirks |= 2;
+		}
+		else if (name == "incrementI") {
+			quirks |= 4;
+		}
+		else {
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+Chip8Quirks get_rom_profile_quirks(const RomProfile& profile)
+{
+	return Chip8Quirks::from_bits(profile.quirks);
+}
+
+void apply_rom_profile(const RomProfile& profile, Chip8& chip8)
+{
+	if (profile.flags & ROM_PROFILE_HAS_QUIRKS) {
+		chip8.set_quirks(get_rom_profile_quirks(profile));
+	}
+	if (profile.flags & ROM_PROFILE_HAS_INSTRUCTIONS_PER_FRAME) {
+		chip8.set_instructions_per_frame(profile.instructionsPerFrame);
+	}
+}
+
+bool RomDatabase::read_profiles(std::istream& in, const string& source, vector<RomProfile>& profiles, std::deque<string>& names)
+{
+	string line;
+	for (int number = 1; std::getline(in, line); ++number) {
+		std::istringstream fields(line);
+		string hash, name, field;
+		if (!(fields >> hash) || hash[0] == '#') {
+			continue;
+		}
+		RomProfile profile = {};
+		char* end = nullptr;
+		profile.hash = std::strtoull(hash.c_str(), &end, 16);
+		bool ok = hash.size() == 16 && *end == '\0' && profile.hash != 0 && (fields >> name);
+		while (ok && fields >> field) {
+			size_t equals = field.find('=');
+			string key = field.substr(0, equals), value = equals == string::npos ? "" : field.substr(equals + 1);
+			if (key == "quirks") {
+				ok = parse_quirks(value, profile.quirks);
+				profile.flags |= ROM_PROFILE_HAS_QUIRKS;
+			}
+			else if (key == "ipf") {
+				int instructionsPerFrame = std::atoi(value.c_str());
+				ok = instructionsPerFrame > 0 && instructionsPerFrame <= UINT16_MAX;
+				profile.instructionsPerFrame = static_cast<uint16_t>(instructionsPerFrame);
+				profile.flags |= ROM_PROFILE_HAS_INSTRUCTIONS_PER_FRAME;
+			}
+			else if (key == "antiflicker") {
+				ok = value == "on" || value == "off";
+				profile.antiFlicker = value == "on";
+				profile.flags |= ROM_PROFILE_HAS_ANTI_FLICKER;
+			}
+			else {
+				ok = false;
+			}
+		}
+		if (!ok) {
+			cerr << source << ":" << number << ": bad profile" << endl;
+			return false;
+		}
+		names.push_back(name);
+		profile.name = names.back().c_str();
+		profiles.push_back(profile);
+	}
+	return true;
+}
+
+bool RomDatabase::load_overrides(const string& path)
+{
+	std::ifstream ifs(native_path(path));
+	if (!ifs.is_open()) {
+		return false;
+	}
+	vector<RomProfile> profiles;
+	if (!read_profiles(ifs, path, profiles, _names)) {
+		return false;
+	}
+	for (const RomProfile& profile : profiles) {
+		_overrides[profile.hash] = profile;
+	}
+	return true;
+}
+
+const RomProfile* RomDatabase::find(uint64_t hash) const
+{
+	if (!_overrides.empty()) {
+		auto entry = _overrides.find(hash);
+		if (entry != _overrides.end()) {
+			return &entry->second;
+		}
+	}
+	const RomProfile& profile = ROM_PROFILES[rom_profile_slot(hash, ROM_PROFILE_SEED, ROM_PROFILE_SLOT_BITS)];
+	return hash != 0 && profile.hash == hash ? &profile : nullptr;
+}
+
+const RomProfile* RomDatabase::find_file(const NativePath& path) const
+{
+	MappedFile file;
+	if (!file.open(path) || !file.map()) {
+		return nullptr;
+	}
+	return find(fnv1a64(file.get_data(), file.get_size()));
+}
@@ -0,0 +1,64 @@
+#ifndef CHIP8_ROMDB_H
+#define CHIP8_ROMDB_H
+
+#include "chip8.h"
+#include "mappedfile.h"
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum RomProfileFlags : uint8_t {
+	ROM_PROFILE_HAS_QUIRKS = 1 << 0,
+	ROM_PROFILE_HAS_INSTRUCTIONS_PER_FRAME = 1 << 1,
+	ROM_PROFILE_HAS_ANTI_FLICKER = 1 << 2
+};
+
+// Settings a ROM is known to need, keyed by Chip8::get_rom_hash(). Only the fields whose flag is set apply,
+// everything else stays as the user set it.
+struct RomProfile {
+	uint64_t hash;
+	const char* name;
+	uint8_t flags;
+	// bit 0 resetVF, bit 1 setVXtoVY, bit 2 increamentI
+	uint8_t quirks;
+	uint16_t instructionsPerFrame;
+	// the frontend's flicker filter, see CompositorMode
+	bool antiFlicker;
+};
+
+// Slot of a hash in the built-in table: a multiplicative hash of the ROM hash mixed with a seed that
+// chip8romdb --generate picked so that no two known ROMs share a slot.
+constexpr uint32_t rom_profile_slot(uint64_t hash, uint64_t seed, int slotBits)
+{
+	return static_cast<uint32_t>(((hash ^ seed) * 0x9E3779B97F4A7C15ULL) >> (64 - slotBits));
+}
+
+Chip8Quirks get_rom_profile_quirks(const RomProfile& profile);
+// Sets the quirks and instructions per frame the profile has; display settings are the frontend's.
+void apply_rom_profile(const RomProfile& profile, Chip8& chip8);
+
+// The profiles compiled in from ROM/romdb.txt, optionally overridden by a file in the same format.
+// A lookup is one probe of the built-in table, plus a hash map probe once overrides are loaded.
+class RomDatabase {
+public:
+	// Adds the profiles of a file, replacing built-in ones with the same hash.
+	// Returns false, without a message, when the file cannot be opened, since an override file is optional.
+	bool load_overrides(const string& path);
+	const RomProfile* find(uint64_t hash) const;
+	// Hashes the file as load_rom() would and looks it up.
+	const RomProfile* find_file(const NativePath& path) const;
+	size_t get_override_count() const { return _overrides.size(); }
+
+	// One profile per line, '#' starts a comment:
+	//   <hash, 16 hex digits> <name> [quirks=none|resetVF+setVXtoVY+incrementI] [ipf=N] [antiflicker=on|off]
+	// Names are appended to `names`, which the profiles point into.
+	static bool read_profiles(std::istream& in, const string& source, vector<RomProfile>& profiles, std::deque<string>& names);
+private:
+	std::unordered_map<uint64_t, RomProfile> _overrides;
+	std::deque<string> _names;
+};
+
+#endif // CHIP8_ROMDB_H
@@ -0,0 +1,47 @@
+// Generated by chip8romdb --generate ROM/romdb.txt, do not edit.
+// Included by romdb.cpp only; 9 ROM(s) in 32 slots.
+#ifndef CHIP8_ROMDB_TABLE_H
+#define CHIP8_ROMDB_TABLE_H
+
+#include "romdb.h"
+
+constexpr uint64_t ROM_PROFILE_SEED = 35;
+constexpr int ROM_PROFILE_SLOT_BITS = 5;
+
+// hash, name, flags, quirks, instructions per frame, anti-flicker
+constexpr RomProfile ROM_PROFILES[] = {
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0x08c5e8205999485fULL, "random_number_test.ch8", 0, 0, 0, false },
+	{ 0xf29eda105324f103ULL, "1-chip8-logo.ch8", 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0x95a428aecb4e63aaULL, "6-keypad.ch8", 0, 0, 0, false },
+	{ 0x24dc4a340af2a8fbULL, "5-quirks.ch8", 1, 7, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0x290da31d50161491ULL, "7-beep.ch8", 0, 0, 0, false },
+	{ 0xced34281d9dae5c0ULL, "3-corax+.ch8", 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0x853f6aeb68a0439dULL, "delay_timer_test.ch8", 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0x518c0287840c0507ULL, "4-flags.ch8", 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+	{ 0x7ce94f81f0ddb2f2ULL, "2-ibm-logo.ch8", 0, 0, 0, false },
+	{ 0, nullptr, 0, 0, 0, false },
+};
+
+#endif // CHIP8_ROMDB_TABLE_H
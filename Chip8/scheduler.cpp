@@ -0,0 +1,169 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+const uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+}
+
+Chip8Scheduler::Chip8Scheduler() : _frame(0), _framesRun(0), _framesSkipped(0)
+{}
+
+int Chip8Scheduler::add(std::unique_ptr<Chip8> chip8)
+{
+	int id;
+	if (_freeIds.empty()) {
+		id = static_cast<int>(_tasks.size());
+		_tasks.push_back(Task());
+	}
+	else {
+		id = _freeIds.back();
+		_freeIds.pop_back();
+	}
+	Task& task = _tasks[id];
+	task.chip8 = std::move(chip8);
+	task.state = TaskState::RUNNABLE;
+	task.wait = Chip8Wait::NONE;
+	task.frame = _frame;
+	task.wakeFrame = NEVER;
+	_runnable.push_back(id);
+	return id;
+}
+
+std::unique_ptr<Chip8> Chip8Scheduler::remove(int id)
+{
+	Task& task = _tasks[id];
+	catch_up(task);
+	task.state = TaskState::FREE;
+	_freeIds.push_back(id);
+	return std::move(task.chip8);
+}
+
+Chip8& Chip8Scheduler::sync(int id)
+{
+	Task& task = _tasks[id];
+	catch_up(task);
+	return *task.chip8;
+}
+
+void Chip8Scheduler::post_key(int id, int key, bool down)
+{
+	std::lock_guard<std::mutex> lock(_inboxMutex);
+	KeyPost post = { id, key, down };
+	_inbox.push_back(post);
+}
+
+// Skips the frames a parked instance idled through. skip_idle_frames() checks the loop again, so anything
+// it does not vouch for is run for real.
+void Chip8Scheduler::catch_up(Task& task)
+{
+	if (task.frame >= _frame) {
+		return;
+	}
+	uint64_t behind = _frame - task.frame;
+	int skipped = task.chip8->skip_idle_frames(static_cast<int>(std::min<uint64_t>(behind, std::numeric_limits<int>::max())));
+	_framesSkipped += skipped;
+	for (uint64_t frame = skipped; frame < behind; ++frame) {
+		task.chip8->run_frame();
+		++_framesRun;
+	}
+	task.frame = _frame;
+}
+
+void Chip8Scheduler::wake(int id)
+{
+	Task& task = _tasks[id];
+	if (task.state != TaskState::SLEEPING && task.state != TaskState::PARKED) {
+		return;
+	}
+	catch_up(task);
+	task.state = TaskState::RUNNABLE;
+	task.wait = Chip8Wait::NONE;
+	task.wakeFrame = NEVER;
+	_runnable.push_back(id);
+}
+
+void Chip8Scheduler::deliver_keys()
+{
+	vector<KeyPost> posts;
+	posts.swap(_deferred);
+	{
+		std::lock_guard<std::mutex> lock(_inboxMutex);
+		posts.insert(posts.end(), _inbox.begin(), _inbox.end());
+		_inbox.clear();
+	}
+	for (const KeyPost& post : posts) {
+		if (post.id < 0 || post.id >= static_cast<int>(_tasks.size()) || _tasks[post.id].state == TaskState::FREE) {
+			continue;
+		}
+		wake(post.id);
+		Chip8& chip8 = *_tasks[post.id].chip8;
+		if (!chip8.queue_key_event(post.key, post.down, chip8.get_ticks()) && post.key >= 0 && post.key < Chip8::KEYPAD_COUNT) {
+			_deferred.push_back(post);
+		}
+	}
+}
+
+void Chip8Scheduler::run_until(uint64_t frame)
+{
+	for (; _frame < frame; ++_frame) {
+		deliver_keys();
+		while (!_sleepers.empty() && _sleepers.top().first <= _frame) {
+			Wakeup wakeup = _sleepers.top();
+			_sleepers.pop();
+			if (_tasks[wakeup.second].wakeFrame == wakeup.first) {
+				wake(wakeup.second);
+			}
+		}
+		_nextRunnable.clear();
+		for (int id : _runnable) {
+			Task& task = _tasks[id];
+			if (task.state != TaskState::RUNNABLE || task.frame != _frame) {
+				continue;
+			}
+			task.chip8->run_frame();
+			++_framesRun;
+			task.frame = _frame + 1;
+			int frames;
+			task.wait = task.chip8->find_wait(&frames);
+			if (task.wait == Chip8Wait::NONE) {
+				_nextRunnable.push_back(id);
+			}
+			else if (task.wait == Chip8Wait::TIMER) {
+				task.state = TaskState::SLEEPING;
+				task.wakeFrame = task.frame + frames;
+				_sleepers.push(Wakeup(task.wakeFrame, id));
+			}
+			else {
+				task.state = TaskState::PARKED;
+			}
+		}
+		_runnable.swap(_nextRunnable);
+	}
+}
+
+Chip8SchedulerStats Chip8Scheduler::get_stats() const
+{
+	Chip8SchedulerStats stats;
+	stats.framesRun = _framesRun;
+	stats.framesSkipped = _framesSkipped;
+	for (const Task& task : _tasks) {
+		if (task.state == TaskState::RUNNABLE) {
+			++stats.running;
+		}
+		else if (task.state == TaskState::SLEEPING) {
+			++stats.waitingTimer;
+		}
+		else if (task.state == TaskState::PARKED) {
+			if (task.wait == Chip8Wait::KEY) {
+				++stats.waitingKey;
+			}
+			else {
+				++stats.halted;
+			}
+		}
+	}
+	return stats;
+}
@@ -0,0 +1,93 @@
+#ifndef CHIP8_SCHEDULER_H
+#define CHIP8_SCHEDULER_H
+
+#include "chip8.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+
+struct Chip8SchedulerStats {
+	Chip8SchedulerStats() : framesRun(0), framesSkipped(0), running(0), waitingTimer(0), waitingKey(0), halted(0)
+	{}
+	// frames executed with run_frame(), and frames of idle loops accounted for without running them
+	uint64_t framesRun;
+	uint64_t framesSkipped;
+	// instances by what they do at the current frame
+	int running;
+	int waitingTimer;
+	int waitingKey;
+	int halted;
+};
+
+// Runs many Chip8 instances on the thread that calls run_until(). Each instance is a coroutine without a
+// stack of its own: its whole state is the Chip8 object, it is resumed for one frame at a time and yields
+// at the frame boundary. After a frame that leaves it in an idle loop (Chip8::find_wait()) it is parked
+// and costs nothing until a key edge is posted for it or its timer wait ends, then it skips the frames
+// it idled through and runs on. Every instance ends each frame as if it had run every frame itself.
+// Use one scheduler per thread; only post_key() may be called from other threads.
+class Chip8Scheduler {
+public:
+	Chip8Scheduler();
+	Chip8Scheduler(const Chip8Scheduler&) = delete;
+	Chip8Scheduler& operator= (const Chip8Scheduler&) = delete;
+	// Takes an instance with its ROM, quirks and engine set up; it runs from the current frame on.
+	// Returns its id, which is reused once the instance is removed.
+	int add(std::unique_ptr<Chip8> chip8);
+	// Hands the instance back, brought up to the current frame.
+	std::unique_ptr<Chip8> remove(int id);
+	// The instance brought up to the current frame, for reading its display or state.
+	Chip8& sync(int id);
+	// A key edge the instance sees from the start of its next frame. Safe from any thread.
+	void post_key(int id, int key, bool down);
+	// Runs every instance frame by frame until the frame count reaches frame.
+	void run_until(uint64_t frame);
+	// frames run since construction
+	uint64_t get_frame() const { return _frame; }
+	Chip8SchedulerStats get_stats() const;
+private:
+	enum class TaskState {
+		FREE,
+		RUNNABLE,
+		// until wakeFrame, or a key edge
+		SLEEPING,
+		// until a key edge
+		PARKED
+	};
+	struct Task {
+		std::unique_ptr<Chip8> chip8;
+		TaskState state;
+		Chip8Wait wait;
+		// frames the instance has been brought up to
+		uint64_t frame;
+		uint64_t wakeFrame;
+	};
+	struct KeyPost {
+		int id;
+		int key;
+		bool down;
+	};
+	void catch_up(Task& task);
+	void wake(int id);
+	void deliver_keys();
+
+	vector<Task> _tasks;
+	vector<int> _freeIds;
+	// ids to run this frame; may hold ids that were removed or already ran, which are passed over
+	vector<int> _runnable;
+	vector<int> _nextRunnable;
+	typedef std::pair<uint64_t, int> Wakeup;
+	std::priority_queue<Wakeup, vector<Wakeup>, std::greater<Wakeup>> _sleepers;
+	std::mutex _inboxMutex;
+	vector<KeyPost> _inbox;
+	// keys that did not fit an instance's key queue, retried next frame
+	vector<KeyPost> _deferred;
+	uint64_t _frame;
+	uint64_t _framesRun;
+	uint64_t _framesSkipped;
+};
+
+#endif // CHIP8_SCHEDULER_H
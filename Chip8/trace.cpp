@@ -0,0 +1,156 @@
+#include "trace.h"
+#include <chrono>
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+std::atomic<bool> Tracer::_enabled(false);
+constexpr int Tracer::FLUSH_INTERVAL_MS;
+
+Tracer& Tracer::instance()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+uint64_t Tracer::now_micros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Tracer::Tracer() : _firstEvent(true), _stopWriter(false)
+{}
+
+Tracer::~Tracer()
+{
+	stop();
+}
+
+bool Tracer::start(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_file.is_open()) {
+		return true;
+	}
+	_file.open(path, std::ofstream::binary | std::ofstream::trunc);
+	if (!_file.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	_file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	_firstEvent = true;
+	for (auto& buffer : _buffers) {
+		std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+		buffer->events.clear();
+		if (buffer->name) {
+			_file << (_firstEvent ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+				<< buffer->tid << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+			_firstEvent = false;
+		}
+	}
+	_stopWriter = false;
+	_enabled.store(true, std::memory_order_release);
+	_writer = std::thread(&Tracer::write_loop, this);
+	return true;
+}
+
+void Tracer::stop()
+{
+	if (!_writer.joinable()) {
+		return;
+	}
+	_enabled.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(_writerMutex);
+		_stopWriter = true;
+	}
+	_writerWake.notify_one();
+	_writer.join();
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	drain();
+	_file << "\n]}\n";
+	_file.close();
+}
+
+void Tracer::set_thread_name(const char* name)
+{
+	ThreadBuffer& buffer = get_thread_buffer();
+	std::lock_guard<std::mutex> lock(_mutex);
+	buffer.name = name;
+	if (_file.is_open()) {
+		_file << (_firstEvent ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+			<< buffer.tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+		_firstEvent = false;
+	}
+}
+
+void Tracer::complete(const char* name, const char* category, uint64_t startMicros, uint64_t endMicros)
+{
+	record({ name, category, startMicros, endMicros - startMicros, 'X' });
+}
+
+void Tracer::instant(const char* name, const char* category)
+{
+	record({ name, category, now_micros(), 0, 'i' });
+}
+
+Tracer::ThreadBuffer& Tracer::get_thread_buffer()
+{
+	thread_local ThreadBuffer* buffer = nullptr;
+	if (!buffer) {
+		// owned by the tracer, so events survive the thread
+		std::lock_guard<std::mutex> lock(_mutex);
+		_buffers.emplace_back(new ThreadBuffer(static_cast<int>(_buffers.size()) + 1));
+		buffer = _buffers.back().get();
+	}
+	return *buffer;
+}
+
+void Tracer::record(const Event& event)
+{
+	ThreadBuffer& buffer = get_thread_buffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.events.push_back(event);
+}
+
+void Tracer::write_loop()
+{
+	std::unique_lock<std::mutex> wakeLock(_writerMutex);
+	while (!_stopWriter) {
+		_writerWake.wait_for(wakeLock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+		wakeLock.unlock();
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			drain();
+		}
+		wakeLock.lock();
+	}
+}
+
+// Called with _mutex held. Each thread buffer is only locked long enough to swap its events out.
+void Tracer::drain()
+{
+	for (auto& buffer : _buffers) {
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			_drained.swap(buffer->events);
+		}
+		for (const Event& event : _drained) {
+			_file << (_firstEvent ? "" : ",") << "\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+				<< "\",\"ph\":\"" << event.phase << "\",\"ts\":" << event.timestamp;
+			if (event.phase == 'X') {
+				_file << ",\"dur\":" << event.duration;
+			}
+			else {
+				_file << ",\"s\":\"t\"";
+			}
+			_file << ",\"pid\":1,\"tid\":" << buffer->tid << "}";
+			_firstEvent = false;
+		}
+		_drained.clear();
+	}
+	_file.flush();
+}
@@ -0,0 +1,96 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Chrome trace event recorder (chrome://tracing, Perfetto).
+// Events are kept in per-thread buffers and a background thread drains them into the JSON file every
+// FLUSH_INTERVAL_MS, so recording never waits on the disk. While tracing is off, a TRACE_SCOPE costs
+// one relaxed atomic load.
+// Event names and categories must be string literals, only their pointers are stored.
+class Tracer {
+public:
+	static constexpr int FLUSH_INTERVAL_MS = 100;
+
+	static Tracer& instance();
+	static bool is_enabled() { return _enabled.load(std::memory_order_relaxed); }
+	static uint64_t now_micros();
+
+	bool start(const std::string& path);
+	void stop();
+	// Names the calling thread in the trace; may be called before tracing starts.
+	void set_thread_name(const char* name);
+	void complete(const char* name, const char* category, uint64_t startMicros, uint64_t endMicros);
+	void instant(const char* name, const char* category);
+private:
+	struct Event {
+		const char* name;
+		const char* category;
+		uint64_t timestamp;
+		uint64_t duration;
+		char phase;
+	};
+	struct ThreadBuffer {
+		ThreadBuffer(int tid) : tid(tid), name(nullptr)
+		{}
+		int tid;
+		const char* name;
+		std::mutex mutex;
+		std::vector<Event> events;
+	};
+
+	Tracer();
+	~Tracer();
+	Tracer(const Tracer&) = delete;
+	Tracer& operator= (const Tracer&) = delete;
+	ThreadBuffer& get_thread_buffer();
+	void record(const Event& event);
+	void write_loop();
+	void drain();
+
+	static std::atomic<bool> _enabled;
+	std::mutex _mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> _buffers;
+	std::ofstream _file;
+	bool _firstEvent;
+	std::thread _writer;
+	std::mutex _writerMutex;
+	std::condition_variable _writerWake;
+	bool _stopWriter;
+	std::vector<Event> _drained;
+};
+
+class TraceScope {
+public:
+	TraceScope(const char* name, const char* category) : _name(name), _category(category),
+		_start(Tracer::is_enabled() ? Tracer::now_micros() : 0)
+	{}
+	~TraceScope()
+	{
+		if (_start != 0 && Tracer::is_enabled()) {
+			Tracer::instance().complete(_name, _category, _start, Tracer::now_micros());
+		}
+	}
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator= (const TraceScope&) = delete;
+private:
+	const char* _name;
+	const char* _category;
+	uint64_t _start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name, category) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, category)
+#define TRACE_INSTANT(name, category) \
+	do { if (Tracer::is_enabled()) Tracer::instance().instant(name, category); } while (0)
+
+#endif // CHIP8_TRACE_H
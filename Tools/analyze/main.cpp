@@ -0,0 +1,163 @@
+// Prints what static analysis finds in a ROM: code and data bytes, the control-flow graph, jump tables,
+// self-modifying stores and the quirks the program's results depend on.
+// usage: chip8analyze [--cfg] [--map] <rom.ch8>...
+//   --cfg  list every basic block with its successors
+//   --map  print a memory map, one character per byte: C code, S sprite, L loaded, W written, . untouched
+// Exits with 1 when any ROM has invalid reachable code or stores over its own code.
+#include "analyzer.h"
+#include "chip8.h"
+#include "mappedfile.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+static string hex(int value, int width = 3)
+{
+	std::ostringstream text;
+	text << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+	return text.str();
+}
+
+static string register_name(int reg)
+{
+	return reg == 16 ? "I" : "V" + hex(reg, 1);
+}
+
+static char map_char(uint8_t flags)
+{
+	if (flags & (BYTE_CODE | BYTE_CODE_TAIL)) {
+		return 'C';
+	}
+	if (flags & BYTE_WRITTEN) {
+		return 'W';
+	}
+	if (flags & BYTE_SPRITE) {
+		return 'S';
+	}
+	if (flags & BYTE_LOADED) {
+		return 'L';
+	}
+	return '.';
+}
+
+static void print_report(const Chip8Analysis& analysis, bool printCfg, bool printMap)
+{
+	int code = 0, sprite = 0, loaded = 0;
+	for (int i = Chip8::PROGRAM_START; i < Chip8::PROGRAM_START + analysis.romSize; ++i) {
+		uint8_t flags = analysis.bytes[i];
+		if (flags & (BYTE_CODE | BYTE_CODE_TAIL)) {
+			++code;
+		}
+		else if (flags & BYTE_SPRITE) {
+			++sprite;
+		}
+		else if (flags & BYTE_LOADED) {
+			++loaded;
+		}
+	}
+	cout << "  " << analysis.romSize << " bytes: " << code << " code, " << sprite << " sprite, " << loaded << " loaded, "
+		<< analysis.romSize - code - sprite - loaded << " unclassified" << endl;
+	cout << "  " << analysis.instructionCount << " instructions in " << analysis.blocks.size() << " blocks" << endl;
+
+	for (const Chip8IndirectJump& jump : analysis.indirectJumps) {
+		cout << "  indirect jump at " << hex(jump.address) << ": "
+			<< (jump.isResolved ? "to " + hex(jump.target) : string("unresolved")) << endl;
+	}
+	for (const Chip8CodeWrite& write : analysis.codeWrites) {
+		cout << "  self-modifying store at " << hex(write.writer) << ": "
+			<< (write.isTargetKnown ? hex(write.first) + "-" + hex(write.last) : string("unknown target")) << endl;
+	}
+	for (uint16_t address : analysis.invalidInstructions) {
+		cout << "  invalid instruction at " << hex(address) << endl;
+	}
+	for (uint16_t address : analysis.misalignedInstructions) {
+		cout << "  misaligned instruction at " << hex(address) << endl;
+	}
+	for (const Chip8QuirkHint& hint : analysis.quirkHints) {
+		cout << "  " << get_quirk_name(hint.quirk) << ": " << register_name(hint.reg) << " written at " << hex(hint.writer)
+			<< ", read at " << hex(hint.reader) << endl;
+	}
+	uint8_t quirks = analysis.get_quirk_dependencies();
+	cout << "  depends on quirks: ";
+	if (quirks == 0) {
+		cout << "none";
+	}
+	for (int quirk = 0, count = 0; quirk < 3; ++quirk) {
+		if (quirks & (1 << quirk)) {
+			cout << (count++ > 0 ? "+" : "") << get_quirk_name(static_cast<Chip8Quirk>(quirk));
+		}
+	}
+	cout << endl;
+
+	if (printCfg) {
+		for (const Chip8Block& block : analysis.blocks) {
+			cout << "  block " << hex(block.start) << "-" << hex(block.end - 2) << " " << get_block_end_name(block.kind);
+			for (size_t i = 0; i < block.successors.size(); ++i) {
+				cout << (i == 0 ? " -> " : ", ") << hex(block.successors[i]);
+			}
+			cout << endl;
+		}
+	}
+	if (printMap) {
+		int end = Chip8::PROGRAM_START + analysis.romSize;
+		for (int row = Chip8::PROGRAM_START; row < end; row += 64) {
+			cout << "  " << hex(row) << " ";
+			for (int i = row; i < row + 64 && i < end; ++i) {
+				cout << map_char(analysis.bytes[i]);
+			}
+			cout << endl;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool printCfg = false, printMap = false;
+	vector<string> roms;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--cfg") {
+			printCfg = true;
+		}
+		else if (arg == "--map") {
+			printMap = true;
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			roms.push_back(arg);
+		}
+		else {
+			roms.clear();
+			break;
+		}
+	}
+	if (roms.empty()) {
+		cerr << "usage: chip8analyze [--cfg] [--map] <rom.ch8>..." << endl;
+		return 2;
+	}
+
+	Chip8 chip8;
+	Chip8Analysis analysis;
+	int failed = 0;
+	for (const string& rom : roms) {
+		MappedFile file;
+		if (!file.open(native_path(rom)) || !file.map() || !chip8.load_rom_from_memory(file.get_data(), file.get_size())) {
+			cerr << rom << ": could not load" << endl;
+			return 2;
+		}
+		analyze_rom(chip8.get_memory(), file.get_size(), analysis);
+		cout << rom << endl;
+		print_report(analysis, printCfg, printMap);
+		if (!analysis.invalidInstructions.empty() || !analysis.codeWrites.empty()) {
+			++failed;
+		}
+	}
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,446 @@
+// Translates ROMs ahead of time into a C++ source file for the NATIVE engine.
+// usage: chip8aot -o <out.cpp> <rom.ch8>...
+//
+// The output defines CHIP8_NATIVE_PROGRAMS and CHIP8_NATIVE_PROGRAM_COUNT, one Chip8NativeProgram per ROM.
+// Every instruction analyze_rom() finds reachable becomes a labelled statement in one function per ROM;
+// jumps, calls and skips with a static target are gotos, returns and BMMM go through a switch over the
+// translated addresses. Clearing the screen, drawing, CXKK, FX0A and FX18 call the interpreter's handlers.
+//
+// The translation falls back to the interpreter instead of guessing: any instruction that would fault, a
+// jump to an address that was not translated, and the rest of a frame's budget when it runs out.
+// When the analysis finds stores over code or BMMM jumps it cannot resolve, code can change or run in
+// ways it did not see, so every instruction first checks that memory still holds the opcode it was
+// translated from.
+#include "analyzer.h"
+#include "chip8.h"
+#include "mappedfile.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+static string hex(int value, int width = 3)
+{
+	std::ostringstream text;
+	text << "0x" << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+	return text.str();
+}
+
+static string label(int address)
+{
+	return "op_" + hex(address).substr(2);
+}
+
+static string base_name(const string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+static string escape(const string& text)
+{
+	string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+class Translator {
+public:
+	Translator(const uint8_t* memory, const Chip8Analysis& analysis);
+	// the body of the run function for the program
+	string translate();
+private:
+	uint16_t fetch(int address) const { return static_cast<uint16_t>(_memory[address] << 8 | _memory[address + 1]); }
+	// a goto to translated code, or a return to the interpreter at that address
+	string jump(int target) const;
+	string exit(int address) const { return "{ pc = " + hex(address) + "; goto out; }"; }
+	// statements of one instruction after its budget, guard and fault checks
+	void translate_instruction(int address, uint16_t code, std::ostream& out);
+	// the condition under which the interpreter runs the instruction instead, because it faults
+	string get_fault_condition(uint16_t code) const;
+	void call_handler(int address, uint16_t code, std::ostream& out);
+
+	const uint8_t* _memory;
+	const Chip8Analysis& _analysis;
+	bool _isGuarded;
+	bool _usesKeys, _usesQuirks, _usesDispatch;
+	// the instruction translated after the current one, which it falls through to without a goto
+	int _next;
+};
+
+Translator::Translator(const uint8_t* memory, const Chip8Analysis& analysis) : _memory(memory), _analysis(analysis),
+	_isGuarded(!analysis.codeWrites.empty() || !analysis.is_fully_resolved()),
+	_usesKeys(false), _usesQuirks(false), _usesDispatch(false), _next(-1)
+{}
+
+string Translator::jump(int target) const
+{
+	if (target <= Chip8::MEMORY_SIZE - 2 && _analysis.is_code(static_cast<uint16_t>(target))) {
+		return "goto " + label(target) + ";";
+	}
+	return exit(target);
+}
+
+string Translator::get_fault_condition(uint16_t code) const
+{
+	int x = (code >> 8) & 0xF;
+	int y = (code >> 4) & 0xF;
+	string vx = "v[" + hex(x, 1) + "]";
+	switch (code & 0xF000) {
+	case 0x0000:
+		return (code & 0xFF) == 0xEE ? "c.stackPointer == 0" : "";
+	case 0x2000:
+		return "c.stackPointer == 16";
+	case 0xD000:
+		return "I + std::min<int>(" + std::to_string(code & 0xF) + ", 32 - v[" + hex(y, 1) + "] % 32) > 4096";
+	case 0xE000:
+		return vx + " >= 16";
+	case 0xF000:
+		switch (code & 0xFF) {
+		case 0x33:
+			return "I + 3 > 4096";
+		case 0x55:
+		case 0x65:
+			return "I + " + std::to_string(x + 1) + " > 4096";
+		}
+		return "";
+	default:
+		return "";
+	}
+}
+
+void Translator::call_handler(int address, uint16_t code, std::ostream& out)
+{
+	out << "\tc.programCounter = " << hex(address) << ";" << endl;
+	if ((code & 0xF000) == 0xD000) {
+		out << "\tc.I = I;" << endl;
+	}
+	out << "\tc.execute(" << hex(code, 4) << ");" << endl;
+	if ((code & 0xF0FF) == 0xF00A) {
+		// still waiting for a key: each wait counts as an instruction, as in the interpreter, and no key
+		// can change before the budget runs out
+		out << "\tif (c.programCounter != " << hex(address + 2) << ") goto " << label(address) << ";" << endl;
+	}
+}
+
+void Translator::translate_instruction(int address, uint16_t code, std::ostream& out)
+{
+	int x = (code >> 8) & 0xF;
+	int y = (code >> 4) & 0xF;
+	int kk = code & 0xFF;
+	int nnn = code & 0xFFF;
+	string vx = "v[" + hex(x, 1) + "]";
+	string vy = "v[" + hex(y, 1) + "]";
+	string vf = "v[0xF]";
+	string next = address + 2 == _next ? "" : jump(address + 2);
+	string skip = jump(address + 4);
+
+	switch (code & 0xF000) {
+	case 0x0000:
+		if ((code & 0xFF) == 0xE0) {
+			call_handler(address, code, out);
+		}
+		else {
+			out << "\tpc = c.callStack[--c.stackPointer];" << endl;
+			out << "\tgoto dispatch;" << endl;
+			_usesDispatch = true;
+			return;
+		}
+		break;
+	case 0x1000:
+		out << "\t" << jump(nnn) << endl;
+		return;
+	case 0x2000:
+		out << "\tc.callStack[c.stackPointer++] = " << hex(address + 2) << ";" << endl;
+		out << "\t" << jump(nnn) << endl;
+		return;
+	case 0x3000:
+	case 0x4000:
+		out << "\tif (" << vx << ((code & 0xF000) == 0x3000 ? " == " : " != ") << hex(kk, 2) << ") " << skip << endl;
+		break;
+	case 0x5000:
+	case 0x9000:
+		if (x == y) {
+			// 5XX0 always skips, 9XX0 never does
+			if ((code & 0xF000) == 0x5000) {
+				out << "\t" << skip << endl;
+				return;
+			}
+			break;
+		}
+		out << "\tif (" << vx << ((code & 0xF000) == 0x5000 ? " == " : " != ") << vy << ") " << skip << endl;
+		break;
+	case 0x6000:
+		out << "\t" << vx << " = " << hex(kk, 2) << ";" << endl;
+		break;
+	case 0x7000:
+		out << "\t" << vx << " += " << hex(kk, 2) << ";" << endl;
+		break;
+	case 0x8000:
+		switch (code & 0xF) {
+		case 0x0:
+			out << "\t" << vx << " = " << vy << ";" << endl;
+			break;
+		case 0x1:
+		case 0x2:
+		case 0x3:
+			out << "\t" << vx << " " << ((code & 0xF) == 0x1 ? "|" : (code & 0xF) == 0x2 ? "&" : "^") << "= " << vy << ";" << endl;
+			out << "\tif (resetVF) " << vf << " = 0;" << endl;
+			_usesQuirks = true;
+			break;
+		case 0x4:
+			out << "\t{ uint8_t carry = " << vx << " > 0xFF - " << vy << "; " << vx << " += " << vy << "; "
+				<< vf << " = carry; }" << endl;
+			break;
+		case 0x5:
+		case 0x7:
+			if (x == y) {
+				out << "\t" << vx << " = 0; " << vf << " = 1;" << endl;
+			}
+			else if ((code & 0xF) == 0x5) {
+				out << "\t{ uint8_t carry = " << vx << " >= " << vy << "; " << vx << " -= " << vy << "; "
+					<< vf << " = carry; }" << endl;
+			}
+			else {
+				out << "\t{ uint8_t carry = " << vy << " >= " << vx << "; " << vx << " = " << vy << " - " << vx << "; "
+					<< vf << " = carry; }" << endl;
+			}
+			break;
+		case 0x6:
+		case 0xE:
+			if (x != y) {
+				out << "\tif (setVXtoVY) " << vx << " = " << vy << ";" << endl;
+				_usesQuirks = true;
+			}
+			if ((code & 0xF) == 0x6) {
+				out << "\t{ uint8_t carry = " << vx << " & 0x1; " << vx << " >>= 1; " << vf << " = carry; }" << endl;
+			}
+			else {
+				out << "\t{ uint8_t carry = " << vx << " >> 7; " << vx << " <<= 1; " << vf << " = carry; }" << endl;
+			}
+			break;
+		}
+		break;
+	case 0xA000:
+		out << "\tI = " << hex(nnn) << ";" << endl;
+		break;
+	case 0xB000: {
+		const Chip8IndirectJump* resolved = nullptr;
+		for (const Chip8IndirectJump& indirect : _analysis.indirectJumps) {
+			if (indirect.address == address && indirect.isResolved) {
+				resolved = &indirect;
+			}
+		}
+		// V0 is only known to be constant here when every path to it was analyzed
+		if (resolved && !_isGuarded) {
+			out << "\t" << jump(resolved->target) << endl;
+		}
+		else {
+			out << "\tpc = " << hex(nnn) << " + v[0x0];" << endl;
+			out << "\tgoto dispatch;" << endl;
+			_usesDispatch = true;
+		}
+		return;
+	}
+	case 0xC000:
+	case 0xD000:
+		call_handler(address, code, out);
+		break;
+	case 0xE000:
+		out << "\tif (" << ((code & 0xF) == 0xE ? "" : "!") << "keys[" << vx << "]) " << skip << endl;
+		_usesKeys = true;
+		break;
+	case 0xF000:
+		switch (kk) {
+		case 0x07:
+			out << "\t" << vx << " = c.timer;" << endl;
+			break;
+		case 0x0A:
+		case 0x18:
+			call_handler(address, code, out);
+			break;
+		case 0x15:
+			out << "\tc.timer = " << vx << ";" << endl;
+			break;
+		case 0x1E:
+			out << "\tI += " << vx << ";" << endl;
+			break;
+		case 0x29:
+			out << "\tI = 5 * " << vx << ";" << endl;
+			break;
+		case 0x30:
+			break;
+		case 0x33:
+			out << "\tm[I] = " << vx << " / 100; m[I + 1] = " << vx << " / 10 % 10; m[I + 2] = " << vx << " % 10;" << endl;
+			break;
+		case 0x55:
+		case 0x65:
+			if (kk == 0x55) {
+				out << "\tstd::memcpy(m + I, v, " << x + 1 << ");" << endl;
+			}
+			else {
+				out << "\tstd::memcpy(v, m + I, " << x + 1 << ");" << endl;
+			}
+			out << "\tif (incrementI) I += " << x + 1 << ";" << endl;
+			_usesQuirks = true;
+			break;
+		}
+		break;
+	}
+	if (!next.empty()) {
+		out << "\t" << next << endl;
+	}
+}
+
+string Translator::translate()
+{
+	vector<int> addresses;
+	for (int address = 0; address <= Chip8::MEMORY_SIZE - 2; ++address) {
+		if (_analysis.is_code(static_cast<uint16_t>(address))) {
+			addresses.push_back(address);
+		}
+	}
+	std::ostringstream body;
+	std::set<uint16_t> invalid(_analysis.invalidInstructions.begin(), _analysis.invalidInstructions.end());
+	for (size_t i = 0; i < addresses.size(); ++i) {
+		int address = addresses[i];
+		uint16_t code = fetch(address);
+		_next = i + 1 < addresses.size() ? addresses[i + 1] : -1;
+		body << label(address) << ":" << endl;
+		if (invalid.count(static_cast<uint16_t>(address))) {
+			// unknown opcode or a successor past memory, the interpreter faults on it
+			body << "\t" << exit(address) << endl;
+			continue;
+		}
+		string condition = "left == 0";
+		if (_isGuarded) {
+			condition += " || m[" + hex(address) + "] != " + hex(code >> 8, 2) + " || m[" + hex(address + 1) + "] != " + hex(code & 0xFF, 2);
+		}
+		string fault = get_fault_condition(code);
+		if (!fault.empty()) {
+			condition += " || " + fault;
+		}
+		body << "\tif (" << condition << ") " << exit(address) << endl;
+		body << "\t--left;" << endl;
+		translate_instruction(address, code, body);
+	}
+
+	string statements = body.str();
+	std::ostringstream out;
+	if (statements.find("m[") != string::npos || statements.find("m + I") != string::npos) {
+		out << "\tuint8_t* const m = c.memory;" << endl;
+	}
+	if (statements.find("v[") != string::npos || statements.find("(v,") != string::npos || statements.find(", v,") != string::npos) {
+		out << "\tuint8_t* const v = c.variables;" << endl;
+	}
+	if (_usesKeys) {
+		out << "\tconst bool* const keys = c.keyboard;" << endl;
+	}
+	if (_usesQuirks) {
+		out << "\tconst bool resetVF = c.quirks.resetVF, setVXtoVY = c.quirks.setVXtoVY, incrementI = c.quirks.increamentI;" << endl;
+		out << "\t(void)resetVF; (void)setVXtoVY; (void)incrementI;" << endl;
+	}
+	out << "\tuint16_t I = c.I;" << endl;
+	out << "\tuint16_t pc = c.programCounter;" << endl;
+	out << "\tint left = budget;" << endl;
+	if (_usesDispatch) {
+		out << "dispatch:" << endl;
+	}
+	out << "\tswitch (pc) {" << endl;
+	for (int address : addresses) {
+		out << "\tcase " << hex(address) << ": goto " << label(address) << ";" << endl;
+	}
+	out << "\tdefault: goto out;" << endl;
+	out << "\t}" << endl;
+	out << statements;
+	out << "out:" << endl;
+	out << "\tc.programCounter = pc;" << endl;
+	out << "\tc.I = I;" << endl;
+	out << "\treturn budget - left;" << endl;
+	return out.str();
+}
+
+int main(int argc, char* argv[])
+{
+	string output;
+	vector<string> roms;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "-o" && i + 1 < argc) {
+			output = argv[++i];
+		}
+		else if (arg.compare(0, 1, "-") != 0) {
+			roms.push_back(arg);
+		}
+		else {
+			roms.clear();
+			break;
+		}
+	}
+	if (output.empty() || roms.empty()) {
+		cerr << "usage: chip8aot -o <out.cpp> <rom.ch8>..." << endl;
+		return 2;
+	}
+
+	std::ostringstream source;
+	source << "// Generated by chip8aot, do not edit." << endl;
+	source << "#include \"chip8.h\"" << endl;
+	source << "#include <algorithm>" << endl;
+	source << "#include <cstring>" << endl << endl;
+	Chip8 chip8;
+	Chip8Analysis analysis;
+	vector<pair<uint64_t, string>> programs;
+	for (size_t i = 0; i < roms.size(); ++i) {
+		MappedFile file;
+		if (!file.open(native_path(roms[i])) || !file.map() || !chip8.load_rom_from_memory(file.get_data(), file.get_size())) {
+			cerr << roms[i] << ": could not load" << endl;
+			return 2;
+		}
+		analyze_rom(chip8.get_memory(), file.get_size(), analysis);
+		Translator translator(chip8.get_memory(), analysis);
+		string body = translator.translate();
+		string name = base_name(roms[i]);
+		source << "// " << name << ": " << analysis.instructionCount << " instructions"
+			<< (analysis.codeWrites.empty() && analysis.is_fully_resolved() ? "" : ", checked against self-modification") << endl;
+		source << "static int run_" << i << "(Chip8NativeContext& c, int budget)" << endl;
+		source << "{" << endl << body << "}" << endl << endl;
+		programs.push_back(std::make_pair(chip8.get_rom_hash(), name));
+	}
+	source << "extern const Chip8NativeProgram CHIP8_NATIVE_PROGRAMS[] = {" << endl;
+	for (size_t i = 0; i < programs.size(); ++i) {
+		source << "\t{ 0x" << std::hex << std::setw(16) << std::setfill('0') << programs[i].first << std::dec << std::setfill(' ')
+			<< "ULL, \"" << escape(programs[i].second) << "\", run_" << i << " }," << endl;
+	}
+	source << "};" << endl;
+	source << "extern const int CHIP8_NATIVE_PROGRAM_COUNT = " << programs.size() << ";" << endl;
+
+	// only replaced when it changed, so a rebuild does not recompile it for nothing
+	string text = source.str();
+	std::ifstream previous(native_path(output), std::ios::binary);
+	std::ostringstream old;
+	old << previous.rdbuf();
+	if (previous.is_open() && old.str() == text) {
+		return 0;
+	}
+	previous.close();
+	std::ofstream ofs(native_path(output), std::ios::binary);
+	if (!(ofs << text)) {
+		cerr << "Write: " << output << " error" << endl;
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,185 @@
+// Runs ROMs with the programs chip8aot translated into this binary, checks them against the interpreter
+// and times both.
+// usage: chip8aot-run [options] <rom.ch8 | rom directory>...
+//   --frames N      frames per run (default 3600)
+//   --input-seed N  random keypad edges from this seed, 0 runs without input (default 1)
+//   --all-quirks    check every ROM under all eight quirk combinations instead of the defaults
+//   --list          list the translated programs
+// The interpreter and the NATIVE engine get the same seed and input and have to end every frame with the
+// same state hash. ROMs without a translated program are skipped.
+#include "chip8.h"
+#include "mappedfile.h"
+#include "romlist.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+// defined by the source chip8aot generated
+extern const Chip8NativeProgram CHIP8_NATIVE_PROGRAMS[];
+extern const int CHIP8_NATIVE_PROGRAM_COUNT;
+
+static const Chip8NativeProgram* find_program(uint64_t romHash)
+{
+	for (int i = 0; i < CHIP8_NATIVE_PROGRAM_COUNT; ++i) {
+		if (CHIP8_NATIVE_PROGRAMS[i].romHash == romHash) {
+			return &CHIP8_NATIVE_PROGRAMS[i];
+		}
+	}
+	return nullptr;
+}
+
+struct RunOptions {
+	RunOptions() : frames(3600), inputSeed(1), allQuirks(false)
+	{}
+	int frames;
+	uint32_t inputSeed;
+	bool allQuirks;
+};
+
+static void setup(Chip8& chip8, const MappedFile& file, const Chip8Quirks& quirks, Chip8Engine engine, const Chip8NativeProgram* program)
+{
+	chip8.load_rom_from_memory(file.get_data(), file.get_size());
+	chip8.set_quirks(quirks);
+	chip8.set_seed(1);
+	chip8.set_engine(engine);
+	chip8.set_native_program(program);
+	chip8.set_fault_logging(false);
+}
+
+// Returns false on divergence, after printing where it happened.
+static bool check(const string& path, const MappedFile& file, const Chip8NativeProgram* program, const Chip8Quirks& quirks,
+	const RunOptions& options)
+{
+	Chip8 reference, candidate;
+	setup(reference, file, quirks, Chip8Engine::SWITCH, nullptr);
+	setup(candidate, file, quirks, Chip8Engine::NATIVE, program);
+	std::mt19937 random(options.inputSeed);
+	uint16_t keys = 0;
+	for (int frame = 0; frame < options.frames; ++frame) {
+		if (options.inputSeed != 0 && random() % 8 == 0) {
+			int key = random() % Chip8::KEYPAD_COUNT;
+			uint64_t cycle = reference.get_ticks() + random() % reference.get_instructions_per_frame();
+			keys ^= 1 << key;
+			reference.queue_key_event(key, (keys & (1 << key)) != 0, cycle);
+			candidate.queue_key_event(key, (keys & (1 << key)) != 0, cycle);
+		}
+		reference.run_frame();
+		candidate.run_frame();
+		if (reference.state_hash() != candidate.state_hash() || reference.get_ticks() != candidate.get_ticks()) {
+			Chip8Registers a = reference.get_registers(), b = candidate.get_registers();
+			cout << "DIVERGED " << path << " [quirks " << quirks.resetVF << quirks.setVXtoVY << quirks.increamentI
+				<< "] at frame " << frame << std::hex << std::uppercase << ", PC " << a.programCounter << " != " << b.programCounter
+				<< ", I " << a.I << " != " << b.I << std::dec << std::nouppercase << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// nanoseconds per instruction over a run without input
+static double time_engine(const MappedFile& file, Chip8Engine engine, const Chip8NativeProgram* program, int frames)
+{
+	Chip8 chip8;
+	setup(chip8, file, Chip8Quirks(), engine, program);
+	auto start = Clock::now();
+	for (int frame = 0; frame < frames; ++frame) {
+		chip8.run_frame();
+	}
+	double nanos = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	return nanos / std::max<uint64_t>(chip8.get_ticks(), 1);
+}
+
+static bool is_rom_file(const string& path)
+{
+	return path.size() > 4 && path.compare(path.size() - 4, 4, ".ch8") == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	RunOptions options;
+	vector<string> roms;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--frames" && hasValue) {
+			options.frames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--input-seed" && hasValue) {
+			options.inputSeed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--all-quirks") {
+			options.allQuirks = true;
+		}
+		else if (arg == "--list") {
+			for (int program = 0; program < CHIP8_NATIVE_PROGRAM_COUNT; ++program) {
+				cout << std::hex << std::setw(16) << std::setfill('0') << CHIP8_NATIVE_PROGRAMS[program].romHash
+					<< std::dec << std::setfill(' ') << " " << CHIP8_NATIVE_PROGRAMS[program].name << endl;
+			}
+			return 0;
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			if (is_rom_file(arg)) {
+				roms.push_back(arg);
+			}
+			else {
+				for (const string& name : list_roms(arg)) {
+					roms.push_back(arg + "/" + name);
+				}
+			}
+		}
+		else {
+			roms.clear();
+			break;
+		}
+	}
+	if (roms.empty()) {
+		cerr << "usage: chip8aot-run [--frames N] [--input-seed N] [--all-quirks] [--list] <rom.ch8 | rom directory>..." << endl;
+		return 2;
+	}
+
+	int runs = 0, diverged = 0, skipped = 0;
+	for (const string& rom : roms) {
+		MappedFile file;
+		Chip8 probe;
+		if (!file.open(native_path(rom)) || !file.map() || !probe.load_rom_from_memory(file.get_data(), file.get_size())) {
+			cout << "FAILED " << rom << ": could not load" << endl;
+			++diverged;
+			continue;
+		}
+		const Chip8NativeProgram* program = find_program(probe.get_rom_hash());
+		if (!program) {
+			++skipped;
+			continue;
+		}
+		int profiles = options.allQuirks ? 8 : 1;
+		bool ok = true;
+		for (int profile = 0; profile < profiles && ok; ++profile) {
+			++runs;
+			ok = check(rom, file, program, Chip8Quirks::from_bits(profile), options);
+		}
+		if (!ok) {
+			++diverged;
+			continue;
+		}
+		double interpreted = time_engine(file, Chip8Engine::SWITCH, nullptr, options.frames);
+		double native = time_engine(file, Chip8Engine::NATIVE, program, options.frames);
+		cout << "OK " << rom << ": " << std::fixed << std::setprecision(2) << interpreted << " ns/instruction interpreted, "
+			<< native << " native, " << std::setprecision(1) << interpreted / native << "x" << endl;
+	}
+	cout << runs << " run(s), " << diverged << " failure(s), " << skipped << " without a program" << endl;
+	return diverged > 0 ? 1 : 0;
+}
@@ -0,0 +1,469 @@
+// Micro-benchmarks for the interpreter core: every opcode handler, the execute_code() dispatch,
+// fetch_code(), DXYN for each sprite height and whole frames of every ROM in a directory.
+// usage: chip8bench [options] [rom directory]
+//   --reps N         timed repetitions per benchmark, the median is reported (default 9)
+//   --warmup N       untimed repetitions run first (default 2)
+//   --iterations N   calls per repetition for the handler benchmarks (default 1000000)
+//   --frames N       frames per repetition for the ROM benchmarks (default 20000)
+//   --filter TEXT    only run benchmarks whose name contains TEXT
+//   --json FILE      write the results as JSON, one result per line in a fixed order
+//   --baseline FILE  compare against a JSON file written by --json, exit 1 on regressions
+//   --threshold PCT  slowdown that counts as a regression (default 5)
+#include "chip8.h"
+#include "mappedfile.h"
+#include "romlist.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::map;
+using std::ofstream;
+using std::ifstream;
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchOptions {
+	BenchOptions() : reps(9), warmup(2), iterations(1000000), frames(20000), threshold(5.0), romDirectory("ROM/Test")
+	{}
+	int reps;
+	int warmup;
+	int iterations;
+	int frames;
+	double threshold;
+	string filter;
+	string jsonPath;
+	string baselinePath;
+	string romDirectory;
+};
+
+struct BenchResult {
+	string name;
+	// nanoseconds per call (per instruction for the ROM benchmarks)
+	double median, min, max;
+	// instructions per second in millions, ROM benchmarks only
+	double mips;
+};
+
+static volatile uint32_t sink;
+
+static double median_of(vector<double> samples)
+{
+	std::sort(samples.begin(), samples.end());
+	size_t middle = samples.size() / 2;
+	return samples.size() % 2 ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2.0;
+}
+
+static BenchResult summarize(const string& name, const vector<double>& samples)
+{
+	BenchResult result;
+	result.name = name;
+	result.median = median_of(samples);
+	result.min = *std::min_element(samples.begin(), samples.end());
+	result.max = *std::max_element(samples.begin(), samples.end());
+	result.mips = 0.0;
+	return result;
+}
+
+// Friend of Chip8, see chip8.h.
+// Every handler benchmark calls `op` on a core whose registers were set up once; `op` restores
+// whatever the handler moves (PC, I, stack pointer) so each call does the same work.
+// The cost of that restore is measured on its own and subtracted.
+class Chip8Bench {
+public:
+	Chip8Bench(const BenchOptions& options) : _options(options), _overhead(0.0)
+	{}
+	void run_handlers();
+	void run_dispatch();
+	void run_roms();
+	const vector<BenchResult>& get_results() const { return _results; }
+private:
+	bool is_selected(const string& name) const
+	{
+		return _options.filter.empty() || name.find(_options.filter) != string::npos;
+	}
+
+	static void setup(Chip8& chip8)
+	{
+		chip8.reset();
+		chip8.set_seed(1);
+		chip8.set_fault_logging(false);
+		std::copy(chip8._fonts, chip8._fonts + 16 * 5, chip8._memory);
+		for (int i = 0; i < Chip8::VARIABLE_SIZE; ++i) {
+			chip8._variables[i] = static_cast<uint8_t>(i * 7 + 3);
+		}
+		chip8._I = 0x300;
+		chip8._callStack[0] = 0x200;
+	}
+
+	// nanoseconds per call of each timed repetition
+	template <typename Op>
+	vector<double> time_op(Chip8& chip8, Op op)
+	{
+		vector<double> samples;
+		for (int rep = -_options.warmup; rep < _options.reps; ++rep) {
+			auto start = Clock::now();
+			for (int i = 0; i < _options.iterations; ++i) {
+				op(chip8);
+			}
+			double nanos = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+			if (rep >= 0) {
+				samples.push_back(nanos / _options.iterations);
+			}
+		}
+		return samples;
+	}
+
+	template <typename Op>
+	void bench(const string& name, Op op)
+	{
+		if (!is_selected(name)) {
+			return;
+		}
+		Chip8 chip8;
+		setup(chip8);
+		vector<double> samples = time_op(chip8, op);
+		for (double& sample : samples) {
+			sample = std::max(sample - _overhead, 0.0);
+		}
+		_results.push_back(summarize(name, samples));
+	}
+
+	const BenchOptions& _options;
+	double _overhead;
+	vector<BenchResult> _results;
+};
+
+void Chip8Bench::run_handlers()
+{
+	{
+		Chip8 chip8;
+		setup(chip8);
+		_overhead = median_of(time_op(chip8, [](Chip8& c) { c._programCounter = 0x200; }));
+	}
+
+	bench("code_00E0", [](Chip8& c) { c._programCounter = 0x200; c.code_00E0(); });
+	bench("code_00EE", [](Chip8& c) { c._stackPointer = 1; c.code_00EE(); });
+	bench("code_1MMM", [](Chip8& c) { c.code_1MMM(0x1200); });
+	bench("code_2MMM", [](Chip8& c) { c._stackPointer = 0; c.code_2MMM(0x2200); });
+	bench("code_3XKK", [](Chip8& c) { c._programCounter = 0x200; c.code_3XKK(0x3118); });
+	bench("code_4XKK", [](Chip8& c) { c._programCounter = 0x200; c.code_4XKK(0x4118); });
+	bench("code_5XY0", [](Chip8& c) { c._programCounter = 0x200; c.code_5XY0(0x5120); });
+	bench("code_6XKK", [](Chip8& c) { c._programCounter = 0x200; c.code_6XKK(0x6142); });
+	bench("code_7XKK", [](Chip8& c) { c._programCounter = 0x200; c.code_7XKK(0x7101); });
+	bench("code_8XY0", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY0(0x8120); });
+	bench("code_8XY1", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY1(0x8121); });
+	bench("code_8XY2", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY2(0x8122); });
+	bench("code_8XY3", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY3(0x8123); });
+	bench("code_8XY4", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY4(0x8124); });
+	bench("code_8XY5", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY5(0x8125); });
+	bench("code_8XY6", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY6(0x8126); });
+	bench("code_8XY7", [](Chip8& c) { c._programCounter = 0x200; c.code_8XY7(0x8127); });
+	bench("code_8XYE", [](Chip8& c) { c._programCounter = 0x200; c.code_8XYE(0x812E); });
+	bench("code_9XY0", [](Chip8& c) { c._programCounter = 0x200; c.code_9XY0(0x9120); });
+	bench("code_AMMM", [](Chip8& c) { c._programCounter = 0x200; c.code_AMMM(0xA300); });
+	bench("code_BMMM", [](Chip8& c) { c.code_BMMM(0xB200); });
+	bench("code_CXKK", [](Chip8& c) { c._programCounter = 0x200; c.code_CXKK(0xC1FF); });
+	bench("code_EX9E", [](Chip8& c) { c._programCounter = 0x200; c.code_EX9E(0xE19E); });
+	bench("code_EXA1", [](Chip8& c) { c._programCounter = 0x200; c.code_EXA1(0xE1A1); });
+	bench("code_FX07", [](Chip8& c) { c._programCounter = 0x200; c.code_FX07(0xF107); });
+	// no key is down, so this is the cost of one waiting iteration
+	bench("code_FX0A", [](Chip8& c) { c._programCounter = 0x200; c.code_FX0A(0xF10A); });
+	bench("code_FX15", [](Chip8& c) { c._programCounter = 0x200; c.code_FX15(0xF115); });
+	bench("code_FX18", [](Chip8& c) { c._programCounter = 0x200; c.code_FX18(0xF118); });
+	bench("code_FX1E", [](Chip8& c) { c._programCounter = 0x200; c._I = 0x300; c.code_FX1E(0xF11E); });
+	bench("code_FX29", [](Chip8& c) { c._programCounter = 0x200; c.code_FX29(0xF129); });
+	bench("code_FX33", [](Chip8& c) { c._programCounter = 0x200; c._I = 0x300; c.code_FX33(0xF133); });
+	bench("code_FX55", [](Chip8& c) { c._programCounter = 0x200; c._I = 0x300; c.code_FX55(0xFF55); });
+	bench("code_FX65", [](Chip8& c) { c._programCounter = 0x200; c._I = 0x300; c.code_FX65(0xFF65); });
+
+	// V1 = 10, V2 = 17: the sprite straddles a byte boundary of the packed plane without clipping.
+	for (uint16_t height = 1; height <= 15; ++height) {
+		uint16_t code = 0xD120 | height;
+		bench("code_DXYN/" + std::to_string(height), [code](Chip8& c) {
+			c._programCounter = 0x200;
+			c._I = 0;
+			c.code_DXYN(code);
+		});
+	}
+}
+
+void Chip8Bench::run_dispatch()
+{
+	if (is_selected("fetch_code")) {
+		Chip8 chip8;
+		setup(chip8);
+		for (int i = 0x200; i < 0x300; ++i) {
+			chip8._memory[i] = static_cast<uint8_t>(i);
+		}
+		vector<double> samples = time_op(chip8, [](Chip8& c) {
+			c._programCounter = 0x200 + ((c._programCounter + 2) & 0xFE);
+			sink = sink + c.fetch_code();
+		});
+		_results.push_back(summarize("fetch_code", samples));
+	}
+
+	// A straight-line mix of the common arithmetic, memory and skip opcodes; A300 and 1200 keep I and PC in place.
+	struct MixEntry {
+		uint16_t code;
+		const char* handler;
+	};
+	static const MixEntry mix[] = {
+		{ 0x6142, "code_6XKK" }, { 0x7101, "code_7XKK" }, { 0x3118, "code_3XKK" }, { 0x4118, "code_4XKK" },
+		{ 0x5120, "code_5XY0" }, { 0x8120, "code_8XY0" }, { 0x8121, "code_8XY1" }, { 0x8122, "code_8XY2" },
+		{ 0x8123, "code_8XY3" }, { 0x8124, "code_8XY4" }, { 0x8125, "code_8XY5" }, { 0x8126, "code_8XY6" },
+		{ 0x8127, "code_8XY7" }, { 0x812E, "code_8XYE" }, { 0x9120, "code_9XY0" }, { 0xA300, "code_AMMM" },
+		{ 0xC1FF, "code_CXKK" }, { 0xF107, "code_FX07" }, { 0xF115, "code_FX15" }, { 0xF11E, "code_FX1E" },
+		{ 0xF129, "code_FX29" }, { 0xA300, "code_AMMM" }, { 0xF133, "code_FX33" }, { 0xF355, "code_FX55" },
+		{ 0xF365, "code_FX65" }, { 0x1200, "code_1MMM" }
+	};
+	static const int mixSize = sizeof(mix) / sizeof(mix[0]);
+	if (!is_selected("execute_code")) {
+		return;
+	}
+	// The handlers of the mix were timed on their own above, what execute_code() adds on top is the dispatch.
+	map<string, double> handlers;
+	for (const BenchResult& result : _results) {
+		handlers[result.name] = result.median;
+	}
+	double handlerTotal = 0.0;
+	for (const MixEntry& entry : mix) {
+		auto it = handlers.find(entry.handler);
+		handlerTotal = it == handlers.end() || handlerTotal < 0 ? -1.0 : handlerTotal + it->second;
+	}
+
+	// the switch engine keeps the unprefixed names so older baselines still compare
+	static const pair<Chip8Engine, const char*> engines[] = {
+		{ Chip8Engine::SWITCH, "execute_code/" },
+		{ Chip8Engine::TABLE, "execute_code/table/" }
+	};
+	for (const auto& engine : engines) {
+		Chip8 chip8;
+		setup(chip8);
+		chip8.set_engine(engine.first);
+		int next = 0;
+		vector<double> samples = time_op(chip8, [&next](Chip8& c) {
+			c.execute_code(mix[next].code);
+			next = next + 1 == mixSize ? 0 : next + 1;
+		});
+		_results.push_back(summarize(string(engine.second) + "mix", samples));
+		if (handlerTotal >= 0) {
+			double dispatch = _results.back().median - handlerTotal / mixSize;
+			_results.push_back(summarize(string(engine.second) + "dispatch", vector<double>(1, std::max(dispatch, 0.0))));
+		}
+	}
+}
+
+void Chip8Bench::run_roms()
+{
+	vector<string> roms = list_roms(_options.romDirectory);
+	if (roms.empty()) {
+		cerr << "No .ch8 files in " << _options.romDirectory << endl;
+		return;
+	}
+	// the switch engine keeps the unprefixed names so older baselines still compare
+	static const pair<Chip8Engine, const char*> engines[] = {
+		{ Chip8Engine::SWITCH, "rom/" },
+		{ Chip8Engine::PREDECODED, "rom/predecoded/" }
+	};
+	for (const string& rom : roms) {
+		// mapped once, so the repetitions time no file access
+		MappedFile file;
+		bool isMapped = false;
+		for (const auto& engine : engines) {
+			string name = engine.second + rom;
+			if (!is_selected(name)) {
+				continue;
+			}
+			if (!isMapped && (!file.open(native_path(_options.romDirectory + "/" + rom)) || !file.map())) {
+				cerr << "Open: " << rom << " error" << endl;
+				break;
+			}
+			isMapped = true;
+			Chip8 chip8;
+			chip8.set_engine(engine.first);
+			chip8.set_fault_logging(false);
+			vector<double> samples;
+			uint64_t instructions = 0;
+			double seconds = 0.0;
+			for (int rep = -_options.warmup; rep < _options.reps; ++rep) {
+				if (!chip8.load_rom_from_memory(file.get_data(), file.get_size())) {
+					cerr << "Load: " << rom << ": " << get_load_error_name(chip8.get_load_error()) << endl;
+					break;
+				}
+				chip8.set_seed(1);
+				auto start = Clock::now();
+				for (int frame = 0; frame < _options.frames; ++frame) {
+					chip8.run_frame();
+				}
+				double nanos = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+				if (rep >= 0) {
+					samples.push_back(nanos / chip8.get_ticks());
+					instructions += chip8.get_ticks();
+					seconds += nanos / 1e9;
+				}
+			}
+			if (samples.empty()) {
+				continue;
+			}
+			BenchResult result = summarize(name, samples);
+			result.mips = instructions / seconds / 1e6;
+			_results.push_back(result);
+		}
+	}
+}
+
+static void write_json(std::ostream& os, const BenchOptions& options, const vector<BenchResult>& results)
+{
+	os << std::fixed << std::setprecision(3);
+	os << "{" << endl;
+	os << "\"version\": 1," << endl;
+	os << "\"unit\": \"ns/op\"," << endl;
+	os << "\"reps\": " << options.reps << ", \"iterations\": " << options.iterations << ", \"frames\": " << options.frames << "," << endl;
+	os << "\"results\": [" << endl;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult& r = results[i];
+		os << "{\"name\": \"" << r.name << "\", \"median\": " << r.median << ", \"min\": " << r.min << ", \"max\": " << r.max;
+		if (r.mips > 0) {
+			os << ", \"mips\": " << r.mips;
+		}
+		os << "}" << (i + 1 < results.size() ? "," : "") << endl;
+	}
+	os << "]" << endl;
+	os << "}" << endl;
+}
+
+// Reads the medians back from a file written by write_json(), which keeps one result per line.
+static bool read_baseline(const string& path, map<string, double>& medians)
+{
+	ifstream ifs(path);
+	if (!ifs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	const string nameKey = "\"name\": \"", medianKey = "\"median\": ";
+	string line;
+	while (std::getline(ifs, line)) {
+		size_t name = line.find(nameKey);
+		size_t median = line.find(medianKey);
+		if (name == string::npos || median == string::npos) {
+			continue;
+		}
+		name += nameKey.size();
+		size_t nameEnd = line.find('"', name);
+		medians[line.substr(name, nameEnd - name)] = std::atof(line.c_str() + median + medianKey.size());
+	}
+	return true;
+}
+
+static void print_results(const vector<BenchResult>& results, const map<string, double>* baseline, double threshold, int& regressions)
+{
+	cout << std::fixed << std::setprecision(2);
+	cout << std::left << std::setw(28) << "benchmark" << std::right
+		<< std::setw(12) << "median ns" << std::setw(12) << "min ns" << std::setw(12) << "max ns";
+	if (baseline) {
+		cout << std::setw(12) << "base ns" << std::setw(10) << "delta";
+	}
+	cout << endl;
+	for (const BenchResult& r : results) {
+		cout << std::left << std::setw(28) << r.name << std::right
+			<< std::setw(12) << r.median << std::setw(12) << r.min << std::setw(12) << r.max;
+		if (baseline) {
+			auto it = baseline->find(r.name);
+			if (it == baseline->end() || it->second <= 0) {
+				cout << std::setw(12) << "-" << std::setw(10) << "new";
+			}
+			else {
+				double delta = (r.median - it->second) / it->second * 100.0;
+				cout << std::setw(12) << it->second << std::setw(9) << std::showpos << delta << std::noshowpos << "%";
+				if (delta > threshold) {
+					cout << "  REGRESSION";
+					++regressions;
+				}
+			}
+		}
+		if (r.mips > 0) {
+			cout << "  " << r.mips << " MIPS";
+		}
+		cout << endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--reps" && hasValue) {
+			options.reps = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--warmup" && hasValue) {
+			options.warmup = std::max(std::atoi(argv[++i]), 0);
+		}
+		else if (arg == "--iterations" && hasValue) {
+			options.iterations = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--frames" && hasValue) {
+			options.frames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--filter" && hasValue) {
+			options.filter = argv[++i];
+		}
+		else if (arg == "--json" && hasValue) {
+			options.jsonPath = argv[++i];
+		}
+		else if (arg == "--baseline" && hasValue) {
+			options.baselinePath = argv[++i];
+		}
+		else if (arg == "--threshold" && hasValue) {
+			options.threshold = std::atof(argv[++i]);
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			options.romDirectory = arg;
+		}
+		else {
+			cerr << "usage: chip8bench [--reps N] [--warmup N] [--iterations N] [--frames N] [--filter TEXT]"
+				" [--json FILE] [--baseline FILE] [--threshold PCT] [rom directory]" << endl;
+			return 2;
+		}
+	}
+
+	map<string, double> baseline;
+	if (!options.baselinePath.empty() && !read_baseline(options.baselinePath, baseline)) {
+		return 2;
+	}
+
+	Chip8Bench bench(options);
+	bench.run_handlers();
+	bench.run_dispatch();
+	bench.run_roms();
+	const vector<BenchResult>& results = bench.get_results();
+
+	int regressions = 0;
+	print_results(results, options.baselinePath.empty() ? nullptr : &baseline, options.threshold, regressions);
+	if (!options.jsonPath.empty()) {
+		ofstream ofs(options.jsonPath);
+		if (!ofs.is_open()) {
+			cerr << "Open: " << options.jsonPath << " error" << endl;
+			return 2;
+		}
+		write_json(ofs, options, results);
+	}
+	if (regressions > 0) {
+		cout << regressions << " regression(s) above " << options.threshold << "%" << endl;
+		return 1;
+	}
+	return 0;
+}
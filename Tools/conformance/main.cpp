@@ -0,0 +1,345 @@
+// Runs every ROM of a directory headless under every quirk profile and checks the final display against golden hashes.
+// ROMs that wait on a menu get the key presses of KEY_SCRIPT.
+// usage: chip8conformance [options] [rom directory | archive.c8pk]
+//   --frames N      frames to run each ROM for (default 600, 10 seconds of emulated time)
+//   --jobs N        worker threads (default: hardware concurrency)
+//   --goldens FILE  golden hash file (default goldens.txt in the ROM directory or next to the archive)
+//   --update        rewrite the golden file from this run instead of comparing
+//   --engine NAME   switch (default), table or predecoded
+#include "chip8.h"
+#include "hash.h"
+#include "mappedfile.h"
+#include "romarchive.h"
+#include "romlist.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::map;
+using std::pair;
+
+typedef std::chrono::steady_clock Clock;
+
+// CXKK draws from this, so random_number_test is reproducible.
+static constexpr uint32_t CONFORMANCE_SEED = 1;
+// A profile is the Chip8Quirks::to_bits() form of the quirks it runs with.
+static constexpr int PROFILE_COUNT = 8;
+
+static string profile_name(int profile)
+{
+	if (profile == 0) {
+		return "none";
+	}
+	string name;
+	if (profile & 1) {
+		name += "resetVF";
+	}
+	if (profile & 2) {
+		name += name.empty() ? "setVXtoVY" : "+setVXtoVY";
+	}
+	if (profile & 4) {
+		name += name.empty() ? "incrementI" : "+incrementI";
+	}
+	return name;
+}
+
+// Key edges queued at the start of a frame. Without them a ROM that opens on a menu never reaches the
+// code its quirks change, and every profile ends on the same menu.
+struct ScriptedKey {
+	const char* rom;
+	int frame;
+	int key;
+	bool down;
+};
+
+static const ScriptedKey KEY_SCRIPT[] = {
+	// the platform menu: 1 picks CHIP-8
+	{ "5-quirks.ch8", 30, 1, true },
+	{ "5-quirks.ch8", 36, 1, false }
+};
+
+struct ConformanceJob {
+	string rom;
+	int profile;
+	bool loaded;
+	Chip8LoadError loadError;
+	uint64_t hash;
+	double millis;
+};
+
+static bool parse_engine(const string& name, Chip8Engine& engine)
+{
+	static const pair<const char*, Chip8Engine> ENGINES[] = {
+		{ "switch", Chip8Engine::SWITCH },
+		{ "table", Chip8Engine::TABLE },
+		{ "predecoded", Chip8Engine::PREDECODED }
+	};
+	for (const auto& entry : ENGINES) {
+		if (name == entry.first) {
+			engine = entry.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Runs one ROM under one profile from the image read up front; jobs share nothing but the
+// read-only images, so any number run at once.
+static void run_job(const pair<const uint8_t*, size_t>& image, int frames, Chip8Engine engine, ConformanceJob& job)
+{
+	auto start = Clock::now();
+	Chip8 chip8;
+	chip8.set_engine(engine);
+	chip8.set_fault_logging(false);
+	job.loaded = chip8.load_rom_from_memory(image.first, image.second);
+	job.loadError = chip8.get_load_error();
+	if (job.loaded) {
+		chip8.set_quirks(Chip8Quirks::from_bits(job.profile));
+		chip8.set_seed(CONFORMANCE_SEED);
+		vector<ScriptedKey> keys;
+		for (const ScriptedKey& key : KEY_SCRIPT) {
+			if (job.rom == key.rom) {
+				keys.push_back(key);
+			}
+		}
+		size_t nextKey = 0;
+		for (int frame = 0; frame < frames; ++frame) {
+			for (; nextKey < keys.size() && keys[nextKey].frame == frame; ++nextKey) {
+				chip8.queue_key_event(keys[nextKey].key, keys[nextKey].down, chip8.get_ticks());
+			}
+			chip8.run_frame();
+		}
+		job.hash = fnv1a64(chip8.get_display_bits(), Chip8::DISPLAY_ROWS * Chip8::DISPLAY_ROW_BYTES);
+	}
+	job.millis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static string hash_string(uint64_t hash)
+{
+	std::ostringstream os;
+	os << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return os.str();
+}
+
+static string golden_key(const string& rom, const string& profile, int frames)
+{
+	return rom + " " + profile + " " + std::to_string(frames);
+}
+
+// One golden per line: <rom> <profile> <frames> <hash>, '#' starts a comment.
+static bool read_goldens(const string& path, map<string, uint64_t>& goldens)
+{
+	std::ifstream ifs(path);
+	if (!ifs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	string line;
+	while (std::getline(ifs, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::istringstream fields(line);
+		string rom, profile;
+		int frames;
+		uint64_t hash;
+		if (fields >> rom >> profile >> frames >> std::hex >> hash) {
+			goldens[golden_key(rom, profile, frames)] = hash;
+		}
+	}
+	return true;
+}
+
+static bool write_goldens(const string& path, const vector<ConformanceJob>& jobs, int frames)
+{
+	std::ofstream ofs(path);
+	if (!ofs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	ofs << "# Display hashes (FNV-1a over the packed 1bpp plane) after running each ROM headless." << endl;
+	ofs << "# seed " << CONFORMANCE_SEED << ", " << Chip8::DEFAULT_INSTRUCTIONS_PER_FRAME << " instructions per frame, no input but the key script in Tools/conformance/main.cpp." << endl;
+	ofs << "# Regenerate with: chip8conformance --update" << endl;
+	ofs << "# rom profile frames hash" << endl;
+	for (const ConformanceJob& job : jobs) {
+		if (job.loaded) {
+			ofs << golden_key(job.rom, profile_name(job.profile), frames) << " " << hash_string(job.hash) << endl;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	string directory = "ROM/Test", goldenPath;
+	Chip8Engine engine = Chip8Engine::SWITCH;
+	int frames = 600;
+	int jobCount = static_cast<int>(std::thread::hardware_concurrency());
+	bool update = false;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--frames" && hasValue) {
+			frames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--jobs" && hasValue) {
+			jobCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "--goldens" && hasValue) {
+			goldenPath = argv[++i];
+		}
+		else if (arg == "--update") {
+			update = true;
+		}
+		else if (arg == "--engine" && hasValue && parse_engine(argv[i + 1], engine)) {
+			++i;
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			directory = arg;
+		}
+		else {
+			cerr << "usage: chip8conformance [--frames N] [--jobs N] [--goldens FILE] [--update] [--engine switch|table|predecoded]"
+				<< " [rom directory | archive.c8pk]" << endl;
+			return 2;
+		}
+	}
+	// Every ROM is read once here instead of once per job; an archive is only mapped and the jobs
+	// run straight from the mapping.
+	bool isArchive = directory.size() > 5 && directory.compare(directory.size() - 5, 5, ".c8pk") == 0;
+	RomArchive archive;
+	map<string, vector<uint8_t>> files;
+	map<string, pair<const uint8_t*, size_t>> images;
+	vector<string> roms;
+	if (isArchive) {
+		if (!archive.open(directory)) {
+			return 2;
+		}
+		for (size_t i = 0; i < archive.get_entry_count(); ++i) {
+			const RomArchiveEntry& entry = archive.get_entry(i);
+			string rom = archive.get_name(entry);
+			images[rom] = std::make_pair(archive.get_rom(entry), static_cast<size_t>(entry.size));
+			roms.push_back(rom);
+		}
+		std::sort(roms.begin(), roms.end());
+		size_t slash = directory.find_last_of("/\\");
+		directory = slash == string::npos ? "." : directory.substr(0, slash);
+	}
+	else {
+		roms = list_roms(directory);
+		for (const string& rom : roms) {
+			MappedFile file;
+			if (file.open(native_path(directory + "/" + rom)) && file.map()) {
+				vector<uint8_t>& image = files[rom];
+				image.assign(file.get_data(), file.get_data() + file.get_size());
+				images[rom] = std::make_pair(image.data(), image.size());
+			}
+			else {
+				cerr << "Open: " << rom << " error" << endl;
+			}
+		}
+	}
+	if (roms.empty()) {
+		cerr << "No ROMs in " << directory << endl;
+		return 2;
+	}
+	if (goldenPath.empty()) {
+		goldenPath = directory + "/goldens.txt";
+	}
+	map<string, uint64_t> goldens;
+	if (!update && !read_goldens(goldenPath, goldens)) {
+		return 2;
+	}
+
+	vector<ConformanceJob> jobs;
+	for (const string& rom : roms) {
+		for (int profile = 0; profile < PROFILE_COUNT; ++profile) {
+			ConformanceJob job;
+			job.rom = rom;
+			job.profile = profile;
+			job.loaded = false;
+			job.loadError = Chip8LoadError::NONE;
+			job.hash = 0;
+			job.millis = 0.0;
+			jobs.push_back(job);
+		}
+	}
+
+	auto start = Clock::now();
+	std::atomic<size_t> nextJob(0);
+	auto worker = [&]() {
+		for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+			auto image = images.find(jobs[i].rom);
+			if (image != images.end()) {
+				run_job(image->second, frames, engine, jobs[i]);
+			}
+		}
+	};
+	jobCount = std::max(1, std::min(jobCount, static_cast<int>(jobs.size())));
+	vector<std::thread> workers;
+	for (int i = 1; i < jobCount; ++i) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : workers) {
+		thread.join();
+	}
+	double wallMillis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	if (update) {
+		if (!write_goldens(goldenPath, jobs, frames)) {
+			return 2;
+		}
+		cout << "wrote " << jobs.size() << " goldens for " << frames << " frames to " << goldenPath << endl;
+		return 0;
+	}
+
+	int failures = 0;
+	cout << std::fixed << std::setprecision(1);
+	for (size_t first = 0; first < jobs.size(); first += PROFILE_COUNT) {
+		int passed = 0;
+		double millis = 0.0;
+		std::ostringstream problems;
+		for (size_t i = first; i < first + PROFILE_COUNT; ++i) {
+			const ConformanceJob& job = jobs[i];
+			string profile = profile_name(job.profile);
+			millis += job.millis;
+			if (!job.loaded) {
+				problems << "    " << profile << ": could not load, " << get_load_error_name(job.loadError) << endl;
+				continue;
+			}
+			auto golden = goldens.find(golden_key(job.rom, profile, frames));
+			if (golden == goldens.end()) {
+				problems << "    " << profile << ": no golden for " << frames << " frames, got " << hash_string(job.hash) << endl;
+			}
+			else if (golden->second != job.hash) {
+				problems << "    " << profile << ": expected " << hash_string(golden->second)
+					<< ", got " << hash_string(job.hash) << endl;
+			}
+			else {
+				++passed;
+			}
+		}
+		failures += PROFILE_COUNT - passed;
+		cout << (passed == PROFILE_COUNT ? "PASS " : "FAIL ") << std::left << std::setw(28) << jobs[first].rom << std::right
+			<< passed << "/" << PROFILE_COUNT << std::setw(10) << millis << " ms" << endl;
+		cout << problems.str();
+	}
+	cout << jobs.size() << " runs on " << jobCount << " threads in " << wallMillis << " ms, "
+		<< failures << " failure(s)" << endl;
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,294 @@
+// libFuzzer harness for the interpreter core, also buildable as a plain replay and throughput tool.
+//
+// Input layout:
+//   0-3    CXKK seed, little endian
+//   4      bits 0-2 quirks (resetVF, setVXtoVY, increamentI), bit 3 table engine
+//   5      number of key edges K, at most MAX_KEY_EVENTS
+//   6..    K edges of 3 bytes: instruction number (16 bit little endian), key in bits 0-3, bit 4 down
+//   rest   ROM image, cut at 3584 bytes
+//
+// Each input runs for at most CHIP8_FUZZ_STEPS instructions (default 1000) and stops early on a fault
+// or once the program counter stays put with no key edge left to change that (a jump to itself, FX0A).
+// Faults are counted and summarized at exit.
+// CHIP8_FUZZ_TRAP lists the ones to abort on instead (stack-overflow, stack-underflow, memory, pc, key,
+// unknown or all); every kind aborts in its own function so the fuzzer keeps them as separate crashes.
+//
+// chip8fuzz-run, the build without libFuzzer:
+//   chip8fuzz-run <input>...              run inputs, e.g. crash files, and print their fault
+//   chip8fuzz-run --random N [--seed S]   time N random inputs
+//   chip8fuzz-run --wrap <rom.ch8> <out>  write a ROM as an input with an empty header, for seed corpora
+#include "chip8.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+#ifdef _MSC_VER
+#define FUZZ_NOINLINE __declspec(noinline)
+#else
+#define FUZZ_NOINLINE __attribute__((noinline))
+#endif
+
+static constexpr size_t HEADER_SIZE = 6;
+static constexpr size_t KEY_EVENT_SIZE = 3;
+static constexpr int MAX_KEY_EVENTS = 32;
+static constexpr size_t MAX_ROM_SIZE = Chip8::MEMORY_SIZE - Chip8::PROGRAM_START;
+static constexpr int FAULT_KINDS = static_cast<int>(Chip8Fault::KEY_OUT_OF_RANGE) + 1;
+
+// One core for the whole process: every input starts from `_blank` with its ROM copied in,
+// instead of reset() clearing memory and load_rom() copying the font each time.
+class FuzzTarget {
+public:
+	FuzzTarget();
+	void run(const uint8_t* data, size_t size);
+	Chip8Fault get_fault() const { return _chip8.get_fault(); }
+	uint16_t get_fault_address() const { return _chip8.get_fault_address(); }
+	uint64_t get_instructions() const { return _instructions; }
+	void print_summary() const;
+private:
+	void check_fault();
+
+	Chip8 _chip8;
+	Chip8Snapshot _blank;
+	size_t _romSize;
+	int _stepBudget;
+	bool _traps[FAULT_KINDS];
+	uint64_t _runs;
+	uint64_t _instructions;
+	uint64_t _faults[FAULT_KINDS];
+};
+
+static const char* TRAP_NAMES[FAULT_KINDS] = { "", "unknown", "stack-overflow", "stack-underflow", "memory", "pc", "key" };
+
+FuzzTarget::FuzzTarget() : _romSize(0), _stepBudget(1000), _traps(), _runs(0), _instructions(0), _faults()
+{
+	_chip8.set_fault_logging(false);
+	_chip8.load_rom_from_memory(nullptr, 0);
+	_chip8.save_snapshot(_blank);
+
+	if (const char* steps = std::getenv("CHIP8_FUZZ_STEPS")) {
+		_stepBudget = std::max(std::atoi(steps), 1);
+	}
+	if (const char* traps = std::getenv("CHIP8_FUZZ_TRAP")) {
+		string list = string(",") + traps + ",";
+		for (int kind = 1; kind < FAULT_KINDS; ++kind) {
+			_traps[kind] = list.find(",all,") != string::npos
+				|| list.find(string(",") + TRAP_NAMES[kind] + ",") != string::npos;
+		}
+	}
+}
+
+void FuzzTarget::run(const uint8_t* data, size_t size)
+{
+	if (size < HEADER_SIZE) {
+		return;
+	}
+	uint32_t seed = data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24;
+	uint8_t flags = data[4];
+	int keyCount = std::min<int>(data[5], MAX_KEY_EVENTS);
+	size_t romOffset = HEADER_SIZE + keyCount * KEY_EVENT_SIZE;
+	if (size < romOffset) {
+		return;
+	}
+	size_t romSize = std::min(size - romOffset, MAX_ROM_SIZE);
+
+	// only the bytes the previous ROM touched need clearing
+	uint8_t* program = _blank.memory + Chip8::PROGRAM_START;
+	std::memcpy(program, data + romOffset, romSize);
+	if (_romSize > romSize) {
+		std::memset(program + romSize, 0, _romSize - romSize);
+	}
+	_romSize = romSize;
+	_chip8.load_snapshot(_blank);
+	_chip8.set_quirks(Chip8Quirks::from_bits(flags));
+	_chip8.set_engine(flags & 8 ? Chip8Engine::TABLE : Chip8Engine::SWITCH);
+	_chip8.set_seed(seed);
+	const uint8_t* keys = data + HEADER_SIZE;
+	for (int i = 0; i < keyCount; ++i, keys += KEY_EVENT_SIZE) {
+		_chip8.queue_key_event(keys[2] & 0xF, (keys[2] & 0x10) != 0, keys[0] | keys[1] << 8);
+	}
+
+	int instructionsPerFrame = _chip8.get_instructions_per_frame();
+	int steps = 0;
+	uint16_t programCounter = Chip8::PROGRAM_START;
+	while (steps < _stepBudget) {
+		if (steps > 0 && steps % instructionsPerFrame == 0) {
+			_chip8.countdown();
+		}
+		_chip8.step();
+		++steps;
+		if (_chip8.get_fault() != Chip8Fault::NONE) {
+			break;
+		}
+		uint16_t next = _chip8.get_registers().programCounter;
+		if (next == programCounter && _chip8.get_pending_key_events() == 0) {
+			break;
+		}
+		programCounter = next;
+	}
+	++_runs;
+	_instructions += steps;
+	check_fault();
+}
+
+FUZZ_NOINLINE static void trap_unknown_opcode(uint16_t address) { cerr << "unknown opcode at " << address << endl; std::abort(); }
+FUZZ_NOINLINE static void trap_stack_overflow(uint16_t address) { cerr << "stack overflow at " << address << endl; std::abort(); }
+FUZZ_NOINLINE static void trap_stack_underflow(uint16_t address) { cerr << "stack underflow at " << address << endl; std::abort(); }
+FUZZ_NOINLINE static void trap_memory(uint16_t address) { cerr << "memory out of bounds at " << address << endl; std::abort(); }
+FUZZ_NOINLINE static void trap_program_counter(uint16_t address) { cerr << "program counter out of bounds at " << address << endl; std::abort(); }
+FUZZ_NOINLINE static void trap_key(uint16_t address) { cerr << "key out of range at " << address << endl; std::abort(); }
+
+// A case per kind also gives the fuzzer a coverage edge per fault it reached.
+void FuzzTarget::check_fault()
+{
+	Chip8Fault fault = _chip8.get_fault();
+	int kind = static_cast<int>(fault);
+	++_faults[kind];
+	if (!_traps[kind]) {
+		return;
+	}
+	uint16_t address = _chip8.get_fault_address();
+	switch (fault) {
+	case Chip8Fault::UNKNOWN_OPCODE:
+		trap_unknown_opcode(address);
+		break;
+	case Chip8Fault::STACK_OVERFLOW:
+		trap_stack_overflow(address);
+		break;
+	case Chip8Fault::STACK_UNDERFLOW:
+		trap_stack_underflow(address);
+		break;
+	case Chip8Fault::MEMORY_OUT_OF_BOUNDS:
+		trap_memory(address);
+		break;
+	case Chip8Fault::PC_OUT_OF_BOUNDS:
+		trap_program_counter(address);
+		break;
+	case Chip8Fault::KEY_OUT_OF_RANGE:
+		trap_key(address);
+		break;
+	default:
+		break;
+	}
+}
+
+void FuzzTarget::print_summary() const
+{
+	if (_runs == 0) {
+		return;
+	}
+	cerr << "chip8fuzz: " << _runs << " runs, " << _instructions << " instructions";
+	for (int kind = 1; kind < FAULT_KINDS; ++kind) {
+		if (_faults[kind] > 0) {
+			cerr << ", " << get_fault_name(static_cast<Chip8Fault>(kind)) << " " << _faults[kind];
+		}
+	}
+	cerr << endl;
+}
+
+static FuzzTarget& target()
+{
+	static FuzzTarget fuzzTarget;
+	return fuzzTarget;
+}
+
+static void print_summary_at_exit()
+{
+	target().print_summary();
+}
+
+extern "C" int LLVMFuzzerInitialize(int*, char***)
+{
+	target();
+	std::atexit(print_summary_at_exit);
+	return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	target().run(data, size);
+	return 0;
+}
+
+#ifndef CHIP8_LIBFUZZER
+static bool read_file(const string& path, vector<uint8_t>& data)
+{
+	std::ifstream ifs(path, std::ifstream::binary);
+	if (!ifs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc == 4 && string(argv[1]) == "--wrap") {
+		vector<uint8_t> rom;
+		if (!read_file(argv[2], rom)) {
+			return 2;
+		}
+		vector<uint8_t> input(HEADER_SIZE, 0);
+		input.insert(input.end(), rom.begin(), rom.end());
+		std::ofstream ofs(argv[3], std::ofstream::binary);
+		ofs.write(reinterpret_cast<const char*>(input.data()), input.size());
+		return ofs.good() ? 0 : 2;
+	}
+
+	LLVMFuzzerInitialize(&argc, &argv);
+	if (argc >= 3 && string(argv[1]) == "--random") {
+		long count = std::atol(argv[2]);
+		uint32_t seed = argc == 5 && string(argv[3]) == "--seed" ? static_cast<uint32_t>(std::atol(argv[4])) : 1;
+		// generated up front so only the harness is timed
+		std::mt19937 random(seed);
+		vector<vector<uint8_t>> inputs(4096);
+		for (vector<uint8_t>& input : inputs) {
+			input.resize(HEADER_SIZE + random() % 512);
+			for (uint8_t& byte : input) {
+				byte = static_cast<uint8_t>(random());
+			}
+			input[5] &= 0x7;
+		}
+		auto start = std::chrono::steady_clock::now();
+		for (long i = 0; i < count; ++i) {
+			const vector<uint8_t>& input = inputs[i % inputs.size()];
+			LLVMFuzzerTestOneInput(input.data(), input.size());
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		cout << count << " inputs in " << std::fixed << std::setprecision(3) << seconds << " s, "
+			<< std::setprecision(0) << count / seconds << " executions/s, "
+			<< std::setprecision(1) << target().get_instructions() / seconds / 1e6 << " MIPS" << endl;
+		return 0;
+	}
+	if (argc < 2) {
+		cerr << "usage: chip8fuzz-run <input>... | --random N [--seed S] | --wrap <rom.ch8> <out>" << endl;
+		return 2;
+	}
+	for (int i = 1; i < argc; ++i) {
+		vector<uint8_t> input;
+		if (!read_file(argv[i], input)) {
+			return 2;
+		}
+		LLVMFuzzerTestOneInput(input.data(), input.size());
+		cout << argv[i] << ": " << get_fault_name(target().get_fault());
+		if (target().get_fault() != Chip8Fault::NONE) {
+			cout << " at " << std::hex << target().get_fault_address() << std::dec;
+		}
+		cout << endl;
+	}
+	return 0;
+}
+#endif
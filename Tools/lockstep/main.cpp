@@ -0,0 +1,373 @@
+// Runs a reference and a candidate engine side by side on the same ROM and input, compares their registers
+// after every instruction and their full state hashes every block of instructions. Engines that run several
+// instructions at once, like predecoded, run whole frames and are compared after each one.
+// Stops at the first divergence with a diff of both states.
+// usage: chip8lockstep [options] <rom.ch8 | rom directory>...
+//   --candidate NAME  engine checked against the switch interpreter (default table)
+//   --frames N        frames per run (default 3600)
+//   --block N         instructions between full state comparisons, registers are compared after each one (default 60)
+//   --input-seed N    random keypad edges from this seed, 0 runs without input (default 1)
+//   --all-quirks      run every ROM under all eight quirk combinations instead of the defaults
+//   --movie FILE      replay the input, seed, quirks and IPF of a movie; needs a single ROM
+#include "chip8.h"
+#include "movie.h"
+#include "romlist.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+struct EngineName {
+	Chip8Engine engine;
+	const char* name;
+	// only differs from the interpreter in run_frame()
+	bool isFrameBased;
+};
+
+static const EngineName ENGINES[] = {
+	{ Chip8Engine::SWITCH, "switch", false },
+	{ Chip8Engine::TABLE, "table", false },
+	{ Chip8Engine::PREDECODED, "predecoded", true }
+};
+
+static bool is_frame_based(Chip8Engine engine)
+{
+	for (const EngineName& entry : ENGINES) {
+		if (entry.engine == engine) {
+			return entry.isFrameBased;
+		}
+	}
+	return false;
+}
+
+static const char* engine_name(Chip8Engine engine)
+{
+	for (const EngineName& entry : ENGINES) {
+		if (entry.engine == engine) {
+			return entry.name;
+		}
+	}
+	return "?";
+}
+
+struct LockstepOptions {
+	LockstepOptions() : candidate(Chip8Engine::TABLE), frames(3600), block(60), inputSeed(1), allQuirks(false)
+	{}
+	Chip8Engine candidate;
+	int frames;
+	int block;
+	uint32_t inputSeed;
+	bool allQuirks;
+	string moviePath;
+};
+
+// Queues the same keypad edges into both cores.
+class InputSource {
+public:
+	InputSource(const Movie* movie, uint32_t seed) : _movie(movie), _seed(seed), _random(seed), _next(0), _keys(0)
+	{}
+	void queue_frame(uint32_t frame, int instructionsPerFrame, Chip8& reference, Chip8& candidate)
+	{
+		uint64_t frameStart = reference.get_ticks();
+		if (_movie) {
+			for (; _next < _movie->inputs.size() && _movie->inputs[_next].frame == frame; ++_next) {
+				toggle(_movie->inputs[_next].toggled, frameStart + _movie->inputs[_next].offset, reference, candidate);
+			}
+		}
+		else if (_seed != 0 && _random() % 8 == 0) {
+			toggle(1 << (_random() % Chip8::KEYPAD_COUNT), frameStart + _random() % instructionsPerFrame, reference, candidate);
+		}
+	}
+private:
+	void toggle(uint16_t toggled, uint64_t cycle, Chip8& reference, Chip8& candidate)
+	{
+		for (int key = 0; key < Chip8::KEYPAD_COUNT; ++key) {
+			if (toggled & (1 << key)) {
+				_keys ^= 1 << key;
+				bool down = (_keys & (1 << key)) != 0;
+				reference.queue_key_event(key, down, cycle);
+				candidate.queue_key_event(key, down, cycle);
+			}
+		}
+	}
+
+	const Movie* _movie;
+	uint32_t _seed;
+	std::mt19937 _random;
+	size_t _next;
+	uint16_t _keys;
+};
+
+static string quirks_name(const Chip8Quirks& quirks)
+{
+	string name;
+	if (quirks.resetVF) {
+		name += "resetVF ";
+	}
+	if (quirks.setVXtoVY) {
+		name += "setVXtoVY ";
+	}
+	if (quirks.increamentI) {
+		name += "incrementI ";
+	}
+	return name.empty() ? "none" : name.substr(0, name.size() - 1);
+}
+
+static bool same_registers(const Chip8Registers& a, const Chip8Registers& b)
+{
+	return a.programCounter == b.programCounter && a.I == b.I
+		&& std::equal(a.variables, a.variables + 16, b.variables)
+		&& a.stackPointer == b.stackPointer && std::equal(a.callStack, a.callStack + a.stackPointer, b.callStack)
+		&& a.timer == b.timer && a.soundTimer == b.soundTimer;
+}
+
+static void print_difference(const Chip8& reference, const Chip8& candidate)
+{
+	Chip8Registers a = reference.get_registers(), b = candidate.get_registers();
+	cout << std::hex << std::uppercase;
+	if (a.programCounter != b.programCounter) {
+		cout << "    PC: " << a.programCounter << " != " << b.programCounter << endl;
+	}
+	if (a.I != b.I) {
+		cout << "    I: " << a.I << " != " << b.I << endl;
+	}
+	for (int i = 0; i < 16; ++i) {
+		if (a.variables[i] != b.variables[i]) {
+			cout << "    V" << i << ": " << int(a.variables[i]) << " != " << int(b.variables[i]) << endl;
+		}
+	}
+	if (a.stackPointer != b.stackPointer || !std::equal(a.callStack, a.callStack + a.stackPointer, b.callStack)) {
+		cout << "    stack:";
+		for (int i = 0; i < a.stackPointer; ++i) {
+			cout << " " << a.callStack[i];
+		}
+		cout << " !=";
+		for (int i = 0; i < b.stackPointer; ++i) {
+			cout << " " << b.callStack[i];
+		}
+		cout << endl;
+	}
+	if (a.timer != b.timer || a.soundTimer != b.soundTimer) {
+		cout << "    timers: " << int(a.timer) << "/" << int(a.soundTimer)
+			<< " != " << int(b.timer) << "/" << int(b.soundTimer) << endl;
+	}
+	const uint8_t* memoryA = reference.get_memory();
+	const uint8_t* memoryB = candidate.get_memory();
+	int shown = 0, differing = 0;
+	for (int address = 0; address < Chip8::MEMORY_SIZE; ++address) {
+		if (memoryA[address] != memoryB[address]) {
+			if (shown++ < 8) {
+				cout << "    [" << address << "]: " << int(memoryA[address]) << " != " << int(memoryB[address]) << endl;
+			}
+			++differing;
+		}
+	}
+	if (differing > shown) {
+		cout << "    ... " << std::dec << differing << " memory bytes differ" << std::hex << endl;
+	}
+	const uint8_t* bitsA = reference.get_display_bits();
+	const uint8_t* bitsB = candidate.get_display_bits();
+	int pixels = 0;
+	for (int i = 0; i < Chip8::DISPLAY_ROWS * Chip8::DISPLAY_ROW_BYTES; ++i) {
+		for (uint8_t diff = bitsA[i] ^ bitsB[i]; diff; diff &= diff - 1) {
+			++pixels;
+		}
+	}
+	if (pixels > 0) {
+		cout << "    display: " << std::dec << pixels << " pixels differ" << endl;
+	}
+	cout << std::dec << std::nouppercase;
+}
+
+// Returns false on divergence, after printing where it happened.
+static bool run_lockstep(const string& path, Chip8Quirks quirks, const LockstepOptions& options, const Movie* movie)
+{
+	Chip8 reference, candidate;
+	if (!reference.load_rom(path) || !candidate.load_rom(path)) {
+		cout << "FAILED " << path << ": could not load" << endl;
+		return false;
+	}
+	if (movie && movie->romHash != reference.get_rom_hash()) {
+		cout << "FAILED " << path << ": ROM does not match the movie" << endl;
+		return false;
+	}
+	reference.set_engine(Chip8Engine::SWITCH);
+	candidate.set_engine(options.candidate);
+	// generated pathological ROMs fault on purpose; the engines are compared by state, not by their logs
+	reference.set_fault_logging(false);
+	candidate.set_fault_logging(false);
+
+	uint32_t seed = movie ? movie->seed : 1;
+	int instructionsPerFrame = movie ? movie->instructionsPerFrame : Chip8::DEFAULT_INSTRUCTIONS_PER_FRAME;
+	uint32_t frames = movie ? movie->frameCount : static_cast<uint32_t>(options.frames);
+	if (movie) {
+		quirks = movie->quirks;
+	}
+	for (Chip8* chip8 : { &reference, &candidate }) {
+		chip8->set_quirks(quirks);
+		chip8->set_seed(seed);
+		chip8->set_instructions_per_frame(instructionsPerFrame);
+	}
+
+	InputSource input(movie, options.inputSeed);
+	auto start = Clock::now();
+	int sinceCompare = 0;
+	// instruction count at which the full states last matched
+	uint64_t matched = 0;
+	for (uint32_t frame = 0; frame < frames; ++frame) {
+		input.queue_frame(frame, instructionsPerFrame, reference, candidate);
+		if (is_frame_based(options.candidate)) {
+			uint16_t address = reference.get_registers().programCounter;
+			reference.run_frame();
+			candidate.run_frame();
+			if (!same_registers(reference.get_registers(), candidate.get_registers())
+				|| reference.get_ticks() != candidate.get_ticks() || reference.state_hash() != candidate.state_hash()) {
+				cout << "DIVERGED " << path << " [" << quirks_name(quirks) << "] in frame " << frame
+					<< " (last full match at " << matched << "), which started at " << std::hex << std::uppercase
+					<< std::setfill('0') << std::setw(3) << address << std::setfill(' ') << std::dec << std::nouppercase
+					<< ", " << engine_name(Chip8Engine::SWITCH) << " != " << engine_name(options.candidate) << endl;
+				print_difference(reference, candidate);
+				return false;
+			}
+			matched = reference.get_ticks();
+			continue;
+		}
+		for (int i = 0; i < instructionsPerFrame; ++i) {
+			uint16_t address = reference.get_registers().programCounter;
+			uint16_t code = reference.fetch_code();
+			reference.step();
+			candidate.step();
+			bool diverged = !same_registers(reference.get_registers(), candidate.get_registers());
+			if (!diverged && ++sinceCompare >= options.block) {
+				sinceCompare = 0;
+				diverged = reference.state_hash() != candidate.state_hash();
+				if (!diverged) {
+					matched = reference.get_ticks();
+				}
+			}
+			if (diverged) {
+				cout << "DIVERGED " << path << " [" << quirks_name(quirks) << "] at frame " << frame
+					<< ", instruction " << reference.get_ticks() << " (last full match at " << matched << "), after "
+					<< std::hex << std::uppercase << std::setfill('0') << std::setw(4) << code << " at " << std::setw(3) << address
+					<< std::setfill(' ') << std::dec << std::nouppercase
+					<< ", " << engine_name(Chip8Engine::SWITCH) << " != " << engine_name(options.candidate) << endl;
+				print_difference(reference, candidate);
+				return false;
+			}
+		}
+		reference.countdown();
+		candidate.countdown();
+	}
+	if (reference.state_hash() != candidate.state_hash()) {
+		cout << "DIVERGED " << path << " [" << quirks_name(quirks) << "] after frame " << frames - 1
+			<< " (last full match at " << matched << ")" << endl;
+		print_difference(reference, candidate);
+		return false;
+	}
+	double millis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	cout << "OK " << path << " [" << quirks_name(quirks) << "] " << frames << " frames, "
+		<< reference.get_ticks() << " instructions, " << std::fixed << std::setprecision(1) << millis << " ms" << endl;
+	return true;
+}
+
+static bool is_rom_file(const string& path)
+{
+	return path.size() > 4 && path.compare(path.size() - 4, 4, ".ch8") == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	LockstepOptions options;
+	vector<string> roms;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--candidate" && hasValue) {
+			string name = argv[++i];
+			bool found = false;
+			for (const EngineName& entry : ENGINES) {
+				if (name == entry.name) {
+					options.candidate = entry.engine;
+					found = true;
+				}
+			}
+			if (!found) {
+				cerr << "Unknown engine " << name << endl;
+				return 2;
+			}
+		}
+		else if (arg == "--frames" && hasValue) {
+			options.frames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--block" && hasValue) {
+			options.block = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--input-seed" && hasValue) {
+			options.inputSeed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--all-quirks") {
+			options.allQuirks = true;
+		}
+		else if (arg == "--movie" && hasValue) {
+			options.moviePath = argv[++i];
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			if (is_rom_file(arg)) {
+				roms.push_back(arg);
+			}
+			else {
+				for (const string& name : list_roms(arg)) {
+					roms.push_back(arg + "/" + name);
+				}
+			}
+		}
+		else {
+			roms.clear();
+			break;
+		}
+	}
+	if (roms.empty()) {
+		cerr << "usage: chip8lockstep [--candidate NAME] [--frames N] [--block N] [--input-seed N] [--all-quirks]"
+			" [--movie FILE] <rom.ch8 | rom directory>..." << endl;
+		return 2;
+	}
+
+	Movie movie;
+	if (!options.moviePath.empty()) {
+		if (roms.size() != 1) {
+			cerr << "--movie needs exactly one ROM" << endl;
+			return 2;
+		}
+		if (!movie.load(options.moviePath)) {
+			return 2;
+		}
+	}
+
+	int runs = 0, diverged = 0;
+	for (const string& rom : roms) {
+		int profiles = options.allQuirks && options.moviePath.empty() ? 8 : 1;
+		for (int profile = 0; profile < profiles; ++profile) {
+			Chip8Quirks quirks = Chip8Quirks::from_bits(profile);
+			++runs;
+			if (!run_lockstep(rom, quirks, options, options.moviePath.empty() ? nullptr : &movie)) {
+				++diverged;
+				break;
+			}
+		}
+	}
+	cout << runs << " run(s), " << diverged << " failure(s)" << endl;
+	return diverged > 0 ? 1 : 0;
+}
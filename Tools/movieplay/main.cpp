@@ -0,0 +1,57 @@
+// Replays a movie recorded by the interpreter as fast as possible and verifies its state checkpoints.
+// usage: movieplay <rom.ch8> <movie.c8m>
+#include "chip8.h"
+#include "movie.h"
+#include <iostream>
+#include <chrono>
+#include <string>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3) {
+		cerr << "usage: movieplay <rom.ch8> <movie.c8m>" << endl;
+		return 2;
+	}
+	string romPath(argv[1]), moviePath(argv[2]);
+
+	Movie movie;
+	if (!movie.load(moviePath)) {
+		return 2;
+	}
+	Chip8 chip8;
+	if (!chip8.load_rom(romPath)) {
+		return 2;
+	}
+	if (chip8.get_rom_hash() != movie.romHash) {
+		cerr << "ROM does not match the movie (" << std::hex << chip8.get_rom_hash()
+			<< " != " << movie.romHash << ")" << endl;
+		return 1;
+	}
+
+	MovieReplayResult result;
+	auto start = std::chrono::steady_clock::now();
+	bool ok = replay_movie(movie, chip8, result);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	cout << "frames: " << result.framesRun << "/" << movie.frameCount
+		<< ", inputs: " << movie.inputs.size()
+		<< ", checkpoints verified: " << result.checkpointsVerified << "/" << movie.checkpoints.size() << endl;
+	cout << "time: " << seconds * 1000.0 << " ms, " << (seconds > 0 ? result.framesRun / seconds : 0.0) << " frames/s, "
+		<< (seconds > 0 ? chip8.get_ticks() / seconds / 1e6 : 0.0) << " MIPS" << endl;
+	if (!ok && result.overflowFrame >= 0) {
+		cout << "frame " << result.overflowFrame << " has more key edges than the key queue holds ("
+			<< Chip8::KEY_EVENT_CAPACITY << ")" << endl;
+		return 1;
+	}
+	if (!ok) {
+		cout << "DESYNC at frame " << result.desyncFrame << endl;
+		return 1;
+	}
+	cout << "OK, final state " << std::hex << result.finalHash << endl;
+	return 0;
+}
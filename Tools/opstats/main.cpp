@@ -0,0 +1,150 @@
+// Profiles which opcodes ROMs execute, alone and in sequences of two and three, to pick what the
+// PREDECODED engine fuses.
+// usage: chip8opstats [options] <rom.ch8 | rom directory>...
+//   --frames N      frames per ROM (default 3600)
+//   --top N         sequences listed per length (default 20)
+//   --input-seed N  random keypad edges from this seed, 0 runs without input (default 1)
+// Sequences are counted by opcode form, e.g. "AMMM DXYN", and only along the path actually taken,
+// so a skipped instruction does not count as following the skip.
+#include "chip8.h"
+#include "romlist.h"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::map;
+
+// The opcode form as the interpreter decodes it, e.g. 8XY4 or FX1E.
+static string opcode_form(uint16_t code)
+{
+	static const char* const MAIN[16] = {
+		"0NNN", "1MMM", "2MMM", "3XKK", "4XKK", "5XY0", "6XKK", "7XKK", "8XYN", "9XY0", "AMMM", "BMMM", "CXKK", "DXYN", "EXNN", "FXNN"
+	};
+	static const char DIGITS[] = "0123456789ABCDEF";
+	string form = MAIN[code >> 12];
+	switch (code & 0xF000) {
+	case 0x0000:
+		return (code & 0xFF) == 0xE0 ? "00E0" : (code & 0xFF) == 0xEE ? "00EE" : form;
+	case 0x8000:
+		form[3] = DIGITS[code & 0xF];
+		return form;
+	case 0xE000:
+		return (code & 0xF) == 0xE ? "EX9E" : (code & 0xF) == 0x1 ? "EXA1" : form;
+	case 0xF000:
+		form[2] = DIGITS[(code >> 4) & 0xF];
+		form[3] = DIGITS[code & 0xF];
+		return form;
+	default:
+		return form;
+	}
+}
+
+static void print_top(const map<string, uint64_t>& counts, uint64_t total, int top, const string& title)
+{
+	vector<std::pair<uint64_t, string>> sorted;
+	for (const auto& entry : counts) {
+		sorted.push_back(std::make_pair(entry.second, entry.first));
+	}
+	std::sort(sorted.rbegin(), sorted.rend());
+	cout << title << endl;
+	for (int i = 0; i < top && i < static_cast<int>(sorted.size()); ++i) {
+		cout << "  " << std::left << std::setw(16) << sorted[i].second << std::right << std::setw(12) << sorted[i].first
+			<< std::fixed << std::setprecision(2) << std::setw(8) << 100.0 * sorted[i].first / std::max<uint64_t>(total, 1) << "%" << endl;
+	}
+}
+
+static bool is_rom_file(const string& path)
+{
+	return path.size() > 4 && path.compare(path.size() - 4, 4, ".ch8") == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int frames = 3600, top = 20;
+	uint32_t inputSeed = 1;
+	vector<string> roms;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--frames" && hasValue) {
+			frames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--top" && hasValue) {
+			top = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--input-seed" && hasValue) {
+			inputSeed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			if (is_rom_file(arg)) {
+				roms.push_back(arg);
+			}
+			else {
+				for (const string& name : list_roms(arg)) {
+					roms.push_back(arg + "/" + name);
+				}
+			}
+		}
+		else {
+			roms.clear();
+			break;
+		}
+	}
+	if (roms.empty()) {
+		cerr << "usage: chip8opstats [--frames N] [--top N] [--input-seed N] <rom.ch8 | rom directory>..." << endl;
+		return 2;
+	}
+
+	map<string, uint64_t> singles, pairs, triples;
+	uint64_t total = 0;
+	Chip8 chip8;
+	chip8.set_fault_logging(false);
+	for (const string& rom : roms) {
+		if (!chip8.load_rom(rom)) {
+			cerr << "Load: " << rom << ": " << get_load_error_name(chip8.get_load_error()) << endl;
+			continue;
+		}
+		chip8.set_seed(1);
+		std::mt19937 random(inputSeed);
+		uint16_t keys = 0;
+		string previous[2];
+		for (int frame = 0; frame < frames; ++frame) {
+			if (inputSeed != 0 && random() % 8 == 0) {
+				int key = random() % Chip8::KEYPAD_COUNT;
+				keys ^= 1 << key;
+				chip8.queue_key_event(key, (keys & (1 << key)) != 0, chip8.get_ticks() + random() % chip8.get_instructions_per_frame());
+			}
+			for (int i = 0; i < chip8.get_instructions_per_frame(); ++i) {
+				string form = opcode_form(chip8.fetch_code());
+				chip8.step();
+				++total;
+				++singles[form];
+				if (!previous[1].empty()) {
+					++pairs[previous[1] + " " + form];
+				}
+				if (!previous[0].empty()) {
+					++triples[previous[0] + " " + previous[1] + " " + form];
+				}
+				previous[0] = previous[1];
+				previous[1] = form;
+			}
+			chip8.countdown();
+		}
+	}
+	cout << roms.size() << " ROM(s), " << total << " instructions" << endl;
+	print_top(singles, total, top, "opcodes:");
+	print_top(pairs, total, top, "pairs:");
+	print_top(triples, total, top, "triples:");
+	return 0;
+}
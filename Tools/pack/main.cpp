@@ -0,0 +1,204 @@
+// Packs ROMs into one archive that batch runners map instead of opening every file, and lists archives.
+// usage:
+//   chip8pack [--meta FILE] -o <archive.c8pk> <rom.ch8 | rom directory>...
+//   chip8pack --list <archive.c8pk>
+//
+// The metadata file has one line per ROM, '#' starts a comment:
+//   <rom name> [quirks=none|resetVF+setVXtoVY+incrementI] [ipf=N]
+#include "chip8.h"
+#include "mappedfile.h"
+#include "romarchive.h"
+#include "romlist.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::map;
+
+static bool parse_quirks(const string& value, Chip8Quirks& quirks)
+{
+	quirks = Chip8Quirks();
+	if (value == "none") {
+		return true;
+	}
+	std::istringstream names(value);
+	string name;
+	while (std::getline(names, name, '+')) {
+		if (name == "resetVF") {
+			quirks.resetVF = true;
+		}
+		else if (name == "setVXtoVY") {
+			quirks.setVXtoVY = true;
+		}
+		else if (name == "incrementI") {
+			quirks.increamentI = true;
+		}
+		else {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool read_metadata(const string& path, map<string, RomArchiveMetadata>& metadata)
+{
+	std::ifstream ifs(native_path(path));
+	if (!ifs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	string line;
+	for (int number = 1; std::getline(ifs, line); ++number) {
+		std::istringstream fields(line);
+		string rom, field;
+		if (!(fields >> rom) || rom[0] == '#') {
+			continue;
+		}
+		RomArchiveMetadata& entry = metadata[rom];
+		while (fields >> field) {
+			size_t equals = field.find('=');
+			string key = field.substr(0, equals), value = equals == string::npos ? "" : field.substr(equals + 1);
+			bool ok = true;
+			if (key == "quirks") {
+				ok = parse_quirks(value, entry.quirks);
+				entry.flags |= ROM_ARCHIVE_HAS_QUIRKS;
+			}
+			else if (key == "ipf") {
+				entry.instructionsPerFrame = std::atoi(value.c_str());
+				ok = entry.instructionsPerFrame > 0 && entry.instructionsPerFrame <= UINT16_MAX;
+				entry.flags |= ROM_ARCHIVE_HAS_INSTRUCTIONS_PER_FRAME;
+			}
+			else {
+				ok = false;
+			}
+			if (!ok) {
+				cerr << path << ":" << number << ": bad field " << field << endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// A directory adds its .ch8 files, anything else is taken as a ROM file. Entries are named by file name.
+static bool add_path(RomArchiveWriter& writer, const string& path, const map<string, RomArchiveMetadata>& metadata)
+{
+	vector<string> roms = list_roms(path);
+	vector<pair<string, string>> files;
+	for (const string& rom : roms) {
+		files.push_back(std::make_pair(rom, path + "/" + rom));
+	}
+	if (roms.empty()) {
+		size_t slash = path.find_last_of("/\\");
+		files.push_back(std::make_pair(slash == string::npos ? path : path.substr(slash + 1), path));
+	}
+	for (const pair<string, string>& file : files) {
+		MappedFile mapped;
+		if (!mapped.open(native_path(file.second)) || !mapped.map()) {
+			cerr << "Open: " << file.second << " error" << endl;
+			return false;
+		}
+		auto entry = metadata.find(file.first);
+		if (!writer.add(file.first, mapped.get_data(), mapped.get_size(),
+			entry == metadata.end() ? RomArchiveMetadata() : entry->second)) {
+			cerr << "skipped " << file.second << ": duplicate or too large" << endl;
+		}
+	}
+	return true;
+}
+
+static string quirks_string(const Chip8Quirks& quirks)
+{
+	string names;
+	if (quirks.resetVF) {
+		names += "resetVF";
+	}
+	if (quirks.setVXtoVY) {
+		names += names.empty() ? "setVXtoVY" : "+setVXtoVY";
+	}
+	if (quirks.increamentI) {
+		names += names.empty() ? "incrementI" : "+incrementI";
+	}
+	return names.empty() ? "none" : names;
+}
+
+static int list_archive(const string& path)
+{
+	RomArchive archive;
+	if (!archive.open(path)) {
+		return 2;
+	}
+	for (size_t i = 0; i < archive.get_entry_count(); ++i) {
+		const RomArchiveEntry& entry = archive.get_entry(i);
+		RomArchiveMetadata metadata = archive.get_metadata(entry);
+		cout << std::hex << std::setw(16) << std::setfill('0') << entry.hash << std::dec << std::setfill(' ')
+			<< std::setw(6) << entry.size << "  " << archive.get_name(entry);
+		if (metadata.flags & ROM_ARCHIVE_HAS_QUIRKS) {
+			cout << " quirks=" << quirks_string(metadata.quirks);
+		}
+		if (metadata.flags & ROM_ARCHIVE_HAS_INSTRUCTIONS_PER_FRAME) {
+			cout << " ipf=" << metadata.instructionsPerFrame;
+		}
+		cout << endl;
+	}
+	cout << archive.get_entry_count() << " ROM(s)" << endl;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc == 3 && string(argv[1]) == "--list") {
+		return list_archive(argv[2]);
+	}
+	string output, metaPath;
+	vector<string> inputs;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-o" && hasValue) {
+			output = argv[++i];
+		}
+		else if (arg == "--meta" && hasValue) {
+			metaPath = argv[++i];
+		}
+		else if (arg.compare(0, 1, "-") != 0) {
+			inputs.push_back(arg);
+		}
+		else {
+			inputs.clear();
+			break;
+		}
+	}
+	if (output.empty() || inputs.empty()) {
+		cerr << "usage: chip8pack [--meta FILE] -o <archive.c8pk> <rom.ch8 | rom directory>..." << endl
+			<< "       chip8pack --list <archive.c8pk>" << endl;
+		return 2;
+	}
+
+	map<string, RomArchiveMetadata> metadata;
+	if (!metaPath.empty() && !read_metadata(metaPath, metadata)) {
+		return 2;
+	}
+	RomArchiveWriter writer;
+	for (const string& input : inputs) {
+		if (!add_path(writer, input, metadata)) {
+			return 2;
+		}
+	}
+	if (!writer.write(output)) {
+		return 2;
+	}
+	cout << "packed " << writer.get_rom_count() << " ROM(s) into " << output << endl;
+	return 0;
+}
@@ -0,0 +1,204 @@
+// Builds the compiled-in ROM database and looks ROMs up in it.
+// usage:
+//   chip8romdb --generate ROM/romdb.txt > Chip8/romdb_table.h
+//   chip8romdb [--override FILE] <rom.ch8>...
+//
+// A lookup also runs analyze_rom() and lists the quirks whose setting changes a value the ROM reads,
+// flagging ROMs that depend on a quirk their profile leaves to the user: those need a quirks= entry.
+// --generate searches for the smallest table, at least twice the number of ROMs, and a seed for
+// rom_profile_slot() under which every ROM gets a slot of its own, so a lookup is a single probe.
+#include "chip8.h"
+#include "analyzer.h"
+#include "hash.h"
+#include "mappedfile.h"
+#include "romdb.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+static constexpr uint64_t MAX_SEED_TRIES = 1000000;
+
+static string quirks_string(uint8_t quirks)
+{
+	string names;
+	if (quirks & 1) {
+		names += "resetVF";
+	}
+	if (quirks & 2) {
+		names += names.empty() ? "setVXtoVY" : "+setVXtoVY";
+	}
+	if (quirks & 4) {
+		names += names.empty() ? "incrementI" : "+incrementI";
+	}
+	return names.empty() ? "none" : names;
+}
+
+static string escape(const string& text)
+{
+	string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+static bool find_seed(const vector<RomProfile>& profiles, int slotBits, uint64_t& seed)
+{
+	for (seed = 1; seed <= MAX_SEED_TRIES; ++seed) {
+		std::set<uint32_t> slots;
+		bool collided = false;
+		for (const RomProfile& profile : profiles) {
+			if (!slots.insert(rom_profile_slot(profile.hash, seed, slotBits)).second) {
+				collided = true;
+				break;
+			}
+		}
+		if (!collided) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int generate(const string& path)
+{
+	std::ifstream ifs(native_path(path));
+	if (!ifs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return 2;
+	}
+	vector<RomProfile> profiles;
+	std::deque<string> names;
+	if (!RomDatabase::read_profiles(ifs, path, profiles, names)) {
+		return 2;
+	}
+	std::set<uint64_t> hashes;
+	for (const RomProfile& profile : profiles) {
+		if (!hashes.insert(profile.hash).second) {
+			cerr << path << ": " << profile.name << " is listed twice" << endl;
+			return 2;
+		}
+	}
+
+	int slotBits = 1;
+	while ((size_t(1) << slotBits) < profiles.size() * 2) {
+		++slotBits;
+	}
+	uint64_t seed;
+	while (!find_seed(profiles, slotBits, seed)) {
+		++slotBits;
+	}
+	vector<const RomProfile*> slots(size_t(1) << slotBits, nullptr);
+	for (const RomProfile& profile : profiles) {
+		slots[rom_profile_slot(profile.hash, seed, slotBits)] = &profile;
+	}
+
+	cout << "// Generated by chip8romdb --generate " << path << ", do not edit." << endl;
+	cout << "// Included by romdb.cpp only; " << profiles.size() << " ROM(s) in " << slots.size() << " slots." << endl;
+	cout << "#ifndef CHIP8_ROMDB_TABLE_H" << endl;
+	cout << "#define CHIP8_ROMDB_TABLE_H" << endl << endl;
+	cout << "#include \"romdb.h\"" << endl << endl;
+	cout << "constexpr uint64_t ROM_PROFILE_SEED = " << seed << ";" << endl;
+	cout << "constexpr int ROM_PROFILE_SLOT_BITS = " << slotBits << ";" << endl << endl;
+	cout << "// hash, name, flags, quirks, instructions per frame, anti-flicker" << endl;
+	cout << "constexpr RomProfile ROM_PROFILES[] = {" << endl;
+	for (const RomProfile* profile : slots) {
+		if (!profile) {
+			cout << "\t{ 0, nullptr, 0, 0, 0, false }," << endl;
+			continue;
+		}
+		cout << "\t{ 0x" << std::hex << std::setw(16) << std::setfill('0') << profile->hash << std::dec << std::setfill(' ')
+			<< "ULL, \"" << escape(profile->name) << "\", " << static_cast<int>(profile->flags) << ", "
+			<< static_cast<int>(profile->quirks) << ", " << profile->instructionsPerFrame << ", "
+			<< (profile->antiFlicker ? "true" : "false") << " }," << endl;
+	}
+	cout << "};" << endl << endl;
+	cout << "#endif // CHIP8_ROMDB_TABLE_H" << endl;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc == 3 && string(argv[1]) == "--generate") {
+		return generate(argv[2]);
+	}
+	RomDatabase database;
+	vector<string> roms;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--override" && i + 1 < argc) {
+			string path = argv[++i];
+			if (!database.load_overrides(path)) {
+				cerr << "could not read " << path << endl;
+				return 2;
+			}
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			roms.push_back(arg);
+		}
+		else {
+			roms.clear();
+			break;
+		}
+	}
+	if (roms.empty()) {
+		cerr << "usage: chip8romdb --generate <romdb.txt>" << endl
+			<< "       chip8romdb [--override FILE] <rom.ch8>..." << endl;
+		return 2;
+	}
+
+	int unknown = 0;
+	Chip8 chip8;
+	Chip8Analysis analysis;
+	for (const string& rom : roms) {
+		MappedFile file;
+		const RomProfile* profile = nullptr;
+		uint8_t dependencies = 0;
+		if (file.open(native_path(rom)) && file.map() && chip8.load_rom_from_memory(file.get_data(), file.get_size())) {
+			profile = database.find(chip8.get_rom_hash());
+			analyze_rom(chip8.get_memory(), file.get_size(), analysis);
+			dependencies = analysis.get_quirk_dependencies();
+		}
+		if (!profile) {
+			cout << rom << ": unknown";
+			if (dependencies != 0) {
+				cout << ", reads " << quirks_string(dependencies) << ": needs a quirks= entry";
+			}
+			cout << endl;
+			++unknown;
+			continue;
+		}
+		cout << rom << ": " << profile->name;
+		if (profile->flags & ROM_PROFILE_HAS_QUIRKS) {
+			cout << " quirks=" << quirks_string(profile->quirks);
+		}
+		if (profile->flags & ROM_PROFILE_HAS_INSTRUCTIONS_PER_FRAME) {
+			cout << " ipf=" << profile->instructionsPerFrame;
+		}
+		if (profile->flags & ROM_PROFILE_HAS_ANTI_FLICKER) {
+			cout << " antiflicker=" << (profile->antiFlicker ? "on" : "off");
+		}
+		if (dependencies != 0) {
+			cout << " (reads " << quirks_string(dependencies);
+			if (!(profile->flags & ROM_PROFILE_HAS_QUIRKS)) {
+				cout << ", needs a quirks= entry";
+			}
+			cout << ")";
+		}
+		cout << endl;
+	}
+	return unknown > 0 ? 1 : 0;
+}
@@ -0,0 +1,520 @@
+// Generates synthetic CHIP-8 programs with a chosen opcode mix, for benchmarks and for differential and fuzz testing.
+// usage: chip8romgen [options] <output.ch8 | output directory>
+//   --profile NAME    alu, call, sprite, selfmod, memory or mixed (default mixed)
+//   --seed N          generator seed, the same seed always gives the same ROM (default 1)
+//   --count N         write N ROMs with consecutive seeds into the output directory (default 1)
+//   --length N        instructions in the loop body (default 64)
+//   --iterations N    times the body runs before the program halts, 1 to 255 (default 100)
+//   --depth N         call depth reached by nested and recursive subroutines, 1 to 16 (default 12)
+//   --forever         restart from the top instead of halting
+//   --pathological    also emit stack overflow/underflow, I past the end of memory and keys past F
+//
+// Every program has the same shape:
+//   0x200  6XKK...         random V0-VC, VE = iterations
+//   loop:  body            snippets drawn from the profile
+//          7EFF 3E00 1loop VE -= 1, repeat while it is not 0
+//   halt:  1halt           (or 1200 with --forever)
+//          subroutines
+// The body never writes VD or VE, and every skip is followed by a plain instruction of its own snippet,
+// so without --pathological the program always reaches `halt`, after iterations * (body + 3) instructions
+// plus the skips taken. Memory writes stay in 0x600-0xDFF, away from the code.
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using std::map;
+
+static constexpr uint16_t PROGRAM_START = 0x200;
+// code has to end below the scratch area the memory snippets write to
+static constexpr uint16_t SCRATCH_START = 0x600;
+static constexpr uint16_t SCRATCH_END = 0xE00;
+// V0-VC are free for the body, VD counts recursion and VE counts loop iterations
+static constexpr int BODY_REGISTERS = 13;
+static constexpr int MAX_DEPTH = 16;
+
+enum class SnippetKind {
+	ALU,
+	SKIP,
+	CALL,
+	SPRITE,
+	SELF_MODIFY,
+	MEMORY,
+	TIMER,
+	// --pathological only
+	FAULT,
+	COUNT
+};
+
+static const char* SNIPPET_NAMES[] = { "alu", "skip", "call", "sprite", "selfmod", "memory", "timer", "fault" };
+
+struct Profile {
+	const char* name;
+	// relative weight of each SnippetKind except FAULT
+	int weights[static_cast<int>(SnippetKind::FAULT)];
+};
+
+static const Profile PROFILES[] = {
+	//               alu skip call sprite selfmod memory timer
+	{ "alu",       { 70, 20,  2,   2,     0,      4,     2 } },
+	{ "call",      { 30, 10, 50,   2,     0,      5,     3 } },
+	{ "sprite",    { 20,  5,  2,  65,     0,      6,     2 } },
+	{ "selfmod",   { 30, 10,  2,   5,    45,      6,     2 } },
+	{ "memory",    { 20,  5,  2,   5,     3,     63,     2 } },
+	{ "mixed",     { 35, 15, 12,  12,     6,     15,     5 } }
+};
+
+struct GeneratorOptions {
+	GeneratorOptions() : profile(&PROFILES[5]), seed(1), count(1), length(64), iterations(100), depth(12),
+		forever(false), pathological(false)
+	{}
+	const Profile* profile;
+	uint32_t seed;
+	int count;
+	int length;
+	int iterations;
+	int depth;
+	bool forever;
+	bool pathological;
+};
+
+// A tiny assembler: opcodes whose low 12 bits are a label address are patched once the layout is known.
+class RomGenerator {
+public:
+	RomGenerator(const GeneratorOptions& options, uint32_t seed) : _options(options), _random(seed), _nextLabel(0),
+		_leaf(-1), _chain(-1), _recursive(-1), _stackBreaker(-1), _kindCounts()
+	{}
+	bool generate(vector<uint8_t>& rom);
+	const int* get_kind_counts() const { return _kindCounts; }
+	size_t get_body_size() const { return _bodySize; }
+private:
+	int random(int count) { return static_cast<int>(_random() % static_cast<uint32_t>(count)); }
+	int body_register() { return random(BODY_REGISTERS); }
+	uint16_t address() const { return static_cast<uint16_t>(PROGRAM_START + _code.size() * 2); }
+	int new_label() { return _nextLabel++; }
+	void place(int label) { _labels[label] = address(); }
+	void emit(uint16_t code) { _code.push_back(code); }
+	void emit_to(uint16_t code, int label)
+	{
+		_fixups.push_back(std::make_pair(_code.size(), label));
+		_code.push_back(code);
+	}
+	uint16_t scratch_address(int reserve)
+	{
+		return static_cast<uint16_t>(SCRATCH_START + random(SCRATCH_END - SCRATCH_START - reserve));
+	}
+
+	SnippetKind pick_kind();
+	void emit_alu();
+	void emit_skip();
+	void emit_call();
+	void emit_sprite();
+	void emit_self_modify();
+	void emit_memory();
+	void emit_timer();
+	void emit_fault();
+	void emit_subroutines();
+
+	const GeneratorOptions& _options;
+	std::mt19937 _random;
+	vector<uint16_t> _code;
+	map<int, uint16_t> _labels;
+	vector<std::pair<size_t, int>> _fixups;
+	int _nextLabel;
+	// subroutine entry labels, -1 until a snippet calls them
+	int _leaf, _chain, _recursive, _stackBreaker;
+	int _kindCounts[static_cast<int>(SnippetKind::COUNT)];
+	size_t _bodySize;
+};
+
+SnippetKind RomGenerator::pick_kind()
+{
+	if (_options.pathological && random(16) == 0) {
+		return SnippetKind::FAULT;
+	}
+	const int* weights = _options.profile->weights;
+	int total = 0;
+	for (int i = 0; i < static_cast<int>(SnippetKind::FAULT); ++i) {
+		total += weights[i];
+	}
+	int pick = random(total);
+	for (int i = 0; i < static_cast<int>(SnippetKind::FAULT); ++i) {
+		if (pick < weights[i]) {
+			return static_cast<SnippetKind>(i);
+		}
+		pick -= weights[i];
+	}
+	return SnippetKind::ALU;
+}
+
+void RomGenerator::emit_alu()
+{
+	int x = body_register(), y = body_register();
+	static const uint16_t arithmetic[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+	switch (random(4)) {
+	case 0:
+		emit(static_cast<uint16_t>(0x6000 | x << 8 | random(256)));
+		break;
+	case 1:
+		emit(static_cast<uint16_t>(0x7000 | x << 8 | random(256)));
+		break;
+	case 2:
+		emit(static_cast<uint16_t>(0xC000 | x << 8 | random(256)));
+		break;
+	default:
+		// VF as the destination too, the flag write must win over the result
+		if (random(8) == 0) {
+			x = 0xF;
+		}
+		emit(static_cast<uint16_t>(0x8000 | x << 8 | y << 4 | arithmetic[random(9)]));
+		break;
+	}
+}
+
+void RomGenerator::emit_skip()
+{
+	int x = body_register(), y = body_register();
+	switch (random(5)) {
+	case 0:
+		emit(static_cast<uint16_t>(0x3000 | x << 8 | random(256)));
+		break;
+	case 1:
+		emit(static_cast<uint16_t>(0x4000 | x << 8 | random(256)));
+		break;
+	case 2:
+		emit(static_cast<uint16_t>(0x5000 | x << 8 | y << 4));
+		break;
+	case 3:
+		emit(static_cast<uint16_t>(0x9000 | x << 8 | y << 4));
+		break;
+	default:
+		// keypad skips need a key number in range
+		emit(static_cast<uint16_t>(0x6000 | x << 8 | random(16)));
+		emit(static_cast<uint16_t>(0xE000 | x << 8 | (random(2) ? 0x9E : 0xA1)));
+		break;
+	}
+	emit_alu();
+}
+
+void RomGenerator::emit_call()
+{
+	switch (random(3)) {
+	case 0:
+		if (_leaf < 0) {
+			_leaf = new_label();
+		}
+		emit_to(0x2000, _leaf);
+		break;
+	case 1:
+		if (_chain < 0) {
+			_chain = new_label();
+		}
+		emit_to(0x2000, _chain);
+		break;
+	default:
+		if (_recursive < 0) {
+			_recursive = new_label();
+		}
+		// the call from the body is one level, each recursion one more
+		emit(static_cast<uint16_t>(0x6D00 | (_options.depth - 1)));
+		emit_to(0x2000, _recursive);
+		break;
+	}
+}
+
+void RomGenerator::emit_sprite()
+{
+	int x = body_register(), y = body_register();
+	switch (random(4)) {
+	case 0:
+		emit(0x00E0);
+		break;
+	case 1:
+		// a font glyph, VX may be past F and point I into the program, which is still in memory
+		emit(static_cast<uint16_t>(0xF029 | x << 8));
+		break;
+	case 2:
+		emit(static_cast<uint16_t>(0xA000 | random(SCRATCH_START - 16)));
+		break;
+	default:
+		emit(static_cast<uint16_t>(0xA000 | scratch_address(16)));
+		break;
+	}
+	emit(static_cast<uint16_t>(0xD000 | x << 8 | y << 4 | (1 + random(15))));
+}
+
+// Stores V0 over the low byte of the 6XKK right after it, which then runs with the new value.
+void RomGenerator::emit_self_modify()
+{
+	int x = body_register();
+	emit(static_cast<uint16_t>(0xA000 | (address() + 5)));
+	emit(0xF055);
+	emit(static_cast<uint16_t>(0x6000 | x << 8 | random(256)));
+}
+
+void RomGenerator::emit_memory()
+{
+	int x = body_register();
+	emit(static_cast<uint16_t>(0xA000 | scratch_address(256 + 16)));
+	if (random(2)) {
+		emit(static_cast<uint16_t>(0xF01E | body_register() << 8));
+	}
+	switch (random(3)) {
+	case 0:
+		emit(static_cast<uint16_t>(0xF033 | x << 8));
+		break;
+	case 1:
+		emit(static_cast<uint16_t>(0xF055 | x << 8));
+		break;
+	default:
+		// VD and VE are loaded too when x is past C, keep x inside the body registers
+		emit(static_cast<uint16_t>(0xF065 | x << 8));
+		break;
+	}
+}
+
+void RomGenerator::emit_timer()
+{
+	int x = body_register();
+	switch (random(3)) {
+	case 0:
+		emit(static_cast<uint16_t>(0xF015 | x << 8));
+		break;
+	case 1:
+		emit(static_cast<uint16_t>(0xF018 | x << 8));
+		break;
+	default:
+		emit(static_cast<uint16_t>(0xF007 | x << 8));
+		break;
+	}
+}
+
+void RomGenerator::emit_fault()
+{
+	switch (random(4)) {
+	case 0:
+		// recursion deeper than the 16 entry stack
+		if (_stackBreaker < 0) {
+			_stackBreaker = new_label();
+		}
+		emit_to(0x2000, _stackBreaker);
+		break;
+	case 1:
+		// return with an empty stack
+		emit(0x00EE);
+		break;
+	case 2:
+		// I past the end of memory, then a read through it
+		emit(static_cast<uint16_t>(0xAFF0 | random(16)));
+		emit(static_cast<uint16_t>(0x6000 | 0xFF));
+		emit(0xF01E);
+		emit(static_cast<uint16_t>(0xFF65));
+		break;
+	default:
+		// a key number past F
+		emit(static_cast<uint16_t>(0x6000 | 0x80 | random(128)));
+		emit(0xE09E);
+		emit(0x6000);
+		break;
+	}
+}
+
+void RomGenerator::emit_subroutines()
+{
+	if (_leaf >= 0) {
+		place(_leaf);
+		emit_alu();
+		emit_alu();
+		emit(0x00EE);
+	}
+	if (_chain >= 0) {
+		// _options.depth levels, each calling the next
+		int label = _chain;
+		for (int level = 0; level < _options.depth; ++level) {
+			place(label);
+			emit_alu();
+			if (level + 1 < _options.depth) {
+				label = new_label();
+				emit_to(0x2000, label);
+			}
+			emit(0x00EE);
+		}
+	}
+	if (_recursive >= 0) {
+		//        3D00      skip while VD == 0
+		//        1go
+		//        00EE
+		// go:    7DFF      VD -= 1
+		//        alu
+		//        2rec
+		//        00EE
+		int go = new_label();
+		place(_recursive);
+		emit(0x3D00);
+		emit_to(0x1000, go);
+		emit(0x00EE);
+		place(go);
+		emit(0x7DFF);
+		emit_alu();
+		emit_to(0x2000, _recursive);
+		emit(0x00EE);
+	}
+	if (_stackBreaker >= 0) {
+		place(_stackBreaker);
+		emit_alu();
+		emit_to(0x2000, _stackBreaker);
+		emit(0x00EE);
+	}
+}
+
+bool RomGenerator::generate(vector<uint8_t>& rom)
+{
+	for (int x = 0; x < BODY_REGISTERS; ++x) {
+		emit(static_cast<uint16_t>(0x6000 | x << 8 | random(256)));
+	}
+	emit(static_cast<uint16_t>(0x6E00 | _options.iterations));
+	emit(static_cast<uint16_t>(0xA000 | SCRATCH_START));
+
+	int loop = new_label(), halt = new_label();
+	place(loop);
+	size_t bodyStart = _code.size();
+	while (_code.size() - bodyStart < static_cast<size_t>(_options.length)) {
+		SnippetKind kind = pick_kind();
+		++_kindCounts[static_cast<int>(kind)];
+		switch (kind) {
+		case SnippetKind::ALU: emit_alu(); break;
+		case SnippetKind::SKIP: emit_skip(); break;
+		case SnippetKind::CALL: emit_call(); break;
+		case SnippetKind::SPRITE: emit_sprite(); break;
+		case SnippetKind::SELF_MODIFY: emit_self_modify(); break;
+		case SnippetKind::MEMORY: emit_memory(); break;
+		case SnippetKind::TIMER: emit_timer(); break;
+		default: emit_fault(); break;
+		}
+	}
+	_bodySize = _code.size() - bodyStart;
+	emit(0x7EFF);
+	emit(0x3E00);
+	emit_to(0x1000, loop);
+	place(halt);
+	if (_options.forever) {
+		emit(0x1000 | PROGRAM_START);
+	}
+	else {
+		emit_to(0x1000, halt);
+	}
+	emit_subroutines();
+
+	if (address() > SCRATCH_START) {
+		cerr << "Program does not fit below " << std::hex << SCRATCH_START << std::dec
+			<< ", use a smaller --length or --depth" << endl;
+		return false;
+	}
+	for (const auto& fixup : _fixups) {
+		_code[fixup.first] = static_cast<uint16_t>((_code[fixup.first] & 0xF000) | _labels[fixup.second]);
+	}
+	rom.clear();
+	for (uint16_t code : _code) {
+		rom.push_back(static_cast<uint8_t>(code >> 8));
+		rom.push_back(static_cast<uint8_t>(code & 0xFF));
+	}
+	return true;
+}
+
+static bool write_rom(const string& path, const vector<uint8_t>& rom)
+{
+	std::ofstream ofs(path, std::ofstream::binary);
+	if (!ofs.is_open()) {
+		cerr << "Open: " << path << " error" << endl;
+		return false;
+	}
+	ofs.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+	return ofs.good();
+}
+
+int main(int argc, char* argv[])
+{
+	GeneratorOptions options;
+	string output;
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--profile" && hasValue) {
+			string name = argv[++i];
+			options.profile = nullptr;
+			for (const Profile& profile : PROFILES) {
+				if (name == profile.name) {
+					options.profile = &profile;
+				}
+			}
+			usage = options.profile == nullptr;
+		}
+		else if (arg == "--seed" && hasValue) {
+			options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--count" && hasValue) {
+			options.count = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--length" && hasValue) {
+			options.length = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--iterations" && hasValue) {
+			options.iterations = std::min(std::max(std::atoi(argv[++i]), 1), 255);
+		}
+		else if (arg == "--depth" && hasValue) {
+			options.depth = std::min(std::max(std::atoi(argv[++i]), 1), MAX_DEPTH);
+		}
+		else if (arg == "--forever") {
+			options.forever = true;
+		}
+		else if (arg == "--pathological") {
+			options.pathological = true;
+		}
+		else if (arg.compare(0, 2, "--") != 0 && output.empty()) {
+			output = arg;
+		}
+		else {
+			usage = true;
+		}
+	}
+	if (usage || output.empty()) {
+		cerr << "usage: chip8romgen [--profile alu|call|sprite|selfmod|memory|mixed] [--seed N] [--count N] [--length N]"
+			" [--iterations N] [--depth N] [--forever] [--pathological] <output.ch8 | output directory>" << endl;
+		return 2;
+	}
+
+	for (int i = 0; i < options.count; ++i) {
+		uint32_t seed = options.seed + i;
+		RomGenerator generator(options, seed);
+		vector<uint8_t> rom;
+		if (!generator.generate(rom)) {
+			return 1;
+		}
+		string path = options.count == 1 ? output
+			: output + "/" + options.profile->name + "-" + std::to_string(seed) + ".ch8";
+		if (!write_rom(path, rom)) {
+			return 1;
+		}
+		cout << path << ": " << rom.size() << " bytes, " << generator.get_body_size() << " body instructions, snippets";
+		const int* counts = generator.get_kind_counts();
+		for (int kind = 0; kind < static_cast<int>(SnippetKind::COUNT); ++kind) {
+			if (counts[kind] > 0) {
+				cout << " " << SNIPPET_NAMES[kind] << "=" << counts[kind];
+			}
+		}
+		cout << endl;
+	}
+	return 0;
+}
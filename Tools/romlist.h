@@ -0,0 +1,43 @@
+#ifndef ROM_LIST_H
+#define ROM_LIST_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Sorted names of the .ch8 files in `directory`, without the directory.
+inline std::vector<std::string> list_roms(const std::string& directory)
+{
+	std::vector<std::string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "\\*.ch8").c_str(), &data);
+	if (find != INVALID_HANDLE_VALUE) {
+		do {
+			names.push_back(data.cFileName);
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir) {
+		while (dirent* entry = readdir(dir)) {
+			std::string name = entry->d_name;
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ch8") == 0) {
+				names.push_back(name);
+			}
+		}
+		closedir(dir);
+	}
+#endif
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+#endif // ROM_LIST_H
@@ -0,0 +1,398 @@
+// Stands in for a service driving chip8server: opens sessions over the socket, steps them with random key
+// input in rounds, one pipelined batch of requests per round, and replays every session on a local Chip8
+// (seeded the same way) to check each frame the server returns and the final state hashes.
+// usage: chip8client [options] <socket path> <rom.ch8 | rom directory>...
+//   --sessions N    sessions, given the ROMs in turn and the eight quirk profiles in turn (default 64)
+//   --frames N      frames to run each session (default 600)
+//   --step N        frames per STEP request, at most MAX_STEP_FRAMES, followed by a GET_FRAME (default 1)
+//   --input-seed N  random key edges from this seed, about one per session every half second; 0 runs without input (default 1)
+#include "chip8.h"
+#include "mappedfile.h"
+#include "romlist.h"
+#include "protocol.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using namespace chip8server;
+
+typedef std::chrono::steady_clock Clock;
+
+struct ClientOptions {
+	ClientOptions() : sessions(64), frames(600), step(1), inputSeed(1)
+	{}
+	int sessions;
+	int frames;
+	int step;
+	uint32_t inputSeed;
+};
+
+struct Reply {
+	ResponseHeader header;
+	vector<uint8_t> payload;
+	// position among the replies of its batch as they arrived
+	size_t order;
+};
+
+// Queues requests and exchanges them with the server one batch at a time.
+class ServerLink {
+public:
+	ServerLink() : _fd(-1), _nextRequest(1), _batchStart(1), _bytesSent(0), _bytesReceived(0)
+	{}
+	~ServerLink()
+	{
+		if (_fd >= 0) {
+			close(_fd);
+		}
+	}
+	bool connect(const string& path);
+	// Queues a request and returns its index in the batch.
+	size_t request(uint32_t session, Command command, const vector<uint8_t>& payload = vector<uint8_t>());
+	// Sends the batch and collects a reply for each request, by index. Reads while it writes, so a batch
+	// larger than the socket buffers cannot stall both sides.
+	bool exchange(vector<Reply>& replies);
+	uint64_t get_bytes_sent() const { return _bytesSent; }
+	uint64_t get_bytes_received() const { return _bytesReceived; }
+private:
+	int _fd;
+	uint32_t _nextRequest;
+	uint32_t _batchStart;
+	vector<uint8_t> _output;
+	vector<uint8_t> _input;
+	uint64_t _bytesSent;
+	uint64_t _bytesReceived;
+};
+
+bool ServerLink::connect(const string& path)
+{
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	return _fd >= 0 && ::connect(_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+}
+
+size_t ServerLink::request(uint32_t session, Command command, const vector<uint8_t>& payload)
+{
+	RequestHeader header;
+	header.size = static_cast<uint32_t>(payload.size());
+	header.requestId = _nextRequest++;
+	header.session = session;
+	header.command = command;
+	put_request_header(_output, header);
+	_output.insert(_output.end(), payload.begin(), payload.end());
+	return header.requestId - _batchStart;
+}
+
+bool ServerLink::exchange(vector<Reply>& replies)
+{
+	size_t expected = _nextRequest - _batchStart;
+	replies.assign(expected, Reply());
+	size_t received = 0;
+	size_t sent = 0;
+	uint8_t buffer[65536];
+	while (received < expected) {
+		pollfd fd = { _fd, POLLIN, 0 };
+		if (sent < _output.size()) {
+			fd.events |= POLLOUT;
+		}
+		if (poll(&fd, 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if ((fd.revents & POLLOUT) && sent < _output.size()) {
+			ssize_t count = send(_fd, _output.data() + sent, _output.size() - sent, MSG_DONTWAIT);
+			if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				return false;
+			}
+			sent += std::max<ssize_t>(count, 0);
+		}
+		if (!(fd.revents & (POLLIN | POLLHUP | POLLERR))) {
+			continue;
+		}
+		ssize_t count = recv(_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			return false;
+		}
+		if (count < 0) {
+			continue;
+		}
+		_bytesReceived += count;
+		_input.insert(_input.end(), buffer, buffer + count);
+		size_t offset = 0;
+		while (_input.size() - offset >= RESPONSE_HEADER_SIZE) {
+			ResponseHeader header = get_response_header(_input.data() + offset);
+			if (_input.size() - offset < RESPONSE_HEADER_SIZE + header.size) {
+				break;
+			}
+			size_t index = header.requestId - _batchStart;
+			if (header.requestId < _batchStart || index >= expected) {
+				return false;
+			}
+			const uint8_t* payload = _input.data() + offset + RESPONSE_HEADER_SIZE;
+			replies[index].header = header;
+			replies[index].payload.assign(payload, payload + header.size);
+			replies[index].order = received++;
+			offset += RESPONSE_HEADER_SIZE + header.size;
+		}
+		_input.erase(_input.begin(), _input.begin() + offset);
+	}
+	_bytesSent += _output.size();
+	_output.clear();
+	_batchStart = _nextRequest;
+	return true;
+}
+
+struct ClientSession {
+	uint32_t id;
+	std::unique_ptr<Chip8> reference;
+	// the frame rebuilt from the deltas the server sent
+	uint8_t frame[FRAME_ROWS * FRAME_ROW_BYTES];
+	uint16_t keypad;
+};
+
+static bool is_rom_file(const string& path)
+{
+	return path.size() > 4 && path.compare(path.size() - 4, 4, ".ch8") == 0;
+}
+
+static bool check_status(const Reply& reply, const char* what)
+{
+	if (reply.header.status != OK) {
+		cerr << what << ": status " << static_cast<int>(reply.header.status) << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	ClientOptions options;
+	string socketPath;
+	vector<string> paths;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--sessions" && hasValue) {
+			options.sessions = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--frames" && hasValue) {
+			options.frames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--step" && hasValue) {
+			options.step = std::min(std::max(std::atoi(argv[++i]), 1), static_cast<int>(MAX_STEP_FRAMES));
+		}
+		else if (arg == "--input-seed" && hasValue) {
+			options.inputSeed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg.compare(0, 2, "--") != 0 && socketPath.empty()) {
+			socketPath = arg;
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			if (is_rom_file(arg)) {
+				paths.push_back(arg);
+			}
+			else {
+				for (const string& name : list_roms(arg)) {
+					paths.push_back(arg + "/" + name);
+				}
+			}
+		}
+		else {
+			paths.clear();
+			break;
+		}
+	}
+	if (paths.empty()) {
+		cerr << "usage: chip8client [--sessions N] [--frames N] [--step N] [--input-seed N] <socket path> <rom.ch8 | rom directory>..." << endl;
+		return 2;
+	}
+	vector<vector<uint8_t>> roms;
+	for (const string& path : paths) {
+		MappedFile file;
+		if (file.open(native_path(path)) && file.map() && file.get_size() <= static_cast<size_t>(Chip8::MAX_ROM_SIZE)) {
+			roms.push_back(vector<uint8_t>(file.get_data(), file.get_data() + file.get_size()));
+		}
+		else {
+			cerr << "Open: " << path << " error" << endl;
+		}
+	}
+	if (roms.empty()) {
+		return 2;
+	}
+	ServerLink link;
+	if (!link.connect(socketPath)) {
+		cerr << "Connect: " << socketPath << " " << std::strerror(errno) << endl;
+		return 1;
+	}
+
+	auto start = Clock::now();
+	vector<ClientSession> sessions(options.sessions);
+	vector<Reply> replies;
+	for (int i = 0; i < options.sessions; ++i) {
+		link.request(0, CREATE);
+	}
+	if (!link.exchange(replies)) {
+		cerr << "Connection lost" << endl;
+		return 1;
+	}
+	for (int i = 0; i < options.sessions; ++i) {
+		if (!check_status(replies[i], "CREATE") || replies[i].payload.size() != 4) {
+			return 1;
+		}
+		ClientSession& session = sessions[i];
+		session.id = get_u32(replies[i].payload.data());
+		session.reference.reset(new Chip8());
+		session.reference->set_fault_logging(false);
+		std::memset(session.frame, 0, sizeof(session.frame));
+		session.keypad = 0;
+		const vector<uint8_t>& rom = roms[i % roms.size()];
+		uint8_t quirks = static_cast<uint8_t>(i % 8);
+		session.reference->load_rom_from_memory(rom.data(), rom.size());
+		session.reference->set_quirks(Chip8Quirks::from_bits(quirks));
+		link.request(session.id, LOAD_ROM, rom);
+		link.request(session.id, SET_QUIRKS, vector<uint8_t>(1, quirks));
+		vector<uint8_t> seed;
+		put_u32(seed, static_cast<uint32_t>(i + 1));
+		session.reference->set_seed(static_cast<uint32_t>(i + 1));
+		link.request(session.id, SET_SEED, seed);
+	}
+	if (!link.exchange(replies)) {
+		cerr << "Connection lost" << endl;
+		return 1;
+	}
+	for (int i = 0; i < options.sessions; ++i) {
+		const Reply& load = replies[i * 3];
+		if (!check_status(load, "LOAD_ROM") || !check_status(replies[i * 3 + 1], "SET_QUIRKS")
+			|| !check_status(replies[i * 3 + 2], "SET_SEED")) {
+			return 1;
+		}
+		if (load.payload.size() != 8 || get_u64(load.payload.data()) != sessions[i].reference->get_rom_hash()) {
+			cerr << "LOAD_ROM: ROM hash differs" << endl;
+			return 1;
+		}
+	}
+
+	std::mt19937 random(options.inputSeed);
+	std::uniform_int_distribution<int> keyChance(0, 29);
+	uint64_t requests = static_cast<uint64_t>(options.sessions) * 4;
+	uint64_t frameReplies = 0;
+	uint64_t frameBytes = 0;
+	int frameMismatches = 0;
+	for (int frame = 0; frame < options.frames; frame += options.step) {
+		uint32_t frames = static_cast<uint32_t>(std::min(options.step, options.frames - frame));
+		vector<uint8_t> step;
+		put_u32(step, frames);
+		vector<size_t> stepIndex(options.sessions);
+		for (int i = 0; i < options.sessions; ++i) {
+			ClientSession& session = sessions[i];
+			if (options.inputSeed != 0 && keyChance(random) < static_cast<int>(frames)) {
+				int key = random() % Chip8::KEYPAD_COUNT;
+				session.keypad ^= 1 << key;
+				bool down = (session.keypad & (1 << key)) != 0;
+				vector<uint8_t> edge;
+				edge.push_back(static_cast<uint8_t>(key));
+				edge.push_back(down ? 1 : 0);
+				link.request(session.id, KEY, edge);
+				session.reference->queue_key_event(key, down, session.reference->get_ticks());
+				++requests;
+			}
+			stepIndex[i] = link.request(session.id, STEP, step);
+			link.request(session.id, GET_FRAME);
+			requests += 2;
+			for (uint32_t j = 0; j < frames; ++j) {
+				session.reference->run_frame();
+			}
+		}
+		if (!link.exchange(replies)) {
+			cerr << "Connection lost" << endl;
+			return 1;
+		}
+		for (int i = 0; i < options.sessions; ++i) {
+			ClientSession& session = sessions[i];
+			const Reply& stepped = replies[stepIndex[i]];
+			const Reply& shown = replies[stepIndex[i] + 1];
+			if (stepIndex[i] > 0 && replies[stepIndex[i] - 1].header.command == KEY && !check_status(replies[stepIndex[i] - 1], "KEY")) {
+				return 1;
+			}
+			if (!check_status(stepped, "STEP") || !check_status(shown, "GET_FRAME")) {
+				return 1;
+			}
+			if (!apply_frame_delta(shown.payload.data(), shown.payload.size(), session.frame)) {
+				cerr << "GET_FRAME: malformed delta" << endl;
+				return 1;
+			}
+			++frameReplies;
+			frameBytes += RESPONSE_HEADER_SIZE + shown.payload.size();
+			if (stepped.payload.size() != 8 || get_u64(stepped.payload.data()) != session.reference->get_ticks()
+				|| std::memcmp(session.frame, session.reference->get_display_bits(), sizeof(session.frame)) != 0) {
+				++frameMismatches;
+			}
+		}
+	}
+
+	for (const ClientSession& session : sessions) {
+		link.request(session.id, GET_HASH);
+		link.request(session.id, DESTROY);
+	}
+	// a destroyed session is gone for good
+	link.request(sessions[0].id, GET_HASH);
+	requests += static_cast<uint64_t>(options.sessions) * 2 + 1;
+	if (!link.exchange(replies)) {
+		cerr << "Connection lost" << endl;
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	int hashMismatches = 0;
+	for (int i = 0; i < options.sessions; ++i) {
+		const Reply& hash = replies[i * 2];
+		if (!check_status(hash, "GET_HASH") || !check_status(replies[i * 2 + 1], "DESTROY")) {
+			return 1;
+		}
+		if (hash.payload.size() != 16 || get_u64(hash.payload.data()) != sessions[i].reference->state_hash()
+			|| get_u64(hash.payload.data() + 8) != sessions[i].reference->get_ticks()) {
+			++hashMismatches;
+		}
+	}
+	if (replies.back().header.status != NO_SESSION) {
+		cerr << "GET_HASH after DESTROY: status " << static_cast<int>(replies.back().header.status) << endl;
+		return 1;
+	}
+	// pipelined in the same batch as the DESTROY, so it must not be answered ahead of it
+	if (replies.back().order < replies[1].order) {
+		cerr << "GET_HASH after DESTROY: answered before the DESTROY" << endl;
+		return 1;
+	}
+
+	cout << options.sessions << " sessions of " << roms.size() << " ROM(s), " << options.frames << " frames in steps of "
+		<< options.step << ": " << requests << " requests in " << std::fixed << std::setprecision(2) << seconds << " s ("
+		<< std::setprecision(0) << requests / seconds << " requests/s)" << endl;
+	cout << std::setprecision(1) << static_cast<double>(frameBytes) / std::max<uint64_t>(frameReplies, 1)
+		<< " bytes per frame reply against " << RESPONSE_HEADER_SIZE + 4 + FRAME_ROWS * FRAME_ROW_BYTES << " for a full frame, "
+		<< link.get_bytes_sent() << " bytes sent, " << link.get_bytes_received() << " received" << endl;
+	cout << frameMismatches << " frame(s) and " << hashMismatches << " final state(s) differ from the local replay" << endl;
+	return frameMismatches + hashMismatches > 0 ? 1 : 0;
+}
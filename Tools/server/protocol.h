@@ -0,0 +1,191 @@
+#ifndef CHIP8_SERVER_PROTOCOL_H
+#define CHIP8_SERVER_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// The chip8server wire format, shared with chip8client. Every message is a fixed header followed by
+// `size` payload bytes, all integers little endian:
+//   request   u32 size, u32 requestId, u32 session, u8 command, u8[3] reserved
+//   response  u32 size, u32 requestId, u8 status, u8 command, u8[2] reserved
+// A response echoes the requestId and command of its request. Requests for one session are answered in
+// order; requests for different sessions run on different workers and may be answered out of order.
+namespace chip8server {
+
+const uint32_t REQUEST_HEADER_SIZE = 16;
+const uint32_t RESPONSE_HEADER_SIZE = 12;
+// larger than any ROM; a request announcing more is a protocol error and closes the connection
+const uint32_t MAX_PAYLOAD_SIZE = 4096;
+// packed 1bpp rows of Chip8::get_display_bits()
+const int FRAME_ROWS = 32;
+const int FRAME_ROW_BYTES = 8;
+// one minute of frames; a STEP blocks every session on its worker, so a longer run is split by the client
+const uint32_t MAX_STEP_FRAMES = 3600;
+
+enum Command : uint8_t {
+	// session ignored -> u32 session
+	CREATE = 1,
+	// -> nothing; the session id is not reused while the server runs
+	DESTROY = 2,
+	// ROM image -> u64 ROM hash
+	LOAD_ROM = 3,
+	// u8 bits: bit 0 resetVF, bit 1 setVXtoVY, bit 2 increamentI -> nothing
+	SET_QUIRKS = 4,
+	// u8 key, u8 down -> nothing; the edge lands before the next instruction the session runs
+	KEY = 5,
+	// u32 frames, at most MAX_STEP_FRAMES -> u64 ticks after the last frame
+	STEP = 6,
+	// nothing -> u32 changedRows, then FRAME_ROW_BYTES per set bit from row 0 up, each XORed with that row
+	// as this session last returned it (all clear before the first GET_FRAME)
+	GET_FRAME = 7,
+	// nothing -> u64 Chip8::state_hash(), u64 ticks
+	GET_HASH = 8,
+	// u32 seed for CXKK -> nothing; a new session draws its seed from std::random_device
+	SET_SEED = 9
+};
+
+enum Status : uint8_t {
+	OK = 0,
+	UNKNOWN_COMMAND = 1,
+	// not a session this connection created, or already destroyed
+	NO_SESSION = 2,
+	// payload of the wrong size or out of range
+	BAD_PAYLOAD = 3,
+	// the ROM did not load, see Chip8LoadError
+	LOAD_FAILED = 4,
+	// KEY with the session's key queue full; step and send the edge again
+	KEY_QUEUE_FULL = 5,
+	// STEP before a ROM is loaded
+	NO_ROM = 6
+};
+
+struct RequestHeader {
+	uint32_t size;
+	uint32_t requestId;
+	uint32_t session;
+	uint8_t command;
+};
+
+struct ResponseHeader {
+	uint32_t size;
+	uint32_t requestId;
+	uint8_t status;
+	uint8_t command;
+};
+
+inline void put_u32(std::vector<uint8_t>& out, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i) {
+		out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+}
+
+inline void put_u64(std::vector<uint8_t>& out, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i) {
+		out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+}
+
+inline uint32_t get_u32(const uint8_t* data)
+{
+	return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8
+		| static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+inline uint64_t get_u64(const uint8_t* data)
+{
+	return static_cast<uint64_t>(get_u32(data)) | static_cast<uint64_t>(get_u32(data + 4)) << 32;
+}
+
+inline void put_request_header(std::vector<uint8_t>& out, const RequestHeader& header)
+{
+	put_u32(out, header.size);
+	put_u32(out, header.requestId);
+	put_u32(out, header.session);
+	out.push_back(header.command);
+	out.insert(out.end(), 3, 0);
+}
+
+inline RequestHeader get_request_header(const uint8_t* data)
+{
+	RequestHeader header;
+	header.size = get_u32(data);
+	header.requestId = get_u32(data + 4);
+	header.session = get_u32(data + 8);
+	header.command = data[12];
+	return header;
+}
+
+inline void put_response_header(std::vector<uint8_t>& out, const ResponseHeader& header)
+{
+	put_u32(out, header.size);
+	put_u32(out, header.requestId);
+	out.push_back(header.status);
+	out.push_back(header.command);
+	out.insert(out.end(), 2, 0);
+}
+
+inline ResponseHeader get_response_header(const uint8_t* data)
+{
+	ResponseHeader header;
+	header.size = get_u32(data);
+	header.requestId = get_u32(data + 4);
+	header.status = data[8];
+	header.command = data[9];
+	return header;
+}
+
+// Writes the rows of frame that differ from last as a GET_FRAME payload and makes last equal frame.
+inline void put_frame_delta(std::vector<uint8_t>& out, const uint8_t* frame, uint8_t* last)
+{
+	size_t maskAt = out.size();
+	put_u32(out, 0);
+	uint32_t changedRows = 0;
+	for (int row = 0; row < FRAME_ROWS; ++row) {
+		const uint8_t* from = frame + row * FRAME_ROW_BYTES;
+		uint8_t* to = last + row * FRAME_ROW_BYTES;
+		uint8_t changed = 0;
+		for (int i = 0; i < FRAME_ROW_BYTES; ++i) {
+			changed |= from[i] ^ to[i];
+		}
+		if (changed == 0) {
+			continue;
+		}
+		changedRows |= 1u << row;
+		for (int i = 0; i < FRAME_ROW_BYTES; ++i) {
+			out.push_back(from[i] ^ to[i]);
+			to[i] = from[i];
+		}
+	}
+	for (int i = 0; i < 4; ++i) {
+		out[maskAt + i] = static_cast<uint8_t>(changedRows >> (i * 8));
+	}
+}
+
+// Applies a GET_FRAME payload to frame. Returns false when size does not match the row mask.
+inline bool apply_frame_delta(const uint8_t* data, size_t size, uint8_t* frame)
+{
+	if (size < 4) {
+		return false;
+	}
+	uint32_t changedRows = get_u32(data);
+	size_t offset = 4;
+	for (int row = 0; row < FRAME_ROWS; ++row) {
+		if (!(changedRows & (1u << row))) {
+			continue;
+		}
+		if (offset + FRAME_ROW_BYTES > size) {
+			return false;
+		}
+		for (int i = 0; i < FRAME_ROW_BYTES; ++i) {
+			frame[row * FRAME_ROW_BYTES + i] ^= data[offset++];
+		}
+	}
+	return offset == size;
+}
+
+}
+
+#endif // CHIP8_SERVER_PROTOCOL_H
@@ -0,0 +1,533 @@
+// Serves Chip8 sessions over a local UNIX domain socket so other processes can drive emulators without
+// linking the library; the wire format is in protocol.h. One thread polls the socket and every connection,
+// sessions are spread over a pool of workers and each session stays on its worker, so its requests run
+// in order without locking the core.
+// usage: chip8server [options] <socket path>
+//   --workers N   worker threads (default: hardware concurrency)
+#include "chip8.h"
+#include "protocol.h"
+#include <iostream>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using namespace chip8server;
+
+namespace {
+
+// a connection whose replies pile up past this is not read from until it takes them
+const size_t MAX_PENDING_OUTPUT = 1 << 20;
+
+int g_wakeFds[2] = { -1, -1 };
+volatile std::sig_atomic_t g_stop = 0;
+
+// Wakes the poll loop, from a worker with replies to send or from the signal handler.
+void wake_poll()
+{
+	char byte = 0;
+	ssize_t written = write(g_wakeFds[1], &byte, 1);
+	(void)written;
+}
+
+void on_signal(int)
+{
+	g_stop = 1;
+	wake_poll();
+}
+
+bool set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+struct Connection {
+	explicit Connection(int fd) : fd(fd), closed(false)
+	{}
+	// poll thread only
+	int fd;
+	vector<uint8_t> input;
+	std::unordered_set<uint32_t> sessions;
+	// replies not yet sent, appended by the workers
+	std::mutex outputMutex;
+	vector<uint8_t> output;
+	bool closed;
+
+	void reply(const RequestHeader& request, Status status, const vector<uint8_t>& payload)
+	{
+		ResponseHeader header;
+		header.size = static_cast<uint32_t>(payload.size());
+		header.requestId = request.requestId;
+		header.status = status;
+		header.command = request.command;
+		std::lock_guard<std::mutex> lock(outputMutex);
+		if (closed) {
+			return;
+		}
+		put_response_header(output, header);
+		output.insert(output.end(), payload.begin(), payload.end());
+	}
+};
+
+struct Job {
+	Job() : rejected(OK)
+	{}
+	// null for the DESTROY a closing connection sends for its sessions
+	std::shared_ptr<Connection> connection;
+	RequestHeader header;
+	vector<uint8_t> payload;
+	// the status to answer with instead of running the request, when the poll thread turned it down
+	Status rejected;
+};
+
+struct Session {
+	std::unique_ptr<Chip8> chip8;
+	// the frame as GET_FRAME last returned it
+	uint8_t lastFrame[FRAME_ROWS * FRAME_ROW_BYTES];
+};
+
+class Worker {
+public:
+	Worker() : _stop(false)
+	{}
+	void start() { _thread = std::thread(&Worker::run, this); }
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_ready.notify_one();
+		_thread.join();
+	}
+	void post(Job&& job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_jobs.push_back(std::move(job));
+		}
+		_ready.notify_one();
+	}
+private:
+	void run();
+	Status execute(const Job& job, vector<uint8_t>& payload);
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _ready;
+	std::deque<Job> _jobs;
+	bool _stop;
+	// worker thread only
+	std::unordered_map<uint32_t, Session> _sessions;
+};
+
+void Worker::run()
+{
+	vector<Job> jobs;
+	vector<uint8_t> payload;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_ready.wait(lock, [this] { return _stop || !_jobs.empty(); });
+			if (_stop) {
+				return;
+			}
+			jobs.assign(std::make_move_iterator(_jobs.begin()), std::make_move_iterator(_jobs.end()));
+			_jobs.clear();
+		}
+		bool replied = false;
+		for (const Job& job : jobs) {
+			payload.clear();
+			Status status = execute(job, payload);
+			if (job.connection) {
+				job.connection->reply(job.header, status, payload);
+				replied = true;
+			}
+		}
+		jobs.clear();
+		if (replied) {
+			wake_poll();
+		}
+	}
+}
+
+Status Worker::execute(const Job& job, vector<uint8_t>& payload)
+{
+	const RequestHeader& header = job.header;
+	if (job.rejected != OK) {
+		return job.rejected;
+	}
+	if (header.command == CREATE) {
+		Session& session = _sessions[header.session];
+		session.chip8.reset(new Chip8());
+		session.chip8->set_fault_logging(false);
+		std::memset(session.lastFrame, 0, sizeof(session.lastFrame));
+		put_u32(payload, header.session);
+		return OK;
+	}
+	auto found = _sessions.find(header.session);
+	if (found == _sessions.end()) {
+		return NO_SESSION;
+	}
+	Chip8& chip8 = *found->second.chip8;
+	const vector<uint8_t>& data = job.payload;
+	switch (header.command) {
+	case DESTROY:
+		_sessions.erase(found);
+		return OK;
+	case LOAD_ROM:
+		if (!chip8.load_rom_from_memory(data.data(), data.size())) {
+			return LOAD_FAILED;
+		}
+		put_u64(payload, chip8.get_rom_hash());
+		return OK;
+	case SET_QUIRKS:
+		if (data.size() != 1 || data[0] > 7) {
+			return BAD_PAYLOAD;
+		}
+		chip8.set_quirks(Chip8Quirks::from_bits(data[0]));
+		return OK;
+	case KEY:
+		if (data.size() != 2 || data[0] >= Chip8::KEYPAD_COUNT || data[1] > 1) {
+			return BAD_PAYLOAD;
+		}
+		return chip8.queue_key_event(data[0], data[1] != 0, chip8.get_ticks()) ? OK : KEY_QUEUE_FULL;
+	case STEP: {
+		if (data.size() != 4 || get_u32(data.data()) > MAX_STEP_FRAMES) {
+			return BAD_PAYLOAD;
+		}
+		if (!chip8.is_ROM_opened()) {
+			return NO_ROM;
+		}
+		// idle loops are skipped as Chip8Scheduler does, so stepping a session that waits on a key is cheap
+		int frames = static_cast<int>(get_u32(data.data()));
+		while (frames > 0) {
+			int skipped = chip8.skip_idle_frames(frames);
+			frames -= skipped;
+			if (frames > 0) {
+				chip8.run_frame();
+				--frames;
+			}
+		}
+		put_u64(payload, chip8.get_ticks());
+		return OK;
+	}
+	case GET_FRAME:
+		put_frame_delta(payload, chip8.get_display_bits(), found->second.lastFrame);
+		return OK;
+	case GET_HASH:
+		put_u64(payload, chip8.state_hash());
+		put_u64(payload, chip8.get_ticks());
+		return OK;
+	case SET_SEED:
+		if (data.size() != 4) {
+			return BAD_PAYLOAD;
+		}
+		chip8.set_seed(get_u32(data.data()));
+		return OK;
+	default:
+		return UNKNOWN_COMMAND;
+	}
+}
+
+class Server {
+public:
+	explicit Server(int workerCount) : _workers(workerCount), _nextSession(1), _requests(0), _connectionCount(0)
+	{}
+	bool listen(const string& path);
+	void run();
+	uint64_t get_requests() const { return _requests; }
+	uint64_t get_connection_count() const { return _connectionCount; }
+private:
+	Worker& worker_of(uint32_t session) { return _workers[session % _workers.size()]; }
+	void accept_connections();
+	bool read_requests(const std::shared_ptr<Connection>& connection);
+	bool dispatch(const std::shared_ptr<Connection>& connection, const RequestHeader& header, const uint8_t* payload);
+	bool send_output(Connection& connection);
+	void close_connection(const std::shared_ptr<Connection>& connection);
+
+	int _listenFd;
+	string _path;
+	vector<Worker> _workers;
+	vector<std::shared_ptr<Connection>> _connections;
+	uint32_t _nextSession;
+	uint64_t _requests;
+	uint64_t _connectionCount;
+};
+
+bool Server::listen(const string& path)
+{
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		cerr << "Socket path too long: " << path << endl;
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (_listenFd < 0) {
+		cerr << "socket: " << std::strerror(errno) << endl;
+		return false;
+	}
+	// a socket left behind by a server that did not shut down cleanly
+	unlink(path.c_str());
+	if (bind(_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(_listenFd, 64) != 0
+		|| !set_nonblocking(_listenFd)) {
+		cerr << "Listen: " << path << " " << std::strerror(errno) << endl;
+		close(_listenFd);
+		return false;
+	}
+	_path = path;
+	return true;
+}
+
+void Server::run()
+{
+	for (Worker& worker : _workers) {
+		worker.start();
+	}
+	vector<pollfd> fds;
+	while (!g_stop) {
+		fds.clear();
+		pollfd wakeFd = { g_wakeFds[0], POLLIN, 0 };
+		pollfd listenFd = { _listenFd, POLLIN, 0 };
+		fds.push_back(wakeFd);
+		fds.push_back(listenFd);
+		for (const auto& connection : _connections) {
+			std::lock_guard<std::mutex> lock(connection->outputMutex);
+			short events = connection->output.size() < MAX_PENDING_OUTPUT ? POLLIN : 0;
+			if (!connection->output.empty()) {
+				events |= POLLOUT;
+			}
+			pollfd fd = { connection->fd, events, 0 };
+			fds.push_back(fd);
+		}
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			cerr << "poll: " << std::strerror(errno) << endl;
+			break;
+		}
+		if (fds[0].revents & POLLIN) {
+			char bytes[64];
+			while (read(g_wakeFds[0], bytes, sizeof(bytes)) > 0) {
+			}
+		}
+		// connections accepted or closed below are only polled from the next round
+		vector<std::shared_ptr<Connection>> polled = _connections;
+		for (size_t i = 0; i < polled.size(); ++i) {
+			short revents = fds[i + 2].revents;
+			bool open = true;
+			if (revents & (POLLIN | POLLHUP | POLLERR)) {
+				open = read_requests(polled[i]);
+			}
+			if (open) {
+				open = send_output(*polled[i]);
+			}
+			if (!open) {
+				close_connection(polled[i]);
+			}
+		}
+		if (fds[1].revents & POLLIN) {
+			accept_connections();
+		}
+	}
+	for (Worker& worker : _workers) {
+		worker.stop();
+	}
+	for (const auto& connection : _connections) {
+		close(connection->fd);
+	}
+	_connections.clear();
+	close(_listenFd);
+	unlink(_path.c_str());
+}
+
+void Server::accept_connections()
+{
+	for (;;) {
+		int fd = accept(_listenFd, nullptr, nullptr);
+		if (fd < 0) {
+			return;
+		}
+		if (!set_nonblocking(fd)) {
+			close(fd);
+			continue;
+		}
+		_connections.push_back(std::make_shared<Connection>(fd));
+		++_connectionCount;
+	}
+}
+
+// Reads what the connection sent and dispatches every complete request. Returns false once the peer has
+// gone or broke the protocol.
+bool Server::read_requests(const std::shared_ptr<Connection>& connection)
+{
+	uint8_t buffer[65536];
+	ssize_t count = read(connection->fd, buffer, sizeof(buffer));
+	if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		return false;
+	}
+	if (count < 0) {
+		return true;
+	}
+	vector<uint8_t>& input = connection->input;
+	input.insert(input.end(), buffer, buffer + count);
+	size_t offset = 0;
+	while (input.size() - offset >= REQUEST_HEADER_SIZE) {
+		RequestHeader header = get_request_header(input.data() + offset);
+		if (header.size > MAX_PAYLOAD_SIZE) {
+			return false;
+		}
+		if (input.size() - offset < REQUEST_HEADER_SIZE + header.size) {
+			break;
+		}
+		if (!dispatch(connection, header, input.data() + offset + REQUEST_HEADER_SIZE)) {
+			return false;
+		}
+		offset += REQUEST_HEADER_SIZE + header.size;
+	}
+	input.erase(input.begin(), input.begin() + offset);
+	return true;
+}
+
+bool Server::dispatch(const std::shared_ptr<Connection>& connection, const RequestHeader& header, const uint8_t* payload)
+{
+	++_requests;
+	Job job;
+	job.connection = connection;
+	job.header = header;
+	if (header.command == CREATE) {
+		if (_nextSession == 0) {
+			// every id is taken; a server that has run this long is restarted before it wraps
+			return false;
+		}
+		job.header.session = _nextSession++;
+		connection->sessions.insert(job.header.session);
+	}
+	else if (!connection->sessions.count(header.session)) {
+		// Still answered by the session's worker: the id may be one this connection has just destroyed,
+		// and its DESTROY and the requests before it may not have been answered yet.
+		bool known = header.command >= DESTROY && header.command <= SET_SEED;
+		job.rejected = known ? NO_SESSION : UNKNOWN_COMMAND;
+	}
+	else if (header.command == DESTROY) {
+		connection->sessions.erase(header.session);
+	}
+	if (job.rejected == OK) {
+		job.payload.assign(payload, payload + header.size);
+	}
+	worker_of(job.header.session).post(std::move(job));
+	return true;
+}
+
+// Sends as much of the pending replies as the socket takes. Returns false once the peer has gone.
+bool Server::send_output(Connection& connection)
+{
+	std::lock_guard<std::mutex> lock(connection.outputMutex);
+	size_t sent = 0;
+	while (sent < connection.output.size()) {
+		ssize_t count = send(connection.fd, connection.output.data() + sent, connection.output.size() - sent, 0);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return false;
+			}
+			break;
+		}
+		sent += count;
+	}
+	connection.output.erase(connection.output.begin(), connection.output.begin() + sent);
+	return true;
+}
+
+// The sessions of a connection end with it; their workers drop them after the requests already queued.
+void Server::close_connection(const std::shared_ptr<Connection>& connection)
+{
+	{
+		std::lock_guard<std::mutex> lock(connection->outputMutex);
+		connection->closed = true;
+		connection->output.clear();
+	}
+	for (uint32_t session : connection->sessions) {
+		Job job;
+		job.header.size = 0;
+		job.header.requestId = 0;
+		job.header.session = session;
+		job.header.command = DESTROY;
+		worker_of(session).post(std::move(job));
+	}
+	connection->sessions.clear();
+	close(connection->fd);
+	_connections.erase(std::find(_connections.begin(), _connections.end(), connection));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	int workers = static_cast<int>(std::thread::hardware_concurrency());
+	string path;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--workers" && hasValue) {
+			workers = std::atoi(argv[++i]);
+		}
+		else if (arg.compare(0, 2, "--") != 0 && path.empty()) {
+			path = arg;
+		}
+		else {
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty()) {
+		cerr << "usage: chip8server [--workers N] <socket path>" << endl;
+		return 2;
+	}
+	workers = std::max(workers, 1);
+	if (pipe(g_wakeFds) != 0 || !set_nonblocking(g_wakeFds[0]) || !set_nonblocking(g_wakeFds[1])) {
+		cerr << "pipe: " << std::strerror(errno) << endl;
+		return 1;
+	}
+	// a client that goes away mid-reply shows up as an error from send(), not as a signal
+	std::signal(SIGPIPE, SIG_IGN);
+	std::signal(SIGINT, on_signal);
+	std::signal(SIGTERM, on_signal);
+
+	Server server(workers);
+	if (!server.listen(path)) {
+		return 1;
+	}
+	cout << "chip8server listening on " << path << " with " << workers << " worker(s)" << endl;
+	server.run();
+	cout << server.get_requests() << " request(s) over " << server.get_connection_count() << " connection(s)" << endl;
+	return 0;
+}
@@ -0,0 +1,257 @@
+// Runs thousands of instances under Chip8Scheduler, a few threads with one scheduler each, and reports how
+// many frames had to run and how many the schedulers skipped while instances idled.
+// usage: chip8swarm [options] <rom.ch8 | rom directory>...
+//   --instances N   instances, given the ROMs in turn (default 10000)
+//   --threads N     threads, one scheduler each (default: hardware concurrency)
+//   --frames N      frames to run (default 3600)
+//   --input-seed N  random key edges from this seed, about one per instance every two seconds; 0 runs without input (default 1)
+//   --check         also run every instance on its own, frame by frame, and compare the final state hashes
+//   --direct        run every instance every frame without a scheduler, to compare with
+#include "chip8.h"
+#include "mappedfile.h"
+#include "romlist.h"
+#include "scheduler.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+struct SwarmOptions {
+	SwarmOptions() : instances(10000), threads(static_cast<int>(std::thread::hardware_concurrency())), frames(3600),
+		inputSeed(1), check(false), direct(false)
+	{}
+	int instances;
+	int threads;
+	int frames;
+	uint32_t inputSeed;
+	bool check;
+	bool direct;
+};
+
+struct SwarmKey {
+	int frame;
+	int instance;
+	int key;
+	bool down;
+};
+
+struct SwarmResult {
+	Chip8SchedulerStats stats;
+	int mismatches;
+};
+
+static std::unique_ptr<Chip8> create_instance(const vector<uint8_t>& rom)
+{
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	chip8->set_fault_logging(false);
+	chip8->load_rom_from_memory(rom.data(), rom.size());
+	chip8->set_seed(1);
+	return chip8;
+}
+
+// The key edges one thread posts, in frame order. Each instance keeps its own keypad so edges alternate.
+static vector<SwarmKey> make_keys(const SwarmOptions& options, int thread, int instances)
+{
+	vector<SwarmKey> keys;
+	if (options.inputSeed == 0) {
+		return keys;
+	}
+	std::mt19937 random(options.inputSeed + thread);
+	vector<uint16_t> keypads(instances, 0);
+	int perFrame = std::max(instances / 120, 1);
+	for (int frame = 0; frame < options.frames; ++frame) {
+		for (int i = 0; i < perFrame; ++i) {
+			SwarmKey edge;
+			edge.frame = frame;
+			edge.instance = random() % instances;
+			edge.key = random() % Chip8::KEYPAD_COUNT;
+			keypads[edge.instance] ^= 1 << edge.key;
+			edge.down = (keypads[edge.instance] & (1 << edge.key)) != 0;
+			keys.push_back(edge);
+		}
+	}
+	return keys;
+}
+
+static void run_thread(const SwarmOptions& options, const vector<vector<uint8_t>>& roms, int thread, SwarmResult& result)
+{
+	vector<int> instances;
+	for (int instance = thread; instance < options.instances; instance += options.threads) {
+		instances.push_back(instance);
+	}
+	vector<SwarmKey> keys = make_keys(options, thread, static_cast<int>(instances.size()));
+	result.mismatches = 0;
+	if (options.direct) {
+		vector<std::unique_ptr<Chip8>> direct;
+		for (int instance : instances) {
+			direct.push_back(create_instance(roms[instance % roms.size()]));
+		}
+		size_t next = 0;
+		for (int frame = 0; frame < options.frames; ++frame) {
+			for (; next < keys.size() && keys[next].frame == frame; ++next) {
+				Chip8& chip8 = *direct[keys[next].instance];
+				chip8.queue_key_event(keys[next].key, keys[next].down, chip8.get_ticks());
+			}
+			for (auto& chip8 : direct) {
+				chip8->run_frame();
+			}
+		}
+		result.stats.framesRun = static_cast<uint64_t>(instances.size()) * options.frames;
+		return;
+	}
+	Chip8Scheduler scheduler;
+	vector<int> ids;
+	for (int instance : instances) {
+		ids.push_back(scheduler.add(create_instance(roms[instance % roms.size()])));
+	}
+	size_t next = 0;
+	for (int frame = 0; frame < options.frames; ++frame) {
+		for (; next < keys.size() && keys[next].frame == frame; ++next) {
+			scheduler.post_key(ids[keys[next].instance], keys[next].key, keys[next].down);
+		}
+		scheduler.run_until(frame + 1);
+	}
+	result.stats = scheduler.get_stats();
+	if (!options.check) {
+		return;
+	}
+	// the same edges, queued at the start of the frame the way the scheduler hands them over
+	vector<vector<SwarmKey>> byInstance(instances.size());
+	for (const SwarmKey& edge : keys) {
+		byInstance[edge.instance].push_back(edge);
+	}
+	for (size_t i = 0; i < instances.size(); ++i) {
+		std::unique_ptr<Chip8> reference = create_instance(roms[instances[i] % roms.size()]);
+		size_t key = 0;
+		for (int frame = 0; frame < options.frames; ++frame) {
+			for (; key < byInstance[i].size() && byInstance[i][key].frame == frame; ++key) {
+				reference->queue_key_event(byInstance[i][key].key, byInstance[i][key].down, reference->get_ticks());
+			}
+			reference->run_frame();
+		}
+		const Chip8& candidate = scheduler.sync(ids[i]);
+		if (candidate.state_hash() != reference->state_hash() || candidate.get_ticks() != reference->get_ticks()) {
+			++result.mismatches;
+		}
+	}
+}
+
+static bool is_rom_file(const string& path)
+{
+	return path.size() > 4 && path.compare(path.size() - 4, 4, ".ch8") == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	SwarmOptions options;
+	vector<string> paths;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--instances" && hasValue) {
+			options.instances = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--threads" && hasValue) {
+			options.threads = std::atoi(argv[++i]);
+		}
+		else if (arg == "--frames" && hasValue) {
+			options.frames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--input-seed" && hasValue) {
+			options.inputSeed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--check") {
+			options.check = true;
+		}
+		else if (arg == "--direct") {
+			options.direct = true;
+		}
+		else if (arg.compare(0, 2, "--") != 0) {
+			if (is_rom_file(arg)) {
+				paths.push_back(arg);
+			}
+			else {
+				for (const string& name : list_roms(arg)) {
+					paths.push_back(arg + "/" + name);
+				}
+			}
+		}
+		else {
+			paths.clear();
+			break;
+		}
+	}
+	if (paths.empty()) {
+		cerr << "usage: chip8swarm [--instances N] [--threads N] [--frames N] [--input-seed N] [--check] [--direct] <rom.ch8 | rom directory>..." << endl;
+		return 2;
+	}
+	vector<vector<uint8_t>> roms;
+	for (const string& path : paths) {
+		MappedFile file;
+		if (file.open(native_path(path)) && file.map() && file.get_size() <= static_cast<size_t>(Chip8::MAX_ROM_SIZE)) {
+			roms.push_back(vector<uint8_t>(file.get_data(), file.get_data() + file.get_size()));
+		}
+		else {
+			cerr << "Open: " << path << " error" << endl;
+		}
+	}
+	if (roms.empty()) {
+		return 2;
+	}
+	options.threads = std::max(1, std::min(options.threads, options.instances));
+
+	auto start = Clock::now();
+	vector<SwarmResult> results(options.threads);
+	vector<std::thread> threads;
+	for (int thread = 1; thread < options.threads; ++thread) {
+		threads.emplace_back(run_thread, std::cref(options), std::cref(roms), thread, std::ref(results[thread]));
+	}
+	run_thread(options, roms, 0, results[0]);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Chip8SchedulerStats total;
+	int mismatches = 0;
+	for (const SwarmResult& result : results) {
+		total.framesRun += result.stats.framesRun;
+		total.framesSkipped += result.stats.framesSkipped;
+		total.running += result.stats.running;
+		total.waitingTimer += result.stats.waitingTimer;
+		total.waitingKey += result.stats.waitingKey;
+		total.halted += result.stats.halted;
+		mismatches += result.mismatches;
+	}
+	uint64_t instanceFrames = static_cast<uint64_t>(options.instances) * options.frames;
+	cout << options.instances << " instances of " << roms.size() << " ROM(s) on " << options.threads << " thread(s), "
+		<< options.frames << " frames in " << std::fixed << std::setprecision(2) << seconds << " s"
+		<< (options.direct ? " without a scheduler" : options.check ? " with the check" : "") << endl;
+	if (options.direct) {
+		return 0;
+	}
+	cout << std::setprecision(1) << 100.0 * total.framesRun / instanceFrames << "% of instance frames run, "
+		<< 100.0 * total.framesSkipped / instanceFrames << "% skipped, the rest still parked at the end" << endl;
+	cout << "at the end: " << total.running << " running, " << total.waitingTimer << " waiting on the delay timer, "
+		<< total.waitingKey << " waiting on a key, " << total.halted << " halted" << endl;
+	if (!options.check) {
+		return 0;
+	}
+	cout << mismatches << " instance(s) differ from running on their own" << endl;
+	return mismatches > 0 ? 1 : 0;
+}
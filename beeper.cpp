@@ -0,0 +1,247 @@
+#include "beeper.h"
+#include "trace.h"
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+static constexpr int GAIN_ONE = 1 << 15;
+
+constexpr double Beeper::MAX_RATE_ADJUST;
+// rate adjustment per unit of relative fill error, before clamping
+static constexpr double RATE_CONTROL_GAIN = 0.02;
+
+Beeper::Beeper() : _device(0), _sampleRate(44100),
+	_soundTimer(0), _waveform(static_cast<int>(Waveform::SQUARE)), _phaseStep(0), _amplitude(8000), _muted(false),
+	_frequency(392.f),	// G4
+	_phase(0), _gain(0), _gainStep(1),
+	_frameQueue(false), _bufferSamples(256), _queueRead(0), _queueWrite(0), _underruns(0),
+	_samplesPlayed(0), _framesQueued(0), _frameRate(0),
+	_overruns(0), _minQueued(0), _maxQueued(0), _targetQueued(0), _rateAdjust(1.0), _sampleRemainder(0.0)
+{
+	for (int i = 0; i < SINE_TABLE_SIZE; ++i) {
+		_sineTable[i] = static_cast<int16_t>(32767 * sin(2 * M_PI * i / SINE_TABLE_SIZE));
+	}
+}
+
+Beeper::~Beeper()
+{
+	close();
+}
+
+bool Beeper::open(int sampleRate, int bufferSamples)
+{
+	if (_device) {
+		return true;
+	}
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		cerr << "SDL_InitSubSystem(SDL_INIT_AUDIO) error: " << SDL_GetError() << endl;
+		return false;
+	}
+	SDL_AudioSpec desired, obtained;
+	SDL_zero(desired);
+	desired.freq = sampleRate;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 1;
+	desired.samples = static_cast<Uint16>(bufferSamples);
+	desired.callback = audio_callback;
+	desired.userdata = this;
+	_device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (!_device) {
+		cerr << "SDL_OpenAudioDevice error: " << SDL_GetError() << endl;
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+		return false;
+	}
+	_sampleRate = obtained.freq;
+	_bufferSamples = obtained.samples;
+	// ramp the tone in and out over 2 ms to avoid clicks
+	_gainStep = std::max(1, GAIN_ONE / std::max(1, _sampleRate / 500));
+	set_frequency(_frequency);
+	SDL_PauseAudioDevice(_device, 0);
+	TRACE_INSTANT("audio open", "audio");
+	return true;
+}
+
+void Beeper::close()
+{
+	if (!_device) {
+		return;
+	}
+	SDL_CloseAudioDevice(_device);
+	_device = 0;
+	TRACE_INSTANT("audio close", "audio");
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+void Beeper::pause(bool paused)
+{
+	if (_device) {
+		SDL_PauseAudioDevice(_device, paused ? 1 : 0);
+		TRACE_INSTANT(paused ? "audio stop" : "audio start", "audio");
+	}
+}
+
+void Beeper::set_frequency(float hz)
+{
+	_frequency = hz;
+	double step = static_cast<double>(hz) * SINE_TABLE_SIZE / _sampleRate;
+	_phaseStep.store(static_cast<uint32_t>(step * 65536.0), std::memory_order_relaxed);
+}
+
+void Beeper::set_volume(float volume)
+{
+	volume = std::min(std::max(volume, 0.f), 1.f);
+	_amplitude.store(static_cast<int>(volume * 32767), std::memory_order_relaxed);
+}
+
+void SDLCALL Beeper::audio_callback(void* userdata, Uint8* stream, int len)
+{
+	Beeper* beeper = static_cast<Beeper*>(userdata);
+	int16_t* samples = reinterpret_cast<int16_t*>(stream);
+	int count = len / static_cast<int>(sizeof(int16_t));
+	if (beeper->_frameQueue.load(std::memory_order_acquire)) {
+		beeper->drain_queue(samples, count);
+	}
+	else {
+		bool on = beeper->_soundTimer.load(std::memory_order_relaxed) > 0 && !beeper->_muted.load(std::memory_order_relaxed);
+		beeper->synthesize(samples, count, on);
+	}
+}
+
+void Beeper::synthesize(int16_t* samples, int count, bool on)
+{
+	bool square = _waveform.load(std::memory_order_relaxed) == static_cast<int>(Waveform::SQUARE);
+	uint32_t phaseStep = _phaseStep.load(std::memory_order_relaxed);
+	int amplitude = _amplitude.load(std::memory_order_relaxed);
+	int targetGain = on ? GAIN_ONE : 0;
+	for (int i = 0; i < count; ++i) {
+		if (_gain < targetGain) {
+			_gain = std::min(_gain + _gainStep, targetGain);
+		}
+		else if (_gain > targetGain) {
+			_gain = std::max(_gain - _gainStep, targetGain);
+		}
+		if (_gain == 0) {
+			samples[i] = 0;
+			continue;
+		}
+		int index = (_phase >> 16) & (SINE_TABLE_SIZE - 1);
+		int wave = square ? (index < SINE_TABLE_SIZE / 2 ? 32767 : -32767) : _sineTable[index];
+		int sample = static_cast<int>((static_cast<int64_t>(wave) * amplitude / 32767) * _gain / GAIN_ONE);
+		samples[i] = static_cast<int16_t>(sample);
+		_phase += phaseStep;
+	}
+}
+
+void Beeper::drain_queue(int16_t* samples, int count)
+{
+	uint32_t read = _queueRead.load(std::memory_order_relaxed);
+	uint32_t write = _queueWrite.load(std::memory_order_acquire);
+	int available = static_cast<int>(write - read);
+	int n = std::min(count, available);
+	for (int i = 0; i < n; ++i) {
+		samples[i] = _queue[(read + i) & (QUEUE_SIZE - 1)];
+	}
+	_queueRead.store(read + n, std::memory_order_release);
+	if (n < count) {
+		std::fill(samples + n, samples + count, 0);
+		_underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	// the device clock keeps running through an underrun
+	_samplesPlayed.store(_samplesPlayed.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+void Beeper::set_frame_queue(bool enabled)
+{
+	if (enabled == is_frame_queue_enabled()) {
+		return;
+	}
+	TRACE_SCOPE(enabled ? "audio frame queue on" : "audio frame queue off", "audio");
+	// the synthesizer state changes hands, so the callback must not run meanwhile
+	if (_device) SDL_LockAudioDevice(_device);
+	_queueRead.store(0, std::memory_order_relaxed);
+	_samplesPlayed.store(0, std::memory_order_relaxed);
+	_framesQueued = 0;
+	_frameRate = 0;
+	_rateAdjust = 1.0;
+	_sampleRemainder = 0.0;
+	// start with the target lead of silence, every frame after that is paced by what the device consumed
+	int lead = enabled ? 2 * _bufferSamples : 0;
+	std::fill(_queue, _queue + lead, 0);
+	_queueWrite.store(static_cast<uint32_t>(lead), std::memory_order_relaxed);
+	_frameQueue.store(enabled, std::memory_order_release);
+	if (_device) SDL_UnlockAudioDevice(_device);
+	reset_sync_stats();
+}
+
+int Beeper::get_target_fill(int frameRate) const
+{
+	// two device buffers of headroom plus the frame about to be played
+	return 2 * _bufferSamples + _sampleRate / std::max(frameRate, 1);
+}
+
+bool Beeper::needs_frame(int frameRate)
+{
+	double samplesPerFrame = static_cast<double>(_sampleRate) / std::max(frameRate, 1);
+	uint64_t played = _samplesPlayed.load(std::memory_order_acquire);
+	if (frameRate != _frameRate) {
+		// rebase the frame count on the new rate so a settings change neither bursts nor stalls
+		_frameRate = frameRate;
+		_framesQueued = static_cast<uint64_t>(played / samplesPerFrame);
+	}
+	return played >= _framesQueued * samplesPerFrame;
+}
+
+void Beeper::queue_frame(bool soundOn, int frameRate)
+{
+	double exact = static_cast<double>(_sampleRate) / std::max(frameRate, 1) * _rateAdjust + _sampleRemainder;
+	int n = static_cast<int>(exact);
+	_sampleRemainder = exact - n;
+	++_framesQueued;
+
+	uint32_t write = _queueWrite.load(std::memory_order_relaxed);
+	uint32_t read = _queueRead.load(std::memory_order_acquire);
+	int free = static_cast<int>(QUEUE_SIZE - (write - read));
+	if (n > free) {
+		_overruns += n - free;
+		n = free;
+	}
+	uint32_t start = write & (QUEUE_SIZE - 1);
+	int first = std::min(n, static_cast<int>(QUEUE_SIZE - start));
+	synthesize(_queue + start, first, soundOn);
+	synthesize(_queue, n - first, soundOn);
+	_queueWrite.store(write + n, std::memory_order_release);
+
+	// Frames are paced by samples played, so the fill only moves by what the rate adjustment adds or removes:
+	// a proportional term settles it on the target with the adjustment returning to 1.
+	int queued = static_cast<int>(write + n - read);
+	_minQueued = std::min(_minQueued, queued);
+	_maxQueued = std::max(_maxQueued, queued);
+	int target = get_target_fill(frameRate);
+	_targetQueued = target;
+	double error = static_cast<double>(target - queued) / target;
+	_rateAdjust = 1.0 + std::min(std::max(error * RATE_CONTROL_GAIN, -MAX_RATE_ADJUST), MAX_RATE_ADJUST);
+}
+
+AudioSyncStats Beeper::get_sync_stats() const
+{
+	AudioSyncStats stats;
+	stats.queuedSamples = static_cast<int>(_queueWrite.load(std::memory_order_relaxed) - _queueRead.load(std::memory_order_acquire));
+	stats.targetSamples = _targetQueued;
+	stats.minQueuedSamples = _minQueued;
+	stats.maxQueuedSamples = _maxQueued;
+	stats.underruns = _underruns.load(std::memory_order_relaxed);
+	stats.overruns = _overruns;
+	stats.rateAdjust = _rateAdjust;
+	return stats;
+}
+
+void Beeper::reset_sync_stats()
+{
+	_minQueued = INT32_MAX;
+	_maxQueued = 0;
+	_underruns.store(0, std::memory_order_relaxed);
+	_overruns = 0;
+}
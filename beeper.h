@@ -0,0 +1,101 @@
+#ifndef BEEPER_H
+#define BEEPER_H
+
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstdint>
+
+enum class Waveform {
+	SQUARE,
+	SINE
+};
+
+struct AudioSyncStats {
+	int queuedSamples;
+	int targetSamples;
+	// fill range seen by queue_frame() since the last reset_sync_stats()
+	int minQueuedSamples, maxQueuedSamples;
+	// callbacks that drained the queue before it was refilled
+	uint32_t underruns;
+	// samples dropped because the queue was full
+	uint32_t overruns;
+	// current dynamic rate control factor applied to the samples generated per frame
+	double rateAdjust;
+};
+
+// CHIP-8 buzzer on the SDL audio subsystem.
+// The tone is synthesized in the audio callback for as long as the published sound timer is non-zero,
+// so start and stop follow FX18 and the timer running out within one device buffer (about 6 ms)
+// no matter how often frames are rendered. The callback only reads atomics and never allocates or locks.
+//
+// With the frame queue enabled the device clock paces the emulation instead: every emulated frame renders
+// its share of samples into a lock-free ring that the callback drains, and needs_frame() reports a frame
+// due each time the device has played one frame worth of samples. Emulated time therefore cannot drift
+// from the audio output. A small proportional rate control stretches the samples rendered per frame by up
+// to MAX_RATE_ADJUST to hold the ring at its target fill, so jitter neither underruns nor overruns it.
+class Beeper {
+public:
+	Beeper();
+	Beeper(const Beeper&) = delete;
+	Beeper& operator= (const Beeper&) = delete;
+	~Beeper();
+	bool open(int sampleRate = 44100, int bufferSamples = 256);
+	void close();
+	bool is_open() const { return _device != 0; }
+	void pause(bool paused);
+
+	// Hand this to Chip8::publish_sound_timer().
+	std::atomic<uint8_t>* get_sound_timer_state() { return &_soundTimer; }
+	void set_frequency(float hz);
+	void set_waveform(Waveform waveform) { _waveform.store(static_cast<int>(waveform), std::memory_order_relaxed); }
+	// 0.0 - 1.0
+	void set_volume(float volume);
+	// Fades the tone out while muted, e.g. during fast-forward; the sound timer is still followed.
+	void set_muted(bool muted) { _muted.store(muted, std::memory_order_relaxed); }
+	bool is_muted() const { return _muted.load(std::memory_order_relaxed); }
+
+	static constexpr double MAX_RATE_ADJUST = 0.005;
+	bool is_frame_queue_enabled() const { return _frameQueue.load(std::memory_order_relaxed); }
+	void set_frame_queue(bool enabled);
+	bool needs_frame(int frameRate);
+	// Renders one emulated frame of sound into the queue.
+	void queue_frame(bool soundOn, int frameRate);
+	AudioSyncStats get_sync_stats() const;
+	void reset_sync_stats();
+private:
+	static void SDLCALL audio_callback(void* userdata, Uint8* stream, int len);
+	void synthesize(int16_t* samples, int count, bool on);
+	void drain_queue(int16_t* samples, int count);
+	int get_target_fill(int frameRate) const;
+
+	static constexpr int SINE_TABLE_SIZE = 256;
+	SDL_AudioDeviceID _device;
+	int _sampleRate;
+	std::atomic<uint8_t> _soundTimer;
+	std::atomic<int> _waveform;
+	// 16.16 fixed point, in units of sine table entries per sample
+	std::atomic<uint32_t> _phaseStep;
+	std::atomic<int> _amplitude;
+	std::atomic<bool> _muted;
+	float _frequency;
+
+	// touched only by whichever side synthesizes: the callback, or queue_frame() with the frame queue on
+	uint32_t _phase;
+	int _gain, _gainStep;
+	int16_t _sineTable[SINE_TABLE_SIZE];
+
+	static constexpr uint32_t QUEUE_SIZE = 1 << 14;
+	std::atomic<bool> _frameQueue;
+	int _bufferSamples;
+	int16_t _queue[QUEUE_SIZE];
+	std::atomic<uint32_t> _queueRead, _queueWrite;
+	std::atomic<uint32_t> _underruns;
+	std::atomic<uint64_t> _samplesPlayed;
+	uint64_t _framesQueued;
+	int _frameRate;
+	uint32_t _overruns;
+	int _minQueued, _maxQueued, _targetQueued;
+	double _rateAdjust, _sampleRemainder;
+};
+
+#endif // BEEPER_H
@@ -0,0 +1,117 @@
+#include "compositor.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COMPOSITOR_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define COMPOSITOR_NEON
+#endif
+
+CompositorConfig::CompositorConfig(CompositorMode mode, int frames, int decayStep)
+{
+	this->mode = mode;
+	this->frames = frames;
+	this->decayStep = decayStep;
+}
+
+Compositor::Compositor() : _config(), _newest(0)
+{
+	reset();
+}
+
+void Compositor::reset()
+{
+	_newest = 0;
+	std::fill(&_history[0][0], &_history[0][0] + MAX_FRAMES * PIXEL_COUNT, 255);
+	std::fill(_output, _output + PIXEL_COUNT, 255);
+}
+
+void Compositor::set_config(const CompositorConfig& config)
+{
+	_config.mode = config.mode;
+	_config.frames = std::min(std::max(config.frames, 1), static_cast<int>(MAX_FRAMES));
+	_config.decayStep = std::min(std::max(config.decayStep, 1), 255);
+	reset();
+}
+
+// dst = min(dst, src)
+static void min_into(uint8_t* dst, const uint8_t* src, int count)
+{
+	int i = 0;
+#if defined(COMPOSITOR_SSE2)
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(dst + i));
+		__m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_store_si128(reinterpret_cast<__m128i*>(dst + i), _mm_min_epu8(a, b));
+	}
+#elif defined(COMPOSITOR_NEON)
+	for (; i + 16 <= count; i += 16) {
+		vst1q_u8(dst + i, vminq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+	}
+#endif
+	for (; i < count; ++i) {
+		dst[i] = std::min(dst[i], src[i]);
+	}
+}
+
+// dst = min(src, saturate(dst + step))
+static void decay_into(uint8_t* dst, const uint8_t* src, uint8_t step, int count)
+{
+	int i = 0;
+#if defined(COMPOSITOR_SSE2)
+	__m128i steps = _mm_set1_epi8(static_cast<char>(step));
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_adds_epu8(_mm_load_si128(reinterpret_cast<const __m128i*>(dst + i)), steps);
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_store_si128(reinterpret_cast<__m128i*>(dst + i), _mm_min_epu8(a, b));
+	}
+#elif defined(COMPOSITOR_NEON)
+	uint8x16_t steps = vdupq_n_u8(step);
+	for (; i + 16 <= count; i += 16) {
+		vst1q_u8(dst + i, vminq_u8(vqaddq_u8(vld1q_u8(dst + i), steps), vld1q_u8(src + i)));
+	}
+#endif
+	for (; i < count; ++i) {
+		int faded = std::min(dst[i] + step, 255);
+		dst[i] = static_cast<uint8_t>(std::min<int>(faded, src[i]));
+	}
+}
+
+const uint8_t* Compositor::compose(const uint8_t* display)
+{
+	switch (_config.mode) {
+	case CompositorMode::MAX_OF_FRAMES:
+		_newest = (_newest + 1) % MAX_FRAMES;
+		std::memcpy(_history[_newest], display, PIXEL_COUNT);
+		std::memcpy(_output, display, PIXEL_COUNT);
+		for (int age = 1; age < _config.frames; ++age) {
+			min_into(_output, _history[(_newest + MAX_FRAMES - age) % MAX_FRAMES], PIXEL_COUNT);
+		}
+		return _output;
+	case CompositorMode::PHOSPHOR:
+		decay_into(_output, display, static_cast<uint8_t>(_config.decayStep), PIXEL_COUNT);
+		return _output;
+	default:
+		return display;
+	}
+}
+
+void Compositor::get_frame_weights(float weights[MAX_FRAMES]) const
+{
+	for (int age = 0; age < MAX_FRAMES; ++age) {
+		switch (_config.mode) {
+		case CompositorMode::MAX_OF_FRAMES:
+			weights[age] = age < _config.frames ? 1.f : 0.f;
+			break;
+		case CompositorMode::PHOSPHOR:
+			weights[age] = std::max(0.f, 1.f - age * _config.decayStep / 255.f);
+			break;
+		default:
+			weights[age] = age == 0 ? 1.f : 0.f;
+			break;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include "chip8.h"
+#include <cstdint>
+
+enum class CompositorMode {
+	// Every emulated frame is shown as is.
+	OFF,
+	// A pixel stays drawn while it was drawn in any of the last `frames` frames.
+	MAX_OF_FRAMES,
+	// A drawn pixel fades out by `decayStep` per frame after it is erased.
+	PHOSPHOR
+};
+
+struct CompositorConfig {
+	CompositorConfig() : mode(CompositorMode::MAX_OF_FRAMES), frames(2), decayStep(64)
+	{}
+	CompositorConfig(CompositorMode mode, int frames, int decayStep);
+	CompositorMode mode;
+	int frames;
+	int decayStep;
+};
+
+// Persistence stage between the core and the renderer, hiding CHIP-8's XOR-draw flicker
+// without holding back instruction execution.
+// compose() blends the core's byte-per-pixel display (255 = blank, 0 = drawn) on the CPU.
+// The packed 1bpp path does the same blend in the fragment shader instead: the renderer keeps
+// the last MAX_FRAMES bit planes and weighs each one with get_frame_weights().
+class Compositor {
+public:
+	static constexpr int MAX_FRAMES = 8;
+	static constexpr int PIXEL_COUNT = Chip8::DISPLAY_ROWS * Chip8::DISPLAY_COLS;
+
+	Compositor();
+	Compositor(const Compositor&) = delete;
+	Compositor& operator= (const Compositor&) = delete;
+	void reset();
+	const CompositorConfig& get_config() const { return _config; }
+	void set_config(const CompositorConfig& config);
+
+	// Returns the image to present; valid until the next call.
+	const uint8_t* compose(const uint8_t* display);
+	// weights[age] scales a plane drawn `age` frames ago, age 0 being the newest.
+	void get_frame_weights(float weights[MAX_FRAMES]) const;
+private:
+	CompositorConfig _config;
+	int _newest;
+	alignas(16) uint8_t _history[MAX_FRAMES][PIXEL_COUNT];
+	alignas(16) uint8_t _output[PIXEL_COUNT];
+};
+
+#endif // COMPOSITOR_H
@@ -0,0 +1,300 @@
+#include "emuthread.h"
+#include "trace.h"
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <random>
+
+using std::cout;
+using std::endl;
+using std::chrono::steady_clock;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+EmulationThread::EmulationThread(Beeper& beeper) : _beeper(beeper), _running(false),
+	_statsEnabled(false), _statsWindowStart(0),
+	_frameNumber(0), _frameStartTime(0), _fps(60), _speed(1), _syncToAudio(false), _audioSyncFrames(0)
+{}
+
+EmulationThread::~EmulationThread()
+{
+	stop();
+}
+
+void EmulationThread::start()
+{
+	if (_running.load()) {
+		return;
+	}
+	_running.store(true);
+	_thread = std::thread(&EmulationThread::run, this);
+}
+
+void EmulationThread::stop()
+{
+	_running.store(false);
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+}
+
+bool EmulationThread::load_rom(vector<uint8_t>&& image)
+{
+	EmulatorCommand command(EmulatorCommandType::LOAD_ROM, 0);
+	command.rom = std::move(image);
+	return send(std::move(command));
+}
+
+bool EmulationThread::start_recording(const wstring& path)
+{
+	EmulatorCommand command(EmulatorCommandType::START_RECORDING, 0);
+	command.path = path;
+	return send(std::move(command));
+}
+
+bool EmulationThread::set_quirks(const Chip8Quirks& quirks)
+{
+	EmulatorCommand command(EmulatorCommandType::SET_QUIRKS, 0);
+	command.quirks = quirks;
+	return send(std::move(command));
+}
+
+bool EmulationThread::send(EmulatorCommand&& command)
+{
+	if (!_commands.push(std::move(command))) {
+		cout << "Emulation command queue is full, command dropped." << endl;
+		return false;
+	}
+	return true;
+}
+
+void EmulationThread::run()
+{
+	Tracer::instance().set_thread_name("emulation");
+	if (_beeper.is_open()) {
+		_chip8.publish_sound_timer(_beeper.get_sound_timer_state());
+	}
+
+	steady_clock::time_point nextFrame = steady_clock::now();
+	while (_running.load(std::memory_order_acquire)) {
+		process_commands();
+		if (!_chip8.is_ROM_opened()) {
+			std::this_thread::sleep_for(milliseconds(1));
+			nextFrame = steady_clock::now();
+			continue;
+		}
+
+		if (_syncToAudio && _speed == 1) {
+			// the audio device clock decides how many frames are due
+			int frames = 0;
+			while (frames < MAX_CATCH_UP_FRAMES && _beeper.needs_frame(_fps)) {
+				run_frame();
+				_beeper.queue_frame(_chip8.get_sound_timer() > 0, _fps);
+				++frames;
+			}
+			if (frames > 0) {
+				publish_frame();
+			}
+			else {
+				std::this_thread::sleep_for(milliseconds(1));
+			}
+			_audioSyncFrames += frames;
+			if (_audioSyncFrames >= _fps * 10) {
+				_audioSyncFrames = 0;
+				log_audio_sync_stats();
+			}
+			nextFrame = steady_clock::now();
+			continue;
+		}
+
+		steady_clock::time_point now = steady_clock::now();
+		if (_speed != UNCAPPED) {
+			if (now < nextFrame) {
+				// wake up early enough to pick up input queued meanwhile
+				std::this_thread::sleep_until(std::min(nextFrame, now + milliseconds(1)));
+				continue;
+			}
+			nextFrame += microseconds(1000000 / (_fps * _speed));
+			if (now - nextFrame > milliseconds(100)) {
+				// don't fast-forward through a long stall
+				nextFrame = now;
+			}
+		}
+		run_frame();
+		// faster than normal the renderer could not show every frame anyway, so only copy out what it can show
+		if (_speed == 1 || now >= _nextPublish) {
+			publish_frame();
+			_nextPublish = now + microseconds(1000000 / TURBO_PUBLISH_RATE);
+		}
+	}
+
+	end_movie();
+	_chip8.publish_sound_timer(nullptr);
+}
+
+void EmulationThread::run_frame()
+{
+	TRACE_SCOPE("frame", "emulation");
+	_frameStartTime = SDL_GetTicks();
+	if (_statsEnabled) {
+		steady_clock::time_point start = steady_clock::now();
+		_chip8.run_frame();
+		steady_clock::time_point end = steady_clock::now();
+		uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		_statsWindow.executeTime.add(static_cast<uint32_t>(nanos / 1000));
+		_statsWindow.executeNanos += nanos;
+		++_statsWindow.frames;
+		_statsWindow.instructions += _chip8.get_instructions_per_frame();
+		uint64_t nowMicros = std::chrono::duration_cast<microseconds>(end.time_since_epoch()).count();
+		if (nowMicros - _statsWindowStart >= STATS_WINDOW_MICROS) {
+			publish_stats(nowMicros);
+		}
+	}
+	else {
+		_chip8.run_frame();
+	}
+	++_frameNumber;
+	if (_recorder.is_recording()) {
+		_recorder.end_frame();
+	}
+}
+
+void EmulationThread::process_commands()
+{
+	EmulatorCommand command;
+	while (_commands.pop(command)) {
+		TRACE_SCOPE("command", "emulation");
+		switch (command.type) {
+		case EmulatorCommandType::KEY_DOWN:
+			queue_key_event(command.value, true, command.timestamp);
+			break;
+		case EmulatorCommandType::KEY_UP:
+			queue_key_event(command.value, false, command.timestamp);
+			break;
+		case EmulatorCommandType::LOAD_ROM:
+			end_movie();
+			_rom.clear();
+			if (_chip8.load_rom_from_memory(command.rom.data(), command.rom.size())) {
+				_rom = std::move(command.rom);
+			}
+			_frameNumber = 0;
+			publish_frame();
+			break;
+		case EmulatorCommandType::SET_QUIRKS:
+			end_movie();
+			_chip8.set_quirks(command.quirks);
+			break;
+		case EmulatorCommandType::SET_INSTRUCTIONS_PER_FRAME:
+			end_movie();
+			_chip8.set_instructions_per_frame(command.value);
+			break;
+		case EmulatorCommandType::SET_FPS:
+			_fps = std::max(command.value, 1);
+			break;
+		case EmulatorCommandType::SET_AUDIO_SYNC:
+			_syncToAudio = command.value != 0 && _beeper.is_open();
+			_beeper.set_frame_queue(_syncToAudio && _speed == 1);
+			_audioSyncFrames = 0;
+			break;
+		case EmulatorCommandType::SET_SPEED:
+			_speed = std::max(command.value, static_cast<int>(UNCAPPED));
+			_beeper.set_muted(_speed != 1);
+			_beeper.set_frame_queue(_syncToAudio && _speed == 1);
+			break;
+		case EmulatorCommandType::SET_STATS:
+			_statsEnabled = command.value != 0;
+			_statsWindow = EmulationStats();
+			_statsWindowStart = Stats::now_micros();
+			break;
+		case EmulatorCommandType::START_RECORDING:
+			begin_movie(command.path);
+			break;
+		case EmulatorCommandType::STOP_RECORDING:
+			end_movie();
+			break;
+		}
+	}
+}
+
+// A frame executes in one burst at its start, so an edge that arrived while frame N was on screen
+// is played back in frame N + 1 at the same offset into the frame.
+// That costs at most one frame of latency but keeps the spacing between edges exact down to the instruction.
+void EmulationThread::queue_key_event(int key, bool down, uint32_t timestamp)
+{
+	int ipf = _chip8.get_instructions_per_frame();
+	int64_t elapsed = std::max(static_cast<int32_t>(timestamp - _frameStartTime), 0);
+	int64_t frameRate = static_cast<int64_t>(_fps) * _speed;
+	int64_t offset = std::min(elapsed * frameRate * ipf / 1000, static_cast<int64_t>(ipf - 1));
+	if (!_chip8.queue_key_event(key, down, _chip8.get_ticks() + offset)) {
+		if (down) {
+			_chip8.on_key_down(key);
+		}
+		else {
+			_chip8.on_key_up(key);
+		}
+	}
+}
+
+void EmulationThread::begin_movie(const wstring& path)
+{
+	end_movie();
+	if (!_chip8.is_ROM_opened() || !_chip8.load_rom_from_memory(_rom.data(), _rom.size())) {
+		cout << "Load a ROM before recording a movie." << endl;
+		return;
+	}
+	if (!_recorder.start(_chip8, std::random_device()())) {
+		cout << "Movies record up to " << Movie::MAX_INSTRUCTIONS_PER_FRAME << " instructions per frame." << endl;
+		return;
+	}
+	_moviePath = path;
+	_frameNumber = 0;
+	publish_frame();
+}
+
+void EmulationThread::end_movie()
+{
+	if (!_recorder.is_recording()) {
+		return;
+	}
+	const Movie& movie = _recorder.stop();
+	if (movie.save(_moviePath)) {
+		cout << "Movie saved: " << movie.frameCount << " frames, " << movie.inputs.size() << " inputs" << endl;
+	}
+}
+
+void EmulationThread::publish_frame()
+{
+	TRACE_SCOPE("publish", "emulation");
+	DisplayFrame& frame = _frames.back();
+	frame.frameNumber = _frameNumber;
+	frame.finishedMicros = Stats::now_micros();
+	memcpy(frame.pixels, _chip8.get_display_buffer(), sizeof(frame.pixels));
+	memcpy(frame.bits, _chip8.get_display_bits(), sizeof(frame.bits));
+	_frames.publish();
+}
+
+void EmulationThread::publish_stats(uint64_t nowMicros)
+{
+	_statsWindow.micros = nowMicros - _statsWindowStart;
+	_statsWindow.instructionsPerFrame = _chip8.get_instructions_per_frame();
+	if (_beeper.is_frame_queue_enabled()) {
+		AudioSyncStats audio = _beeper.get_sync_stats();
+		_statsWindow.audioQueuedSamples = audio.queuedSamples;
+		_statsWindow.audioTargetSamples = audio.targetSamples;
+	}
+	_stats.back() = _statsWindow;
+	_stats.publish();
+	_statsWindow = EmulationStats();
+	_statsWindowStart = nowMicros;
+}
+
+void EmulationThread::log_audio_sync_stats()
+{
+	AudioSyncStats stats = _beeper.get_sync_stats();
+	cout << "audio sync: queued=" << stats.queuedSamples << "/" << stats.targetSamples
+		<< " range=[" << stats.minQueuedSamples << ", " << stats.maxQueuedSamples << "]"
+		<< " underruns=" << stats.underruns << " overruns=" << stats.overruns
+		<< " rate=" << stats.rateAdjust << endl;
+	_beeper.reset_sync_stats();
+}
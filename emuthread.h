@@ -0,0 +1,138 @@
+#ifndef EMU_THREAD_H
+#define EMU_THREAD_H
+
+#include "chip8.h"
+#include "movie.h"
+#include "stats.h"
+#include "beeper.h"
+#include "triplebuffer.h"
+#include "spscqueue.h"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+// One completed frame as handed from the emulation thread to the renderer.
+struct DisplayFrame {
+	// emulated frames since the ROM was loaded
+	uint64_t frameNumber;
+	// Stats::now_micros() when the frame was finished
+	uint64_t finishedMicros;
+	uint8_t pixels[Chip8::DISPLAY_ROWS * Chip8::DISPLAY_COLS];
+	uint8_t bits[Chip8::DISPLAY_ROWS * Chip8::DISPLAY_ROW_BYTES];
+};
+
+enum class EmulatorCommandType {
+	KEY_DOWN,
+	KEY_UP,
+	LOAD_ROM,
+	SET_QUIRKS,
+	SET_INSTRUCTIONS_PER_FRAME,
+	SET_FPS,
+	SET_AUDIO_SYNC,
+	SET_SPEED,
+	SET_STATS,
+	START_RECORDING,
+	STOP_RECORDING
+};
+
+struct EmulatorCommand {
+	EmulatorCommand() : type(EmulatorCommandType::KEY_DOWN), value(0), timestamp(0), quirks()
+	{}
+	EmulatorCommand(EmulatorCommandType type, int value, uint32_t timestamp=0) : type(type), value(value), timestamp(timestamp), quirks()
+	{}
+	EmulatorCommandType type;
+	int value;
+	// SDL_GetTicks() time of the input event
+	uint32_t timestamp;
+	Chip8Quirks quirks;
+	wstring path;
+	// LOAD_ROM image
+	vector<uint8_t> rom;
+};
+
+// Runs the Chip8 core on its own thread so window messages, modal dialogs and buffer swaps
+// never stall emulation, and the emulation never waits on the GPU.
+// The UI thread talks to the core only through a command queue; finished frames come back
+// through a triple buffer, so neither side takes a lock and the renderer always shows the newest frame.
+class EmulationThread {
+public:
+	EmulationThread(Beeper& beeper);
+	EmulationThread(const EmulationThread&) = delete;
+	EmulationThread& operator= (const EmulationThread&) = delete;
+	~EmulationThread();
+	void start();
+	void stop();
+
+	// UI thread side, each returns false when the command queue is full
+	// timestamp: SDL event time of the key edge, used to place the edge on an instruction
+	bool key_down(int key, uint32_t timestamp) { return send(EmulatorCommand(EmulatorCommandType::KEY_DOWN, key, timestamp)); }
+	bool key_up(int key, uint32_t timestamp) { return send(EmulatorCommand(EmulatorCommandType::KEY_UP, key, timestamp)); }
+	// Takes an image the UI thread has read, so the file is only read once. Settings queued before it,
+	// such as the ROM's quirks and IPF, are in place for its first frame.
+	bool load_rom(vector<uint8_t>&& image);
+	bool set_quirks(const Chip8Quirks& quirks);
+	bool set_instructions_per_frame(int count) { return send(EmulatorCommand(EmulatorCommandType::SET_INSTRUCTIONS_PER_FRAME, count)); }
+	bool set_fps(int fps) { return send(EmulatorCommand(EmulatorCommandType::SET_FPS, fps)); }
+	// Lets the audio device clock pace emulation instead of the frame timer, see Beeper::needs_frame().
+	bool set_audio_sync(bool enabled) { return send(EmulatorCommand(EmulatorCommandType::SET_AUDIO_SYNC, enabled)); }
+	// Runs `multiplier` times faster than the frame rate, or as fast as possible with UNCAPPED.
+	// Above normal speed the beeper is muted, audio sync is suspended and only about
+	// TURBO_PUBLISH_RATE frames per second are handed to the renderer.
+	static constexpr int UNCAPPED = 0;
+	bool set_speed(int multiplier) { return send(EmulatorCommand(EmulatorCommandType::SET_SPEED, multiplier)); }
+	// While enabled every frame is timed and an EmulationStats window is published each STATS_WINDOW_MICROS.
+	bool set_stats(bool enabled) { return send(EmulatorCommand(EmulatorCommandType::SET_STATS, enabled)); }
+	bool acquire_stats() { return _stats.update(); }
+	const EmulationStats& get_stats() const { return _stats.front(); }
+	// Restarts the current ROM with a fresh seed and records every keypad edge into a movie saved at path.
+	// Recording also ends, and the movie is saved, when a ROM is loaded or the quirks or IPF are set.
+	bool start_recording(const wstring& path);
+	bool stop_recording() { return send(EmulatorCommand(EmulatorCommandType::STOP_RECORDING, 0)); }
+
+	// Takes the newest finished frame without blocking, returns false when none was finished since the last call.
+	bool acquire_frame() { return _frames.update(); }
+	const DisplayFrame& get_frame() const { return _frames.front(); }
+private:
+	static constexpr int COMMAND_CAPACITY = 256;
+	// frames run back to back at most when the audio clock is behind
+	static constexpr int MAX_CATCH_UP_FRAMES = 4;
+	static constexpr int TURBO_PUBLISH_RATE = 60;
+	static constexpr uint64_t STATS_WINDOW_MICROS = 500000;
+
+	bool send(EmulatorCommand&& command);
+	void run();
+	void run_frame();
+	void process_commands();
+	void queue_key_event(int key, bool down, uint32_t timestamp);
+	void begin_movie(const wstring& path);
+	void end_movie();
+	void publish_frame();
+	void publish_stats(uint64_t nowMicros);
+	void log_audio_sync_stats();
+
+	Chip8 _chip8;
+	Beeper& _beeper;
+	std::thread _thread;
+	std::atomic<bool> _running;
+	SPSCQueue<EmulatorCommand, COMMAND_CAPACITY> _commands;
+	TripleBuffer<DisplayFrame> _frames;
+	bool _statsEnabled;
+	EmulationStats _statsWindow;
+	uint64_t _statsWindowStart;
+	TripleBuffer<EmulationStats> _stats;
+	// the loaded image, reloaded when a movie starts
+	vector<uint8_t> _rom;
+	MovieRecorder _recorder;
+	wstring _moviePath;
+	uint64_t _frameNumber;
+	uint32_t _frameStartTime;
+	int _fps;
+	int _speed;
+	std::chrono::steady_clock::time_point _nextPublish;
+	bool _syncToAudio;
+	int _audioSyncFrames;
+};
+
+#endif // EMU_THREAD_H
@@ -0,0 +1,435 @@
+#include "glrenderer.h"
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+static const char* PACKED_VERTEX_SHADER =
+	"#version 110\n"
+	"varying vec2 v_uv;\n"
+	"void main()\n"
+	"{\n"
+	"	v_uv = gl_MultiTexCoord0.xy;\n"
+	"	gl_Position = ftransform();\n"
+	"}\n";
+
+// GLSL 1.10 has no integer bit operations, the bit is extracted with exact float arithmetic instead.
+// u_bits holds the last PERSISTENCE_FRAMES planes stacked vertically, u_newest is the slot of the current one.
+static const char* PACKED_FRAGMENT_SHADER =
+	"#version 110\n"
+	"uniform sampler2D u_bits;\n"
+	"uniform vec2 u_size;\n"
+	"uniform float u_newest;\n"
+	"uniform float u_weights[8];\n"
+	"uniform vec3 u_foreground;\n"
+	"uniform vec3 u_background;\n"
+	"uniform float u_scanlines;\n"
+	"uniform float u_grid;\n"
+	"varying vec2 v_uv;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 pixel = min(floor(v_uv * u_size), u_size - 1.0);\n"
+	"	float column = floor(pixel.x / 8.0);\n"
+	"	float shift = 7.0 - (pixel.x - column * 8.0);\n"
+	"	float lit = 0.0;\n"
+	"	for (int age = 0; age < 8; ++age) {\n"
+	"		float slot = mod(u_newest - float(age) + 8.0, 8.0);\n"
+	"		vec2 texel = vec2((column + 0.5) / (u_size.x / 8.0), (slot * u_size.y + pixel.y + 0.5) / (u_size.y * 8.0));\n"
+	"		float byte = floor(texture2D(u_bits, texel).r * 255.0 + 0.5);\n"
+	"		lit = max(lit, mod(floor(byte / exp2(shift)), 2.0) * u_weights[age]);\n"
+	"	}\n"
+	"	vec3 color = mix(u_background, u_foreground, lit);\n"
+	"	vec2 cell = fract(v_uv * u_size);\n"
+	"	color *= 1.0 - u_scanlines * step(0.5, cell.y);\n"
+	"	color *= 1.0 - u_grid * (1.0 - step(0.06, cell.x) * step(0.06, cell.y));\n"
+	"	gl_FragColor = vec4(color, 1.0);\n"
+	"}\n";
+
+GLRenderer::GLRenderer() : _window(nullptr), _texture(0), _bitsTexture(0),
+	_displayW(0), _displayH(0), _uploadFormat(GL_LUMINANCE),
+	_windowW(0), _windowH(0), _swapMode(SwapMode::IMMEDIATE), _renderMode(RenderMode::TEXTURE),
+	_vertices(),
+	_texCoords { 0.f, 0.f, 1.f, 0.f, 1.f, 1.f, 0.f, 1.f },
+	_program(0), _uBits(-1), _uSize(-1), _uNewest(-1), _uWeights(-1),
+	_uForeground(-1), _uBackground(-1), _uScanlines(-1), _uGrid(-1),
+	_newestPlane(0), _frameWeights { 1.f },
+	_foreground { 0.f, 0.f, 0.f }, _background { 1.f, 1.f, 1.f },
+	_scanlines(0.f), _grid(0.f),
+	_gl()
+{}
+
+bool GLRenderer::init(SDL_Window* window, int displayW, int displayH)
+{
+	const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+	if (!version) {
+		cerr << "init GLRenderer: no current OpenGL context" << endl;
+		return false;
+	}
+	int major = 1, minor = 0;
+	sscanf(version, "%d.%d", &major, &minor);
+	int glVersion = major * 10 + minor;
+	bool hasSwizzle = glVersion >= 33 || SDL_GL_ExtensionSupported("GL_ARB_texture_swizzle");
+	bool hasStorage = glVersion >= 42 || SDL_GL_ExtensionSupported("GL_ARB_texture_storage");
+
+	_window = window;
+	_displayW = displayW;
+	_displayH = displayH;
+
+	glClearColor(0.f, 0.f, 0.f, 1.f);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_2D);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	_texture = create_texture(displayW, displayH, hasSwizzle, hasStorage);
+	if (glVersion >= 20 && load_shader_functions() && build_program()) {
+		_bitsTexture = create_texture(displayW / 8, displayH * PERSISTENCE_FRAMES, hasSwizzle, hasStorage);
+		clear_planes();
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_INT, 0, _vertices);
+	glTexCoordPointer(2, GL_FLOAT, 0, _texCoords);
+
+	int w, h;
+	SDL_GL_GetDrawableSize(window, &w, &h);
+	resize(w, h);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+GLuint GLRenderer::create_texture(int w, int h, bool hasSwizzle, bool hasStorage)
+{
+	GLuint texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	PFNGLTEXSTORAGE2DPROC texStorage2D = nullptr;
+	if (hasStorage) {
+		texStorage2D = reinterpret_cast<PFNGLTEXSTORAGE2DPROC>(SDL_GL_GetProcAddress("glTexStorage2D"));
+	}
+	if (hasSwizzle) {
+		// Single channel storage, replicated to RGB at sample time instead of the deprecated luminance format.
+		_uploadFormat = GL_RED;
+		GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		if (texStorage2D) {
+			texStorage2D(GL_TEXTURE_2D, 1, GL_R8, w, h);
+		}
+		else {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+	else {
+		_uploadFormat = GL_LUMINANCE;
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE8, w, h, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, nullptr);
+	}
+	return texture;
+}
+
+bool GLRenderer::load_shader_functions()
+{
+#define LOAD_GL_FUNCTION(member, type, name) \
+	_gl.member = reinterpret_cast<type>(SDL_GL_GetProcAddress(name)); \
+	if (!_gl.member) return false;
+
+	LOAD_GL_FUNCTION(createShader, PFNGLCREATESHADERPROC, "glCreateShader")
+	LOAD_GL_FUNCTION(shaderSource, PFNGLSHADERSOURCEPROC, "glShaderSource")
+	LOAD_GL_FUNCTION(compileShader, PFNGLCOMPILESHADERPROC, "glCompileShader")
+	LOAD_GL_FUNCTION(getShaderiv, PFNGLGETSHADERIVPROC, "glGetShaderiv")
+	LOAD_GL_FUNCTION(getShaderInfoLog, PFNGLGETSHADERINFOLOGPROC, "glGetShaderInfoLog")
+	LOAD_GL_FUNCTION(deleteShader, PFNGLDELETESHADERPROC, "glDeleteShader")
+	LOAD_GL_FUNCTION(createProgram, PFNGLCREATEPROGRAMPROC, "glCreateProgram")
+	LOAD_GL_FUNCTION(attachShader, PFNGLATTACHSHADERPROC, "glAttachShader")
+	LOAD_GL_FUNCTION(linkProgram, PFNGLLINKPROGRAMPROC, "glLinkProgram")
+	LOAD_GL_FUNCTION(getProgramiv, PFNGLGETPROGRAMIVPROC, "glGetProgramiv")
+	LOAD_GL_FUNCTION(getProgramInfoLog, PFNGLGETPROGRAMINFOLOGPROC, "glGetProgramInfoLog")
+	LOAD_GL_FUNCTION(deleteProgram, PFNGLDELETEPROGRAMPROC, "glDeleteProgram")
+	LOAD_GL_FUNCTION(useProgram, PFNGLUSEPROGRAMPROC, "glUseProgram")
+	LOAD_GL_FUNCTION(getUniformLocation, PFNGLGETUNIFORMLOCATIONPROC, "glGetUniformLocation")
+	LOAD_GL_FUNCTION(uniform1i, PFNGLUNIFORM1IPROC, "glUniform1i")
+	LOAD_GL_FUNCTION(uniform1f, PFNGLUNIFORM1FPROC, "glUniform1f")
+	LOAD_GL_FUNCTION(uniform1fv, PFNGLUNIFORM1FVPROC, "glUniform1fv")
+	LOAD_GL_FUNCTION(uniform2f, PFNGLUNIFORM2FPROC, "glUniform2f")
+	LOAD_GL_FUNCTION(uniform3fv, PFNGLUNIFORM3FVPROC, "glUniform3fv")
+
+#undef LOAD_GL_FUNCTION
+	return true;
+}
+
+GLuint GLRenderer::compile_shader(GLenum type, const char* source)
+{
+	GLuint shader = _gl.createShader(type);
+	_gl.shaderSource(shader, 1, &source, nullptr);
+	_gl.compileShader(shader);
+	GLint status = GL_FALSE;
+	_gl.getShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		GLint length = 0;
+		_gl.getShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+		vector<GLchar> log(std::max(length, 1), 0);
+		_gl.getShaderInfoLog(shader, length, nullptr, log.data());
+		cerr << "Compile shader error: " << log.data() << endl;
+		_gl.deleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+bool GLRenderer::build_program()
+{
+	GLuint vertexShader = compile_shader(GL_VERTEX_SHADER, PACKED_VERTEX_SHADER);
+	GLuint fragmentShader = compile_shader(GL_FRAGMENT_SHADER, PACKED_FRAGMENT_SHADER);
+	if (!vertexShader || !fragmentShader) {
+		if (vertexShader) _gl.deleteShader(vertexShader);
+		if (fragmentShader) _gl.deleteShader(fragmentShader);
+		return false;
+	}
+	GLuint program = _gl.createProgram();
+	_gl.attachShader(program, vertexShader);
+	_gl.attachShader(program, fragmentShader);
+	_gl.linkProgram(program);
+	_gl.deleteShader(vertexShader);
+	_gl.deleteShader(fragmentShader);
+	GLint status = GL_FALSE;
+	_gl.getProgramiv(program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		GLint length = 0;
+		_gl.getProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+		vector<GLchar> log(std::max(length, 1), 0);
+		_gl.getProgramInfoLog(program, length, nullptr, log.data());
+		cerr << "Link program error: " << log.data() << endl;
+		_gl.deleteProgram(program);
+		return false;
+	}
+	_program = program;
+	_uBits = _gl.getUniformLocation(program, "u_bits");
+	_uSize = _gl.getUniformLocation(program, "u_size");
+	_uNewest = _gl.getUniformLocation(program, "u_newest");
+	_uWeights = _gl.getUniformLocation(program, "u_weights");
+	_uForeground = _gl.getUniformLocation(program, "u_foreground");
+	_uBackground = _gl.getUniformLocation(program, "u_background");
+	_uScanlines = _gl.getUniformLocation(program, "u_scanlines");
+	_uGrid = _gl.getUniformLocation(program, "u_grid");
+	return true;
+}
+
+void GLRenderer::shutdown()
+{
+	if (_program) {
+		_gl.useProgram(0);
+		_gl.deleteProgram(_program);
+		_program = 0;
+	}
+	if (_bitsTexture) {
+		glDeleteTextures(1, &_bitsTexture);
+		_bitsTexture = 0;
+	}
+	if (_texture) {
+		glDeleteTextures(1, &_texture);
+		_texture = 0;
+	}
+	_window = nullptr;
+}
+
+void GLRenderer::resize(int w, int h)
+{
+	_windowW = w;
+	_windowH = h;
+	glViewport(0, 0, (GLsizei)w, (GLsizei)h);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0.0, (GLdouble)w, 0.0, (GLdouble)h, -1.0, 1.0);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	update_vertices();
+	glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void GLRenderer::update_vertices()
+{
+	// The client array pointer stays bound to _vertices, so rewriting it in place is all a resize takes.
+	GLint vertices[] = {
+		0, _windowH, _windowW, _windowH, _windowW, 0, 0, 0
+	};
+	std::copy(vertices, vertices + 8, _vertices);
+}
+
+void GLRenderer::draw(const uint8_t* pixels)
+{
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindTexture(GL_TEXTURE_2D, _texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0,
+		0, 0, _displayW, _displayH,
+		_uploadFormat,
+		GL_UNSIGNED_BYTE,
+		pixels);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+void GLRenderer::clear_planes()
+{
+	vector<uint8_t> zeros(_displayW / 8 * _displayH * PERSISTENCE_FRAMES, 0);
+	glBindTexture(GL_TEXTURE_2D, _bitsTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0,
+		0, 0, _displayW / 8, _displayH * PERSISTENCE_FRAMES,
+		_uploadFormat,
+		GL_UNSIGNED_BYTE,
+		zeros.data());
+	_newestPlane = 0;
+}
+
+void GLRenderer::draw_bits(const uint8_t* bits)
+{
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindTexture(GL_TEXTURE_2D, _bitsTexture);
+	_newestPlane = (_newestPlane + 1) % PERSISTENCE_FRAMES;
+	glTexSubImage2D(GL_TEXTURE_2D, 0,
+		0, _newestPlane * _displayH, _displayW / 8, _displayH,
+		_uploadFormat,
+		GL_UNSIGNED_BYTE,
+		bits);
+	_gl.uniform1i(_uBits, 0);
+	_gl.uniform2f(_uSize, (GLfloat)_displayW, (GLfloat)_displayH);
+	_gl.uniform1f(_uNewest, (GLfloat)_newestPlane);
+	_gl.uniform1fv(_uWeights, PERSISTENCE_FRAMES, _frameWeights);
+	_gl.uniform3fv(_uForeground, 1, _foreground);
+	_gl.uniform3fv(_uBackground, 1, _background);
+	_gl.uniform1f(_uScanlines, _scanlines);
+	_gl.uniform1f(_uGrid, _grid);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+void GLRenderer::present()
+{
+	SDL_GL_SwapWindow(_window);
+}
+
+void GLRenderer::set_swap_mode(SwapMode mode)
+{
+	int interval = 0;
+	switch (mode) {
+	case SwapMode::VSYNC:
+		interval = 1;
+		break;
+	case SwapMode::ADAPTIVE:
+		interval = -1;
+		break;
+	default:
+		break;
+	}
+	if (SDL_GL_SetSwapInterval(interval) != 0) {
+		if (mode == SwapMode::ADAPTIVE && SDL_GL_SetSwapInterval(1) == 0) {
+			mode = SwapMode::VSYNC;
+		}
+		else {
+			cerr << "SDL_GL_SetSwapInterval(" << interval << ") error: " << SDL_GetError() << endl;
+			mode = SwapMode::IMMEDIATE;
+		}
+	}
+	_swapMode = mode;
+}
+
+bool GLRenderer::set_render_mode(RenderMode mode)
+{
+	if (mode == RenderMode::PACKED_1BPP && !is_packed_mode_supported()) {
+		return false;
+	}
+	if (_program) {
+		_gl.useProgram(mode == RenderMode::PACKED_1BPP ? _program : 0);
+	}
+	if (mode == RenderMode::PACKED_1BPP && _renderMode != mode) {
+		clear_planes();
+	}
+	_renderMode = mode;
+	return true;
+}
+
+void GLRenderer::set_frame_weights(const float* weights, int count)
+{
+	for (int age = 0; age < PERSISTENCE_FRAMES; ++age) {
+		_frameWeights[age] = age < count ? weights[age] : 0.f;
+	}
+}
+
+void GLRenderer::add_overlay_quad(float x0, float y0, float x1, float y1, uint32_t rgba)
+{
+	GLfloat corners[] = { x0, y0, x1, y0, x1, y1, x0, y0, x1, y1, x0, y1 };
+	_overlayVertices.insert(_overlayVertices.end(), corners, corners + 12);
+	for (int i = 0; i < 6; ++i) {
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			_overlayColors.push_back(static_cast<GLubyte>(rgba >> shift));
+		}
+	}
+}
+
+void GLRenderer::draw_overlay(const float* frameTimes, int count, float budget, const float* meters, int meterCount)
+{
+	static const uint32_t METER_COLORS[] = { 0x4A90E2FF, 0xF5A623FF, 0xBD10E0FF, 0x7ED321FF };
+	const float margin = 8.f, graphH = 64.f, meterH = 6.f, gap = 2.f;
+	float panelW = std::min(256.f, _windowW - 2 * margin);
+	float panelH = graphH + meterCount * (meterH + gap) + 2 * gap;
+	if (panelW <= 0.f || budget <= 0.f) {
+		return;
+	}
+	float left = margin, top = _windowH - margin;
+	float graphBottom = top - gap - graphH;
+
+	// the arrays keep their capacity, so only the first overlay allocates
+	_overlayVertices.clear();
+	_overlayColors.clear();
+	add_overlay_quad(left, top - panelH, left + panelW, top, 0x000000A0);
+	float barW = count > 0 ? panelW / count : 0.f;
+	for (int i = 0; i < count; ++i) {
+		float h = std::min(frameTimes[i] / (2.f * budget), 1.f) * graphH;
+		uint32_t color = frameTimes[i] > budget ? 0xE94B3CFF : 0x50C878FF;
+		add_overlay_quad(left + i * barW, graphBottom, left + (i + 1) * barW - (barW > 2.f ? 1.f : 0.f), graphBottom + h, color);
+	}
+	add_overlay_quad(left, graphBottom + graphH / 2, left + panelW, graphBottom + graphH / 2 + 1, 0xFFFFFFC0);
+	for (int i = 0; i < meterCount; ++i) {
+		float y = graphBottom - (i + 1) * (meterH + gap);
+		float fill = std::min(std::max(meters[i], 0.f), 1.f);
+		add_overlay_quad(left, y, left + panelW, y + meterH, 0x404040FF);
+		add_overlay_quad(left, y, left + panelW * fill, y + meterH, METER_COLORS[i % 4]);
+	}
+
+	bool packed = _renderMode == RenderMode::PACKED_1BPP && _program;
+	if (packed) {
+		_gl.useProgram(0);
+	}
+	glDisable(GL_TEXTURE_2D);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glVertexPointer(2, GL_FLOAT, 0, _overlayVertices.data());
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, _overlayColors.data());
+	glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(_overlayVertices.size() / 2));
+
+	glDisable(GL_BLEND);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_INT, 0, _vertices);
+	glEnable(GL_TEXTURE_2D);
+	glColor4f(1.f, 1.f, 1.f, 1.f);
+	if (packed) {
+		_gl.useProgram(_program);
+	}
+}
+
+void GLRenderer::set_palette(uint32_t foreground, uint32_t background)
+{
+	for (int i = 0; i < 3; ++i) {
+		_foreground[i] = ((foreground >> (16 - 8 * i)) & 0xFF) / 255.f;
+		_background[i] = ((background >> (16 - 8 * i)) & 0xFF) / 255.f;
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef GL_RENDERER_H
+#define GL_RENDERER_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_opengl.h>
+#include <cstdint>
+#include <vector>
+
+enum class SwapMode {
+	IMMEDIATE,
+	VSYNC,
+	// Late frames are swapped immediately instead of waiting for the next vblank.
+	// Falls back to VSYNC when the driver lacks EXT_swap_control_tear.
+	ADAPTIVE
+};
+
+enum class RenderMode {
+	// 1 byte per pixel luminance texture, expanded on the CPU by the core.
+	TEXTURE,
+	// 1 bit per pixel texture (8 pixels per texel), expanded and colored by a fragment shader.
+	PACKED_1BPP
+};
+
+// Draws the CHIP-8 display as a single textured quad.
+// The textures are allocated once in init() and only their contents are replaced every frame,
+// so no storage is reallocated and the CPU never waits on the GPU pipeline.
+// Needs nothing above OpenGL 1.1 but uses R8 + swizzle, immutable storage and GLSL when the context offers them,
+// which covers Mesa llvmpipe as well as the Windows ICDs.
+class GLRenderer {
+public:
+	GLRenderer();
+	GLRenderer(const GLRenderer&) = delete;
+	GLRenderer(GLRenderer&&) = delete;
+	GLRenderer& operator= (const GLRenderer&) = delete;
+	bool init(SDL_Window* window, int displayW, int displayH);
+	void shutdown();
+	void resize(int w, int h);
+	// pixels: displayW * displayH bytes
+	void draw(const uint8_t* pixels);
+	// bits: displayW / 8 * displayH bytes, MSB is the leftmost pixel, set bits use the foreground color.
+	// The previous PERSISTENCE_FRAMES planes stay on the GPU and are blended in by their frame weight.
+	void draw_bits(const uint8_t* bits);
+	void present();
+
+	SwapMode get_swap_mode() const { return _swapMode; }
+	void set_swap_mode(SwapMode mode);
+	RenderMode get_render_mode() const { return _renderMode; }
+	bool set_render_mode(RenderMode mode);
+	bool is_packed_mode_supported() const { return _program != 0; }
+
+	static constexpr int PERSISTENCE_FRAMES = 8;
+	// weights[age] scales the plane drawn `age` frames ago, missing weights are 0
+	void set_frame_weights(const float* weights, int count);
+	// 0xRRGGBB
+	void set_palette(uint32_t foreground, uint32_t background);
+	void set_scanlines(float strength) { _scanlines = strength; }
+	void set_grid(float strength) { _grid = strength; }
+
+	// Telemetry panel in the top left corner, drawn over the display before present().
+	// frameTimes: `count` frame times oldest first, drawn as bars with `budget` at half height, red above it.
+	// meters: `meterCount` values in [0, 1] drawn as horizontal gauges below the graph.
+	void draw_overlay(const float* frameTimes, int count, float budget, const float* meters, int meterCount);
+private:
+	GLuint create_texture(int w, int h, bool hasSwizzle, bool hasStorage);
+	bool load_shader_functions();
+	GLuint compile_shader(GLenum type, const char* source);
+	bool build_program();
+	void clear_planes();
+	void update_vertices();
+	void add_overlay_quad(float x0, float y0, float x1, float y1, uint32_t rgba);
+
+	SDL_Window* _window;
+	GLuint _texture, _bitsTexture;
+	int _displayW, _displayH;
+	GLenum _uploadFormat;
+	int _windowW, _windowH;
+	SwapMode _swapMode;
+	RenderMode _renderMode;
+	GLint _vertices[8];
+	GLfloat _texCoords[8];
+	std::vector<GLfloat> _overlayVertices;
+	std::vector<GLubyte> _overlayColors;
+
+	GLuint _program;
+	GLint _uBits, _uSize, _uNewest, _uWeights, _uForeground, _uBackground, _uScanlines, _uGrid;
+	int _newestPlane;
+	GLfloat _frameWeights[PERSISTENCE_FRAMES];
+	GLfloat _foreground[3], _background[3];
+	float _scanlines, _grid;
+
+	struct ShaderFunctions {
+		PFNGLCREATESHADERPROC createShader;
+		PFNGLSHADERSOURCEPROC shaderSource;
+		PFNGLCOMPILESHADERPROC compileShader;
+		PFNGLGETSHADERIVPROC getShaderiv;
+		PFNGLGETSHADERINFOLOGPROC getShaderInfoLog;
+		PFNGLDELETESHADERPROC deleteShader;
+		PFNGLCREATEPROGRAMPROC createProgram;
+		PFNGLATTACHSHADERPROC attachShader;
+		PFNGLLINKPROGRAMPROC linkProgram;
+		PFNGLGETPROGRAMIVPROC getProgramiv;
+		PFNGLGETPROGRAMINFOLOGPROC getProgramInfoLog;
+		PFNGLDELETEPROGRAMPROC deleteProgram;
+		PFNGLUSEPROGRAMPROC useProgram;
+		PFNGLGETUNIFORMLOCATIONPROC getUniformLocation;
+		PFNGLUNIFORM1IPROC uniform1i;
+		PFNGLUNIFORM1FPROC uniform1f;
+		PFNGLUNIFORM1FVPROC uniform1fv;
+		PFNGLUNIFORM2FPROC uniform2f;
+		PFNGLUNIFORM3FVPROC uniform3fv;
+	} _gl;
+};
+
+#endif // GL_RENDERER_H
@@ -0,0 +1,43 @@
+#include "keymap.h"
+#include "chip8.h"
+#include <algorithm>
+
+Keymap::Keymap()
+{
+	load_default();
+}
+
+void Keymap::load_default()
+{
+	static const SDL_Scancode layout[Chip8::KEYPAD_COUNT] = {
+		SDL_SCANCODE_X,
+		SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+		SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E,
+		SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D,
+		SDL_SCANCODE_Z, SDL_SCANCODE_C,
+		SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
+	};
+	clear();
+	for (int key = 0; key < Chip8::KEYPAD_COUNT; ++key) {
+		bind(layout[key], key);
+	}
+}
+
+void Keymap::clear()
+{
+	std::fill(_keys, _keys + SDL_NUM_SCANCODES, -1);
+}
+
+void Keymap::bind(SDL_Scancode scancode, int key)
+{
+	if (static_cast<unsigned>(scancode) < SDL_NUM_SCANCODES && key >= 0 && key < Chip8::KEYPAD_COUNT) {
+		_keys[scancode] = static_cast<int8_t>(key);
+	}
+}
+
+void Keymap::unbind(SDL_Scancode scancode)
+{
+	if (static_cast<unsigned>(scancode) < SDL_NUM_SCANCODES) {
+		_keys[scancode] = -1;
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+
+// Host scancode to CHIP-8 keypad lookup, one table read per key event.
+// Scancodes follow the physical key position, so the default 4x4 block
+//   1 2 3 4        1 2 3 C
+//   Q W E R   ->   4 5 6 D
+//   A S D F        7 8 9 E
+//   Z X C V        A 0 B F
+// stays in place on any keyboard layout.
+class Keymap {
+public:
+	Keymap();
+	void load_default();
+	void clear();
+	void bind(SDL_Scancode scancode, int key);
+	void unbind(SDL_Scancode scancode);
+	// -1 when the scancode is not bound
+	int get_key(SDL_Scancode scancode) const
+	{
+		return static_cast<unsigned>(scancode) < SDL_NUM_SCANCODES ? _keys[scancode] : -1;
+	}
+private:
+	int8_t _keys[SDL_NUM_SCANCODES];
+};
+
+#endif // KEYMAP_H
@@ -0,0 +1,47 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Fixed capacity lock-free queue for exactly one producer thread and one consumer thread.
+template <typename T, size_t CAPACITY>
+class SPSCQueue {
+	static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+public:
+	SPSCQueue() : _head(0), _tail(0)
+	{}
+	SPSCQueue(const SPSCQueue&) = delete;
+	SPSCQueue& operator= (const SPSCQueue&) = delete;
+
+	// producer side, returns false when the queue is full
+	bool push(T&& item)
+	{
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) == CAPACITY) {
+			return false;
+		}
+		_items[tail & (CAPACITY - 1)] = std::move(item);
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, returns false when the queue is empty
+	bool pop(T& item)
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = std::move(_items[head & (CAPACITY - 1)]);
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+private:
+	T _items[CAPACITY];
+	std::atomic<size_t> _head;
+	std::atomic<size_t> _tail;
+};
+
+#endif // SPSC_QUEUE_H
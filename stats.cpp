@@ -0,0 +1,163 @@
+#include "stats.h"
+#include <algorithm>
+
+DurationHistogram::DurationHistogram()
+{
+	reset();
+}
+
+void DurationHistogram::reset()
+{
+	std::fill(_buckets, _buckets + BUCKET_COUNT, 0);
+	_count = 0;
+	_max = 0;
+	_total = 0;
+}
+
+int DurationHistogram::bucket_of(uint32_t micros)
+{
+	if (micros < LINEAR_BUCKETS) {
+		return static_cast<int>(micros);
+	}
+	int octave = 0;
+	while ((micros >> (octave + 7)) != 0 && octave < OCTAVES - 1) {
+		++octave;
+	}
+	uint32_t sub = std::min(micros >> (octave + 1), static_cast<uint32_t>(2 * SUB_BUCKETS - 1)) - SUB_BUCKETS;
+	return LINEAR_BUCKETS + octave * SUB_BUCKETS + static_cast<int>(sub);
+}
+
+uint32_t DurationHistogram::bucket_upper_bound(int bucket)
+{
+	if (bucket < LINEAR_BUCKETS) {
+		return static_cast<uint32_t>(bucket);
+	}
+	int octave = (bucket - LINEAR_BUCKETS) / SUB_BUCKETS;
+	uint32_t sub = static_cast<uint32_t>((bucket - LINEAR_BUCKETS) % SUB_BUCKETS);
+	return ((SUB_BUCKETS + sub + 1) << (octave + 1)) - 1;
+}
+
+void DurationHistogram::add(uint32_t micros)
+{
+	++_buckets[bucket_of(micros)];
+	++_count;
+	_max = std::max(_max, micros);
+	_total += micros;
+}
+
+uint32_t DurationHistogram::percentile(double p) const
+{
+	if (_count == 0) {
+		return 0;
+	}
+	uint32_t rank = static_cast<uint32_t>(std::max(0.0, std::min(p, 1.0)) * (_count - 1)) + 1;
+	uint32_t seen = 0;
+	for (int bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+		seen += _buckets[bucket];
+		if (seen >= rank) {
+			// the last bucket also collects everything past its range
+			return bucket == BUCKET_COUNT - 1 ? _max : std::min(bucket_upper_bound(bucket), _max);
+		}
+	}
+	return _max;
+}
+
+constexpr int Stats::FRAME_HISTORY;
+
+Stats::Stats()
+{
+	reset();
+}
+
+void Stats::reset()
+{
+	_snapshot = StatsSnapshot();
+	_windowStart = 0;
+	_pumpMicros = _renderMicros = 0;
+	_presents = 0;
+	_frameTime.reset();
+	_presentLatency.reset();
+	_emulation = EmulationStats();
+	std::fill(_frameHistory, _frameHistory + FRAME_HISTORY, 0.f);
+	_frameHistoryNext = _frameHistoryCount = 0;
+}
+
+void Stats::add_present(uint32_t intervalMicros, uint32_t latencyMicros)
+{
+	++_presents;
+	_frameTime.add(intervalMicros);
+	_presentLatency.add(latencyMicros);
+	_frameHistory[_frameHistoryNext] = intervalMicros / 1000.f;
+	_frameHistoryNext = (_frameHistoryNext + 1) % FRAME_HISTORY;
+	_frameHistoryCount = std::min(_frameHistoryCount + 1, FRAME_HISTORY);
+}
+
+void Stats::set_emulation(const EmulationStats& stats)
+{
+	_emulation = stats;
+}
+
+bool Stats::update(uint64_t nowMicros)
+{
+	if (_windowStart == 0) {
+		_windowStart = nowMicros;
+		return false;
+	}
+	uint64_t elapsed = nowMicros - _windowStart;
+	if (elapsed < WINDOW_MICROS) {
+		return false;
+	}
+	double seconds = elapsed / 1e6;
+	double emulationSeconds = _emulation.micros / 1e6;
+
+	StatsSnapshot& s = _snapshot;
+	s.instructionsPerSecond = emulationSeconds > 0 ? _emulation.instructions / emulationSeconds : 0;
+	s.emulatedFramesPerSecond = emulationSeconds > 0 ? _emulation.frames / emulationSeconds : 0;
+	s.instructionsPerFrame = _emulation.instructionsPerFrame;
+	s.executeTimeP50 = _emulation.executeTime.percentile(0.5) / 1000.0;
+	s.executeTimeP99 = _emulation.executeTime.percentile(0.99) / 1000.0;
+	s.executeShare = _emulation.micros > 0 ? _emulation.executeNanos / (_emulation.micros * 1000.0) : 0;
+	s.audioQueuedSamples = _emulation.audioQueuedSamples;
+	s.audioTargetSamples = _emulation.audioTargetSamples;
+
+	s.presentsPerSecond = _presents / seconds;
+	s.frameTimeP50 = _frameTime.percentile(0.5) / 1000.0;
+	s.frameTimeP99 = _frameTime.percentile(0.99) / 1000.0;
+	s.frameTimeMax = _frameTime.get_max() / 1000.0;
+	s.presentLatencyP50 = _presentLatency.percentile(0.5) / 1000.0;
+	s.presentLatencyP99 = _presentLatency.percentile(0.99) / 1000.0;
+	s.renderShare = _renderMicros / static_cast<double>(elapsed);
+	s.pumpShare = _pumpMicros / static_cast<double>(elapsed);
+
+	_windowStart = nowMicros;
+	_pumpMicros = _renderMicros = 0;
+	_presents = 0;
+	_frameTime.reset();
+	_presentLatency.reset();
+	return true;
+}
+
+int Stats::get_frame_times(float* out, int max) const
+{
+	int count = std::min(max, _frameHistoryCount);
+	int first = (_frameHistoryNext - count + FRAME_HISTORY) % FRAME_HISTORY;
+	for (int i = 0; i < count; ++i) {
+		out[i] = _frameHistory[(first + i) % FRAME_HISTORY];
+	}
+	return count;
+}
+
+void Stats::write_json(std::ostream& out) const
+{
+	const StatsSnapshot& s = _snapshot;
+	out << "{\"ips\":" << s.instructionsPerSecond
+		<< ",\"emulated_fps\":" << s.emulatedFramesPerSecond
+		<< ",\"ipf\":" << s.instructionsPerFrame
+		<< ",\"present_fps\":" << s.presentsPerSecond
+		<< ",\"frame_ms\":{\"p50\":" << s.frameTimeP50 << ",\"p99\":" << s.frameTimeP99 << ",\"max\":" << s.frameTimeMax << "}"
+		<< ",\"present_latency_ms\":{\"p50\":" << s.presentLatencyP50 << ",\"p99\":" << s.presentLatencyP99 << "}"
+		<< ",\"execute_ms\":{\"p50\":" << s.executeTimeP50 << ",\"p99\":" << s.executeTimeP99 << "}"
+		<< ",\"share\":{\"execute\":" << s.executeShare << ",\"render\":" << s.renderShare << ",\"pump\":" << s.pumpShare << "}"
+		<< ",\"audio_fill\":{\"queued\":" << s.audioQueuedSamples << ",\"target\":" << s.audioTargetSamples << "}"
+		<< "}";
+}
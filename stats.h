@@ -0,0 +1,109 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <ostream>
+#include <chrono>
+
+// Log-linear histogram of durations in microseconds: exact below 64 us, then 32 buckets per power of two
+// (about 3% resolution) up to several seconds. Fixed size, add() never allocates.
+class DurationHistogram {
+public:
+	static constexpr int LINEAR_BUCKETS = 64;
+	static constexpr int SUB_BUCKETS = 32;
+	static constexpr int OCTAVES = 17;
+	static constexpr int BUCKET_COUNT = LINEAR_BUCKETS + OCTAVES * SUB_BUCKETS;
+
+	DurationHistogram();
+	void reset();
+	void add(uint32_t micros);
+	// upper bound of the bucket holding the p-th percentile, p in [0, 1]
+	uint32_t percentile(double p) const;
+	uint32_t get_count() const { return _count; }
+	uint32_t get_max() const { return _max; }
+	uint64_t get_total() const { return _total; }
+private:
+	static int bucket_of(uint32_t micros);
+	static uint32_t bucket_upper_bound(int bucket);
+
+	uint32_t _buckets[BUCKET_COUNT];
+	uint32_t _count;
+	uint32_t _max;
+	uint64_t _total;
+};
+
+// One measurement window as seen by the emulation thread.
+struct EmulationStats {
+	EmulationStats() : micros(0), frames(0), instructions(0), instructionsPerFrame(0), executeNanos(0),
+		audioQueuedSamples(0), audioTargetSamples(0)
+	{}
+	uint64_t micros;
+	uint64_t frames;
+	uint64_t instructions;
+	int instructionsPerFrame;
+	// time spent in Chip8::run_frame() per frame, the sum in nanoseconds since a frame often takes less than 1 us
+	DurationHistogram executeTime;
+	uint64_t executeNanos;
+	// audio frame queue fill at the end of the window, 0 / 0 unless audio sync is on
+	int audioQueuedSamples, audioTargetSamples;
+};
+
+struct StatsSnapshot {
+	StatsSnapshot() : instructionsPerSecond(0), emulatedFramesPerSecond(0), instructionsPerFrame(0),
+		presentsPerSecond(0), frameTimeP50(0), frameTimeP99(0), frameTimeMax(0),
+		presentLatencyP50(0), presentLatencyP99(0), executeTimeP50(0), executeTimeP99(0),
+		executeShare(0), renderShare(0), pumpShare(0), audioQueuedSamples(0), audioTargetSamples(0)
+	{}
+	double instructionsPerSecond;
+	double emulatedFramesPerSecond;
+	int instructionsPerFrame;
+	double presentsPerSecond;
+	// milliseconds between presents
+	double frameTimeP50, frameTimeP99, frameTimeMax;
+	// milliseconds from the end of an emulated frame to the end of its present
+	double presentLatencyP50, presentLatencyP99;
+	// milliseconds per emulated frame inside the core
+	double executeTimeP50, executeTimeP99;
+	// fraction of wall time: execute on the emulation thread, render and event pumping on the UI thread
+	double executeShare, renderShare, pumpShare;
+	int audioQueuedSamples, audioTargetSamples;
+};
+
+// Collects frame timing on the UI thread and combines it with the emulation thread's EmulationStats
+// into a snapshot every WINDOW_MICROS. Feeds the overlay graph and the periodic JSON dump.
+class Stats {
+public:
+	static constexpr uint64_t WINDOW_MICROS = 1000000;
+	static constexpr int FRAME_HISTORY = 128;
+	// steady clock shared by both threads
+	static uint64_t now_micros()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	Stats();
+	void reset();
+	void add_pump(uint32_t micros) { _pumpMicros += micros; }
+	void add_render(uint32_t micros) { _renderMicros += micros; }
+	// intervalMicros: since the previous present, latencyMicros: since the frame was finished by the emulation thread
+	void add_present(uint32_t intervalMicros, uint32_t latencyMicros);
+	void set_emulation(const EmulationStats& stats);
+	// Closes the window once it spans WINDOW_MICROS, returns true when a new snapshot is ready.
+	bool update(uint64_t nowMicros);
+	const StatsSnapshot& get_snapshot() const { return _snapshot; }
+	// the last FRAME_HISTORY present intervals in milliseconds, oldest first; returns how many were written
+	int get_frame_times(float* out, int max) const;
+	// the snapshot as a single line of JSON
+	void write_json(std::ostream& out) const;
+private:
+	StatsSnapshot _snapshot;
+	uint64_t _windowStart;
+	uint64_t _pumpMicros, _renderMicros;
+	uint32_t _presents;
+	DurationHistogram _frameTime, _presentLatency;
+	EmulationStats _emulation;
+	float _frameHistory[FRAME_HISTORY];
+	int _frameHistoryNext, _frameHistoryCount;
+};
+
+#endif // STATS_H
@@ -0,0 +1,45 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free single producer / single consumer triple buffer.
+// The producer fills back() and publish()es it; the consumer calls update() to take the newest
+// published slot and reads front(). Neither side ever waits, and a slow consumer simply skips frames.
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() : _buffers(), _back(0), _middle(1), _front(2)
+	{}
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator= (const TripleBuffer&) = delete;
+
+	// producer side
+	T& back() { return _buffers[_back]; }
+	void publish()
+	{
+		int previous = _middle.exchange(_back | FRESH, std::memory_order_acq_rel);
+		_back = previous & INDEX_MASK;
+	}
+
+	// consumer side, returns false when nothing was published since the last call
+	bool update()
+	{
+		if (!(_middle.load(std::memory_order_relaxed) & FRESH)) {
+			return false;
+		}
+		int previous = _middle.exchange(_front, std::memory_order_acq_rel);
+		_front = previous & INDEX_MASK;
+		return true;
+	}
+	const T& front() const { return _buffers[_front]; }
+private:
+	static constexpr int INDEX_MASK = 0x3;
+	static constexpr int FRESH = 0x4;
+	T _buffers[3];
+	int _back;
+	std::atomic<int> _middle;
+	int _front;
+};
+
+#endif // TRIPLE_BUFFER_H
@@ -4,6 +4,17 @@ processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 
 #include "Chip8\chip8.h"
 #include "winlayout.h"
+#include "glrenderer.h"
+#include "compositor.h"
+#include "romdb.h"
+#include "analyzer.h"
+#include "hash.h"
+#include "mappedfile.h"
+#include "beeper.h"
+#include "emuthread.h"
+#include "keymap.h"
+#include "stats.h"
+#include "trace.h"
 
 #define NOMINMAX
 #include <Windows.h>
@@ -13,8 +24,6 @@ processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 #include <SDL2\SDL.h>
 #include <SDL2\SDL_syswm.h>
 
-#include <gl\GL.h>
-
 #include <cstdio>
 #include <iostream>
 #include <fstream>
@@ -30,6 +39,7 @@ using std::cerr;
 using std::endl;
 using std::vector;
 using std::ifstream;
+using std::ofstream;
 using std::queue;
 using std::stringstream;
 using std::string;
@@ -40,70 +50,56 @@ SDL_Window* sdlWnd = nullptr;
 SDL_GLContext glContext = nullptr;
 int fps = 60;
 
-GLint windowW, windowH;
-void resize_window(int w, int h);
-
-void on_key_down(Chip8& chip8, const SDL_Event& event);
-void on_key_up(Chip8& chip8, const SDL_Event& event);
-
-GLuint texture[] = { 0 };
-void init_GL();
-void setup_chip8_image_vertices(void);
-void draw_chip8_image_buffer(Chip8& chip8);
-
-#define WAV_CREATION
-#ifdef WAV_CREATION
-#define SAMPLE_RATE 44100	// Samples per second
-#define DURATION	0.25	// Duration in seconds
-#define FREQUENCY	392.0	// frequency of the beep (G4 note)
-
-// WAV file header structure
-typedef struct {
-	char chunkID[4];       // "RIFF"
-	uint32_t chunkSize;    // File size - 8 bytes
-	char format[4];        // "WAVE"
-
-	char subchunk1ID[4];   // "fmt "
-	uint32_t subchunk1Size;// Size of the fmt chunk (16 for PCM)
-	uint16_t audioFormat;  // Audio format (1 for PCM)
-	uint16_t numChannels;  // Number of channels (1 for mono)
-	uint32_t sampleRate;   // Samples per second
-	uint32_t byteRate;     // Bytes per second
-	uint16_t blockAlign;   // Bytes per sample * number of channels
-	uint16_t bitsPerSample;// Bits per sample
-
-	char subchunk2ID[4];   // "data"
-	uint32_t subchunk2Size;// Size of the data chunk
-} WavHeader;
-
-void write_wav_header(uint8_t* buffer, int sampleRate, int bitsPerSample, int numChannels, int numSamples) {
-	WavHeader header;
-
-	// Fill the header
-	memcpy(header.chunkID, "RIFF", 4);
-	header.chunkSize = 36 + numSamples * numChannels * (bitsPerSample / 8);
-	memcpy(header.format, "WAVE", 4);
-	memcpy(header.subchunk1ID, "fmt ", 4);
-	header.subchunk1Size = 16;
-	header.audioFormat = 1; // PCM
-	header.numChannels = numChannels;
-	header.sampleRate = sampleRate;
-	header.byteRate = sampleRate * numChannels * (bitsPerSample / 8);
-	header.blockAlign = numChannels * (bitsPerSample / 8);
-	header.bitsPerSample = bitsPerSample;
-	memcpy(header.subchunk2ID, "data", 4);
-	header.subchunk2Size = numSamples * numChannels * (bitsPerSample / 8);
-
-	// Write the header
-	std::copy((uint8_t*)&header, (uint8_t*)&header + sizeof(WavHeader), buffer);
-}
-#endif
+void on_key_down(EmulationThread& emulation, const SDL_Event& event);
+void on_key_up(EmulationThread& emulation, const SDL_Event& event);
+Keymap keymap;
+
+GLRenderer glRenderer;
+Compositor compositor;
+void apply_compositor_config(const CompositorConfig& config);
+// built-in profiles, plus romdb.txt from the working directory when there is one
+RomDatabase romDatabase;
+
+Beeper beeper;
+EmulationThread emulation(beeper);
+bool syncToAudio = false;
+void toggle_audio_sync(HWND hwnd);
+bool recordingMovie = false;
+// multiplier picked in the Speed menu, holding Tab runs uncapped on top of it
+int speed = 1;
+void select_speed(HWND hwnd, UINT id);
+
+Stats stats;
+bool statsOverlay = false;
+// one JSON line per stats window
+ofstream statsDump;
+uint64_t lastPresentMicros = 0;
+bool is_stats_enabled() { return statsOverlay || statsDump.is_open(); }
+void toggle_stats_overlay(HWND hwnd);
+void toggle_stats_dump(HWND hwnd);
+void update_stats();
+
+void toggle_trace(HWND hwnd);
+void toggle_movie_recording(HWND hwnd);
+void end_movie_recording(HWND hwnd);
+
+void present_frame(const DisplayFrame& frame);
 
 void char_to_tchar(TCHAR* dst, const char* src, size_t dstLen);
 
 #define ID_FILE_LOAD_ROM					512
+#define ID_FILE_RECORD_MOVIE				513
 #define ID_FILE_EXIT						WM_DESTROY
 #define ID_SETTING_CONFIG					1024
+#define ID_SETTING_AUDIO_SYNC				1029
+#define ID_SETTING_STATS_OVERLAY			1035
+#define ID_SETTING_STATS_DUMP				1036
+#define ID_SETTING_TRACE					1037
+#define ID_SPEED_1X							1030
+#define ID_SPEED_2X							1031
+#define ID_SPEED_4X							1032
+#define ID_SPEED_8X							1033
+#define ID_SPEED_UNCAPPED					1034
 #define ID_QUIRK_PARENT						1025
 #define ID_QUIRK_RESET_VF					1026
 #define ID_QUIRK_SET_VX_TO_VY				1027
@@ -111,33 +107,42 @@ void char_to_tchar(TCHAR* dst, const char* src, size_t dstLen);
 
 #define ID_VIDEO_PARENT						1536
 #define ID_VIDEO_FPS_EDIT					1537
-#define ID_VIDEO_SKIP_ON_SPRITE_COLLISION	1538
+#define ID_VIDEO_ANTI_FLICKER				1538
+#define ID_VIDEO_VSYNC						1539
+#define ID_VIDEO_IPF_EDIT					1540
 
 typedef struct ConfigTemp {
-	ConfigTemp(Chip8* chip8=nullptr) : chip8(chip8), fps(0), quirks()
+	ConfigTemp() : fps(0), ipf(Chip8::DEFAULT_INSTRUCTIONS_PER_FRAME), quirks()
 	{}
 
-	Chip8* chip8;
 	HWND dialog;
 	HWND quirksGroup;
 	HWND videoGroup;
 	HWND fpsEdit;
+	HWND ipfEdit;
 	int fps;
+	// what the emulation thread was last told, the core itself is only touched from that thread
+	int ipf;
 	Chip8Quirks quirks;
 	WNDPROC originalQuriksProc;
 } ConfigTemp;
 
 void add_menu(HWND hwnd);
 bool open_chip8_file(HWND hwnd, TCHAR* filepath);
+bool save_movie_file(HWND hwnd, TCHAR* filepath);
 
 INT_PTR CALLBACK dialog_proc(HWND, UINT, WPARAM, LPARAM);
 HWND create_config_dialog(HWND hParent, ConfigTemp& config);
 void confirm_modal_dialog(ConfigTemp& config);
+void load_rom(const wstring& path, ConfigTemp& config);
+void apply_rom_profile(const RomProfile* profile, ConfigTemp& config);
+void warn_quirk_dependencies(const vector<uint8_t>& image);
 void close_modal_dialog(HWND hwnd);
 HFONT get_scaled_font(HWND hwnd, int fontSize);
 LRESULT CALLBACK fps_edit_subclass_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam,
 	UINT_PTR uIdSubclass, DWORD_PTR dwRefData);
 void limit_fps(HWND fpsEdit);
+void limit_ipf(HWND ipfEdit, int& ipf);
 
 int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine, int nCmdShow)
 {
@@ -164,34 +169,27 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLi
 	ShowWindow(hwnd, SW_RESTORE);
 
 	glContext = SDL_GL_CreateContext(sdlWnd);
-	SDL_GL_SetSwapInterval(0);
-	init_GL();
-
-	Chip8 chip8;
-	ConfigTemp config(&chip8);
-
-#ifdef WAV_CREATION
-	int numSamples = static_cast<int>(SAMPLE_RATE * DURATION);
-	vector<uint8_t> audioBuf(sizeof(WavHeader) + sizeof(int16_t)*numSamples, 0);
-	write_wav_header(audioBuf.data(), SAMPLE_RATE, 16, 1, numSamples);
-	uint16_t* data = (uint16_t*)(audioBuf.data() + sizeof(WavHeader));
-	for (int i = 0; i < numSamples; i++) {
-		double t = (double)i / SAMPLE_RATE; // Time in seconds
-		data[i] = (int16_t)(32767 * sin(2 * M_PI * FREQUENCY * t));
+	glRenderer.init(sdlWnd, Chip8::DISPLAY_COLS, Chip8::DISPLAY_ROWS);
+	glRenderer.set_swap_mode(SwapMode::IMMEDIATE);
+	glRenderer.set_render_mode(RenderMode::PACKED_1BPP);
+	apply_compositor_config(CompositorConfig());
+
+	ConfigTemp config;
+	Tracer::instance().set_thread_name("ui");
+	if (romDatabase.load_overrides("romdb.txt")) {
+		cout << "ROM database: " << romDatabase.get_override_count() << " profile(s) from romdb.txt" << endl;
 	}
-#endif
+
+	beeper.open();
+	emulation.set_fps(fps);
+	emulation.start();
 
 	bool quit = false;
 	SDL_Event e;
 
-	LARGE_INTEGER startingTime, endingTime, elapsedMicroseconds;
-	LARGE_INTEGER frequency;
-	QueryPerformanceFrequency(&frequency);
-	QueryPerformanceCounter(&startingTime);
-
-	bool readyToDraw = false;
-	uint8_t lastSoundTimer = 0;
 	while (!quit) {
+		uint64_t pumpStart = is_stats_enabled() ? Stats::now_micros() : 0;
+		uint64_t pumpTraceStart = Tracer::is_enabled() ? Tracer::now_micros() : 0;
 		while (SDL_PollEvent(&e) != 0)
 		{
 			switch (e.type) {
@@ -208,67 +206,82 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLi
 						case ID_FILE_LOAD_ROM:{
 							TCHAR filepath[MAX_PATH] = { 0 };
 							if (open_chip8_file(hwnd, filepath)) {
-								chip8.load_rom(filepath);
+								end_movie_recording(hwnd);
+								load_rom(filepath, config);
+								compositor.reset();
 							}
 						}
 						break;
+						case ID_FILE_RECORD_MOVIE:
+							toggle_movie_recording(hwnd);
+						break;
 						case ID_SETTING_CONFIG:
 							create_config_dialog(hwnd, config);
 						break;
+						case ID_SETTING_AUDIO_SYNC:
+							toggle_audio_sync(hwnd);
+						break;
+						case ID_SETTING_STATS_OVERLAY:
+							toggle_stats_overlay(hwnd);
+						break;
+						case ID_SETTING_STATS_DUMP:
+							toggle_stats_dump(hwnd);
+						break;
+						case ID_SETTING_TRACE:
+							toggle_trace(hwnd);
+						break;
+						case ID_SPEED_1X:
+						case ID_SPEED_2X:
+						case ID_SPEED_4X:
+						case ID_SPEED_8X:
+						case ID_SPEED_UNCAPPED:
+							select_speed(hwnd, LOWORD(e.syswm.msg->msg.win.wParam));
+						break;
 					}
 				}
 			case SDL_WINDOWEVENT:
 				if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
-					resize_window(e.window.data1, e.window.data2);
+					glRenderer.resize(e.window.data1, e.window.data2);
 				} else if (e.window.event == SDL_WINDOWEVENT_SHOWN) {
 					int w, h;
 					SDL_GetWindowSize(sdlWnd, &w, &h);
-					resize_window(w, h);
+					glRenderer.resize(w, h);
 				}
 				break;
 			case SDL_KEYDOWN:
-				on_key_down(chip8, e);
+				on_key_down(emulation, e);
 				break;
 			case SDL_KEYUP:
-				on_key_up(chip8, e);
+				on_key_up(emulation, e);
 				break;
 			}
 		}
 
-		if (chip8.is_ROM_opened()) {
-			uint16_t code = chip8.fetch_code();
-			if (!readyToDraw) {
-				chip8.execute_code(code);
-				readyToDraw = chip8.is_draw_code(code) && !(chip8.is_sprites_overlapped() && chip8.skip_on_sprites_overlap());
-			}
+		if (pumpTraceStart != 0 && Tracer::is_enabled()) {
+			Tracer::instance().complete("poll events", "ui", pumpTraceStart, Tracer::now_micros());
+		}
+		if (is_stats_enabled()) {
+			stats.add_pump(static_cast<uint32_t>(Stats::now_micros() - pumpStart));
+		}
 
-			QueryPerformanceCounter(&endingTime);
-			elapsedMicroseconds.QuadPart = endingTime.QuadPart - startingTime.QuadPart;
-			elapsedMicroseconds.QuadPart *= 1000000;
-			elapsedMicroseconds.QuadPart /= frequency.QuadPart;
-			if (elapsedMicroseconds.QuadPart > 1000000 / fps) {
-				QueryPerformanceCounter(&startingTime);
-				if (lastSoundTimer == 0 && chip8.get_sound_timer() > 0) {
-					lastSoundTimer = chip8.get_sound_timer();
-#ifdef WAV_CREATION
-					PlaySound((LPCTSTR)audioBuf.data(), GetModuleHandle(nullptr), SND_MEMORY | SND_ASYNC | SND_LOOP);
-#endif
-				}
-				else if (lastSoundTimer > 0 && chip8.get_sound_timer() == 0) {
-					lastSoundTimer = 0;
-					PlaySound(nullptr, GetModuleHandle(nullptr), SND_SYNC);
-				}
-				chip8.countdown();
-				if (readyToDraw) {
-					readyToDraw = false;
-					chip8.execute_code(code);
-				}
-				draw_chip8_image_buffer(chip8);
-				SDL_GL_SwapWindow(sdlWnd);
-			}
+		// the emulation thread paces itself, only frames it finished since the last pass are drawn
+		if (emulation.acquire_frame()) {
+			present_frame(emulation.get_frame());
+		}
+		else {
+			SDL_Delay(1);
+		}
+		if (is_stats_enabled()) {
+			update_stats();
 		}
 	}
 
+	emulation.stop();
+	beeper.close();
+	Tracer::instance().stop();
+	glRenderer.shutdown();
+	SDL_GL_DeleteContext(glContext);
+	glContext = nullptr;
 	SDL_DestroyWindow(sdlWnd);
 	sdlWnd = nullptr;
 
@@ -294,107 +307,247 @@ void create_console_window()
 #endif
 }
 
-void on_key_down(Chip8& chip8, const SDL_Event& event)
+void on_key_down(EmulationThread& emulation, const SDL_Event& event)
 {
-	switch (event.key.keysym.sym)
-	{
-	case SDLK_1: chip8.on_key_down(0x1); break;
-	case SDLK_2: chip8.on_key_down(0x2); break;
-	case SDLK_3: chip8.on_key_down(0x3); break;
-	case SDLK_q: chip8.on_key_down(0x4); break;
-	case SDLK_w: chip8.on_key_down(0x5); break;
-	case SDLK_e: chip8.on_key_down(0x6); break;
-	case SDLK_a: chip8.on_key_down(0x7); break;
-	case SDLK_s: chip8.on_key_down(0x8); break;
-	case SDLK_d: chip8.on_key_down(0x9); break;
-	case SDLK_z: chip8.on_key_down(0xA); break;
-	case SDLK_x: chip8.on_key_down(0x0); break;
-	case SDLK_c: chip8.on_key_down(0xB); break;
-	case SDLK_4: chip8.on_key_down(0xC); break;
-	case SDLK_r: chip8.on_key_down(0xD); break;
-	case SDLK_f: chip8.on_key_down(0xE); break;
-	case SDLK_v: chip8.on_key_down(0xF); break;
-	default: break;
+	if (event.key.keysym.scancode == SDL_SCANCODE_TAB && !event.key.repeat) {
+		emulation.set_speed(EmulationThread::UNCAPPED);
+		return;
+	}
+	int key = keymap.get_key(event.key.keysym.scancode);
+	if (key >= 0 && !event.key.repeat) {
+		emulation.key_down(key, event.key.timestamp);
+	}
+}
+
+void on_key_up(EmulationThread& emulation, const SDL_Event& event)
+{
+	if (event.key.keysym.scancode == SDL_SCANCODE_TAB) {
+		emulation.set_speed(speed);
+		return;
+	}
+	int key = keymap.get_key(event.key.keysym.scancode);
+	if (key >= 0) {
+		emulation.key_up(key, event.key.timestamp);
 	}
 }
 
-void on_key_up(Chip8& chip8, const SDL_Event& event)
+void present_frame(const DisplayFrame& frame)
 {
-	switch (event.key.keysym.sym)
+	uint64_t renderStart = is_stats_enabled() ? Stats::now_micros() : 0;
 	{
-	case SDLK_1: chip8.on_key_up(0x1); break;
-	case SDLK_2: chip8.on_key_up(0x2); break;
-	case SDLK_3: chip8.on_key_up(0x3); break;
-	case SDLK_q: chip8.on_key_up(0x4); break;
-	case SDLK_w: chip8.on_key_up(0x5); break;
-	case SDLK_e: chip8.on_key_up(0x6); break;
-	case SDLK_a: chip8.on_key_up(0x7); break;
-	case SDLK_s: chip8.on_key_up(0x8); break;
-	case SDLK_d: chip8.on_key_up(0x9); break;
-	case SDLK_z: chip8.on_key_up(0xA); break;
-	case SDLK_x: chip8.on_key_up(0x0); break;
-	case SDLK_c: chip8.on_key_up(0xB); break;
-	case SDLK_4: chip8.on_key_up(0xC); break;
-	case SDLK_r: chip8.on_key_up(0xD); break;
-	case SDLK_f: chip8.on_key_up(0xE); break;
-	case SDLK_v: chip8.on_key_up(0xF); break;
-	default: break;
+		TRACE_SCOPE("texture upload", "render");
+		if (glRenderer.get_render_mode() == RenderMode::PACKED_1BPP) {
+			glRenderer.draw_bits(frame.bits);
+		}
+		else {
+			glRenderer.draw(compositor.compose(frame.pixels));
+		}
+	}
+	if (statsOverlay) {
+		TRACE_SCOPE("stats overlay", "render");
+		float frameTimes[Stats::FRAME_HISTORY];
+		int count = stats.get_frame_times(frameTimes, Stats::FRAME_HISTORY);
+		const StatsSnapshot& snapshot = stats.get_snapshot();
+		float audioFill = snapshot.audioTargetSamples > 0 ? 0.5f * snapshot.audioQueuedSamples / snapshot.audioTargetSamples : 0.f;
+		float meters[] = {
+			static_cast<float>(snapshot.executeShare),
+			static_cast<float>(snapshot.renderShare),
+			static_cast<float>(snapshot.pumpShare),
+			audioFill
+		};
+		glRenderer.draw_overlay(frameTimes, count, 1000.f / fps, meters, 4);
+	}
+	{
+		TRACE_SCOPE("swap", "render");
+		glRenderer.present();
+	}
+
+	if (is_stats_enabled()) {
+		uint64_t now = Stats::now_micros();
+		stats.add_render(static_cast<uint32_t>(now - renderStart));
+		if (lastPresentMicros != 0) {
+			stats.add_present(static_cast<uint32_t>(now - lastPresentMicros), static_cast<uint32_t>(now - frame.finishedMicros));
+		}
+		lastPresentMicros = now;
 	}
 }
 
-void resize_window(int w, int h)
+void toggle_stats_overlay(HWND hwnd)
 {
-	windowW = w;
-	windowH = h;
-	glViewport(0, 0, (GLsizei)w, (GLsizei)h);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0.0, (GLdouble)w, 0.0, (GLdouble)h, -1.0, 1.0);
-	glClearColor(0.f, 0.f, 0.f, 0.f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	setup_chip8_image_vertices();
-	SDL_GL_SwapWindow(sdlWnd);
+	bool wasEnabled = is_stats_enabled();
+	statsOverlay = !statsOverlay;
+	CheckMenuItem(GetMenu(hwnd), ID_SETTING_STATS_OVERLAY, MF_BYCOMMAND | (statsOverlay ? MF_CHECKED : MF_UNCHECKED));
+	if (!statsOverlay) {
+		SDL_SetWindowTitle(sdlWnd, "Chip8 Interpreter");
+	}
+	if (wasEnabled != is_stats_enabled()) {
+		stats.reset();
+		lastPresentMicros = 0;
+		emulation.set_stats(is_stats_enabled());
+	}
 }
 
-void init_GL()
+void toggle_stats_dump(HWND hwnd)
 {
-	glClearColor(1.f, 1.f, 1.f, 1.f);
-	glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
-	glEnable(GL_TEXTURE_2D);
-	glGenTextures(1, &texture[0]);
-	glBindTexture(GL_TEXTURE_2D, texture[0]);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	bool wasEnabled = is_stats_enabled();
+	if (statsDump.is_open()) {
+		statsDump.close();
+	}
+	else {
+		statsDump.open("chip8_stats.jsonl", ofstream::app);
+		if (!statsDump.is_open()) {
+			cerr << "Open: chip8_stats.jsonl error" << endl;
+		}
+	}
+	CheckMenuItem(GetMenu(hwnd), ID_SETTING_STATS_DUMP, MF_BYCOMMAND | (statsDump.is_open() ? MF_CHECKED : MF_UNCHECKED));
+	if (wasEnabled != is_stats_enabled()) {
+		stats.reset();
+		lastPresentMicros = 0;
+		emulation.set_stats(is_stats_enabled());
+	}
 }
 
-void setup_chip8_image_vertices(void)
+void toggle_trace(HWND hwnd)
 {
-	static GLint vertices[] = {
-		0, windowH, windowW, windowH, windowW, 0, 0, 0
-	};
-	static GLfloat texCoords[] = {
-		0.f, 0.f, 1.f, 0.f, 1.f, 1.f, 0.f, 1.f
-	};
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	glVertexPointer(2, GL_INT, 0, vertices);
-	glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
+	if (Tracer::is_enabled()) {
+		Tracer::instance().stop();
+		cout << "Trace saved to chip8_trace.json" << endl;
+	}
+	else {
+		Tracer::instance().start("chip8_trace.json");
+	}
+	CheckMenuItem(GetMenu(hwnd), ID_SETTING_TRACE, MF_BYCOMMAND | (Tracer::is_enabled() ? MF_CHECKED : MF_UNCHECKED));
+}
+
+void update_stats()
+{
+	if (emulation.acquire_stats()) {
+		stats.set_emulation(emulation.get_stats());
+	}
+	if (!stats.update(Stats::now_micros())) {
+		return;
+	}
+	const StatsSnapshot& snapshot = stats.get_snapshot();
+	if (statsOverlay) {
+		stringstream title;
+		title.precision(3);
+		title << "Chip8 Interpreter - " << snapshot.instructionsPerSecond / 1e6 << " MIPS, "
+			<< snapshot.presentsPerSecond << " fps, frame p50 " << snapshot.frameTimeP50
+			<< " ms p99 " << snapshot.frameTimeP99 << " ms, latency p99 " << snapshot.presentLatencyP99 << " ms";
+		SDL_SetWindowTitle(sdlWnd, title.str().c_str());
+	}
+	if (statsDump.is_open()) {
+		stats.write_json(statsDump);
+		statsDump << endl;
+	}
+}
+
+void toggle_audio_sync(HWND hwnd)
+{
+	syncToAudio = !syncToAudio && beeper.is_open();
+	emulation.set_audio_sync(syncToAudio);
+	CheckMenuItem(GetMenu(hwnd), ID_SETTING_AUDIO_SYNC, MF_BYCOMMAND | (syncToAudio ? MF_CHECKED : MF_UNCHECKED));
 }
 
-void draw_chip8_image_buffer(Chip8& chip8)
+void select_speed(HWND hwnd, UINT id)
 {
-	glClear(GL_COLOR_BUFFER_BIT);
-	const uint8_t* bytes = chip8.get_display_buffer();
-	glTexImage2D(GL_TEXTURE_2D, 0,
-		GL_LUMINANCE,
-		64, 32, 0,
-		GL_LUMINANCE,
-		GL_UNSIGNED_BYTE,
-		bytes);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-	glFinish();
+	static const int speeds[] = { 1, 2, 4, 8, EmulationThread::UNCAPPED };
+	speed = speeds[id - ID_SPEED_1X];
+	emulation.set_speed(speed);
+	CheckMenuRadioItem(GetMenu(hwnd), ID_SPEED_1X, ID_SPEED_UNCAPPED, id, MF_BYCOMMAND);
+}
+
+void toggle_movie_recording(HWND hwnd)
+{
+	if (recordingMovie) {
+		end_movie_recording(hwnd);
+		return;
+	}
+	TCHAR filepath[MAX_PATH] = { 0 };
+	if (save_movie_file(hwnd, filepath) && emulation.start_recording(filepath)) {
+		recordingMovie = true;
+		CheckMenuItem(GetMenu(hwnd), ID_FILE_RECORD_MOVIE, MF_BYCOMMAND | MF_CHECKED);
+	}
+}
+
+// The emulation thread saves the movie itself whenever the ROM, quirks or IPF are set, this only keeps the menu in step.
+void end_movie_recording(HWND hwnd)
+{
+	if (recordingMovie) {
+		emulation.stop_recording();
+		recordingMovie = false;
+		CheckMenuItem(GetMenu(hwnd), ID_FILE_RECORD_MOVIE, MF_BYCOMMAND | MF_UNCHECKED);
+	}
+}
+
+void apply_compositor_config(const CompositorConfig& config)
+{
+	compositor.set_config(config);
+	float weights[Compositor::MAX_FRAMES];
+	compositor.get_frame_weights(weights);
+	glRenderer.set_frame_weights(weights, Compositor::MAX_FRAMES);
+}
+
+// Reads the ROM once here: its hash picks the database profile, whose settings are queued ahead of the
+// image so the emulation thread never runs the new ROM with the previous one's quirks or IPF.
+void load_rom(const wstring& path, ConfigTemp& config)
+{
+	MappedFile file;
+	if (!file.open(native_path(path)) || file.get_size() > static_cast<size_t>(Chip8::MAX_ROM_SIZE) || !file.map()) {
+		cerr << "Load: " << utf8_path(path) << ": could not read a ROM" << endl;
+		return;
+	}
+	vector<uint8_t> image(file.get_data(), file.get_data() + file.get_size());
+	const RomProfile* profile = romDatabase.find(fnv1a64(image.data(), image.size()));
+	apply_rom_profile(profile, config);
+	if (!profile || !(profile->flags & ROM_PROFILE_HAS_QUIRKS)) {
+		warn_quirk_dependencies(image);
+	}
+	emulation.load_rom(std::move(image));
+}
+
+// A ROM the database knows gets its quirks, IPF and flicker filter set as if picked in the Settings dialog,
+// so the dialog shows them; anything the profile leaves out, and any unknown ROM, keeps the current settings.
+void apply_rom_profile(const RomProfile* profile, ConfigTemp& config)
+{
+	if (!profile) {
+		return;
+	}
+	cout << "ROM database: " << profile->name << endl;
+	if (profile->flags & ROM_PROFILE_HAS_QUIRKS) {
+		config.quirks = get_rom_profile_quirks(*profile);
+		emulation.set_quirks(config.quirks);
+	}
+	if (profile->flags & ROM_PROFILE_HAS_INSTRUCTIONS_PER_FRAME) {
+		config.ipf = profile->instructionsPerFrame;
+		emulation.set_instructions_per_frame(config.ipf);
+	}
+	if (profile->flags & ROM_PROFILE_HAS_ANTI_FLICKER) {
+		CompositorConfig compositorConfig = compositor.get_config();
+		compositorConfig.mode = profile->antiFlicker ? CompositorMode::MAX_OF_FRAMES : CompositorMode::OFF;
+		apply_compositor_config(compositorConfig);
+	}
+}
+
+// A ROM without stored quirks keeps the current ones; when the analyzer finds code whose result a quirk
+// changes, say which, so a wrong setting is not mistaken for a broken ROM.
+void warn_quirk_dependencies(const vector<uint8_t>& image)
+{
+	vector<uint8_t> memory(Chip8::MEMORY_SIZE, 0);
+	std::copy(image.begin(), image.end(), memory.begin() + Chip8::PROGRAM_START);
+	Chip8Analysis analysis;
+	analyze_rom(memory.data(), image.size(), analysis);
+	uint8_t dependencies = analysis.get_quirk_dependencies();
+	if (dependencies == 0) {
+		return;
+	}
+	cout << "ROM database: no quirks stored for this ROM, and it reads";
+	for (int quirk = 0, count = 0; quirk < 3; ++quirk) {
+		if (dependencies & (1 << quirk)) {
+			cout << (count++ > 0 ? "+" : " ") << get_quirk_name(static_cast<Chip8Quirk>(quirk));
+		}
+	}
+	cout << "; check them in the Settings dialog" << endl;
 }
 
 void char_to_tchar(TCHAR* dst, const char* src, size_t dstLen)
@@ -426,10 +579,24 @@ void add_menu(HWND hwnd)
 
 	HMENU fileMenu = CreateMenu();
 	AppendMenu(fileMenu, MF_STRING, ID_FILE_LOAD_ROM, _T("Load ROM"));
+	AppendMenu(fileMenu, MF_STRING | MF_UNCHECKED, ID_FILE_RECORD_MOVIE, _T("Record Movie"));
 	AppendMenu(fileMenu, MF_STRING, ID_FILE_EXIT, _T("Exit"));
 
 	HMENU settingsMenu = CreateMenu();
 	AppendMenu(settingsMenu, MF_STRING, ID_SETTING_CONFIG, _T("Configs"));
+	AppendMenu(settingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTING_AUDIO_SYNC, _T("Sync to Audio"));
+
+	HMENU speedMenu = CreateMenu();
+	AppendMenu(speedMenu, MF_STRING, ID_SPEED_1X, _T("1x"));
+	AppendMenu(speedMenu, MF_STRING, ID_SPEED_2X, _T("2x"));
+	AppendMenu(speedMenu, MF_STRING, ID_SPEED_4X, _T("4x"));
+	AppendMenu(speedMenu, MF_STRING, ID_SPEED_8X, _T("8x"));
+	AppendMenu(speedMenu, MF_STRING, ID_SPEED_UNCAPPED, _T("Uncapped\tHold Tab"));
+	CheckMenuRadioItem(speedMenu, ID_SPEED_1X, ID_SPEED_UNCAPPED, ID_SPEED_1X, MF_BYCOMMAND);
+	AppendMenu(settingsMenu, MF_POPUP, (UINT_PTR)speedMenu, _T("Speed"));
+	AppendMenu(settingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTING_STATS_OVERLAY, _T("Stats Overlay"));
+	AppendMenu(settingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTING_STATS_DUMP, _T("Dump Stats"));
+	AppendMenu(settingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTING_TRACE, _T("Record Trace"));
 
 	AppendMenu(menuBar, MF_POPUP, (UINT_PTR)fileMenu, _T("&File"));
 	AppendMenu(menuBar, MF_POPUP, (UINT_PTR)settingsMenu, _T("&Settings"));
@@ -468,6 +635,31 @@ bool open_chip8_file(HWND hwnd, TCHAR* filepath)
 	}
 }
 
+bool save_movie_file(HWND hwnd, TCHAR* filepath)
+{
+	TCHAR fileDirectory[MAX_PATH] = { 0 };
+	GetCurrentDirectory(MAX_PATH, fileDirectory);
+	OPENFILENAME ofn = { 0 };
+	ofn.lStructSize = sizeof(OPENFILENAME);
+	ofn.hwndOwner = hwnd;
+	ofn.lpstrFile = filepath;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.lpstrFilter = _T("Chip8 Movies\0*.c8m\0");
+	ofn.lpstrDefExt = _T("c8m");
+	ofn.nFilterIndex = 1; // 1-based
+	ofn.lpstrInitialDir = fileDirectory;
+	ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+
+	if (GetSaveFileName(&ofn)) {
+		return true;
+	}
+	DWORD error = CommDlgExtendedError();
+	if (error != 0) {
+		cerr << "Error in GetSaveFileName: " << error << endl;
+	}
+	return false;
+}
+
 INT_PTR CALLBACK dialog_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
 	ConfigTemp& config = *reinterpret_cast<ConfigTemp*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
@@ -495,6 +687,7 @@ INT_PTR CALLBACK dialog_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
 HWND create_config_dialog(HWND hParent, ConfigTemp& config)
 {
+	TRACE_SCOPE("config dialog", "ui");
 	RECT rcParent;
 	GetWindowRect(hParent, &rcParent);
 	int windowW = rcParent.right - rcParent.left;
@@ -511,7 +704,7 @@ HWND create_config_dialog(HWND hParent, ConfigTemp& config)
 		hParent,
 		NULL,
 		NULL,
-		config.chip8);
+		NULL);
 	config.dialog = hDlg;
 	if (hDlg) {
 		SetWindowLongPtr(hDlg, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(&config));
@@ -548,21 +741,21 @@ HWND create_config_dialog(HWND hParent, ConfigTemp& config)
 			WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX, 0, 0, 0, 0,
 			quirksGroupbox, (HMENU)ID_QUIRK_RESET_VF, NULL, NULL);
 		SendMessage(resetVFHwnd, WM_SETFONT, WPARAM(guiFont1), FALSE);
-		UINT resetVFChecked = config.chip8->get_reset_VF() ? BST_CHECKED : BST_UNCHECKED;
+		UINT resetVFChecked = config.quirks.resetVF ? BST_CHECKED : BST_UNCHECKED;
 		CheckDlgButton(quirksGroupbox, ID_QUIRK_RESET_VF, resetVFChecked);
 
 		HWND setVXToVYHwnd = CreateWindow(_T("button"), _T("Set VX to VY"),
 			WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX, 0, 0, 0, 0,
 			quirksGroupbox, (HMENU)ID_QUIRK_SET_VX_TO_VY, NULL, NULL);
 		SendMessage(setVXToVYHwnd, WM_SETFONT, WPARAM(guiFont1), FALSE);
-		UINT setVXToVYChecked = config.chip8->is_VX_set_to_VY() ? BST_CHECKED : BST_UNCHECKED;
+		UINT setVXToVYChecked = config.quirks.setVXtoVY ? BST_CHECKED : BST_UNCHECKED;
 		CheckDlgButton(quirksGroupbox, ID_QUIRK_SET_VX_TO_VY, setVXToVYChecked);
 
 		HWND incrementIHwnd = CreateWindow(_T("button"), _T("Increment I"),
 			WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX, 0, 0, 0, 0,
 			quirksGroupbox, (HMENU)ID_QUIRK_INCREMENT_I, NULL, NULL);
 		SendMessage(incrementIHwnd, WM_SETFONT, WPARAM(guiFont1), FALSE);
-		UINT incrementIChecked = config.chip8->is_increment_I() ? BST_CHECKED : BST_UNCHECKED;
+		UINT incrementIChecked = config.quirks.increamentI ? BST_CHECKED : BST_UNCHECKED;
 		CheckDlgButton(quirksGroupbox, ID_QUIRK_INCREMENT_I, incrementIChecked);
 
 		HWND okBtnHwnd = CreateWindow(_T("button"), _T("OK"),
@@ -610,6 +803,22 @@ HWND create_config_dialog(HWND hParent, ConfigTemp& config)
 		char_to_tchar(fpsValue, ss.str().c_str(), sizeof(fpsValue) / sizeof(fpsValue[0]));
 		SetWindowText(fpsEdit, fpsValue);
 
+		HWND ipfTitle = CreateWindow(_T("static"), _T("IPF"),
+			WS_CHILD | WS_VISIBLE | SS_CENTERIMAGE, 0, 0, 0, 0,
+			videoGroupbox, (HMENU)0, NULL, NULL);
+		SendMessage(ipfTitle, WM_SETFONT, WPARAM(guiFont1), FALSE);
+		HWND ipfEdit = CreateWindow(_T("edit"), _T(""),
+			WS_CHILD | WS_VISIBLE | WS_BORDER | ES_NUMBER, 0, 0, 0, 0,
+			videoGroupbox, (HMENU)ID_VIDEO_IPF_EDIT, NULL, NULL);
+		SendMessage(ipfEdit, WM_SETFONT, WPARAM(sysFont), FALSE);
+		config.ipfEdit = ipfEdit;
+		ss.clear();
+		ss.str("");
+		ss << config.ipf;
+		TCHAR ipfValue[16] = { 0 };
+		char_to_tchar(ipfValue, ss.str().c_str(), sizeof(ipfValue) / sizeof(ipfValue[0]));
+		SetWindowText(ipfEdit, ipfValue);
+
 		hDC = GetDC(videoGroupbox);
 		DrawText(hDC, _T("Video"), lstrlen(_T("Video")), &textRect, DT_CALCRECT);
 		ReleaseDC(videoGroupbox, hDC);
@@ -619,13 +828,21 @@ HWND create_config_dialog(HWND hParent, ConfigTemp& config)
 			0, 0, 0, 2, // Thin horizontal line
 			videoGroupbox, (HMENU)0, NULL, NULL);
 		
-		HWND skipOnSpriteCollision = CreateWindow(_T("button"), _T("Skip on Sprite Collision"),
+		HWND antiFlicker = CreateWindow(_T("button"), _T("Anti-flicker"),
+			WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX, 0, 0, 0, 0,
+			videoGroupbox, (HMENU)ID_VIDEO_ANTI_FLICKER,
+			NULL, NULL);
+		SendMessage(antiFlicker, WM_SETFONT, WPARAM(guiFont1), FALSE);
+		UINT antiFlickerChecked = compositor.get_config().mode != CompositorMode::OFF ? BST_CHECKED : BST_UNCHECKED;
+		CheckDlgButton(videoGroupbox, ID_VIDEO_ANTI_FLICKER, antiFlickerChecked);
+
+		HWND vsync = CreateWindow(_T("button"), _T("VSync"),
 			WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX, 0, 0, 0, 0,
-			videoGroupbox, (HMENU)ID_VIDEO_SKIP_ON_SPRITE_COLLISION,
+			videoGroupbox, (HMENU)ID_VIDEO_VSYNC,
 			NULL, NULL);
-		SendMessage(skipOnSpriteCollision, WM_SETFONT, WPARAM(guiFont1), FALSE);
-		UINT skipOnSpriteCollisionChecked = config.chip8->skip_on_sprites_overlap() ? BST_CHECKED : BST_UNCHECKED;
-		CheckDlgButton(videoGroupbox, ID_VIDEO_SKIP_ON_SPRITE_COLLISION, skipOnSpriteCollisionChecked);
+		SendMessage(vsync, WM_SETFONT, WPARAM(guiFont1), FALSE);
+		UINT vsyncChecked = glRenderer.get_swap_mode() != SwapMode::IMMEDIATE ? BST_CHECKED : BST_UNCHECKED;
+		CheckDlgButton(videoGroupbox, ID_VIDEO_VSYNC, vsyncChecked);
 
 		HWND hSeparator = CreateWindow(_T("static"), NULL,
 			WS_CHILD | WS_VISIBLE | SS_ETCHEDHORZ,
@@ -658,28 +875,45 @@ HWND create_config_dialog(HWND hParent, ConfigTemp& config)
 		fpsContainer.set_box(0, 0, INT_MAX, 0);
 		fpsContainer.set_fixed_h(fpsTitleHeight); // 16
 
+		winlayout::Widget ipfTitleWidget(ipfTitle), ipfEditWidget(ipfEdit);
+		winlayout::WidgetsContainer ipfContainer;
+		winlayout::EvenLayout ipfLayout;
+		ipfLayout.set_gap(2, 0);
+		ipfContainer.set_layout(&ipfLayout);
+		ipfContainer.add(&ipfTitleWidget);
+		ipfContainer.add(&ipfEditWidget);
+		ipfContainer.set_box(0, 0, INT_MAX, 0);
+		ipfContainer.set_fixed_h(fpsTitleHeight);
+
 		winlayout::Widget videoHSeparatorWidget(videoHSeparator);
 		videoHSeparatorWidget.set_box(0, 0, INT_MAX, 0);
 		videoHSeparatorWidget.set_fixed_h(2);
 
-		winlayout::Widget skipOnSpriteCollisionWidget(skipOnSpriteCollision);
-		skipOnSpriteCollisionWidget.set_box(0, 0, INT_MAX, 0);
-		skipOnSpriteCollisionWidget.set_fixed_h(fpsTitleHeight);
+		winlayout::Widget antiFlickerWidget(antiFlicker);
+		antiFlickerWidget.set_box(0, 0, INT_MAX, 0);
+		antiFlickerWidget.set_fixed_h(fpsTitleHeight);
+
+		winlayout::Widget vsyncWidget(vsync);
+		vsyncWidget.set_box(0, 0, INT_MAX, 0);
+		vsyncWidget.set_fixed_h(fpsTitleHeight);
 		
 		winlayout::WidgetsContainer videoGroupboxContainer(videoGroupbox);
 		winlayout::RatioLayout videoGroupboxLayout(SBS_VERT);
 		videoGroupboxLayout.set_padding(std::min(10, dlgPadding*2), 0, dlgPadding, fpsTitleHeight/2+1);
 		videoGroupboxLayout.set_gap(0, dlgPadding);
 		videoGroupboxLayout.use_reletive_coordinates(true);
-		videoGroupboxLayout.set_percentages({ 25, 0, 25, 0, 25, 0, 25});
+		videoGroupboxLayout.set_percentages({ 20, 0, 0, 20, 0, 20, 0, 20, 0, 20 });
 		videoGroupboxContainer.set_layout(&videoGroupboxLayout);
 		winlayout::Widget space;
 		videoGroupboxContainer.add(&space);
 		videoGroupboxContainer.add(&fpsContainer);
+		videoGroupboxContainer.add(&ipfContainer);
 		videoGroupboxContainer.add(&space);
 		videoGroupboxContainer.add(&videoHSeparatorWidget);
 		videoGroupboxContainer.add(&space);
-		videoGroupboxContainer.add(&skipOnSpriteCollisionWidget);
+		videoGroupboxContainer.add(&antiFlickerWidget);
+		videoGroupboxContainer.add(&space);
+		videoGroupboxContainer.add(&vsyncWidget);
 		videoGroupboxContainer.add(&space);
 
 		winlayout::WidgetsContainer wc3;
@@ -727,18 +961,28 @@ HWND create_config_dialog(HWND hParent, ConfigTemp& config)
 
 void confirm_modal_dialog(ConfigTemp& config)
 {
+	TRACE_SCOPE("config confirm", "ui");
 	UINT resetVFChecked = IsDlgButtonChecked(config.quirksGroup, ID_QUIRK_RESET_VF);
 	Chip8Quirks quirks = {
 		IsDlgButtonChecked(config.quirksGroup, ID_QUIRK_RESET_VF) == BST_CHECKED,
 		IsDlgButtonChecked(config.quirksGroup, ID_QUIRK_SET_VX_TO_VY) == BST_CHECKED,
 		IsDlgButtonChecked(config.quirksGroup, ID_QUIRK_INCREMENT_I) == BST_CHECKED
 	};
-	config.chip8->set_quirks(quirks);
+	end_movie_recording(GetParent(config.dialog));
+	config.quirks = quirks;
+	emulation.set_quirks(quirks);
 
 	limit_fps(config.fpsEdit);
+	limit_ipf(config.ipfEdit, config.ipf);
+	emulation.set_instructions_per_frame(config.ipf);
+
+	CompositorConfig compositorConfig = compositor.get_config();
+	UINT antiFlickerChecked = IsDlgButtonChecked(config.videoGroup, ID_VIDEO_ANTI_FLICKER);
+	compositorConfig.mode = antiFlickerChecked == BST_CHECKED ? CompositorMode::MAX_OF_FRAMES : CompositorMode::OFF;
+	apply_compositor_config(compositorConfig);
 
-	UINT skipOnSpriteCollisionChecked = IsDlgButtonChecked(config.videoGroup, ID_VIDEO_SKIP_ON_SPRITE_COLLISION);
-	config.chip8->set_skip_on_sprite_collision(skipOnSpriteCollisionChecked == BST_CHECKED);
+	UINT vsyncChecked = IsDlgButtonChecked(config.videoGroup, ID_VIDEO_VSYNC);
+	glRenderer.set_swap_mode(vsyncChecked == BST_CHECKED ? SwapMode::ADAPTIVE : SwapMode::IMMEDIATE);
 
 	close_modal_dialog(config.dialog);
 }
@@ -794,4 +1038,23 @@ void limit_fps(HWND fpsEdit)
 	TCHAR fpsValue[8] = { 0 };
 	char_to_tchar(fpsValue, ss.str().c_str(), sizeof(fpsValue) / sizeof(fpsValue[0]));
 	SetWindowText(fpsEdit, fpsValue);
+	emulation.set_fps(fps);
+}
+
+
+void limit_ipf(HWND ipfEdit, int& ipf)
+{
+	int len = GetWindowTextLength(ipfEdit) + 1;
+	vector<TCHAR> ipfText(len, 0);
+	GetWindowText(ipfEdit, &ipfText[0], len);
+	stringstream ss;
+	ss.str(string(ipfText.begin(), ipfText.end()));
+	ss >> ipf;
+	ipf = std::max(1, std::min(ipf, 1000));
+	ss.clear();
+	ss.str("");
+	ss << ipf;
+	TCHAR ipfValue[8] = { 0 };
+	char_to_tchar(ipfValue, ss.str().c_str(), sizeof(ipfValue) / sizeof(ipfValue[0]));
+	SetWindowText(ipfEdit, ipfValue);
 }